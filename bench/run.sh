@@ -0,0 +1,72 @@
+#!/usr/bin/env bash
+# File			: run.sh
+# Times each execution engine on the same fixed set of programs, so engines
+# are always compared on the same numbers.
+#
+# Usage: bench/run.sh [ENGINE...]
+#   interpret	- tree-walking interpreter (--interpret)
+#   run		- bytecode interpreter (--run)
+#   jit		- bytecode interpreter with hot procedures compiled (--jit)
+#   asm, c, llvm	- executable built with --backend NAME
+# Default is all of them. The tree-walking interpreter is the reference: any
+# other engine whose output differs from it is reported as DIFF.
+# Times are wall clock in milliseconds. The in-process engines include parsing
+# and compiling; for the backends only the executable is timed.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+COMPILER=${COMPILER:-$DIR/../bin/compiler}
+ENGINES=${*:-interpret run jit asm c llvm}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+now_ms() {
+  echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# run_engine ENGINE SRC OUT prints the time taken, or fails
+run_engine() {
+  local start
+  case $1 in
+    interpret|run|jit)
+      start=$(now_ms)
+      "$COMPILER" -w -v 2 -i "$2" "--$1" > "$3" 2>&1 < /dev/null || return 1
+      ;;
+    asm|c|llvm)
+      "$COMPILER" -w -v 2 -i "$2" -o "$TMP/exe" --backend "$1" \
+          > /dev/null 2>&1 || return 1
+      start=$(now_ms)
+      "$TMP/exe" > "$3" 2>&1 < /dev/null || return 1
+      ;;
+    *)
+      return 1
+      ;;
+  esac
+  echo $(( $(now_ms) - start ))
+}
+
+printf "%-10s" "program"
+for engine in $ENGINES; do
+  printf "%12s" "$engine"
+done
+printf "\n"
+
+status=0
+for src in "$DIR"/*.src; do
+  name=$(basename "$src" .src)
+  printf "%-10s" "$name"
+  run_engine interpret "$src" "$TMP/expected" > /dev/null
+  for engine in $ENGINES; do
+    if ! ms=$(run_engine "$engine" "$src" "$TMP/out"); then
+      result=FAIL
+      status=1
+    elif ! cmp -s "$TMP/expected" "$TMP/out"; then
+      result=DIFF
+      status=1
+    else
+      result=$ms
+    fi
+    printf "%12s" "$result"
+  done
+  printf "\n"
+done
+exit $status
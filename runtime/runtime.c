@@ -0,0 +1,680 @@
+#include "runtime.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Standard input and output go through buffers of their own, with numbers
+ * formatted and parsed by hand rather than by stdio. Output is written when
+ * the buffer fills, before reading input (so prompts show), before an error
+ * message, and by rt_flush(), which generated code calls as the program ends.
+ * Strings longer than RT_STR_INLINE bytes are made in a region of large
+ * chunks: each is its length, its bytes and a NUL, 8-byte aligned, and the
+ * region is only released as a whole when the program exits, since any
+ * string can end up in a global or be returned.
+ */
+
+#define OUT_SIZE (1 << 16)
+#define IN_SIZE (1 << 16)
+#define ARENA_CHUNK (1 << 16)
+#define STR_HEADER 8 /* Length in front of a string's bytes */
+#define FLOAT_DIGITS 6 /* Significant digits, as printf's %g */
+#define BIG_WORDS 12 /* m * 5^149 for the smallest floats needs 370 bits */
+#define MAX_THREADS 64
+#define CACHE_LINE 64
+
+static char out_buf[OUT_SIZE];
+static size_t out_len;
+static char in_buf[IN_SIZE];
+static size_t in_pos;
+static size_t in_len;
+static int in_eof;
+static char* arena;  /* Where the next string goes, 8-byte aligned */
+static char* arena_end;
+
+/******************************************************************************
+ * Buffers
+ *****************************************************************************/
+
+static void write_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    buf += n;
+    len -= (size_t) n;
+  }
+}
+
+void rt_flush(void) {
+  write_all(STDOUT_FILENO, out_buf, out_len);
+  out_len = 0;
+}
+
+/* Room for n more bytes, n <= OUT_SIZE */
+static char* out_reserve(size_t n) {
+  if (out_len + n > OUT_SIZE) rt_flush();
+  return out_buf + out_len;
+}
+
+static void out_write(const char* s, size_t len) {
+  if (len > OUT_SIZE) {
+    rt_flush();
+    write_all(STDOUT_FILENO, s, len);
+    return;
+  }
+  memcpy(out_reserve(len), s, len);
+  out_len += len;
+}
+
+/* Next input byte without consuming it, or -1 at the end */
+static int in_peek(void) {
+  if (in_pos < in_len) return (unsigned char) in_buf[in_pos];
+  if (in_eof) return -1;
+  rt_flush();
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, in_buf, IN_SIZE);
+    if (n > 0) {
+      in_pos = 0;
+      in_len = (size_t) n;
+      return (unsigned char) in_buf[0];
+    }
+    if ((n < 0) && (errno == EINTR)) continue;
+    in_eof = 1;
+    return -1;
+  }
+}
+
+static int is_space(int c) {
+  return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+static void skip_space(void) {
+  while (is_space(in_peek())) in_pos++;
+}
+
+/* Reads up to cap - 1 non-space bytes into buf, like scanf's %s */
+static size_t read_token(char* buf, size_t cap) {
+  size_t len = 0;
+  skip_space();
+  for (int c = in_peek(); (c >= 0) && !is_space(c) && (len + 1 < cap);
+      c = in_peek()) {
+    buf[len++] = (char) c;
+    in_pos++;
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+/* Room for more bytes after the len already in the string being made at rec,
+ * moving it to a new chunk if need be */
+static char* arena_reserve(char* rec, size_t len, size_t more) {
+  size_t need = STR_HEADER + len + more + 1;
+  if (rec && ((size_t) (arena_end - rec) >= need)) return rec;
+  size_t cap = (need > ARENA_CHUNK / 2) ? 2 * need : ARENA_CHUNK;
+  char* chunk = malloc(cap);
+  if (!chunk) {
+    rt_flush();
+    write_all(STDERR_FILENO, "Runtime error: out of memory\n", 29);
+    exit(EXIT_FAILURE);
+  }
+  if (rec) memcpy(chunk, rec, STR_HEADER + len);
+  arena = chunk;
+  arena_end = chunk + cap;
+  return chunk;
+}
+
+/* The string made at rec; short ones give their space back */
+static rt_str arena_finish(char* rec, size_t len) {
+  if (len <= RT_STR_INLINE) {
+    return rec ? rt_str_inline(rec + STR_HEADER, (uint32_t) len) : 0;
+  }
+  uint64_t header = len;
+  memcpy(rec, &header, sizeof(header));
+  rec[STR_HEADER + len] = '\0';
+  arena = rec + ((STR_HEADER + len + 1 + 7) & ~(size_t) 7);
+  return (rt_str) (uintptr_t) (rec + STR_HEADER);
+}
+
+/* A string's bytes; the bytes of a short one are in the word itself */
+static const char* str_bytes(const rt_str* str, size_t* len) {
+  if (*str & 1) {
+    *len = (size_t) (*str & 0xff) >> 1;
+    return (const char*) str + 1;
+  }
+  if (!*str) {
+    *len = 0;
+    return "";
+  }
+  const char* bytes = (const char*) (uintptr_t) *str;
+  uint64_t header;
+  memcpy(&header, bytes - STR_HEADER, sizeof(header));
+  *len = (size_t) header;
+  return bytes;
+}
+
+/******************************************************************************
+ * Number formatting
+ *****************************************************************************/
+
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+/* Writes val's digits so that they end at end; returns where they start */
+static char* format_uint(char* end, uint32_t val) {
+  while (val >= 100) {
+    end -= 2;
+    memcpy(end, &digit_pairs[2 * (val % 100)], 2);
+    val /= 100;
+  }
+  if (val >= 10) {
+    end -= 2;
+    memcpy(end, &digit_pairs[2 * val], 2);
+  } else {
+    *--end = (char) ('0' + val);
+  }
+  return end;
+}
+
+static size_t format_int(char* buf, int32_t val) {
+  char tmp[12];
+  char* end = tmp + sizeof(tmp);
+  uint32_t mag = (val < 0) ? 0u - (uint32_t) val : (uint32_t) val;
+  char* start = format_uint(end, mag);
+  if (val < 0) *--start = '-';
+  memcpy(buf, start, (size_t) (end - start));
+  return (size_t) (end - start);
+}
+
+/* Big unsigned integers, least significant word first */
+static void big_mul(uint32_t* big, size_t* len, uint32_t factor) {
+  uint64_t carry = 0;
+  for (size_t i = 0; i < *len; i++) {
+    uint64_t prod = (uint64_t) big[i] * factor + carry;
+    big[i] = (uint32_t) prod;
+    carry = prod >> 32;
+  }
+  if (carry) big[(*len)++] = (uint32_t) carry;
+}
+
+static void big_shift(uint32_t* big, size_t* len, int bits) {
+  size_t words = (size_t) bits / 32;
+  bits %= 32;
+  big[*len] = 0;
+  if (bits > 0) {
+    for (size_t i = *len; i > 0; i--) {
+      big[i] |= big[i - 1] >> (32 - bits);
+      big[i - 1] <<= bits;
+    }
+    if (big[*len]) (*len)++;
+  }
+  memmove(big + words, big, *len * sizeof(*big));
+  memset(big, 0, words * sizeof(*big));
+  *len += words;
+}
+
+/* big /= divisor; returns the remainder */
+static uint32_t big_div(uint32_t* big, size_t* len, uint32_t divisor) {
+  uint64_t rem = 0;
+  for (size_t i = *len; i-- > 0;) {
+    uint64_t cur = (rem << 32) | big[i];
+    big[i] = (uint32_t) (cur / divisor);
+    rem = cur % divisor;
+  }
+  while ((*len > 0) && (big[*len - 1] == 0)) (*len)--;
+  return (uint32_t) rem;
+}
+
+/*
+ * Writes val as printf("%g") would. The float's exact value, m * 2^e, is
+ * turned into an integer and a power of ten (m * 5^-e * 10^e when e < 0),
+ * whose decimal digits are then rounded to six, half to even.
+ */
+static size_t format_float(char* buf, float val) {
+  static const uint32_t pow5[] = {1, 5, 25, 125, 625, 3125, 15625, 78125,
+    390625, 1953125, 9765625, 48828125, 244140625, 1220703125};
+  uint32_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  size_t len = 0;
+  if (bits >> 31) buf[len++] = '-';
+  uint32_t exp_bits = (bits >> 23) & 0xff;
+  uint32_t frac = bits & 0x7fffff;
+  if (exp_bits == 0xff) {
+    memcpy(buf + len, frac ? "nan" : "inf", 3);
+    return len + 3;
+  }
+  if ((exp_bits == 0) && (frac == 0)) {
+    buf[len++] = '0';
+    return len;
+  }
+  uint32_t big[BIG_WORDS];
+  size_t big_len = 1;
+  int e = (exp_bits ? (int) exp_bits : 1) - 150;
+  int scale = (e < 0) ? e : 0; /* The value is big * 10^scale */
+  big[0] = exp_bits ? (frac | 0x800000) : frac;
+  if (e > 0) big_shift(big, &big_len, e);
+  for (; e <= -13; e += 13) big_mul(big, &big_len, pow5[13]);
+  if (e < 0) big_mul(big, &big_len, pow5[-e]);
+
+  /* Nine digits at a time, least significant first */
+  char digits[128];
+  size_t num_digits = 0;
+  while (big_len > 0) {
+    uint32_t chunk = big_div(big, &big_len, 1000000000);
+    for (int i = 0; i < 9; i++) {
+      digits[num_digits++] = (char) (chunk % 10);
+      chunk /= 10;
+    }
+  }
+  while (digits[num_digits - 1] == 0) num_digits--;
+  int exp10 = (int) num_digits - 1 + scale;
+
+  /* The six most significant, rounded */
+  char sig[FLOAT_DIGITS];
+  size_t top = num_digits - 1;
+  for (int i = 0; i < FLOAT_DIGITS; i++) {
+    sig[i] = (top >= (size_t) i) ? digits[top - i] : 0;
+  }
+  if (num_digits > FLOAT_DIGITS) {
+    size_t next = num_digits - 1 - FLOAT_DIGITS;
+    int round_up = digits[next] > 5;
+    if (digits[next] == 5) {
+      int rest = 0;
+      for (size_t i = 0; i < next; i++) rest |= digits[i];
+      round_up = rest || (sig[FLOAT_DIGITS - 1] & 1);
+    }
+    int i = FLOAT_DIGITS - 1;
+    for (; round_up && (i >= 0); i--) {
+      round_up = (++sig[i] == 10);
+      if (round_up) sig[i] = 0;
+    }
+    if (round_up) {
+      sig[0] = 1;
+      exp10++;
+    }
+  }
+  int num_sig = FLOAT_DIGITS;
+  while ((num_sig > 1) && (sig[num_sig - 1] == 0)) num_sig--;
+
+  if ((exp10 < -4) || (exp10 >= FLOAT_DIGITS)) {
+    buf[len++] = (char) ('0' + sig[0]);
+    if (num_sig > 1) buf[len++] = '.';
+    for (int i = 1; i < num_sig; i++) buf[len++] = (char) ('0' + sig[i]);
+    buf[len++] = 'e';
+    buf[len++] = (exp10 < 0) ? '-' : '+';
+    int mag = (exp10 < 0) ? -exp10 : exp10;
+    if (mag < 10) buf[len++] = '0';
+    char tmp[4];
+    char* end = tmp + sizeof(tmp);
+    char* start = format_uint(end, (uint32_t) mag);
+    memcpy(buf + len, start, (size_t) (end - start));
+    return len + (size_t) (end - start);
+  }
+  if (exp10 < 0) {
+    buf[len++] = '0';
+    buf[len++] = '.';
+    for (int i = -1; i > exp10; i--) buf[len++] = '0';
+    for (int i = 0; i < num_sig; i++) buf[len++] = (char) ('0' + sig[i]);
+    return len;
+  }
+  for (int i = 0; i <= exp10; i++) buf[len++] = (char) ('0' + sig[i]);
+  if (num_sig > exp10 + 1) {
+    buf[len++] = '.';
+    for (int i = exp10 + 1; i < num_sig; i++) {
+      buf[len++] = (char) ('0' + sig[i]);
+    }
+  }
+  return len;
+}
+
+/******************************************************************************
+ * Number parsing
+ *****************************************************************************/
+
+/* [+-]digits like scanf's %d: out of range values are clamped to a long and
+ * then truncated; returns 0 if there are no digits */
+static int32_t parse_int(void) {
+  skip_space();
+  int neg = 0;
+  int c = in_peek();
+  if ((c == '+') || (c == '-')) {
+    neg = (c == '-');
+    in_pos++;
+  }
+  uint64_t mag = 0;
+  for (c = in_peek(); (c >= '0') && (c <= '9'); c = in_peek()) {
+    if (mag <= (uint64_t) INT64_MAX) mag = 10 * mag + (uint64_t) (c - '0');
+    in_pos++;
+  }
+  int64_t val;
+  if (mag > (uint64_t) INT64_MAX) {
+    val = neg ? INT64_MIN : INT64_MAX;
+  } else {
+    val = neg ? -(int64_t) mag : (int64_t) mag;
+  }
+  return (int32_t) (uint32_t) (uint64_t) val;
+}
+
+static int lower(int c) {
+  return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/*
+ * Decimal floats, inf and nan, like scanf's %f. Up to seven digits with an
+ * exponent of at most ten either way are exact in a float, so one multiply
+ * or divide rounds correctly; anything else goes to strtof.
+ */
+static float parse_float(void) {
+  static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f,
+    1e7f, 1e8f, 1e9f, 1e10f};
+  char tok[128];
+  size_t len = 0;
+  skip_space();
+  int c = in_peek();
+  if ((c == '+') || (c == '-')) {
+    tok[len++] = (char) c;
+    in_pos++;
+    c = in_peek();
+  }
+  if ((lower(c) == 'i') || (lower(c) == 'n')) {
+    while ((len + 1 < sizeof(tok)) && (((lower(c) >= 'a') && (lower(c) <= 'z'))
+        || (c == '(') || (c == ')'))) {
+      tok[len++] = (char) c;
+      in_pos++;
+      c = in_peek();
+    }
+    tok[len] = '\0';
+    return strtof(tok, NULL);
+  }
+  uint64_t mant = 0;
+  int num_mant = 0; /* Significant digits in mant */
+  int exp10 = 0;
+  int any = 0;
+  int dot = 0;
+  for (;; c = in_peek()) {
+    if ((c == '.') && !dot) {
+      dot = 1;
+    } else if ((c >= '0') && (c <= '9')) {
+      any = 1;
+      if (num_mant < 19) {
+        mant = 10 * mant + (uint64_t) (c - '0');
+        if (mant > 0) num_mant++;
+        if (dot) exp10--;
+      } else if (!dot) {
+        exp10++;
+      }
+    } else {
+      break;
+    }
+    if (len + 1 < sizeof(tok)) tok[len++] = (char) c;
+    in_pos++;
+  }
+  if (!any) return 0.0f;
+  if (lower(c) == 'e') {
+    size_t save = len;
+    tok[len++] = 'e';
+    in_pos++;
+    c = in_peek();
+    int exp_neg = 0;
+    if ((c == '+') || (c == '-')) {
+      exp_neg = (c == '-');
+      tok[len++] = (char) c;
+      in_pos++;
+      c = in_peek();
+    }
+    if ((c < '0') || (c > '9')) {
+      len = save; /* scanf would stop here too, having read the e */
+    } else {
+      int exp = 0;
+      for (; (c >= '0') && (c <= '9'); c = in_peek()) {
+        if (exp < 100000) exp = 10 * exp + (c - '0');
+        if (len + 1 < sizeof(tok)) tok[len++] = (char) c;
+        in_pos++;
+      }
+      exp10 += exp_neg ? -exp : exp;
+    }
+  }
+  tok[len] = '\0';
+  if ((len + 1 < sizeof(tok)) && (mant <= (1u << 24)) && (exp10 >= -10)
+      && (exp10 <= 10)) {
+    float f = (float) mant;
+    f = (exp10 < 0) ? f / pow10[-exp10] : f * pow10[exp10];
+    return (tok[0] == '-') ? -f : f;
+  }
+  return strtof(tok, NULL);
+}
+
+/******************************************************************************
+ * Builtins
+ *****************************************************************************/
+
+/* true, false, or an integer (nonzero is true) */
+int32_t rt_getbool(void) {
+  char tok[32];
+  read_token(tok, sizeof(tok));
+  if (strcmp(tok, "true") == 0) return 1;
+  if (strcmp(tok, "false") == 0) return 0;
+  const char* p = tok;
+  if ((*p == '+') || (*p == '-')) p++;
+  for (; (*p >= '0') && (*p <= '9'); p++) {
+    if (*p != '0') return 1;
+  }
+  return 0;
+}
+
+int32_t rt_getinteger(void) {
+  return parse_int();
+}
+
+float rt_getfloat(void) {
+  return parse_float();
+}
+
+/* Reads the rest of the current line, or the next one if it is empty */
+rt_str rt_getstring(void) {
+  if (in_peek() == '\n') in_pos++;
+  char* rec = arena;
+  size_t len = 0;
+  for (int c = in_peek(); (c >= 0) && (c != '\n'); c = in_peek()) {
+    const char* start = in_buf + in_pos;
+    const char* newline = memchr(start, '\n', in_len - in_pos);
+    size_t run = newline ? (size_t) (newline - start) : in_len - in_pos;
+    rec = arena_reserve(rec, len, run);
+    memcpy(rec + STR_HEADER + len, start, run);
+    len += run;
+    in_pos += run;
+  }
+  if (in_peek() == '\n') in_pos++;
+  return arena_finish(rec, len);
+}
+
+int32_t rt_putbool(int32_t val) {
+  if (val) {
+    out_write("true\n", 5);
+  } else {
+    out_write("false\n", 6);
+  }
+  return 1;
+}
+
+int32_t rt_putinteger(int32_t val) {
+  char* buf = out_reserve(12);
+  size_t len = format_int(buf, val);
+  buf[len] = '\n';
+  out_len += len + 1;
+  return 1;
+}
+
+int32_t rt_putfloat(float val) {
+  char* buf = out_reserve(16);
+  size_t len = format_float(buf, val);
+  buf[len] = '\n';
+  out_len += len + 1;
+  return 1;
+}
+
+int32_t rt_putstring(rt_str val) {
+  size_t len;
+  const char* bytes = str_bytes(&val, &len);
+  out_write(bytes, len);
+  out_write("\n", 1);
+  return 1;
+}
+
+float rt_sqrt(int32_t val) {
+  return sqrtf((float) val);
+}
+
+/******************************************************************************
+ * Support for generated code
+ *****************************************************************************/
+
+/* The string of len bytes at bytes, copied if it is not short */
+rt_str rt_string(const char* bytes, uint32_t len) {
+  if (len <= RT_STR_INLINE) return rt_str_inline(bytes, len);
+  char* rec = arena_reserve(arena, 0, len);
+  memcpy(rec + STR_HEADER, bytes, len);
+  return arena_finish(rec, len);
+}
+
+/* Short strings are never stored out of line, so a short string equals
+ * nothing but an identical word */
+int32_t rt_streq(rt_str a, rt_str b) {
+  if (a == b) return 1;
+  if (!a || !b || ((a | b) & 1)) return 0;
+  size_t len_a;
+  size_t len_b;
+  const char* bytes_a = str_bytes(&a, &len_a);
+  const char* bytes_b = str_bytes(&b, &len_b);
+  return (len_a == len_b) && (memcmp(bytes_a, bytes_b, len_a) == 0);
+}
+
+void rt_bounds_error(int32_t idx, int32_t count) {
+  char msg[96];
+  size_t len = 0;
+  memcpy(msg, "Runtime error: index ", 21);
+  len = 21 + format_int(msg + 21, idx);
+  memcpy(msg + len, " out of bounds for array of ", 28);
+  len += 28;
+  len += format_int(msg + len, count);
+  msg[len++] = '\n';
+  rt_flush();
+  write_all(STDERR_FILENO, msg, len);
+  exit(EXIT_FAILURE);
+}
+
+void rt_div_error(void) {
+  static const char msg[] = "Runtime error: integer division by zero\n";
+  rt_flush();
+  write_all(STDERR_FILENO, msg, sizeof(msg) - 1);
+  exit(EXIT_FAILURE);
+}
+
+/******************************************************************************
+ * Threads
+ *****************************************************************************/
+
+/*
+ * The pool is started by the first rt_parallel() call and lives until the
+ * program exits. The caller runs chunk 0 itself; worker k waits for the
+ * generation to change, runs chunk k, and counts itself done.
+ */
+static struct {
+  pthread_once_t once;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint32_t num_threads;  /* Including the caller */
+  uint64_t generation;
+  uint32_t pending;
+  rt_par_fn fn;
+  void* ctx;
+  uint32_t bounds[MAX_THREADS + 1];
+} pool = {
+  PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, 1, 0, 0, NULL, NULL, {0},
+};
+
+static void* pool_worker(void* arg) {
+  uint32_t k = (uint32_t) (uintptr_t) arg;
+  uint64_t seen = 0;
+  for (;;) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.generation == seen) pthread_cond_wait(&pool.start, &pool.lock);
+    seen = pool.generation;
+    rt_par_fn fn = pool.fn;
+    void* ctx = pool.ctx;
+    uint32_t begin = pool.bounds[k];
+    uint32_t end = pool.bounds[k + 1];
+    pthread_mutex_unlock(&pool.lock);
+    if (begin < end) fn(ctx, begin, end);
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.pending == 0) pthread_cond_signal(&pool.done);
+    pthread_mutex_unlock(&pool.lock);
+  }
+  return NULL;
+}
+
+static void pool_init(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* env = getenv("RT_THREADS");
+  if (env && (atoi(env) > 0)) n = atoi(env);
+  if (n < 1) n = 1;
+  if (n > MAX_THREADS) n = MAX_THREADS;
+  pool.num_threads = (uint32_t) n;
+  for (uint32_t k = 1; k < pool.num_threads; k++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, pool_worker, (void*) (uintptr_t) k)) {
+      pool.num_threads = k;
+      break;
+    }
+    pthread_detach(thread);
+  }
+}
+
+void rt_parallel(rt_par_fn fn, void* ctx, uint32_t count, const void* dst,
+    uint32_t size) {
+  pthread_once(&pool.once, pool_init);
+  uint32_t n = pool.num_threads;
+  if (n == 1) {
+    fn(ctx, 0, count);
+    return;
+  }
+
+  /* Equal chunks, each boundary moved up to the next element that starts a
+   * cache line of dst */
+  uint32_t per_line = CACHE_LINE / size;
+  uint32_t first_line = (uint32_t) (((CACHE_LINE
+      - (uintptr_t) dst % CACHE_LINE) % CACHE_LINE) / size);
+  uint64_t chunk = ((uint64_t) count + n - 1) / n;
+  pthread_mutex_lock(&pool.lock);
+  pool.bounds[0] = 0;
+  for (uint32_t k = 1; k < n; k++) {
+    uint64_t b = k * chunk;
+    if (b > first_line) {
+      b = first_line + (b - first_line + per_line - 1) / per_line * per_line;
+    }
+    pool.bounds[k] = (b < count) ? (uint32_t) b : count;
+  }
+  pool.bounds[n] = count;
+  pool.fn = fn;
+  pool.ctx = ctx;
+  pool.pending = n - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  if (pool.bounds[1] > 0) fn(ctx, 0, pool.bounds[1]);
+  pthread_mutex_lock(&pool.lock);
+  while (pool.pending > 0) pthread_cond_wait(&pool.done, &pool.lock);
+  pthread_mutex_unlock(&pool.lock);
+}
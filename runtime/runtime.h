@@ -0,0 +1,66 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+/*
+ * Runtime support for compiled programs
+ * The builtin procedures of the language are rt_<name>; the rest are called
+ * by generated code. Integers and bools are 32-bit, bools are 0 or 1, floats
+ * are single precision, and strings are rt_str words.
+ * Output is buffered: rt_flush() writes it out, and must be called before
+ * the program exits.
+ * Large whole-array operations are split across a pool of threads by
+ * rt_parallel(); RT_THREADS in the environment sets the number of threads,
+ * by default one per online CPU.
+ */
+
+#include <stdint.h>
+
+/*
+ * An immutable string in one 64-bit word, so it fits wherever a pointer
+ * would. 0 is the empty string. A word with the low bit set holds a string
+ * of 1 to RT_STR_INLINE bytes: the low byte is the length times two plus
+ * one, and the bytes follow from the next byte up, the rest zero. Any other
+ * word points at the bytes of a longer string, which are 8-byte aligned and
+ * NUL-terminated, with the length as a uint64_t in the 8 bytes before them.
+ * Strings short enough to be inline always are.
+ */
+typedef uint64_t rt_str;
+
+#define RT_STR_INLINE 7
+
+static inline rt_str rt_str_inline(const char* bytes, uint32_t len) {
+  rt_str str = 0;
+  if (len == 0) return 0;
+  for (uint32_t i = 0; i < len; i++) {
+    str |= (rt_str) (unsigned char) bytes[i] << (8 * (i + 1));
+  }
+  return str | ((rt_str) len << 1) | 1;
+}
+
+int32_t rt_getbool(void);
+int32_t rt_getinteger(void);
+float rt_getfloat(void);
+rt_str rt_getstring(void);
+int32_t rt_putbool(int32_t);
+int32_t rt_putinteger(int32_t);
+int32_t rt_putfloat(float);
+int32_t rt_putstring(rt_str);
+float rt_sqrt(int32_t);
+
+rt_str rt_string(const char*, uint32_t);
+int32_t rt_streq(rt_str, rt_str);
+void rt_bounds_error(int32_t, int32_t);
+void rt_div_error(void);
+void rt_flush(void);
+
+/*
+ * Runs fn(ctx, begin, end) over [0, count) in one contiguous chunk per
+ * thread, and returns once every chunk is done. Chunks start on cache line
+ * boundaries of dst, the array of size-byte elements being written, so no
+ * two threads write the same line. fn must not fail.
+ */
+typedef void (*rt_par_fn)(void*, uint32_t, uint32_t);
+void rt_parallel(rt_par_fn fn, void* ctx, uint32_t count, const void* dst,
+    uint32_t size);
+
+#endif /* RUNTIME_H */
@@ -0,0 +1,136 @@
+#include "array_fusion.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+ArrayFusion::ArrayFusion(Function& f) :
+    func(f),
+    fused(f.instrs.size(), false),
+    sources(2 * f.instrs.size(), NO_VALUE),
+    unused_slots(f.slots.size(), false),
+    can_fail(f.instrs.size(), false),
+    num_fused(0) {
+  std::vector<SlotUse> uses;
+  findSlotUses(uses);
+  std::vector<uint32_t> pos(func.instrs.size(), 0);
+  for (auto& block : func.blocks) {
+    for (uint32_t i = 0; i < block.instrs.size(); i++) {
+      pos[block.instrs[i]] = i;
+    }
+  }
+
+  // In block order, so the sources of an operation are settled before it
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      if (!isElementWise(instr.op)) continue;
+      can_fail[v] = (instr.op == IR_ABIN) && (instr.imm.u == IR_DIV)
+          && (instr.src_type != IR_FLT);
+      for (uint32_t n = 1; n < instr.num_ops; n++) {
+        uint32_t s = getSlot(func.getOperand(v, n));
+        if (s == UINT32_MAX) continue;
+        SlotUse& use = uses[s];
+        if (!isCandidate(use, pos) || (use.reader != v)
+            || !isSafeBetween(use.writer, v, uses, pos)) {
+          continue;
+        }
+        fused[use.writer] = true;
+        sources[2 * v + n - 1] = use.writer;
+        unused_slots[s] = true;
+        can_fail[v] = can_fail[v] || can_fail[use.writer];
+        num_fused++;
+      }
+    }
+  }
+}
+
+void ArrayFusion::findArgs(const ValueId& v, std::vector<ValueId>& args) {
+  Instr& instr = func.instrs[v];
+  for (uint32_t n = 1; n < instr.num_ops; n++) {
+    ValueId source = getSource(v, n);
+    if (source != NO_VALUE) {
+      findArgs(source, args);
+      continue;
+    }
+    ValueId arg = func.getOperand(v, n);
+    bool seen = false;
+    for (ValueId a : args) seen |= (a == arg);
+    if (!seen) args.push_back(arg);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void ArrayFusion::findSlotUses(std::vector<SlotUse>& uses) {
+  uses.assign(func.slots.size(), {NO_VALUE, NO_VALUE, 0, false});
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      for (uint32_t n = 0; n < instr.num_ops; n++) {
+        uint32_t s = getSlot(func.getOperand(v, n));
+        if (s == UINT32_MAX) continue;
+        SlotUse& use = uses[s];
+        if (!isElementWise(instr.op)) {
+          use.other = true;
+        } else if (n == 0) {
+          use.other = use.other || (use.writer != NO_VALUE);
+          use.writer = v;
+        } else {
+          use.other = use.other || (use.reader != NO_VALUE);
+          use.reader = v;
+          use.operand = n;
+        }
+      }
+    }
+  }
+}
+
+// A temporary written once and then read once, further down the same block
+bool ArrayFusion::isCandidate(const SlotUse& use,
+    const std::vector<uint32_t>& pos) {
+  if (use.other || (use.writer == NO_VALUE) || (use.reader == NO_VALUE)) {
+    return false;
+  }
+  Instr& writer = func.instrs[use.writer];
+  Instr& reader = func.instrs[use.reader];
+  if (func.slots[getSlot(func.getOperand(use.writer, 0))].zeroed
+      || (writer.block != reader.block) || (pos[use.writer] >= pos[use.reader])
+      || (writer.count != reader.count)) {
+    return false;
+  }
+  IrType read_type = (reader.op == IR_AUN) ? reader.type : reader.src_type;
+  return writer.type == read_type;
+}
+
+// Moving the writer down to the reader must not let anything in between
+// change its inputs or report an error first
+bool ArrayFusion::isSafeBetween(const ValueId& writer, const ValueId& reader,
+    const std::vector<SlotUse>& uses, const std::vector<uint32_t>& pos) {
+  Block& block = func.blocks[func.instrs[writer].block];
+  size_t i = 0;
+  while (block.instrs[i] != writer) i++;
+  for (i++; block.instrs[i] != reader; i++) {
+    ValueId v = block.instrs[i];
+    Instr& instr = func.instrs[v];
+    if (isElementWise(instr.op)) {
+      // Writes a temporary read only further down
+      uint32_t s = getSlot(func.getOperand(v, 0));
+      if ((s == UINT32_MAX) || !isCandidate(uses[s], pos)) return false;
+    } else if (Module::hasSideEffects(instr.op)) {
+      return false;
+    } else if ((instr.op == IR_ALOAD) && can_fail[writer]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t ArrayFusion::getSlot(const ValueId& v) {
+  Instr& instr = func.instrs[v];
+  return (instr.op == IR_SLOT) ? instr.imm.u : UINT32_MAX;
+}
@@ -0,0 +1,71 @@
+#ifndef ARRAY_FUSION_H
+#define ARRAY_FUSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+// Whole-array operations of at least this many elements are split across
+// threads by the compiled-code backends, unless told otherwise
+const uint32_t DEFAULT_PARALLEL_MIN = 1 << 16;
+
+////////////////////////////////////////////////////////////////////////////////
+// Whole-array expression fusion
+// The IR builder gives every inner operation of an array expression its own
+// temporary, so a := b * c + d is a loop into a temporary and a second loop
+// reading it back. When a temporary is written by one element-wise operation
+// and read by one other later in the same block, and nothing in between can
+// change what the first one reads or fail before it, a backend can instead
+// compute the first operation element by element inside the second's loop.
+// This only finds such pairs; the temporaries they leave unused need no
+// storage.
+////////////////////////////////////////////////////////////////////////////////
+class ArrayFusion {
+public:
+  ArrayFusion(Function&);
+
+  // Computed inside the loop of the operation that reads its result
+  bool isFused(const ValueId& v) { return fused[v]; }
+  // The fused operation that computes operand n (1 or 2) of an array
+  // operation, or NO_VALUE if the operand is read from memory or a scalar
+  ValueId getSource(const ValueId& v, const uint32_t& n) {
+    return sources[2 * v + n - 1];
+  }
+  bool isSlotUnused(const uint32_t& slot) { return unused_slots[slot]; }
+  // Integer division somewhere in the operation or what is fused into it
+  bool canFail(const ValueId& v) { return can_fail[v]; }
+  // The arrays and scalars a parallel worker for v needs, in the order it
+  // first reads them, through the operations fused into it
+  void findArgs(const ValueId&, std::vector<ValueId>&);
+  size_t getNumFused() { return num_fused; }
+
+  static bool isElementWise(const Opcode& op) {
+    return (op == IR_ABIN) || (op == IR_AUN) || (op == IR_ACONV);
+  }
+
+private:
+  // The one operation writing a slot and the one reading it
+  struct SlotUse {
+    ValueId writer;
+    ValueId reader;
+    uint32_t operand;  // Of the reader
+    bool other;  // Referenced any other way
+  };
+
+  Function& func;
+  std::vector<bool> fused;
+  std::vector<ValueId> sources;  // Two per value, for operands 1 and 2
+  std::vector<bool> unused_slots;
+  std::vector<bool> can_fail;  // Integer division somewhere in the tree
+  size_t num_fused;
+
+  void findSlotUses(std::vector<SlotUse>&);
+  bool isSafeBetween(const ValueId&, const ValueId&,
+      const std::vector<SlotUse>&, const std::vector<uint32_t>&);
+  bool isCandidate(const SlotUse&, const std::vector<uint32_t>&);
+  uint32_t getSlot(const ValueId&);
+};
+
+#endif // ARRAY_FUSION_H
@@ -0,0 +1,267 @@
+#include "ast.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "environment.h"
+#include "log.h"
+#include "token.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Name lists
+////////////////////////////////////////////////////////////////////////////////
+
+const std::string Ast::kind_names[NUM_NODE_ENUMS] = {
+  "ERROR",
+  "PROGRAM",
+  "PROCEDURE",
+  "PARAMETERS",
+  "DECLARATIONS",
+  "VARIABLE",
+  "STATEMENTS",
+  "ASSIGN",
+  "IF",
+  "LOOP",
+  "RETURN",
+  "BINARY",
+  "NOT",
+  "NEGATE",
+  "NAME",
+  "CALL",
+  "INT_LIT",
+  "FLT_LIT",
+  "STR_LIT",
+  "BOOL_LIT",
+};
+
+const std::string Ast::op_names[NUM_OP_ENUMS] = {
+  "NONE",
+  "&",
+  "|",
+  "+",
+  "-",
+  "*",
+  "/",
+  "<",
+  "<=",
+  ">",
+  ">=",
+  "==",
+  "!=",
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+////////////////////////////////////////////////////////////////////////////////
+
+Ast::Ast(std::shared_ptr<Environment> e) : env(e), root(NO_NODE) {
+  clear();
+}
+
+// Create a node whose children (if any) were created before it
+NodeId Ast::makeNode(const NodeKind& kind, const TypeMark& tm,
+    const uint32_t& size, const uint32_t& offset, const NodeId& first_child) {
+  NodeId node = static_cast<NodeId>(kinds.size());
+  kinds.push_back(kind);
+  type_marks.push_back(static_cast<uint8_t>(tm));
+  sizes.push_back(size);
+  children.push_back(first_child);
+  siblings.push_back(NO_NODE);
+  offsets.push_back(offset);
+  values.push_back(0);
+  return node;
+}
+
+// Node referring to a symbol; type and size come from the symbol
+NodeId Ast::makeSymbol(const NodeKind& kind, std::shared_ptr<IdToken> id_tok,
+    const uint32_t& offset, const NodeId& first_child) {
+  NodeId node = makeNode(kind, id_tok->getTypeMark(),
+      id_tok->getProcedure() ? 0 : id_tok->getNumElements(), offset,
+      first_child);
+  values[node] = id_tok->getId();
+  return node;
+}
+
+NodeId Ast::makeBinary(std::shared_ptr<Token> op_tok, const NodeId& lhs,
+    const NodeId& rhs, const TypeMark& tm, const uint32_t& size,
+    const uint32_t& offset) {
+  siblings[lhs] = rhs;
+  NodeId node = makeNode(NODE_BINARY, tm, size, offset, lhs);
+  values[node] = getBinaryOp(op_tok->getVal());
+  return node;
+}
+
+NodeId Ast::makeInt(const int& val, const uint32_t& offset) {
+  NodeId node = makeNode(NODE_INT_LIT, TYPE_INT, 0, offset);
+  values[node] = static_cast<uint32_t>(val);
+  return node;
+}
+
+NodeId Ast::makeFloat(const float& val, const uint32_t& offset) {
+  NodeId node = makeNode(NODE_FLT_LIT, TYPE_FLT, 0, offset);
+  std::memcpy(&values[node], &val, sizeof(float));
+  return node;
+}
+
+NodeId Ast::makeBool(const bool& val, const uint32_t& offset) {
+  NodeId node = makeNode(NODE_BOOL_LIT, TYPE_BOOL, 0, offset);
+  values[node] = val ? 1 : 0;
+  return node;
+}
+
+// The scanner keeps the opening quote in string literal values; drop it
+NodeId Ast::makeString(const std::string& val, const uint32_t& offset) {
+  NodeId node = makeNode(NODE_STR_LIT, TYPE_STR, 0, offset);
+  size_t start = (!val.empty() && (val[0] == '"')) ? 1 : 0;
+  values[node] = static_cast<uint32_t>(string_pool.size());
+  string_pool.insert(string_pool.end(), val.begin() + start, val.end());
+  string_pool.push_back('\0');
+  return node;
+}
+
+// Add a node to a child list that is still being built
+void Ast::link(NodeId& first, NodeId& tail, const NodeId& node) {
+  if (node == NO_NODE) return;
+  if (first == NO_NODE) {
+    first = node;
+  } else {
+    siblings[tail] = node;
+  }
+  tail = node;
+}
+
+// Make room for an expected number of nodes up front
+void Ast::reserve(const size_t& num_nodes) {
+  kinds.reserve(num_nodes + 1);
+  type_marks.reserve(num_nodes + 1);
+  sizes.reserve(num_nodes + 1);
+  children.reserve(num_nodes + 1);
+  siblings.reserve(num_nodes + 1);
+  offsets.reserve(num_nodes + 1);
+  values.reserve(num_nodes + 1);
+}
+
+// Get the n-th child (NO_NODE if there are not that many)
+NodeId Ast::getChild(const NodeId& node, int n) {
+  NodeId c = children[node];
+  while ((c != NO_NODE) && (n-- > 0)) c = siblings[c];
+  return c;
+}
+
+uint32_t Ast::getLine(const NodeId& node) {
+  auto it = std::upper_bound(line_starts.begin(), line_starts.end(),
+      offsets[node]);
+  return static_cast<uint32_t>(it - line_starts.begin());
+}
+
+float Ast::getFloat(const NodeId& node) {
+  float val;
+  std::memcpy(&val, &values[node], sizeof(float));
+  return val;
+}
+
+// Bytes held by the node arrays and the string pool
+size_t Ast::getBytes() {
+  size_t num = kinds.size();
+  return num * (sizeof(NodeKind) + sizeof(uint8_t) + 5 * sizeof(uint32_t))
+      + string_pool.size();
+}
+
+// Free the whole tree in one step; node 0 is the "no node" sentinel
+void Ast::clear() {
+  kinds.assign(1, NODE_ERROR);
+  type_marks.assign(1, TYPE_NONE);
+  sizes.assign(1, 0);
+  children.assign(1, NO_NODE);
+  siblings.assign(1, NO_NODE);
+  offsets.assign(1, 0);
+  values.assign(1, 0);
+  string_pool.clear();
+  root = NO_NODE;
+}
+
+void Ast::dump(std::ostream& os) {
+  if (root == NO_NODE) {
+    os << "<empty syntax tree>\n";
+    return;
+  }
+  dumpNode(os, root, 0);
+}
+
+std::string Ast::getKindName(const NodeKind& k) {
+  if (k < NUM_NODE_ENUMS) {
+    return kind_names[k];
+  } else {
+    return "NUM_NODE_ENUMS";
+  }
+}
+
+std::string Ast::getOpName(const BinaryOp& op) {
+  if (op < NUM_OP_ENUMS) {
+    return op_names[op];
+  } else {
+    return "NUM_OP_ENUMS";
+  }
+}
+
+BinaryOp Ast::getBinaryOp(const std::string& s) {
+  for (int i = OP_AND; i < NUM_OP_ENUMS; i++) {
+    if (op_names[i] == s) return static_cast<BinaryOp>(i);
+  }
+  LOG(ERROR) << "Unknown binary operator: " << s;
+  return OP_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void Ast::dumpNode(std::ostream& os, const NodeId& node, const int& depth) {
+  std::shared_ptr<IdToken> id_tok;
+  os << std::string(2 * depth, ' ') << kind_names[kinds[node]];
+  switch (kinds[node]) {
+    case NODE_PROCEDURE:
+    case NODE_VARIABLE:
+    case NODE_NAME:
+    case NODE_CALL:
+      id_tok = (getSymbol(node) != NO_SYMBOL) ? env->getSymbol(getSymbol(node))
+          : nullptr;
+      os << " " << (id_tok ? id_tok->getVal() : "?");
+      break;
+    case NODE_BINARY:
+      os << " " << op_names[getOp(node)];
+      break;
+    case NODE_INT_LIT:
+      os << " " << getInt(node);
+      break;
+    case NODE_FLT_LIT:
+      os << " " << getFloat(node);
+      break;
+    case NODE_STR_LIT:
+      os << " \"" << getString(node) << "\"";
+      break;
+    case NODE_BOOL_LIT:
+      os << " " << (getBool(node) ? "true" : "false");
+      break;
+    default:
+      break;
+  }
+  if (getTypeMark(node) != TYPE_NONE) {
+    os << " : " << Token::getTypeMarkName(getTypeMark(node));
+    if (sizes[node] > 0) {
+      os << "[" << sizes[node] << "]";
+    }
+  }
+  if (((kinds[node] == NODE_VARIABLE) || (kinds[node] == NODE_PROCEDURE))
+      && id_tok && id_tok->getGlobal()) {
+    os << " (global)";
+  }
+  os << "  @" << getLine(node) << "\n";
+  for (NodeId c = children[node]; c != NO_NODE; c = siblings[c]) {
+    dumpNode(os, c, depth + 1);
+  }
+}
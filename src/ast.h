@@ -0,0 +1,134 @@
+#ifndef AST_H
+#define AST_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "environment.h"
+#include "token.h"
+
+enum NodeKind : uint8_t {
+  NODE_ERROR = 0, // Placeholder for something that failed to parse
+  NODE_PROGRAM, // [<declarations>, <statements>]
+  NODE_PROCEDURE, // symbol; [<parameters>, <declarations>, <statements>]
+  NODE_PARAMETERS, // [<variable>...]
+  NODE_DECLARATIONS, // [<variable> | <procedure>...]
+  NODE_VARIABLE, // symbol; size is the bound
+  NODE_STATEMENTS, // [<statement>...]
+  NODE_ASSIGN, // [<name>, <expression>]
+  NODE_IF, // [<expression>, <statements>, [<statements>]]
+  NODE_LOOP, // [<assign>, <expression>, <statements>]
+  NODE_RETURN, // [<expression>]
+  NODE_BINARY, // op; [<expression>, <expression>]
+  NODE_NOT, // [<expression>]
+  NODE_NEGATE, // [<expression>]
+  NODE_NAME, // symbol; [[<expression>]] when indexed
+  NODE_CALL, // symbol; [<expression>...]
+  NODE_INT_LIT, // int_val
+  NODE_FLT_LIT, // flt_val
+  NODE_STR_LIT, // str_val
+  NODE_BOOL_LIT, // bool_val
+  NUM_NODE_ENUMS,
+};
+
+enum BinaryOp : uint8_t {
+  OP_NONE = 0,
+  OP_AND, // &
+  OP_OR, // |
+  OP_ADD, // +
+  OP_SUB, // -
+  OP_MUL, // *
+  OP_DIV, // /
+  OP_LT, // <
+  OP_LE, // <=
+  OP_GT, // >
+  OP_GE, // >=
+  OP_EQ, // ==
+  OP_NE, // !=
+  NUM_OP_ENUMS,
+};
+
+// Index of a node in the Ast; 0 is reserved for "no node"
+typedef uint32_t NodeId;
+const NodeId NO_NODE = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Abstract syntax tree for one compilation
+// Nodes are stored as parallel arrays and addressed by NodeId. Children are a
+// singly linked list (first child, next sibling). The parser creates every
+// node after its children, so the arrays are in post-order: a bottom-up pass
+// is a forward scan over the indices, and a top-down pass is a backward scan.
+// Nodes dropped by error recovery stay in the arrays but are unreachable, so
+// scans are only meaningful on a tree that parsed without errors.
+// The value field depends on the kind: a SymbolId into the Environment, the
+// BinaryOp, the bits of an int/float/bool literal, or an offset into the
+// string pool.
+////////////////////////////////////////////////////////////////////////////////
+class Ast {
+public:
+  Ast(std::shared_ptr<Environment>);
+  NodeId makeNode(const NodeKind&, const TypeMark&, const uint32_t&,
+      const uint32_t&, const NodeId& = NO_NODE);
+  NodeId makeSymbol(const NodeKind&, std::shared_ptr<IdToken>,
+      const uint32_t&, const NodeId& = NO_NODE);
+  NodeId makeBinary(std::shared_ptr<Token>, const NodeId&, const NodeId&,
+      const TypeMark&, const uint32_t&, const uint32_t&);
+  NodeId makeInt(const int&, const uint32_t&);
+  NodeId makeFloat(const float&, const uint32_t&);
+  NodeId makeBool(const bool&, const uint32_t&);
+  NodeId makeString(const std::string&, const uint32_t&);
+  void link(NodeId&, NodeId&, const NodeId&);
+  void reserve(const size_t&);
+  void setRoot(const NodeId& r) { root = r; }
+  NodeId getRoot() { return root; }
+  void setLineStarts(const std::vector<uint32_t>& l) { line_starts = l; }
+  void clear();
+  void dump(std::ostream&);
+
+  // Node accessors
+  NodeKind getKind(const NodeId& n) { return kinds[n]; }
+  TypeMark getTypeMark(const NodeId& n) {
+    return static_cast<TypeMark>(type_marks[n]);
+  }
+  uint32_t getSize(const NodeId& n) { return sizes[n]; }
+  void setSize(const NodeId& n, const uint32_t& s) { sizes[n] = s; }
+  NodeId getChild(const NodeId& n) { return children[n]; }
+  NodeId getChild(const NodeId&, int);
+  NodeId getNext(const NodeId& n) { return siblings[n]; }
+  uint32_t getOffset(const NodeId& n) { return offsets[n]; }
+  uint32_t getLine(const NodeId&);
+  SymbolId getSymbol(const NodeId& n) { return values[n]; }
+  BinaryOp getOp(const NodeId& n) { return static_cast<BinaryOp>(values[n]); }
+  int getInt(const NodeId& n) { return static_cast<int>(values[n]); }
+  float getFloat(const NodeId&);
+  bool getBool(const NodeId& n) { return values[n] != 0; }
+  const char* getString(const NodeId& n) { return &string_pool[values[n]]; }
+
+  // Number of nodes, not counting the reserved node 0
+  size_t getNumNodes() { return kinds.size() - 1; }
+  size_t getBytes();
+  static std::string getKindName(const NodeKind&);
+  static std::string getOpName(const BinaryOp&);
+  static BinaryOp getBinaryOp(const std::string&);
+
+private:
+  std::shared_ptr<Environment> env;
+  std::vector<NodeKind> kinds;
+  std::vector<uint8_t> type_marks;
+  std::vector<uint32_t> sizes;  // Number of elements; 0 for scalars
+  std::vector<NodeId> children;
+  std::vector<NodeId> siblings;
+  std::vector<uint32_t> offsets;  // Source offset of the construct
+  std::vector<uint32_t> values;
+  std::vector<char> string_pool;
+  std::vector<uint32_t> line_starts;  // Source offset of each line
+  NodeId root;
+  void dumpNode(std::ostream&, const NodeId&, const int&);
+  static const std::string kind_names[NUM_NODE_ENUMS];
+  static const std::string op_names[NUM_OP_ENUMS];
+};
+
+#endif // AST_H
@@ -0,0 +1,496 @@
+#include "c_backend.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "array_fusion.h"
+#include "ir.h"
+#include "log.h"
+
+extern "C" {
+#include "../runtime/runtime.h"
+}
+
+CBackend::CBackend(Module& m, const uint32_t& par_min) :
+    module(m),
+    parallel_min(par_min),
+    func(nullptr),
+    func_idx(0),
+    fusion(nullptr) {}
+
+void CBackend::emit(std::ostream& os) {
+  emitPrologue(os);
+
+  // Procedures may call each other in any order
+  for (uint32_t i = 0; i < module.functions.size(); i++) {
+    Function& f = module.functions[i];
+    if (f.is_main) continue;
+    if (!f.external) os << "static ";
+    emitSignature(os, i);
+    os << ";\n";
+  }
+  os << "\n";
+
+  // Short strings are constants; longer ones are data after their lengths
+  for (uint32_t i = 0; i < module.strings.size(); i++) {
+    size_t len = module.strings[i].size();
+    if (len <= RT_STR_INLINE) continue;
+    os << "static const struct { uint64_t len; char bytes[" << len + 1
+        << "]; } str" << i << " = {" << len << ", \"";
+    for (unsigned char c : module.strings[i]) {
+      if ((c == '"') || (c == '\\') || (c == '?')) {
+        os << '\\' << c;
+      } else if ((c < 0x20) || (c >= 0x7f)) {
+        os << '\\' << static_cast<char>('0' + ((c >> 6) & 7))
+            << static_cast<char>('0' + ((c >> 3) & 7))
+            << static_cast<char>('0' + (c & 7));
+      } else {
+        os << c;
+      }
+    }
+    os << "\"};\n";
+  }
+  for (uint32_t i = 0; i < module.globals.size(); i++) {
+    Global& g = module.globals[i];
+    os << "static " << getCType(g.type) << " " << module.getGlobalName(i);
+    if (g.count > 0) os << "[" << g.count << "]";
+    os << ";\n";
+  }
+
+  for (func_idx = 0; func_idx < module.functions.size(); func_idx++) {
+    func = &module.functions[func_idx];
+    if (func->external) continue;
+    os << "\n";
+    emitFunction(os);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Includes and the runtime support the generated code calls
+void CBackend::emitPrologue(std::ostream& os) {
+  os << "#include <stdint.h>\n"
+      << "#include <string.h>\n"
+      << "\n"
+      << "typedef uint64_t rt_str;\n"
+      << "\n"
+      << "int32_t rt_streq(rt_str, rt_str);\n"
+      << "_Noreturn void rt_bounds_error(int32_t, int32_t);\n"
+      << "_Noreturn void rt_div_error(void);\n"
+      << "void rt_flush(void);\n"
+      << "void rt_parallel(void (*)(void*, uint32_t, uint32_t), void*, "
+      << "uint32_t,\n"
+      << "    const void*, uint32_t);\n"
+      << "\n"
+      << "static inline int32_t rt_div(int32_t a, int32_t b) {\n"
+      << "  if (b == 0) rt_div_error();\n"
+      << "  if (b == -1) return (int32_t) (0u - (uint32_t) a);\n"
+      << "  return a / b;\n"
+      << "}\n"
+      << "\n"
+      << "/* Out of range conversions give INT32_MIN, like cvttss2si */\n"
+      << "static inline int32_t rt_ftoi(float f) {\n"
+      << "  if (!(f > -2147483904.0f) || !(f < 2147483648.0f)) return INT32_MIN;\n"
+      << "  return (int32_t) f;\n"
+      << "}\n"
+      << "\n"
+      << "static inline float rt_bits(uint32_t u) {\n"
+      << "  float f;\n"
+      << "  memcpy(&f, &u, sizeof(f));\n"
+      << "  return f;\n"
+      << "}\n"
+      << "\n";
+}
+
+void CBackend::emitSignature(std::ostream& os, const uint32_t& idx) {
+  Function& f = module.functions[idx];
+  if (f.is_main) {
+    os << "int main(void)";
+    return;
+  }
+  os << getCType(f.ret_type) << " " << module.getLinkName(idx) << "(";
+  for (uint32_t i = 0; i < f.params.size(); i++) {
+    if (i > 0) os << ", ";
+    Param& param = f.params[i];
+    os << getCType((param.count > 0) ? IR_PTR : param.type) << " a" << i;
+  }
+  if (f.params.empty()) os << "void";
+  os << ")";
+}
+
+// Worker functions for the parallel operations are written out first, so the
+// body is built up separately
+void CBackend::emitFunction(std::ostream& os) {
+  ArrayFusion func_fusion(*func);
+  fusion = &func_fusion;
+  workers.str("");
+  std::ostringstream body;
+  if (!func->is_main) body << "static ";
+  emitSignature(body, func_idx);
+  body << " {\n";
+
+  // Every value and phi input up front, so gotos never skip a declaration
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      if (instr.type == IR_VOID) continue;
+      body << "  " << getCType(instr.type) << " " << getValue(v);
+      if (instr.op == IR_PHI) body << ", p" << v;
+      body << ";\n";
+    }
+  }
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (fusion->isSlotUnused(i)) continue;
+    body << "  " << getCType(slot.type) << " s" << i << "[" << slot.count
+        << "];\n";
+  }
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    if (func->slots[i].zeroed) {
+      body << "  memset(s" << i << ", 0, sizeof(s" << i << "));\n";
+    }
+  }
+
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    Block& block = func->blocks[b];
+    bool jumped_to = false;
+    for (BlockId p : block.preds) jumped_to |= (p + 1 != b);
+    if (jumped_to) body << "L" << b << ":;\n";
+    for (ValueId v : block.instrs) emitInstr(body, v);
+  }
+  body << "}\n";
+  os << workers.str() << body.str();
+  fusion = nullptr;
+}
+
+void CBackend::emitInstr(std::ostream& os, const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  std::string val = getValue(v);
+  std::string type = getCType(instr.type);
+  IrType src_type = (instr.src_type != IR_VOID) ? instr.src_type : instr.type;
+  switch (instr.op) {
+    case IR_CONST:
+      os << "  " << val << " = " << getConst(instr) << ";\n";
+      break;
+    case IR_PARAM:
+      os << "  " << val << " = a" << instr.imm.u << ";\n";
+      break;
+    case IR_GLOAD:
+      os << "  " << val << " = " << module.getGlobalName(instr.imm.u) << ";\n";
+      break;
+    case IR_GSTORE:
+      os << "  " << module.getGlobalName(instr.imm.u) << " = "
+          << getOperand(v, 0) << ";\n";
+      break;
+    case IR_GADDR:
+      os << "  " << val << " = " << module.getGlobalName(instr.imm.u) << ";\n";
+      break;
+    case IR_SLOT:
+      if (fusion->isSlotUnused(instr.imm.u)) {
+        os << "  " << val << " = 0;\n";
+      } else {
+        os << "  " << val << " = s" << instr.imm.u << ";\n";
+      }
+      break;
+    case IR_ALOAD:
+      if (!(instr.flags & IR_FLAG_IN_BOUNDS)) {
+        emitBoundsCheck(os, getOperand(v, 1), instr.count);
+      }
+      os << "  " << val << " = ((" << type << "*) " << getOperand(v, 0)
+          << ")[" << getOperand(v, 1) << "];\n";
+      break;
+    case IR_ASTORE:
+      if (!(instr.flags & IR_FLAG_IN_BOUNDS)) {
+        emitBoundsCheck(os, getOperand(v, 1), instr.count);
+      }
+      os << "  ((" << type << "*) " << getOperand(v, 0) << ")["
+          << getOperand(v, 1) << "] = " << getOperand(v, 2) << ";\n";
+      break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      os << "  " << val << " = " << getScalarExpr(instr.op, src_type,
+          getOperand(v, 0), getOperand(v, 1)) << ";\n";
+      break;
+    case IR_NEG:
+    case IR_NOT:
+      os << "  " << val << " = "
+          << getScalarExpr(instr.op, src_type, getOperand(v, 0)) << ";\n";
+      break;
+    case IR_ITOF:
+    case IR_FTOI:
+    case IR_ITOB:
+    case IR_BTOI:
+      os << "  " << val << " = "
+          << getConvExpr(instr.src_type, instr.type, getOperand(v, 0))
+          << ";\n";
+      break;
+    case IR_ACOPY:
+      os << "  memmove(" << getOperand(v, 0) << ", " << getOperand(v, 1)
+          << ", " << instr.count << " * sizeof(" << type << "));\n";
+      break;
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      if (fusion->isFused(v)) break;
+      if ((parallel_min > 0) && (instr.count >= parallel_min)
+          && !fusion->canFail(v)) {
+        emitParallelOp(os, v);
+      } else {
+        emitArrayOp(os, v, "0", std::to_string(instr.count));
+      }
+      break;
+    case IR_CALL: {
+      os << "  ";
+      if (instr.type != IR_VOID) os << val << " = ";
+      os << module.getLinkName(instr.imm.u) << "(";
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        if (i > 0) os << ", ";
+        os << getOperand(v, i);
+      }
+      os << ");\n";
+      break;
+    }
+    case IR_PHI:
+      os << "  " << val << " = p" << v << ";\n";
+      break;
+    case IR_BR: {
+      emitPhiCopies(os, instr.block);
+      BlockId target = func->blocks[instr.block].succs[0];
+      if (target != instr.block + 1) os << "  goto L" << target << ";\n";
+      break;
+    }
+    case IR_CBR: {
+      emitPhiCopies(os, instr.block);
+      BlockId t = func->blocks[instr.block].succs[0];
+      BlockId f = func->blocks[instr.block].succs[1];
+      if (t == instr.block + 1) {
+        os << "  if (!" << getOperand(v, 0) << ") goto L" << f << ";\n";
+      } else {
+        os << "  if (" << getOperand(v, 0) << ") goto L" << t << ";\n";
+        if (f != instr.block + 1) os << "  goto L" << f << ";\n";
+      }
+      break;
+    }
+    case IR_RET:
+      if (instr.num_ops > 0) {
+        os << "  return " << getOperand(v, 0) << ";\n";
+      } else if (func->is_main) {
+        os << "  rt_flush();\n  return 0;\n";
+      } else {
+        os << "  return;\n";
+      }
+      break;
+    default:
+      LOG(ERROR) << "Cannot translate " << Module::getOpName(instr.op);
+      break;
+  }
+}
+
+// Phi inputs are written before the jump; the phi reads them on entry
+void CBackend::emitPhiCopies(std::ostream& os, const BlockId& b) {
+  for (BlockId s : func->blocks[b].succs) {
+    Block& succ = func->blocks[s];
+    uint32_t idx = 0;
+    while (succ.preds[idx] != b) idx++;
+    for (ValueId phi : succ.instrs) {
+      if (func->instrs[phi].op != IR_PHI) break;
+      os << "  p" << phi << " = " << getOperand(phi, idx) << ";\n";
+    }
+  }
+}
+
+// Whole-array operations become simple counted loops the C compiler can
+// vectorize. Fused operations are expanded into the loop that reads them, so
+// a chained expression is one loop with no temporary arrays.
+void CBackend::emitArrayOp(std::ostream& os, const ValueId& v,
+    const std::string& begin, const std::string& end) {
+  Instr& instr = func->instrs[v];
+  os << "  for (uint32_t i = " << begin << "; i < " << end << "; i++) {\n"
+      << "    ((" << getCType(instr.type) << "*) " << getOperand(v, 0)
+      << ")[i] = " << getArrayOpExpr(v) << ";\n"
+      << "  }\n";
+}
+
+// The loop moves to a worker over a chunk of the elements. The values it
+// uses are passed in a struct of the same name and copied back out to locals
+// of the same names, which the stores in the loop cannot alias.
+void CBackend::emitParallelOp(std::ostream& os, const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  std::string name = "par" + std::to_string(func_idx) + "_"
+      + std::to_string(v);
+  std::vector<ValueId> args = {func->getOperand(v, 0)};
+  fusion->findArgs(v, args);
+  workers << "struct " << name << " {";
+  for (ValueId arg : args) {
+    workers << " " << getCType(func->instrs[arg].type) << " " << getValue(arg)
+        << ";";
+  }
+  workers << " };\n\n"
+      << "static void " << name
+      << "(void* ctx, uint32_t begin, uint32_t end) {\n"
+      << "  struct " << name << "* c = ctx;\n";
+  for (ValueId arg : args) {
+    workers << "  " << getCType(func->instrs[arg].type) << " " << getValue(arg)
+        << " = c->" << getValue(arg) << ";\n";
+  }
+  emitArrayOp(workers, v, "begin", "end");
+  workers << "}\n\n";
+
+  os << "  {\n"
+      << "    struct " << name << " c = {";
+  for (uint32_t i = 0; i < args.size(); i++) {
+    os << ((i > 0) ? ", " : "") << getValue(args[i]);
+  }
+  os << "};\n"
+      << "    rt_parallel(" << name << ", &c, " << instr.count << ", "
+      << getOperand(v, 0) << ", " << getElemSize(instr.type) << ");\n"
+      << "  }\n";
+}
+
+// Element i of operand n of an array operation
+std::string CBackend::getElemExpr(const ValueId& v, const uint32_t& n) {
+  Instr& instr = func->instrs[v];
+  uint8_t scalar = (n == 1) ? IR_FLAG_LHS_SCALAR : IR_FLAG_RHS_SCALAR;
+  if ((instr.op == IR_ABIN) && (instr.flags & scalar)) return getOperand(v, n);
+  ValueId source = fusion->getSource(v, n);
+  if (source != NO_VALUE) return "(" + getArrayOpExpr(source) + ")";
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  return "((" + getCType(src_type) + "*) " + getOperand(v, n) + ")[i]";
+}
+
+std::string CBackend::getArrayOpExpr(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  Opcode op = static_cast<Opcode>(instr.imm.u);
+  if (instr.op == IR_ABIN) {
+    return getScalarExpr(op, instr.src_type, getElemExpr(v, 1),
+        getElemExpr(v, 2));
+  } else if (instr.op == IR_AUN) {
+    return getScalarExpr(op, instr.type, getElemExpr(v, 1));
+  }
+  return getConvExpr(instr.src_type, instr.type, getElemExpr(v, 1));
+}
+
+void CBackend::emitBoundsCheck(std::ostream& os, const std::string& idx,
+    const uint32_t& count) {
+  os << "  if ((uint32_t) " << idx << " >= " << count << "u) rt_bounds_error("
+      << idx << ", " << count << ");\n";
+}
+
+// Floats are written in hex so they round-trip exactly
+std::string CBackend::getConst(const Instr& instr) {
+  std::ostringstream ss;
+  switch (instr.type) {
+    case IR_FLT:
+      if (std::isfinite(instr.imm.f)) {
+        ss << std::hexfloat << instr.imm.f << "f";
+      } else {
+        ss << "rt_bits(" << instr.imm.u << "u)";
+      }
+      break;
+    case IR_STR: {
+      const std::string& s = module.strings[instr.imm.u];
+      if (s.size() > RT_STR_INLINE) {
+        ss << "(rt_str) (uintptr_t) str" << instr.imm.u << ".bytes";
+      } else {
+        ss << "UINT64_C(0x" << std::hex << rt_str_inline(s.data(),
+            static_cast<uint32_t>(s.size())) << ")";
+      }
+      break;
+    }
+    default:
+      if (instr.imm.u == 0x80000000u) {
+        ss << "INT32_MIN";
+      } else {
+        ss << instr.imm.i;
+      }
+      break;
+  }
+  return ss.str();
+}
+
+// C expression for a scalar operation on operand type type
+std::string CBackend::getScalarExpr(const Opcode& op, const IrType& type,
+    const std::string& a, const std::string& b) {
+  static const std::string c_ops[] = {"+", "-", "*", "/", "&", "|", "<", "<=",
+    ">", ">=", "==", "!="};
+  bool is_int = (type == IR_INT);
+  switch (op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+      if (is_int) {
+        return "(int32_t) ((uint32_t) " + a + " " + c_ops[op - IR_ADD]
+            + " (uint32_t) " + b + ")";
+      }
+      return a + " " + c_ops[op - IR_ADD] + " " + b;
+    case IR_DIV:
+      if (is_int) return "rt_div(" + a + ", " + b + ")";
+      return a + " / " + b;
+    case IR_EQ:
+    case IR_NE:
+      if (type == IR_STR) {
+        return std::string((op == IR_EQ) ? "" : "!") + "rt_streq(" + a + ", "
+            + b + ")";
+      }
+      return a + " " + c_ops[op - IR_ADD] + " " + b;
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+      return a + " " + c_ops[op - IR_ADD] + " " + b;
+    case IR_NEG:
+      if (is_int) return "(int32_t) (0u - (uint32_t) " + a + ")";
+      return "-" + a;
+    case IR_NOT:
+      return ((type == IR_BOOL) ? "!" : "~") + a;
+    default:
+      LOG(ERROR) << "Cannot translate " << Module::getOpName(op);
+      return a;
+  }
+}
+
+// Bools are 0 or 1, so they convert to float like the int they hold
+std::string CBackend::getConvExpr(const IrType& from, const IrType& to,
+    const std::string& a) {
+  if (to == IR_FLT) return "(float) " + a;
+  if (from == IR_FLT) {
+    return (to == IR_BOOL) ? "(rt_ftoi(" + a + ") != 0)" : "rt_ftoi(" + a + ")";
+  }
+  if (to == IR_BOOL) return "(" + a + " != 0)";
+  return a;
+}
+
+std::string CBackend::getCType(const IrType& type) {
+  switch (type) {
+    case IR_INT:
+    case IR_BOOL:
+      return "int32_t";
+    case IR_FLT:
+      return "float";
+    case IR_STR:
+      return "rt_str";
+    case IR_PTR:
+      return "void*";
+    default:
+      return "void";
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef C_BACKEND_H
+#define C_BACKEND_H
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "array_fusion.h"
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// C code generator
+// Translates the IR to portable C99 so the system C compiler can do register
+// allocation, scheduling and vectorization. Each SSA value becomes a local
+// variable and each block a label; phis are assigned by their predecessors.
+// Integer arithmetic goes through uint32_t so overflow wraps as it does in
+// the other backends instead of being undefined. Large whole-array operations
+// that cannot fail become worker functions that rt_parallel runs on each
+// thread's chunk of the elements.
+////////////////////////////////////////////////////////////////////////////////
+class CBackend {
+public:
+  CBackend(Module&, const uint32_t& = DEFAULT_PARALLEL_MIN);
+  void emit(std::ostream&);
+
+private:
+  Module& module;
+  uint32_t parallel_min;  // Elements; 0 never splits an operation
+  Function* func;
+  uint32_t func_idx;
+  ArrayFusion* fusion;
+  std::ostringstream workers;  // Emitted before the function that uses them
+
+  void emitPrologue(std::ostream&);
+  void emitSignature(std::ostream&, const uint32_t&);
+  void emitFunction(std::ostream&);
+  void emitInstr(std::ostream&, const ValueId&);
+  void emitPhiCopies(std::ostream&, const BlockId&);
+  void emitArrayOp(std::ostream&, const ValueId&, const std::string&,
+      const std::string&);
+  void emitParallelOp(std::ostream&, const ValueId&);
+  std::string getElemExpr(const ValueId&, const uint32_t&);
+  std::string getArrayOpExpr(const ValueId&);
+  void emitBoundsCheck(std::ostream&, const std::string&, const uint32_t&);
+  std::string getValue(const ValueId& v) { return "v" + std::to_string(v); }
+  std::string getOperand(const ValueId& v, const uint32_t& n) {
+    return getValue(func->getOperand(v, n));
+  }
+  std::string getConst(const Instr&);
+  static std::string getScalarExpr(const Opcode&, const IrType&,
+      const std::string&, const std::string& = "");
+  static std::string getConvExpr(const IrType&, const IrType&,
+      const std::string&);
+  static std::string getCType(const IrType&);
+};
+
+#endif // C_BACKEND_H
@@ -0,0 +1,345 @@
+#include "call_evaluator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+#include "sccp.h"
+
+namespace {
+
+// Limits on evaluating one call: instructions run, nested calls, and array
+// elements held at once
+const size_t MAX_STEPS = 1 << 20;
+const uint32_t MAX_DEPTH = 1000;
+const size_t MAX_ELEMS = 1 << 20;
+
+// Instructions run at compile time over the whole program
+const size_t MAX_TOTAL_STEPS = 1 << 24;
+
+}  // namespace
+
+CallEvaluator::CallEvaluator(Module& m) :
+    module(m),
+    num_elems(0),
+    steps(0),
+    budget(MAX_TOTAL_STEPS),
+    num_calls(0),
+    num_evaluated(0),
+    num_steps(0) {}
+
+void CallEvaluator::run() {
+  findPure();
+  for (auto& func : module.functions) {
+    if (!func.external) runFunction(func);
+  }
+  LOG(INFO) << "Call evaluation: " << num_evaluated << " of " << num_calls
+      << " calls to pure procedures evaluated, " << num_steps
+      << " instructions run at compile time";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Procedures start out pure unless they touch a global themselves, and lose
+// it when they call one that is not
+void CallEvaluator::findPure() {
+  pure.assign(module.functions.size(), false);
+  for (uint32_t f = 0; f < module.functions.size(); f++) {
+    Function& func = module.functions[f];
+    if (func.external) {
+      pure[f] = (func.name == "sqrt");
+      continue;
+    }
+    if (func.is_main) continue;
+    pure[f] = true;
+    for (auto& block : func.blocks) {
+      for (ValueId v : block.instrs) {
+        Opcode op = func.instrs[v].op;
+        if ((op == IR_GLOAD) || (op == IR_GSTORE) || (op == IR_GADDR)) {
+          pure[f] = false;
+        }
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t f = 0; f < module.functions.size(); f++) {
+      Function& func = module.functions[f];
+      if (!pure[f] || func.external) continue;
+      for (auto& block : func.blocks) {
+        for (ValueId v : block.instrs) {
+          Instr& instr = func.instrs[v];
+          if ((instr.op == IR_CALL) && !pure[instr.imm.u]) {
+            pure[f] = false;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+}
+
+void CallEvaluator::runFunction(Function& func) {
+  std::vector<ValueId> calls;
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      if ((instr.op == IR_CALL) && pure[instr.imm.u]) calls.push_back(v);
+    }
+  }
+  num_calls += calls.size();
+
+  bool changed = false;
+  for (ValueId call : calls) {
+    std::vector<uint32_t> args;
+    for (uint32_t i = 0; i < func.instrs[call].num_ops; i++) {
+      Instr& arg = func.instrs[func.getOperand(call, i)];
+      if (arg.op != IR_CONST) break;
+      args.push_back(arg.imm.u);
+    }
+    if ((args.size() < func.instrs[call].num_ops) || (budget == 0)) continue;
+    steps = std::min(MAX_STEPS, budget);
+    size_t start = steps;
+    uint32_t result = 0;
+    bool ok = evaluate(func.instrs[call].imm.u, args, result, 0);
+    budget -= start - steps;
+    if (!ok) continue;
+    num_steps += start - steps;
+
+    IrType type = func.instrs[call].type;
+    if (type != IR_VOID) {
+      ValueId c = func.addInstr(IR_CONST, type);
+      func.instrs[c].imm.u = result;
+      func.instrs[c].block = 0;
+      func.blocks[0].instrs.insert(func.blocks[0].instrs.begin(), c);
+      func.replaceAllUses(call, c);
+    }
+    func.instrs[call].op = IR_NOP;
+    num_evaluated++;
+    changed = true;
+  }
+  if (changed) func.compact();
+}
+
+// Run function f on args; false if it cannot be done within the limits
+bool CallEvaluator::evaluate(const uint32_t& f,
+    const std::vector<uint32_t>& args, uint32_t& result,
+    const uint32_t& depth) {
+  Function& func = module.functions[f];
+  if (func.external) {
+    // sqrt, the one builtin a pure procedure can call
+    float r = std::sqrt(static_cast<float>(static_cast<int32_t>(args[0])));
+    std::memcpy(&result, &r, sizeof(result));
+    return true;
+  }
+  if (depth >= MAX_DEPTH) return false;
+  size_t num_arrays = arrays.size();
+  size_t elems = num_elems;
+  bool ok = evaluateBody(func, args, result, depth);
+  arrays.resize(num_arrays);
+  num_elems = elems;
+  return ok;
+}
+
+bool CallEvaluator::evaluateBody(Function& func,
+    const std::vector<uint32_t>& args, uint32_t& result,
+    const uint32_t& depth) {
+  std::vector<uint32_t> slots(func.slots.size());
+  for (uint32_t s = 0; s < func.slots.size(); s++) {
+    if (!newArray(func.slots[s].count, slots[s])) return false;
+  }
+  std::vector<uint32_t> values(func.instrs.size(), 0);
+  std::vector<uint32_t> phi_values;
+  BlockId b = 0;
+  BlockId prev = 0;
+  bool entry = true;
+  while (true) {
+    // Phis take their operands from the edge just taken, all at once
+    std::vector<ValueId>& instrs = func.blocks[b].instrs;
+    size_t i = 0;
+    if (!entry) {
+      std::vector<BlockId>& preds = func.blocks[b].preds;
+      uint32_t pred = static_cast<uint32_t>(
+          std::find(preds.begin(), preds.end(), prev) - preds.begin());
+      phi_values.clear();
+      for (; (i < instrs.size()) && (func.instrs[instrs[i]].op == IR_PHI);
+          i++) {
+        phi_values.push_back(values[func.getOperand(instrs[i], pred)]);
+      }
+      for (size_t p = 0; p < phi_values.size(); p++) {
+        values[instrs[p]] = phi_values[p];
+      }
+    }
+
+    bool jumped = false;
+    for (; !jumped && (i < instrs.size()); i++) {
+      if (steps == 0) return false;
+      steps--;
+      ValueId v = instrs[i];
+      Instr& instr = func.instrs[v];
+      switch (instr.op) {
+        case IR_PARAM:
+          values[v] = args[instr.imm.u];
+          break;
+        case IR_SLOT:
+          values[v] = slots[instr.imm.u];
+          break;
+        case IR_BR:
+          prev = b;
+          b = func.blocks[b].succs[0];
+          jumped = true;
+          break;
+        case IR_CBR:
+          prev = b;
+          b = func.blocks[b].succs[
+              (values[func.getOperand(v, 0)] != 0) ? 0 : 1];
+          jumped = true;
+          break;
+        case IR_RET:
+          result = (instr.num_ops > 0) ? values[func.getOperand(v, 0)] : 0;
+          return true;
+        default:
+          if (!evaluateInstr(func, v, values, depth)) return false;
+          break;
+      }
+    }
+    if (!jumped) return false;
+    entry = false;
+  }
+}
+
+bool CallEvaluator::evaluateInstr(Function& func, const ValueId& v,
+    std::vector<uint32_t>& values, const uint32_t& depth) {
+  Instr& instr = func.instrs[v];
+  switch (instr.op) {
+    case IR_NOP:
+      return true;
+    case IR_CONST:
+      values[v] = instr.imm.u;
+      return true;
+    case IR_ALOAD: {
+      uint32_t* elem = getElem(values[func.getOperand(v, 0)],
+          values[func.getOperand(v, 1)], instr.count);
+      if (elem == nullptr) return false;
+      values[v] = *elem;
+      return true;
+    }
+    case IR_ASTORE: {
+      uint32_t* elem = getElem(values[func.getOperand(v, 0)],
+          values[func.getOperand(v, 1)], instr.count);
+      if (elem == nullptr) return false;
+      *elem = values[func.getOperand(v, 2)];
+      return true;
+    }
+    case IR_ACOPY:
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      return evaluateArrayOp(func, v, values);
+    case IR_CALL: {
+      std::vector<uint32_t> args(instr.num_ops);
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        args[i] = values[func.getOperand(v, i)];
+      }
+      return evaluate(instr.imm.u, args, values[v], depth + 1);
+    }
+    default: {
+      if ((instr.num_ops == 0) || (instr.num_ops > 2)) return false;
+      uint32_t ops[2] = {values[func.getOperand(v, 0)], 0};
+      if (instr.num_ops > 1) ops[1] = values[func.getOperand(v, 1)];
+      return Sccp::evaluate(instr, ops, values[v]);
+    }
+  }
+}
+
+// Element by element, with each element's scalar operation
+bool CallEvaluator::evaluateArrayOp(Function& func, const ValueId& v,
+    std::vector<uint32_t>& values) {
+  Instr& instr = func.instrs[v];
+  Instr scalar = instr;
+  std::vector<Opcode> convs;
+  switch (instr.op) {
+    case IR_ABIN:
+      scalar.op = static_cast<Opcode>(instr.imm.u);
+      scalar.num_ops = 2;
+      break;
+    case IR_AUN:
+      scalar.op = static_cast<Opcode>(instr.imm.u);
+      scalar.src_type = instr.type;
+      scalar.num_ops = 1;
+      break;
+    case IR_ACONV:
+      // As the targets convert: floats to bools through ints
+      scalar.num_ops = 1;
+      if (instr.type == IR_FLT) {
+        convs.push_back(IR_ITOF);
+      } else if (instr.src_type == IR_FLT) {
+        convs.push_back(IR_FTOI);
+        if (instr.type == IR_BOOL) convs.push_back(IR_ITOB);
+      } else if (instr.type == IR_BOOL) {
+        convs.push_back(IR_ITOB);
+      }
+      break;
+    default:
+      break;
+  }
+
+  uint32_t dst = values[func.getOperand(v, 0)];
+  for (uint32_t i = 0; i < instr.count; i++) {
+    uint32_t ops[2] = {0, 0};
+    for (uint32_t n = 1; n < instr.num_ops; n++) {
+      uint32_t val = values[func.getOperand(v, n)];
+      bool is_scalar = (instr.op == IR_ABIN)
+          && (instr.flags & ((n == 1) ? IR_FLAG_LHS_SCALAR
+          : IR_FLAG_RHS_SCALAR));
+      if (is_scalar) {
+        ops[n - 1] = val;
+        continue;
+      }
+      uint32_t* elem = getElem(val, i, instr.count);
+      if (elem == nullptr) return false;
+      ops[n - 1] = *elem;
+    }
+    uint32_t out = ops[0];
+    if ((instr.op == IR_ABIN) || (instr.op == IR_AUN)) {
+      if (!Sccp::evaluate(scalar, ops, out)) return false;
+    }
+    for (Opcode conv : convs) {
+      scalar.op = conv;
+      scalar.src_type = IR_VOID;
+      scalar.type = (conv == IR_ITOF) ? IR_FLT : IR_INT;
+      uint32_t in = out;
+      if (!Sccp::evaluate(scalar, &in, out)) return false;
+    }
+    uint32_t* elem = getElem(dst, i, instr.count);
+    if (elem == nullptr) return false;
+    *elem = out;
+  }
+  return true;
+}
+
+bool CallEvaluator::newArray(const uint32_t& count, uint32_t& ptr) {
+  if (num_elems + count > MAX_ELEMS) return false;
+  ptr = static_cast<uint32_t>(arrays.size());
+  arrays.emplace_back(count, 0);
+  num_elems += count;
+  return true;
+}
+
+// Element idx of the array at ptr, or null if it is out of range
+uint32_t* CallEvaluator::getElem(const uint32_t& ptr, const uint32_t& idx,
+    const uint32_t& count) {
+  if ((ptr >= arrays.size()) || (idx >= count)
+      || (idx >= arrays[ptr].size())) {
+    return nullptr;
+  }
+  return &arrays[ptr][idx];
+}
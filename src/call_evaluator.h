@@ -0,0 +1,54 @@
+#ifndef CALL_EVALUATOR_H
+#define CALL_EVALUATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Compile-time evaluation of pure procedures
+// A procedure is pure if it neither reads nor writes a global and calls
+// only pure procedures and builtins without side effects (sqrt), so its
+// result depends on its arguments alone. A call to one with constant
+// arguments is run by a small IR interpreter and replaced by the constant
+// it returns. The interpreter keeps its arrays, the procedures' slots, in
+// its own memory and gives up on anything that would fail at run time (an
+// index out of range, division by zero), on going too deep, and on
+// exceeding its limits on steps and on memory; the call is then left
+// alone.
+////////////////////////////////////////////////////////////////////////////////
+class CallEvaluator {
+public:
+  CallEvaluator(Module&);
+  void run();
+  size_t getNumCalls() { return num_calls; }
+  size_t getNumEvaluated() { return num_evaluated; }
+  size_t getNumSteps() { return num_steps; }
+
+private:
+  Module& module;
+  std::vector<bool> pure;  // Function -> pure
+  std::vector<std::vector<uint32_t>> arrays;  // Pointers are indices here
+  size_t num_elems;  // Held by arrays
+  size_t steps;  // Left for the call being evaluated
+  size_t budget;  // Steps left for the whole program
+  size_t num_calls;
+  size_t num_evaluated;
+  size_t num_steps;  // Instructions run at compile time instead
+
+  void findPure();
+  void runFunction(Function&);
+  bool evaluate(const uint32_t&, const std::vector<uint32_t>&, uint32_t&,
+      const uint32_t&);
+  bool evaluateBody(Function&, const std::vector<uint32_t>&, uint32_t&,
+      const uint32_t&);
+  bool evaluateInstr(Function&, const ValueId&, std::vector<uint32_t>&,
+      const uint32_t&);
+  bool evaluateArrayOp(Function&, const ValueId&, std::vector<uint32_t>&);
+  bool newArray(const uint32_t&, uint32_t&);
+  uint32_t* getElem(const uint32_t&, const uint32_t&, const uint32_t&);
+};
+
+#endif // CALL_EVALUATOR_H
@@ -0,0 +1,286 @@
+#include "dead_code.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+DeadCode::DeadCode(Module& m, const bool& w) :
+    module(m),
+    warn(w),
+    num_functions(0),
+    num_globals(0),
+    num_slots(0),
+    num_instrs(0) {}
+
+void DeadCode::run() {
+  removeFunctions();
+  findDeadGlobals();
+  for (auto& func : module.functions) {
+    if (!func.external) runFunction(func);
+  }
+  removeGlobals();
+  if (warn) {
+    warnRemoved("Procedure", "is never called", procs);
+    warnRemoved("Variable", "is never read", vars);
+  }
+  LOG(INFO) << "Dead code: " << num_functions << " procedures, "
+      << num_globals << " globals, " << num_slots << " local arrays and "
+      << num_instrs << " instructions removed";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Keep the functions the program body reaches through calls, renumbering
+// them in their original order
+void DeadCode::removeFunctions() {
+  size_t num_funcs = module.functions.size();
+  std::vector<bool> reached(num_funcs, false);
+  std::vector<uint32_t> work(1, module.main_func);
+  reached[module.main_func] = true;
+  while (!work.empty()) {
+    Function& func = module.functions[work.back()];
+    work.pop_back();
+    for (auto& block : func.blocks) {
+      for (ValueId v : block.instrs) {
+        Instr& instr = func.instrs[v];
+        if ((instr.op == IR_CALL) && !reached[instr.imm.u]) {
+          reached[instr.imm.u] = true;
+          work.push_back(instr.imm.u);
+        }
+      }
+    }
+  }
+
+  if (std::find(reached.begin(), reached.end(), false) == reached.end()) {
+    return;
+  }
+  std::vector<uint32_t> renumber(num_funcs, 0);
+  std::vector<Function> kept;
+  for (uint32_t f = 0; f < num_funcs; f++) {
+    Function& func = module.functions[f];
+    if (!reached[f]) {
+      // Builtins go with their last caller, silently
+      if (!func.external) {
+        procs.push_back({func.line, func.name});
+        num_functions++;
+      }
+      continue;
+    }
+    renumber[f] = static_cast<uint32_t>(kept.size());
+    kept.push_back(std::move(func));
+  }
+  module.functions.swap(kept);
+  module.main_func = renumber[module.main_func];
+  for (auto& func : module.functions) {
+    for (auto& instr : func.instrs) {
+      if (instr.op == IR_CALL) instr.imm.u = renumber[instr.imm.u];
+    }
+  }
+}
+
+// A global is dead if no procedure loads it or reads through its address
+void DeadCode::findDeadGlobals() {
+  dead_globals.assign(module.globals.size(), true);
+  for (auto& func : module.functions) {
+    std::vector<bool> reads = findReads(func);
+    for (auto& block : func.blocks) {
+      for (ValueId v : block.instrs) {
+        Instr& instr = func.instrs[v];
+        if ((instr.op == IR_GLOAD) || ((instr.op == IR_GADDR) && reads[v])) {
+          dead_globals[instr.imm.u] = false;
+        }
+      }
+    }
+  }
+}
+
+// Drop the dead globals, whose stores are gone, and renumber the rest
+void DeadCode::removeGlobals() {
+  size_t num = module.globals.size();
+  std::vector<uint32_t> renumber(num, 0);
+  std::vector<Global> kept;
+  for (uint32_t g = 0; g < num; g++) {
+    if (dead_globals[g]) {
+      vars.push_back({module.globals[g].line, module.globals[g].name});
+      num_globals++;
+      continue;
+    }
+    renumber[g] = static_cast<uint32_t>(kept.size());
+    kept.push_back(module.globals[g]);
+  }
+  if (kept.size() == num) return;
+  module.globals.swap(kept);
+  for (auto& func : module.functions) {
+    for (auto& instr : func.instrs) {
+      if ((instr.op == IR_GLOAD) || (instr.op == IR_GSTORE)
+          || (instr.op == IR_GADDR)) {
+        instr.imm.u = renumber[instr.imm.u];
+      }
+    }
+  }
+}
+
+void DeadCode::runFunction(Function& func) {
+  std::vector<bool> dead_slots(func.slots.size(), true);
+  std::vector<bool> reads = findReads(func);
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      if ((instr.op == IR_SLOT) && reads[v]) dead_slots[instr.imm.u] = false;
+    }
+  }
+  size_t before = num_instrs;
+  removeDeadWrites(func, dead_slots);
+  removeDeadInstrs(func);
+
+  // Whatever still names a dead slot was removed with the writes to it
+  bool changed = (num_instrs > before);
+  for (uint32_t s = static_cast<uint32_t>(func.slots.size()); s-- > 0;) {
+    if (!dead_slots[s]) continue;
+    Slot& slot = func.slots[s];
+    if (!func.is_main) {
+      vars.push_back({slot.line, func.name + "." + slot.name});
+    } else {
+      vars.push_back({slot.line, slot.name});
+    }
+    func.removeSlot(s);
+    num_slots++;
+    changed = true;
+  }
+  if (changed) func.compact();
+}
+
+void DeadCode::removeDeadWrites(Function& func,
+    const std::vector<bool>& dead_slots) {
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      bool dead = false;
+      if (instr.op == IR_GSTORE) {
+        dead = dead_globals[instr.imm.u];
+      } else if (isWrite(func, v, 0)) {
+        Instr& dst = func.instrs[func.getOperand(v, 0)];
+        dead = ((dst.op == IR_GADDR) && dead_globals[dst.imm.u])
+            || ((dst.op == IR_SLOT) && dead_slots[dst.imm.u]);
+      }
+      if (dead) {
+        instr.op = IR_NOP;
+        num_instrs++;
+      }
+    }
+  }
+}
+
+// Mark from the instructions that must stay back through their operands;
+// the unmarked ones compute values nothing needs
+void DeadCode::removeDeadInstrs(Function& func) {
+  std::vector<bool> live(func.instrs.size(), false);
+  std::vector<ValueId> work;
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Opcode op = func.instrs[v].op;
+      if ((op != IR_NOP)
+          && (Module::hasSideEffects(op) || mayFail(func, v))) {
+        live[v] = true;
+        work.push_back(v);
+      }
+    }
+  }
+  while (!work.empty()) {
+    ValueId v = work.back();
+    work.pop_back();
+    for (uint32_t n = 0; n < func.instrs[v].num_ops; n++) {
+      ValueId o = func.getOperand(v, n);
+      if (!live[o]) {
+        live[o] = true;
+        work.push_back(o);
+      }
+    }
+  }
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      if (live[v] || (instr.op == IR_NOP)) continue;
+      instr.op = IR_NOP;
+      num_instrs++;
+    }
+  }
+}
+
+// The values read other than as the destination of a write that cannot
+// fail; an array whose addresses are not among them is never read, and the
+// writes to it can all go
+std::vector<bool> DeadCode::findReads(Function& func) {
+  std::vector<bool> reads(func.instrs.size(), false);
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      bool can_go = !mayFail(func, v);
+      for (uint32_t n = 0; n < func.instrs[v].num_ops; n++) {
+        if (!can_go || !isWrite(func, v, n)) {
+          reads[func.getOperand(v, n)] = true;
+        }
+      }
+    }
+  }
+  return reads;
+}
+
+// Whether operand n of v is the array v writes
+bool DeadCode::isWrite(Function& func, const ValueId& v, const uint32_t& n) {
+  switch (func.instrs[v].op) {
+    case IR_ASTORE:
+    case IR_ACOPY:
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      return n == 0;
+    default:
+      return false;
+  }
+}
+
+// Whether v could stop the program: an index not known to be in range, or
+// an integer division by something that could be zero
+bool DeadCode::mayFail(Function& func, const ValueId& v) {
+  Instr& instr = func.instrs[v];
+  switch (instr.op) {
+    case IR_ALOAD:
+    case IR_ASTORE: {
+      if (instr.flags & IR_FLAG_IN_BOUNDS) return false;
+      Instr& idx = func.instrs[func.getOperand(v, 1)];
+      return (idx.op != IR_CONST) || (idx.imm.u >= instr.count);
+    }
+    case IR_DIV: {
+      if (instr.type != IR_INT) return false;
+      Instr& rhs = func.instrs[func.getOperand(v, 1)];
+      return (rhs.op != IR_CONST) || (rhs.imm.i == 0);
+    }
+    case IR_ABIN:
+      return (instr.imm.u == IR_DIV) && (instr.type == IR_INT);
+    default:
+      return false;
+  }
+}
+
+// One warning per item, in source order, each at its declaration's line
+void DeadCode::warnRemoved(const std::string& what, const std::string& why,
+    std::vector<std::pair<uint32_t, std::string>>& items) {
+  std::stable_sort(items.begin(), items.end(),
+      [](const std::pair<uint32_t, std::string>& a,
+          const std::pair<uint32_t, std::string>& b) {
+        return a.first < b.first;
+      });
+  int line = LOG::line_number;
+  for (auto& item : items) {
+    LOG::line_number = static_cast<int>(item.first);
+    LOG(WARN) << what << ' ' << item.second << ' ' << why << ", removed";
+  }
+  LOG::line_number = line;
+}
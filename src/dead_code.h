@@ -0,0 +1,61 @@
+#ifndef DEAD_CODE_H
+#define DEAD_CODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Dead code elimination
+// Procedures the program body cannot reach over the call graph are removed,
+// along with the builtins only they called. An array, global or local, is
+// dead if nothing reads it: its address only ever names the destination of
+// a store or a whole-array operation, and a scalar global is dead if it is
+// never loaded; the writes to dead storage go, and then the storage itself.
+// Last, an instruction is live if it has an effect (a store, a call, a
+// branch or return) or could stop the program with a run-time error (an
+// unchecked index or an integer division), or if a live instruction uses
+// it; the rest are removed. Run first, what it removes was dead in the
+// source, and is reported in warnings; run again at the end, it clears up
+// after inlining and constant propagation.
+////////////////////////////////////////////////////////////////////////////////
+class DeadCode {
+public:
+  DeadCode(Module&, const bool&);
+  void run();
+  size_t getNumFunctions() { return num_functions; }
+  size_t getNumGlobals() { return num_globals; }
+  size_t getNumSlots() { return num_slots; }
+  size_t getNumInstrs() { return num_instrs; }
+
+private:
+  Module& module;
+  bool warn;  // Whether what is removed is reported as a warning
+  std::vector<bool> dead_globals;
+  // Declaration lines and names of the procedures removed, and of the
+  // arrays and globals
+  std::vector<std::pair<uint32_t, std::string>> procs;
+  std::vector<std::pair<uint32_t, std::string>> vars;
+  size_t num_functions;
+  size_t num_globals;
+  size_t num_slots;
+  size_t num_instrs;
+
+  void removeFunctions();
+  void findDeadGlobals();
+  void removeGlobals();
+  void runFunction(Function&);
+  void removeDeadWrites(Function&, const std::vector<bool>&);
+  void removeDeadInstrs(Function&);
+  std::vector<bool> findReads(Function&);
+  bool isWrite(Function&, const ValueId&, const uint32_t&);
+  bool mayFail(Function&, const ValueId&);
+  void warnRemoved(const std::string&, const std::string&,
+      std::vector<std::pair<uint32_t, std::string>>&);
+};
+
+#endif // DEAD_CODE_H
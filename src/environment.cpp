@@ -6,6 +6,9 @@
 
 Environment::Environment() {
 
+  // Handle 0 is reserved for "no symbol"
+  symbols.push_back(nullptr);
+
   // Populate reserved words in global symbol table
   global_symbol_table.insert("program",
     std::shared_ptr<Token>(new Token(TOK_RW_PROG, "program")));
@@ -54,26 +57,26 @@ Environment::Environment() {
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "getbool"));
   builtin_tok->setTypeMark(TYPE_BOOL);
   builtin_tok->setProcedure(true);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // getInteger() : integer value
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT,
       "getinteger"));
   builtin_tok->setTypeMark(TYPE_INT);
   builtin_tok->setProcedure(true);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // getFloat() : float value
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "getfloat"));
   builtin_tok->setTypeMark(TYPE_FLT);
   builtin_tok->setProcedure(true);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // getString() : string value
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "getstring"));
   builtin_tok->setTypeMark(TYPE_STR);
   builtin_tok->setProcedure(true);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // putBool(bool value) : bool
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "putbool"));
@@ -82,7 +85,7 @@ Environment::Environment() {
   param_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "param"));
   param_tok->setTypeMark(TYPE_BOOL);
   builtin_tok->addParam(param_tok);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // putInteger(integer value) : bool
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT,
@@ -92,7 +95,7 @@ Environment::Environment() {
   param_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "param"));
   param_tok->setTypeMark(TYPE_INT);
   builtin_tok->addParam(param_tok);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // putFloat(float value) : bool
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "putfloat"));
@@ -101,7 +104,7 @@ Environment::Environment() {
   param_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "param"));
   param_tok->setTypeMark(TYPE_FLT);
   builtin_tok->addParam(param_tok);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // putString(string value) : bool
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "putstring"));
@@ -110,7 +113,7 @@ Environment::Environment() {
   param_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "param"));
   param_tok->setTypeMark(TYPE_STR);
   builtin_tok->addParam(param_tok);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 
   // sqrt(integer value) : float
   builtin_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "sqrt"));
@@ -119,7 +122,7 @@ Environment::Environment() {
   param_tok = std::shared_ptr<IdToken>(new IdToken(TOK_IDENT, "param"));
   param_tok->setTypeMark(TYPE_INT);
   builtin_tok->addParam(param_tok);
-  global_symbol_table.insert(builtin_tok->getVal(), builtin_tok);
+  insertBuiltin(builtin_tok);
 }
 
 std::shared_ptr<Token> Environment::lookup(const std::string& key,
@@ -154,6 +157,10 @@ bool Environment::insert(const std::string& key,
     LOG(ERROR) << "Cannot overwrite reserved word: " << key;
   }
   if (success) {
+    std::shared_ptr<IdToken> id_tok = std::dynamic_pointer_cast<IdToken>(t);
+    if (id_tok && (id_tok->getId() == NO_SYMBOL)) {
+      addSymbol(id_tok, is_global);
+    }
     LOG(DEBUG) << "Added " << t->getStr()
         << " to symbol table with key " << key;
   } else {
@@ -199,3 +206,23 @@ std::string Environment::getLocalStr() {
 std::string Environment::getGlobalStr() {
   return global_symbol_table.getStr();
 }
+
+std::shared_ptr<IdToken> Environment::getSymbol(const SymbolId& id) {
+  if (id >= symbols.size()) {
+    LOG(ERROR) << "Invalid symbol handle: " << id;
+    return nullptr;
+  }
+  return symbols[id];
+}
+
+void Environment::addSymbol(std::shared_ptr<IdToken> id_tok,
+    const bool& is_global) {
+  id_tok->setId(static_cast<SymbolId>(symbols.size()));
+  id_tok->setGlobal(is_global);
+  symbols.push_back(id_tok);
+}
+
+void Environment::insertBuiltin(std::shared_ptr<IdToken> id_tok) {
+  global_symbol_table.insert(id_tok->getVal(), id_tok);
+  addSymbol(id_tok, true);
+}
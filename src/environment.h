@@ -4,6 +4,7 @@
 #include <memory>
 #include <stack>
 #include <string>
+#include <vector>
 
 #include "token.h"
 #include "symbol_table.h"
@@ -19,10 +20,18 @@ public:
   void pop();
   std::string getLocalStr();
   std::string getGlobalStr();
+  std::shared_ptr<IdToken> getSymbol(const SymbolId&);
+  size_t getNumSymbols() { return symbols.size() - 1; }
 
 private:
   SymbolTable global_symbol_table;
   std::stack<SymbolTable> local_symbol_table_stack;
+
+  // Every declared identifier by handle; symbols outlive their scope so the
+  // syntax tree can refer to locals after their table is popped
+  std::vector<std::shared_ptr<IdToken>> symbols;
+  void addSymbol(std::shared_ptr<IdToken>, const bool&);
+  void insertBuiltin(std::shared_ptr<IdToken>);
 };
 
 #endif // ENVIRONMENT_H
@@ -0,0 +1,160 @@
+#include "escape_analysis.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+EscapeAnalysis::EscapeAnalysis(Module& m) :
+    module(m),
+    num_params(0),
+    num_by_ref(0),
+    num_bytes(0) {}
+
+void EscapeAnalysis::run() {
+  findGlobalWrites();
+  for (uint32_t f = 0; f < module.functions.size(); f++) {
+    if (module.functions[f].external || module.functions[f].is_main) continue;
+    runFunction(f);
+  }
+  LOG(INFO) << "Escape analysis: " << num_by_ref << " of " << num_params
+      << " array parameters passed by reference, " << num_bytes
+      << " bytes of copies per call removed";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// The global arrays each function writes, itself or through its calls; a
+// write through any other pointer could be to any of them
+void EscapeAnalysis::findGlobalWrites() {
+  size_t num_funcs = module.functions.size();
+  size_t num_globals = module.globals.size();
+  writes.assign(num_funcs, std::vector<bool>(num_globals, false));
+  std::vector<std::vector<uint32_t>> callees(num_funcs);
+  for (uint32_t f = 0; f < num_funcs; f++) {
+    Function& func = module.functions[f];
+    if (func.external) continue;
+    for (auto& block : func.blocks) {
+      for (ValueId v : block.instrs) {
+        Instr& instr = func.instrs[v];
+        switch (instr.op) {
+          case IR_ASTORE:
+          case IR_ACOPY:
+          case IR_ABIN:
+          case IR_AUN:
+          case IR_ACONV: {
+            Instr& dst = func.instrs[func.getOperand(v, 0)];
+            if (dst.op == IR_GADDR) {
+              writes[f][dst.imm.u] = true;
+            } else if (dst.op != IR_SLOT) {
+              writes[f].assign(num_globals, true);
+            }
+            break;
+          }
+          case IR_CALL:
+            // Builtins only do I/O
+            if (!module.functions[instr.imm.u].external) {
+              callees[f].push_back(instr.imm.u);
+            }
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t f = 0; f < num_funcs; f++) {
+      for (uint32_t c : callees[f]) {
+        for (uint32_t g = 0; g < num_globals; g++) {
+          if (writes[c][g] && !writes[f][g]) {
+            writes[f][g] = true;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+}
+
+void EscapeAnalysis::runFunction(const uint32_t& f) {
+  Function& func = module.functions[f];
+  bool changed = false;
+  for (ValueId v : func.blocks[0].instrs) {
+    Instr& copy = func.instrs[v];
+    if ((copy.op != IR_ACOPY)
+        || (func.instrs[func.getOperand(v, 1)].op != IR_PARAM)) {
+      continue;
+    }
+    num_params++;
+    ValueId param = func.getOperand(v, 1);
+    uint32_t slot = func.instrs[func.getOperand(v, 0)].imm.u;
+    if (mayBeWritten(f, func.params[func.instrs[param].imm.u])
+        || !isReadOnly(func, slot, v)) {
+      continue;
+    }
+
+    for (ValueId s = 0; s < func.instrs.size(); s++) {
+      Instr& instr = func.instrs[s];
+      if ((instr.op == IR_SLOT) && (instr.imm.u == slot)) {
+        func.replaceAllUses(s, param);
+        instr.op = IR_NOP;
+      }
+    }
+    num_bytes += copy.count * getElemSize(copy.type);
+    copy.op = IR_NOP;
+    func.removeSlot(slot);
+    num_by_ref++;
+    changed = true;
+  }
+  if (changed) func.compact();
+}
+
+// Whether the slot, besides being filled by the copy, is only read: loaded
+// from, read by whole-array operations, or passed to calls
+bool EscapeAnalysis::isReadOnly(Function& func, const uint32_t& slot,
+    const ValueId& copy) {
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func.instrs[v];
+      if ((v == copy) || (instr.op == IR_NOP)) continue;
+      for (uint32_t n = 0; n < instr.num_ops; n++) {
+        Instr& op = func.instrs[func.getOperand(v, n)];
+        if ((op.op != IR_SLOT) || (op.imm.u != slot)) continue;
+        switch (instr.op) {
+          case IR_ALOAD:
+          case IR_CALL:
+            break;
+          case IR_ACOPY:
+          case IR_ABIN:
+          case IR_AUN:
+          case IR_ACONV:
+            if (n == 0) return false;
+            break;
+          default:
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Whether function f could change an array passed as the parameter while it
+// runs: arrays only match parameters of the same type and length
+bool EscapeAnalysis::mayBeWritten(const uint32_t& f, const Param& param) {
+  for (uint32_t g = 0; g < module.globals.size(); g++) {
+    Global& global = module.globals[g];
+    if (writes[f][g] && (global.type == param.type)
+        && (global.count == param.count)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,44 @@
+#ifndef ESCAPE_ANALYSIS_H
+#define ESCAPE_ANALYSIS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Array parameter escape analysis
+// Arrays are passed by value: the caller passes the address of its array and
+// the callee copies it into a slot of its frame on entry. When nothing in
+// the callee writes the copy or lets its address out where it could be
+// written (it is only loaded from, read by whole-array operations, or
+// passed on to further calls, which make their own copies or follow the
+// same rule), the callee can read the caller's array in place instead. That
+// is only safe if the caller's array cannot change while the callee runs,
+// and the one way it could is through a global, so the callee and
+// everything it calls must write no global array of the parameter's type
+// and length. The copy and its slot are then removed.
+////////////////////////////////////////////////////////////////////////////////
+class EscapeAnalysis {
+public:
+  EscapeAnalysis(Module&);
+  void run();
+  size_t getNumParams() { return num_params; }
+  size_t getNumByRef() { return num_by_ref; }
+  size_t getNumBytes() { return num_bytes; }
+
+private:
+  Module& module;
+  std::vector<std::vector<bool>> writes;  // Function -> global arrays written
+  size_t num_params;
+  size_t num_by_ref;
+  size_t num_bytes;  // Per call, summed over the parameters passed by reference
+
+  void findGlobalWrites();
+  void runFunction(const uint32_t&);
+  bool isReadOnly(Function&, const uint32_t&, const ValueId&);
+  bool mayBeWritten(const uint32_t&, const Param&);
+};
+
+#endif // ESCAPE_ANALYSIS_H
@@ -0,0 +1,228 @@
+#include "gvn.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+Gvn::Gvn(Module& m) :
+    module(m),
+    func(nullptr),
+    next_version(0),
+    num_arith(0),
+    num_loads(0),
+    num_phis(0) {}
+
+void Gvn::run() {
+  for (auto& f : module.functions) {
+    if (f.external) continue;
+    func = &f;
+    runFunction();
+  }
+  LOG(INFO) << "Value numbering: " << num_arith << " computations, "
+      << num_loads << " loads, " << num_phis << " phis removed";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Blocks are in reverse postorder, so a block's immediate dominator and every
+// definition it uses outside loops come first
+void Gvn::runFunction() {
+  idoms = func->findIdoms();
+  table.clear();
+  repl.assign(func->instrs.size(), NO_VALUE);
+  size_t num_locations = module.globals.size() + func->slots.size()
+      + func->params.size();
+  std::vector<std::vector<uint32_t>> exits(func->blocks.size());
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    Block& block = func->blocks[b];
+    if ((block.preds.size() == 1) && (block.preds[0] == idoms[b])) {
+      versions = exits[idoms[b]];
+    } else {
+      versions.resize(num_locations);
+      for (uint32_t& version : versions) version = next_version++;
+    }
+    for (ValueId v : block.instrs) visit(v);
+    exits[b] = versions;
+  }
+
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        func->setOperand(v, i, resolve(func->getOperand(v, i)));
+      }
+    }
+  }
+  func->compact();
+}
+
+void Gvn::visit(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  if (instr.op != IR_PHI) {
+    for (uint32_t i = 0; i < instr.num_ops; i++) {
+      func->setOperand(v, i, resolve(func->getOperand(v, i)));
+    }
+  }
+
+  std::vector<uint32_t> key;
+  size_t* count = &num_arith;
+  switch (instr.op) {
+    case IR_GLOAD:
+      key = getLoadKey(instr.type, instr.imm.u, NO_VALUE, NO_VALUE, 0);
+      count = &num_loads;
+      break;
+    case IR_ALOAD:
+      key = getLoadKey(instr.type, getLocation(func->getOperand(v, 0)),
+          func->getOperand(v, 0), func->getOperand(v, 1), instr.count);
+      count = &num_loads;
+      break;
+    case IR_PHI:
+      key = getKey(v);
+      key.push_back(instr.block);
+      count = &num_phis;
+      break;
+    case IR_GSTORE:
+      clobber(instr.imm.u);
+      table[getLoadKey(func->instrs[func->getOperand(v, 0)].type,
+          instr.imm.u, NO_VALUE, NO_VALUE, 0)].push_back(
+          func->getOperand(v, 0));
+      return;
+    case IR_ASTORE: {
+      uint32_t loc = getLocation(func->getOperand(v, 0));
+      clobber(loc);
+      table[getLoadKey(instr.type, loc, func->getOperand(v, 0),
+          func->getOperand(v, 1), instr.count)].push_back(
+          func->getOperand(v, 2));
+      return;
+    }
+    case IR_ACOPY:
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      clobber(getLocation(func->getOperand(v, 0)));
+      return;
+    case IR_CALL:
+      // Builtins only do I/O
+      if (!module.functions[instr.imm.u].external) clobberGlobals();
+      return;
+    case IR_NOP:
+    case IR_BR:
+    case IR_CBR:
+    case IR_RET:
+      return;
+    default:
+      key = getKey(v);
+      break;
+  }
+
+  ValueId same = find(key, instr.block);
+  if (same == NO_VALUE) {
+    table[key].push_back(v);
+    return;
+  }
+  repl[v] = same;
+  instr.op = IR_NOP;
+  (*count)++;
+}
+
+// The latest value under key whose block dominates b
+ValueId Gvn::find(const std::vector<uint32_t>& key, const BlockId& b) {
+  auto it = table.find(key);
+  if (it == table.end()) return NO_VALUE;
+  for (auto v = it->second.rbegin(); v != it->second.rend(); v++) {
+    BlockId x = b;
+    BlockId d = func->instrs[*v].block;
+    while ((x != d) && (x != 0)) x = idoms[x];
+    if (x == d) return *v;
+  }
+  return NO_VALUE;
+}
+
+// Everything the result of a scalar instruction depends on; operands of
+// commutative operations in a fixed order
+std::vector<uint32_t> Gvn::getKey(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  std::vector<uint32_t> key = {instr.op, instr.type, instr.src_type,
+      instr.flags, instr.count, instr.imm.u};
+  for (uint32_t i = 0; i < instr.num_ops; i++) {
+    key.push_back(func->getOperand(v, i));
+  }
+  switch (instr.op) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_EQ:
+    case IR_NE:
+      std::sort(key.end() - 2, key.end());
+      break;
+    default:
+      break;
+  }
+  return key;
+}
+
+// A load of location loc as it is now; scalar globals have no pointer or
+// index
+std::vector<uint32_t> Gvn::getLoadKey(const IrType& type, const uint32_t& loc,
+    const ValueId& ptr, const ValueId& idx, const uint32_t& count) {
+  uint32_t version = (loc < versions.size()) ? versions[loc] : next_version++;
+  return {IR_ALOAD, type, loc, ptr, idx, count, version};
+}
+
+// Locations are the globals, then this function's slots, then its
+// parameters; an array pointer from anywhere else is none of them
+uint32_t Gvn::getLocation(const ValueId& ptr) {
+  Instr& instr = func->instrs[ptr];
+  uint32_t num_globals = static_cast<uint32_t>(module.globals.size());
+  uint32_t num_slots = static_cast<uint32_t>(func->slots.size());
+  switch (instr.op) {
+    case IR_GADDR:
+      return instr.imm.u;
+    case IR_SLOT:
+      return num_globals + instr.imm.u;
+    case IR_PARAM:
+      return num_globals + num_slots + instr.imm.u;
+    default:
+      return static_cast<uint32_t>(versions.size());
+  }
+}
+
+// A write to loc; array parameters are treated as if they could be any
+// global array and the other way round
+void Gvn::clobber(const uint32_t& loc) {
+  uint32_t num_globals = static_cast<uint32_t>(module.globals.size());
+  uint32_t num_slots = static_cast<uint32_t>(func->slots.size());
+  if (loc >= versions.size()) {
+    for (uint32_t& version : versions) version = next_version++;
+    return;
+  }
+  versions[loc] = next_version++;
+  bool is_param = (loc >= num_globals + num_slots);
+  if (!is_param && ((loc >= num_globals) || (module.globals[loc].count == 0))) {
+    return;
+  }
+  for (uint32_t l = num_globals + num_slots; l < versions.size(); l++) {
+    versions[l] = next_version++;
+  }
+  if (!is_param) return;
+  for (uint32_t g = 0; g < num_globals; g++) {
+    if (module.globals[g].count > 0) versions[g] = next_version++;
+  }
+}
+
+// A procedure can write any global, and so any array passed to the caller
+void Gvn::clobberGlobals() {
+  uint32_t num_globals = static_cast<uint32_t>(module.globals.size());
+  uint32_t num_slots = static_cast<uint32_t>(func->slots.size());
+  for (uint32_t g = 0; g < num_globals; g++) versions[g] = next_version++;
+  for (uint32_t l = num_globals + num_slots; l < versions.size(); l++) {
+    versions[l] = next_version++;
+  }
+}
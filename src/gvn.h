@@ -0,0 +1,56 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Global value numbering over the dominator tree
+// Two instructions with the same opcode, types and operands compute the same
+// value, so the later one is replaced by the earlier when the earlier's block
+// dominates it. Loads are also keyed by the version of what they read: every
+// store, whole-array operation or call that can write a location gives it a
+// new version, and so does entering a block that can be reached from more
+// than its immediate dominator. A store makes its value available to the
+// loads after it.
+////////////////////////////////////////////////////////////////////////////////
+class Gvn {
+public:
+  Gvn(Module&);
+  void run();
+  size_t getNumArith() { return num_arith; }
+  size_t getNumLoads() { return num_loads; }
+  size_t getNumPhis() { return num_phis; }
+
+private:
+  Module& module;
+  Function* func;
+  std::vector<BlockId> idoms;
+  std::map<std::vector<uint32_t>, std::vector<ValueId>> table;
+  std::vector<ValueId> repl;  // ValueId -> value it was replaced by
+  std::vector<uint32_t> versions;  // Location -> current version
+  uint32_t next_version;
+  size_t num_arith;
+  size_t num_loads;
+  size_t num_phis;
+
+  void runFunction();
+  void visit(const ValueId&);
+  ValueId find(const std::vector<uint32_t>&, const BlockId&);
+  std::vector<uint32_t> getKey(const ValueId&);
+  std::vector<uint32_t> getLoadKey(const IrType&, const uint32_t&,
+      const ValueId&, const ValueId&, const uint32_t&);
+  uint32_t getLocation(const ValueId&);
+  void clobber(const uint32_t&);
+  void clobberGlobals();
+  ValueId resolve(ValueId v) {
+    while (repl[v] != NO_VALUE) v = repl[v];
+    return v;
+  }
+};
+
+#endif // GVN_H
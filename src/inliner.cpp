@@ -0,0 +1,323 @@
+#include "inliner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+namespace {
+
+// Instructions a call costs the caller beyond its arguments: the call
+// itself, saving and restoring around it, and the callee's return
+const size_t CALL_COST = 4;
+// Largest net cost inlined at a call outside any loop
+const size_t INLINE_THRESHOLD = 8;
+// How much more a call in a loop is worth inlining
+const size_t LOOP_WEIGHT = 8;
+// No caller grows past this many instructions by inlining
+const size_t MAX_CALLER_SIZE = 2000;
+// Inlining adds at most this percentage to the program, or MIN_BUDGET
+// instructions for small programs
+const size_t MAX_GROWTH = 50;
+const size_t MIN_BUDGET = 400;
+
+}  // namespace
+
+Inliner::Inliner(Module& m) :
+    module(m),
+    budget(0),
+    num_calls(0),
+    num_recursive(0),
+    num_inlined(0),
+    num_added(0) {}
+
+void Inliner::run() {
+  size_t total = 0;
+  for (auto& f : module.functions) total += getSize(f);
+  budget = std::max(MIN_BUDGET, total * MAX_GROWTH / 100);
+  findRecursive();
+  LOG(INFO) << "Inlining: " << num_inlined << " of " << num_calls
+      << " calls inlined (" << num_recursive << " recursive), "
+      << num_added << " instructions added";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Tarjan's strongly connected components of the call graph. A component is
+// finished only after every component it calls, so each procedure's calls
+// are inlined as soon as its component is found.
+void Inliner::findRecursive() {
+  size_t num_funcs = module.functions.size();
+  recursive.assign(num_funcs, false);
+  std::vector<uint32_t> index(num_funcs, UINT32_MAX);
+  std::vector<uint32_t> low(num_funcs, 0);
+  std::vector<bool> on_stack(num_funcs, false);
+  std::vector<uint32_t> stack;
+  uint32_t next = 0;
+  std::function<void(uint32_t)> visit = [&](uint32_t f) {
+    index[f] = low[f] = next++;
+    stack.push_back(f);
+    on_stack[f] = true;
+    Function& func = module.functions[f];
+    for (auto& block : func.blocks) {
+      for (ValueId v : block.instrs) {
+        if (func.instrs[v].op != IR_CALL) continue;
+        uint32_t g = func.instrs[v].imm.u;
+        if (g == f) recursive[f] = true;
+        if (index[g] == UINT32_MAX) {
+          visit(g);
+          low[f] = std::min(low[f], low[g]);
+        } else if (on_stack[g]) {
+          low[f] = std::min(low[f], index[g]);
+        }
+      }
+    }
+    if (low[f] != index[f]) return;
+    std::vector<uint32_t> component;
+    uint32_t g;
+    do {
+      g = stack.back();
+      stack.pop_back();
+      on_stack[g] = false;
+      component.push_back(g);
+    } while (g != f);
+    if (component.size() > 1) {
+      for (uint32_t c : component) recursive[c] = true;
+    }
+    for (uint32_t c : component) inlineCalls(c);
+  };
+  for (uint32_t f = 0; f < num_funcs; f++) {
+    if (index[f] == UINT32_MAX) visit(f);
+  }
+}
+
+// Inline one call at a time, looking again after each, since the copied
+// blocks can hold calls of their own
+void Inliner::inlineCalls(const uint32_t& f) {
+  Function& func = module.functions[f];
+  if (func.external) return;
+  std::set<ValueId> seen;
+  bool inlined = false;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    findLoops(func);
+    for (BlockId b = 0; (b < func.blocks.size()) && !changed; b++) {
+      for (ValueId v : func.blocks[b].instrs) {
+        Instr& instr = func.instrs[v];
+        if ((instr.op != IR_CALL) || seen.count(v)) continue;
+        seen.insert(v);
+        Function& callee = module.functions[instr.imm.u];
+        if (callee.external) continue;
+        num_calls++;
+        if (recursive[instr.imm.u]) {
+          num_recursive++;
+          continue;
+        }
+        if (!shouldInline(func, v)) continue;
+        inlineCall(func, v);
+        inlined = true;
+        changed = true;
+        break;
+      }
+    }
+  }
+  if (!inlined) return;
+  func.mergeBlocks();
+  func.compact();
+}
+
+// Blocks inside a natural loop: those that reach a back edge's source
+// without passing its target
+void Inliner::findLoops(Function& func) {
+  in_loop.assign(func.blocks.size(), false);
+  std::vector<BlockId> idoms = func.findIdoms();
+  std::vector<bool> reached(func.blocks.size(), false);
+  std::vector<BlockId> work(1, 0);
+  reached[0] = true;
+  while (!work.empty()) {
+    BlockId b = work.back();
+    work.pop_back();
+    for (BlockId s : func.blocks[b].succs) {
+      if (!reached[s]) {
+        reached[s] = true;
+        work.push_back(s);
+      }
+    }
+  }
+  for (BlockId t = 0; t < func.blocks.size(); t++) {
+    if (!reached[t]) continue;
+    for (BlockId h : func.blocks[t].succs) {
+      BlockId x = t;
+      while ((x != h) && (x != 0)) x = idoms[x];
+      if (x != h) continue;
+      std::vector<bool> body(func.blocks.size(), false);
+      body[h] = true;
+      in_loop[h] = true;
+      std::vector<BlockId> stack(1, t);
+      while (!stack.empty()) {
+        BlockId b = stack.back();
+        stack.pop_back();
+        if (body[b]) continue;
+        body[b] = true;
+        in_loop[b] = true;
+        for (BlockId p : func.blocks[b].preds) stack.push_back(p);
+      }
+    }
+  }
+}
+
+bool Inliner::shouldInline(Function& func, const ValueId& call) {
+  Instr& instr = func.instrs[call];
+  Function& callee = module.functions[instr.imm.u];
+
+  // Declared arrays are cleared on entry to the callee, which has no
+  // equivalent in the middle of the caller
+  for (auto& slot : callee.slots) {
+    if (slot.zeroed) return false;
+  }
+  if (!callee.blocks[0].preds.empty()) return false;
+
+  size_t size = getSize(callee);
+  size_t saved = CALL_COST + instr.num_ops;
+  size_t cost = (size > saved) ? size - saved : 0;
+  size_t weight = in_loop[instr.block] ? LOOP_WEIGHT : 1;
+  return (cost <= INLINE_THRESHOLD * weight) && (size <= budget)
+      && (getSize(func) + size <= MAX_CALLER_SIZE);
+}
+
+void Inliner::inlineCall(Function& func, const ValueId& call) {
+  Function& callee = module.functions[func.instrs[call].imm.u];
+  size_t size = getSize(callee);
+  budget -= size;
+  num_added += size;
+  num_inlined++;
+
+  // The rest of the call's block moves to a new block the returns go to
+  BlockId b = func.instrs[call].block;
+  BlockId rest = func.addBlock();
+  {
+    std::vector<ValueId>& instrs = func.blocks[b].instrs;
+    auto pos = std::find(instrs.begin(), instrs.end(), call);
+    for (auto it = pos + 1; it != instrs.end(); it++) func.append(rest, *it);
+    instrs.erase(pos, instrs.end());
+  }
+  func.blocks[rest].succs.swap(func.blocks[b].succs);
+  for (BlockId s : func.blocks[rest].succs) {
+    std::replace(func.blocks[s].preds.begin(), func.blocks[s].preds.end(), b,
+        rest);
+  }
+
+  // Copy the blocks and instructions; operands are filled in once every
+  // value has its copy, since phis can refer forward
+  uint32_t slot_base = static_cast<uint32_t>(func.slots.size());
+  for (auto& slot : callee.slots) {
+    func.slots.push_back({callee.name + "." + slot.name, slot.type, slot.count,
+        slot.zeroed, slot.line});
+  }
+  BlockId block_base = static_cast<BlockId>(func.blocks.size());
+  for (BlockId cb = 0; cb < callee.blocks.size(); cb++) func.addBlock();
+  std::vector<ValueId>& entry = func.blocks[0].instrs;
+  size_t num_phis = 0;
+  while ((num_phis < entry.size())
+      && (func.instrs[entry[num_phis]].op == IR_PHI)) {
+    num_phis++;
+  }
+  std::vector<ValueId> values(callee.instrs.size(), NO_VALUE);
+  std::vector<BlockId> returns;
+  std::vector<ValueId> results;
+  for (BlockId cb = 0; cb < callee.blocks.size(); cb++) {
+    for (ValueId cv : callee.blocks[cb].instrs) {
+      Instr instr = callee.instrs[cv];
+      if (instr.op == IR_PARAM) {
+        values[cv] = func.getOperand(call, instr.imm.u);
+        continue;
+      }
+      if (instr.op == IR_RET) {
+        returns.push_back(block_base + cb);
+        if (instr.num_ops > 0) results.push_back(callee.getOperand(cv, 0));
+        instr.op = IR_BR;
+        instr.num_ops = 0;
+      }
+      if (instr.op == IR_SLOT) instr.imm.u += slot_base;
+      ValueId v = func.addInstr(instr.op, instr.type,
+          std::vector<ValueId>(instr.num_ops, NO_VALUE));
+      Instr& copy = func.instrs[v];
+      copy.src_type = instr.src_type;
+      copy.flags = instr.flags;
+      copy.count = instr.count;
+      copy.imm = instr.imm;
+      values[cv] = v;
+
+      // Constants and addresses stay with the caller's, in its entry block
+      if ((instr.op == IR_CONST) || (instr.op == IR_GADDR)) {
+        entry.insert(entry.begin() + num_phis++, v);
+        copy.block = 0;
+      } else {
+        func.append(block_base + cb, v);
+      }
+    }
+  }
+  for (BlockId cb = 0; cb < callee.blocks.size(); cb++) {
+    for (ValueId cv : callee.blocks[cb].instrs) {
+      Instr& instr = callee.instrs[cv];
+      if ((instr.op == IR_PARAM) || (instr.op == IR_RET)) continue;
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        func.setOperand(values[cv], i, values[callee.getOperand(cv, i)]);
+      }
+    }
+    Block& copy = func.blocks[block_base + cb];
+    for (BlockId p : callee.blocks[cb].preds) {
+      copy.preds.push_back(block_base + p);
+    }
+    for (BlockId s : callee.blocks[cb].succs) {
+      copy.succs.push_back(block_base + s);
+    }
+  }
+
+  func.append(b, func.addInstr(IR_BR, IR_VOID));
+  func.addEdge(b, block_base);
+  for (BlockId r : returns) func.addEdge(r, rest);
+  if (results.empty()) {
+    func.instrs[call].op = IR_NOP;
+    return;
+  }
+  ValueId result = values[results[0]];
+  if (results.size() > 1) {
+    std::vector<ValueId> ops;
+    for (ValueId r : results) ops.push_back(values[r]);
+    result = func.addInstr(IR_PHI, callee.ret_type, ops);
+    func.blocks[rest].instrs.insert(func.blocks[rest].instrs.begin(), result);
+    func.instrs[result].block = rest;
+  }
+  func.replaceAllUses(call, result);
+  func.instrs[call].op = IR_NOP;
+}
+
+// Instructions that cost something when run; constants and addresses are
+// set up once on entry
+size_t Inliner::getSize(Function& func) {
+  if (func.external) return 0;
+  size_t size = 0;
+  for (auto& block : func.blocks) {
+    for (ValueId v : block.instrs) {
+      switch (func.instrs[v].op) {
+        case IR_NOP:
+        case IR_CONST:
+        case IR_PARAM:
+        case IR_GADDR:
+        case IR_SLOT:
+          break;
+        default:
+          size++;
+      }
+    }
+  }
+  return size;
+}
@@ -0,0 +1,47 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Procedure inlining
+// Procedures are visited callees first, so a procedure's own calls have been
+// inlined before it is weighed for inlining elsewhere. A procedure that can
+// reach itself through the call graph is never inlined. At each call the
+// cost, the callee's size less what the call itself takes, is weighed
+// against the benefit, which is larger for a call inside a loop; a caller
+// stops growing at a fixed size, and the program as a whole by a fixed
+// fraction. The callee's blocks are copied in place of the call, its
+// parameters become the arguments, and its returns jump to the rest of the
+// caller's block, where a phi collects the result.
+////////////////////////////////////////////////////////////////////////////////
+class Inliner {
+public:
+  Inliner(Module&);
+  void run();
+  size_t getNumInlined() { return num_inlined; }
+  size_t getNumCalls() { return num_calls; }
+
+private:
+  Module& module;
+  std::vector<bool> recursive;  // Function -> can call itself
+  std::vector<bool> in_loop;  // BlockId -> in a loop of the caller
+  size_t budget;  // Instructions inlining may still add to the program
+  size_t num_calls;
+  size_t num_recursive;
+  size_t num_inlined;
+  size_t num_added;
+
+  void findRecursive();
+  void inlineCalls(const uint32_t&);
+  void findLoops(Function&);
+  bool shouldInline(Function&, const ValueId&);
+  void inlineCall(Function&, const ValueId&);
+  static size_t getSize(Function&);
+};
+
+#endif // INLINER_H
@@ -0,0 +1,585 @@
+#include "interpreter.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "log.h"
+#include "token.h"
+
+Interpreter::Interpreter(Ast& a, std::shared_ptr<Environment> e) :
+    ast(a),
+    env(e),
+    frame(nullptr),
+    top(nullptr),
+    ret_type(TYPE_NONE),
+    depth(0),
+    num_evaluated(0) {
+  ret_val.i = 0;
+}
+
+bool Interpreter::run() {
+  LOG(INFO) << "Begin interpreting";
+  resolveTypes();
+
+  // Storage for every variable, and the procedures that can be called
+  static const std::string builtin_names[] = {"getbool", "getinteger",
+    "getfloat", "getstring", "putbool", "putinteger", "putfloat", "putstring",
+    "sqrt"};
+  size_t num_symbols = env->getNumSymbols() + 1;
+  locations.assign(num_symbols, {false, 0});
+  procedures.assign(num_symbols, {NO_NODE, 0, -1});
+  NodeId root = ast.getRoot();
+  uint32_t main_size = 0;
+  layout(ast.getChild(root, 0), main_size);
+  for (NodeId n = 1; n <= ast.getNumNodes(); n++) {
+    if (ast.getKind(n) != NODE_CALL) continue;
+    Procedure& proc = procedures[ast.getSymbol(n)];
+    if (proc.node != NO_NODE) continue;
+    std::string name = env->getSymbol(ast.getSymbol(n))->getVal();
+    int b = 0;
+    while ((b < NUM_BUILTINS) && (builtin_names[b] != name)) b++;
+    if (b == NUM_BUILTINS) {
+      LOG(ERROR) << "No builtin named " << name;
+      return false;
+    }
+    proc.builtin = b;
+  }
+
+  stack.reset(new Value[STACK_SIZE]);
+  frame = stack.get();
+  top = frame;
+  std::memset(alloc(main_size), 0, main_size * sizeof(Value));
+  auto start = std::chrono::steady_clock::now();
+
+  // A call in the program is several nested calls here, so the tree is walked
+  // on a thread with room for MAX_DEPTH of them
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, NATIVE_STACK_SIZE);
+  bool started = (pthread_create(&thread, &attr, &Interpreter::runBody, this)
+      == 0);
+  pthread_attr_destroy(&attr);
+  if (!started) {
+    LOG(ERROR) << "Cannot start the interpreter thread";
+    return false;
+  }
+  pthread_join(thread, nullptr);
+  rt_flush();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now()
+      - start;
+  LOG(INFO) << "Done interpreting: " << num_evaluated << " nodes in "
+      << secs.count() << " s (" << (num_evaluated / secs.count() / 1e6)
+      << " million/s)";
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void* Interpreter::runBody(void* arg) {
+  Interpreter* interp = static_cast<Interpreter*>(arg);
+  interp->execStatements(interp->ast.getChild(interp->ast.getRoot(), 1));
+  return nullptr;
+}
+
+// Children come before their parents, so one forward scan types every
+// expression
+void Interpreter::resolveTypes() {
+  size_t num_nodes = ast.getNumNodes() + 1;
+  types.assign(num_nodes, TYPE_NONE);
+  counts.assign(num_nodes, 0);
+  literals.assign(num_nodes, 0);
+  std::unordered_map<std::string, rt_str> strings;
+  for (NodeId n = 1; n < num_nodes; n++) {
+    switch (ast.getKind(n)) {
+      case NODE_INT_LIT:
+        types[n] = TYPE_INT;
+        break;
+      case NODE_FLT_LIT:
+        types[n] = TYPE_FLT;
+        break;
+      case NODE_STR_LIT: {
+        // Equal literals share storage, so comparing them is quick
+        std::string s = ast.getString(n);
+        auto it = strings.find(s);
+        if (it == strings.end()) {
+          it = strings.emplace(s, rt_string(s.data(),
+              static_cast<uint32_t>(s.size()))).first;
+        }
+        types[n] = TYPE_STR;
+        literals[n] = it->second;
+        break;
+      }
+      case NODE_BOOL_LIT:
+        types[n] = TYPE_BOOL;
+        break;
+      case NODE_NAME: {
+        std::shared_ptr<IdToken> id_tok = env->getSymbol(ast.getSymbol(n));
+        types[n] = id_tok->getTypeMark();
+        if (ast.getChild(n) == NO_NODE) {
+          counts[n] = static_cast<uint32_t>(id_tok->getNumElements());
+        }
+        break;
+      }
+      case NODE_CALL:
+        types[n] = env->getSymbol(ast.getSymbol(n))->getTypeMark();
+        break;
+      case NODE_BINARY: {
+        NodeId lhs = ast.getChild(n, 0);
+        NodeId rhs = ast.getNext(lhs);
+        BinaryOp op = ast.getOp(n);
+        types[n] = ((op >= OP_LT) && (op <= OP_NE)) ? TYPE_BOOL
+            : getCommonType(types[lhs], types[rhs]);
+        counts[n] = std::max(counts[lhs], counts[rhs]);
+        break;
+      }
+      case NODE_NOT:
+      case NODE_NEGATE:
+        types[n] = types[ast.getChild(n)];
+        counts[n] = counts[ast.getChild(n)];
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Globals get fixed storage; everything else is placed in the frame of the
+// procedure (or program body) declaring it, parameters first
+void Interpreter::layout(const NodeId& decls, uint32_t& frame_size) {
+  for (NodeId n = ast.getChild(decls); n != NO_NODE; n = ast.getNext(n)) {
+    SymbolId sym = ast.getSymbol(n);
+    std::shared_ptr<IdToken> id_tok = env->getSymbol(sym);
+    if (ast.getKind(n) == NODE_VARIABLE) {
+      uint32_t size = std::max(ast.getSize(n), 1u);
+      if (id_tok->getGlobal()) {
+        locations[sym] = {true, static_cast<uint32_t>(globals.size())};
+        globals.resize(globals.size() + size);
+      } else {
+        locations[sym] = {false, frame_size};
+        frame_size += size;
+      }
+    } else if (ast.getKind(n) == NODE_PROCEDURE) {
+      uint32_t size = 0;
+      NodeId params = ast.getChild(n, 0);
+      for (NodeId p = ast.getChild(params); p != NO_NODE; p = ast.getNext(p)) {
+        locations[ast.getSymbol(p)] = {false, size};
+        size += std::max(ast.getSize(p), 1u);
+      }
+      layout(ast.getChild(n, 1), size);
+      procedures[sym] = {n, size, -1};
+    }
+  }
+}
+
+// False once a return statement has run
+bool Interpreter::execStatements(const NodeId& stmts) {
+  for (NodeId n = ast.getChild(stmts); n != NO_NODE; n = ast.getNext(n)) {
+    if (!execStatement(n)) return false;
+  }
+  return true;
+}
+
+bool Interpreter::execStatement(const NodeId& node) {
+  num_evaluated++;
+  switch (ast.getKind(node)) {
+    case NODE_ASSIGN:
+      execAssign(node);
+      return true;
+    case NODE_IF: {
+      NodeId cond = ast.getChild(node, 0);
+      NodeId then_stmts = ast.getNext(cond);
+      NodeId else_stmts = ast.getNext(then_stmts);
+      if (evalConverted(cond, TYPE_BOOL).i) return execStatements(then_stmts);
+      if (else_stmts != NO_NODE) return execStatements(else_stmts);
+      return true;
+    }
+    case NODE_LOOP: {
+      NodeId init = ast.getChild(node, 0);
+      NodeId cond = ast.getNext(init);
+      NodeId body = ast.getNext(cond);
+      execAssign(init);
+      while (evalConverted(cond, TYPE_BOOL).i) {
+        if (!execStatements(body)) return false;
+      }
+      return true;
+    }
+    case NODE_RETURN: {
+      NodeId expr = ast.getChild(node);
+      ret_val = eval(expr);
+      if (ret_type != TYPE_NONE) {
+        ret_val = convert(ret_val, types[expr], ret_type);
+      }
+      return false;
+    }
+    default:
+      LOG(ERROR) << "Unexpected statement: "
+          << Ast::getKindName(ast.getKind(node));
+      return true;
+  }
+}
+
+// The index is evaluated before the value and checked after it, as in the
+// compiled code
+void Interpreter::execAssign(const NodeId& node) {
+  NodeId dest = ast.getChild(node, 0);
+  NodeId expr = ast.getNext(dest);
+  SymbolId sym = ast.getSymbol(dest);
+  std::shared_ptr<IdToken> id_tok = env->getSymbol(sym);
+  TypeMark type = id_tok->getTypeMark();
+  uint32_t count = static_cast<uint32_t>(id_tok->getNumElements());
+  NodeId idx = ast.getChild(dest);
+  Value* saved_top = top;
+  if (idx != NO_NODE) {
+    int32_t i = evalConverted(idx, TYPE_INT).i;
+    Value val = evalConverted(expr, type);
+    if (static_cast<uint32_t>(i) >= count) rt_bounds_error(i, count);
+    getAddr(sym)[i] = val;
+  } else if (count > 0) {
+    evalArrayConverted(expr, type, getAddr(sym));
+  } else {
+    *getAddr(sym) = evalConverted(expr, type);
+  }
+  top = saved_top;
+}
+
+Interpreter::Value Interpreter::eval(const NodeId& node) {
+  num_evaluated++;
+  Value val;
+  switch (ast.getKind(node)) {
+    case NODE_INT_LIT:
+      val.i = ast.getInt(node);
+      return val;
+    case NODE_FLT_LIT:
+      val.f = ast.getFloat(node);
+      return val;
+    case NODE_BOOL_LIT:
+      val.i = ast.getBool(node);
+      return val;
+    case NODE_STR_LIT:
+      val.s = literals[node];
+      return val;
+    case NODE_NAME: {
+      NodeId idx = ast.getChild(node);
+      SymbolId sym = ast.getSymbol(node);
+      if (idx == NO_NODE) return *getAddr(sym);
+      return getAddr(sym)[evalIndex(idx,
+          static_cast<uint32_t>(env->getSymbol(sym)->getNumElements()))];
+    }
+    case NODE_CALL:
+      return call(node);
+    case NODE_BINARY: {
+      NodeId lhs = ast.getChild(node, 0);
+      NodeId rhs = ast.getNext(lhs);
+      TypeMark type = getCommonType(types[lhs], types[rhs]);
+      Value a = evalConverted(lhs, type);
+      Value b = evalConverted(rhs, type);
+      return apply(ast.getOp(node), type, a, b);
+    }
+    case NODE_NOT:
+    case NODE_NEGATE:
+      return applyUnary(ast.getKind(node), types[node],
+          eval(ast.getChild(node)));
+    default:
+      LOG(ERROR) << "Unexpected expression: "
+          << Ast::getKindName(ast.getKind(node));
+      return getZero(TYPE_INT);
+  }
+}
+
+// Whole-array expression into counts[node] values at dst; operands are
+// evaluated in full before any element is written, so dst may be one of them
+void Interpreter::evalArray(const NodeId& node, Value* dst) {
+  num_evaluated++;
+  uint32_t count = counts[node];
+  switch (ast.getKind(node)) {
+    case NODE_NAME:
+      std::memmove(dst, getAddr(ast.getSymbol(node)), count * sizeof(Value));
+      break;
+    case NODE_BINARY: {
+      NodeId lhs = ast.getChild(node, 0);
+      NodeId rhs = ast.getNext(lhs);
+      TypeMark type = getCommonType(types[lhs], types[rhs]);
+      BinaryOp op = ast.getOp(node);
+      Value a = getZero(type);
+      Value b = a;
+      const Value* l = nullptr;
+      const Value* r = nullptr;
+      if (counts[lhs] > 0) {
+        l = getArrayOperand(lhs, type);
+      } else {
+        a = evalConverted(lhs, type);
+      }
+      if (counts[rhs] > 0) {
+        r = getArrayOperand(rhs, type);
+      } else {
+        b = evalConverted(rhs, type);
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        dst[i] = apply(op, type, l ? l[i] : a, r ? r[i] : b);
+      }
+      break;
+    }
+    case NODE_NOT:
+    case NODE_NEGATE: {
+      NodeId operand = ast.getChild(node);
+      const Value* src = getArrayOperand(operand, types[operand]);
+      for (uint32_t i = 0; i < count; i++) {
+        dst[i] = applyUnary(ast.getKind(node), types[node], src[i]);
+      }
+      break;
+    }
+    default:
+      LOG(ERROR) << "Unexpected array expression: "
+          << Ast::getKindName(ast.getKind(node));
+      break;
+  }
+}
+
+void Interpreter::evalArrayConverted(const NodeId& node, const TypeMark& type,
+    Value* dst) {
+  if (types[node] == type) {
+    evalArray(node, dst);
+    return;
+  }
+  Value* tmp = alloc(counts[node]);
+  evalArray(node, tmp);
+  for (uint32_t i = 0; i < counts[node]; i++) {
+    dst[i] = convert(tmp[i], types[node], type);
+  }
+}
+
+// Elements of an array operand as type; a variable of that type is used in
+// place, anything else goes to a temporary
+const Interpreter::Value* Interpreter::getArrayOperand(const NodeId& node,
+    const TypeMark& type) {
+  if ((ast.getKind(node) == NODE_NAME) && (types[node] == type)) {
+    num_evaluated++;
+    return getAddr(ast.getSymbol(node));
+  }
+  Value* tmp = alloc(counts[node]);
+  evalArrayConverted(node, type, tmp);
+  return tmp;
+}
+
+uint32_t Interpreter::evalIndex(const NodeId& node, const uint32_t& count) {
+  int32_t i = evalConverted(node, TYPE_INT).i;
+  if (static_cast<uint32_t>(i) >= count) rt_bounds_error(i, count);
+  return static_cast<uint32_t>(i);
+}
+
+// Arguments are evaluated left to right straight into the callee's frame;
+// array arguments are copies
+Interpreter::Value Interpreter::call(const NodeId& node) {
+  Procedure& proc = procedures[ast.getSymbol(node)];
+  if (proc.builtin >= 0) return callBuiltin(proc.builtin, node);
+  if (depth == MAX_DEPTH) stackOverflow();
+  Value* callee = alloc(proc.frame_size);
+  std::memset(callee, 0, proc.frame_size * sizeof(Value));
+  NodeId params = ast.getChild(proc.node, 0);
+  NodeId arg = ast.getChild(node);
+  for (NodeId p = ast.getChild(params); p != NO_NODE;
+      p = ast.getNext(p), arg = ast.getNext(arg)) {
+    std::shared_ptr<IdToken> param = env->getSymbol(ast.getSymbol(p));
+    Value* dst = callee + locations[ast.getSymbol(p)].offset;
+    if (param->getNumElements() > 0) {
+      evalArrayConverted(arg, param->getTypeMark(), dst);
+    } else {
+      *dst = evalConverted(arg, param->getTypeMark());
+    }
+  }
+
+  Value* saved_frame = frame;
+  TypeMark saved_ret_type = ret_type;
+  frame = callee;
+  ret_type = env->getSymbol(ast.getSymbol(node))->getTypeMark();
+  depth++;
+  Value val = execStatements(ast.getChild(proc.node, 2)) ? getZero(ret_type)
+      : ret_val;
+  depth--;
+  ret_type = saved_ret_type;
+  frame = saved_frame;
+  top = callee;
+  return val;
+}
+
+Interpreter::Value Interpreter::callBuiltin(const int& builtin,
+    const NodeId& node) {
+  static const TypeMark param_types[] = {TYPE_NONE, TYPE_NONE, TYPE_NONE,
+    TYPE_NONE, TYPE_BOOL, TYPE_INT, TYPE_FLT, TYPE_STR, TYPE_INT};
+  Value arg = getZero(TYPE_INT);
+  NodeId arg_node = ast.getChild(node);
+  if (arg_node != NO_NODE) arg = evalConverted(arg_node, param_types[builtin]);
+  Value val;
+  switch (builtin) {
+    case B_GETBOOL:
+      val.i = rt_getbool();
+      break;
+    case B_GETINTEGER:
+      val.i = rt_getinteger();
+      break;
+    case B_GETFLOAT:
+      val.f = rt_getfloat();
+      break;
+    case B_GETSTRING:
+      val.s = rt_getstring();
+      break;
+    case B_PUTBOOL:
+      val.i = rt_putbool(arg.i);
+      break;
+    case B_PUTINTEGER:
+      val.i = rt_putinteger(arg.i);
+      break;
+    case B_PUTFLOAT:
+      val.i = rt_putfloat(arg.f);
+      break;
+    case B_PUTSTRING:
+      val.i = rt_putstring(arg.s);
+      break;
+    default:
+      val.f = rt_sqrt(arg.i);
+      break;
+  }
+  return val;
+}
+
+Interpreter::Value* Interpreter::alloc(const uint32_t& size) {
+  if (size > static_cast<size_t>(stack.get() + STACK_SIZE - top)) {
+    stackOverflow();
+  }
+  Value* p = top;
+  top += size;
+  return p;
+}
+
+// Same rules as the IR builder: bool <-> float goes through int, and out of
+// range floats convert to INT32_MIN
+Interpreter::Value Interpreter::convert(const Value& val, const TypeMark& from,
+    const TypeMark& to) {
+  if (from == to) return val;
+  Value out;
+  if (to == TYPE_FLT) {
+    out.f = static_cast<float>(val.i);
+  } else if (from == TYPE_FLT) {
+    float f = val.f;
+    out.i = (!(f > -2147483904.0f) || !(f < 2147483648.0f)) ? INT32_MIN
+        : static_cast<int32_t>(f);
+    if (to == TYPE_BOOL) out.i = (out.i != 0);
+  } else if (to == TYPE_BOOL) {
+    out.i = (val.i != 0);
+  } else {
+    out = val;
+  }
+  return out;
+}
+
+// Integer arithmetic wraps; division by zero is a runtime error
+Interpreter::Value Interpreter::apply(const BinaryOp& op, const TypeMark& type,
+    const Value& a, const Value& b) {
+  uint32_t ua = static_cast<uint32_t>(a.i);
+  uint32_t ub = static_cast<uint32_t>(b.i);
+  bool is_flt = (type == TYPE_FLT);
+  Value out;
+  switch (op) {
+    case OP_ADD:
+      if (is_flt) out.f = a.f + b.f; else out.i = static_cast<int32_t>(ua + ub);
+      break;
+    case OP_SUB:
+      if (is_flt) out.f = a.f - b.f; else out.i = static_cast<int32_t>(ua - ub);
+      break;
+    case OP_MUL:
+      if (is_flt) out.f = a.f * b.f; else out.i = static_cast<int32_t>(ua * ub);
+      break;
+    case OP_DIV:
+      if (is_flt) {
+        out.f = a.f / b.f;
+      } else if (b.i == 0) {
+        rt_div_error();
+      } else if (b.i == -1) {
+        out.i = static_cast<int32_t>(0u - ua);
+      } else {
+        out.i = a.i / b.i;
+      }
+      break;
+    case OP_AND:
+      out.i = a.i & b.i;
+      break;
+    case OP_OR:
+      out.i = a.i | b.i;
+      break;
+    case OP_LT:
+      out.i = is_flt ? (a.f < b.f) : (a.i < b.i);
+      break;
+    case OP_LE:
+      out.i = is_flt ? (a.f <= b.f) : (a.i <= b.i);
+      break;
+    case OP_GT:
+      out.i = is_flt ? (a.f > b.f) : (a.i > b.i);
+      break;
+    case OP_GE:
+      out.i = is_flt ? (a.f >= b.f) : (a.i >= b.i);
+      break;
+    case OP_EQ:
+    case OP_NE:
+      if (type == TYPE_STR) {
+        out.i = rt_streq(a.s, b.s);
+      } else {
+        out.i = is_flt ? (a.f == b.f) : (a.i == b.i);
+      }
+      if (op == OP_NE) out.i = !out.i;
+      break;
+    default:
+      out.i = 0;
+      break;
+  }
+  return out;
+}
+
+// not is bitwise on int and logical on bool
+Interpreter::Value Interpreter::applyUnary(const NodeKind& kind,
+    const TypeMark& type, const Value& val) {
+  Value out;
+  if (kind == NODE_NOT) {
+    out.i = (type == TYPE_BOOL) ? !val.i : ~val.i;
+  } else if (type == TYPE_FLT) {
+    out.f = -val.f;
+  } else {
+    out.i = static_cast<int32_t>(0u - static_cast<uint32_t>(val.i));
+  }
+  return out;
+}
+
+// Type both operands of a binary operator are converted to
+TypeMark Interpreter::getCommonType(const TypeMark& lhs, const TypeMark& rhs) {
+  if ((lhs == TYPE_STR) || (rhs == TYPE_STR)) return TYPE_STR;
+  if ((lhs == TYPE_FLT) || (rhs == TYPE_FLT)) return TYPE_FLT;
+  if ((lhs == TYPE_INT) || (rhs == TYPE_INT)) return TYPE_INT;
+  return lhs;
+}
+
+// All zero bits, whatever the type: 0, false, 0.0 or the empty string
+Interpreter::Value Interpreter::getZero(const TypeMark&) {
+  Value val;
+  val.s = 0;
+  return val;
+}
+
+void Interpreter::stackOverflow() {
+  rt_flush();
+  std::fprintf(stderr, "Runtime error: stack overflow\n");
+  std::exit(EXIT_FAILURE);
+}
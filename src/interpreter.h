@@ -0,0 +1,114 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "token.h"
+
+extern "C" {
+#include "../runtime/runtime.h"
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tree-walking interpreter
+// Runs a checked syntax tree directly, as a reference for the compiled
+// engines: it shares nothing with them past the parser, so a disagreement
+// points at the IR or a backend. Operand types follow the same rules as the
+// IR builder, worked out once up front from the symbols' TypeMarks and array
+// sizes. Every variable and array element is one Value; globals have fixed
+// storage, and each call gets a zeroed frame on a value stack that also holds
+// the temporaries of whole-array expressions.
+////////////////////////////////////////////////////////////////////////////////
+class Interpreter {
+public:
+  Interpreter(Ast&, std::shared_ptr<Environment>);
+  bool run();
+  uint64_t getNumEvaluated() { return num_evaluated; }
+
+private:
+  enum Builtin {
+    B_GETBOOL = 0,
+    B_GETINTEGER,
+    B_GETFLOAT,
+    B_GETSTRING,
+    B_PUTBOOL,
+    B_PUTINTEGER,
+    B_PUTFLOAT,
+    B_PUTSTRING,
+    B_SQRT,
+    NUM_BUILTINS,
+  };
+
+  union Value {
+    int32_t i;
+    float f;
+    rt_str s;
+  };
+
+  // Storage of a variable: in the globals, or relative to the frame
+  struct Location {
+    bool global;
+    uint32_t offset;
+  };
+
+  struct Procedure {
+    NodeId node;
+    uint32_t frame_size;
+    int builtin;  // Index into the builtins, or -1
+  };
+
+  static const size_t STACK_SIZE = size_t(1) << 24;  // Values
+  static const uint32_t MAX_DEPTH = uint32_t(1) << 20;  // Calls
+  static const size_t NATIVE_STACK_SIZE = size_t(1) << 30;  // Bytes
+
+  Ast& ast;
+  std::shared_ptr<Environment> env;
+  std::vector<TypeMark> types;  // NodeId -> result type
+  std::vector<uint32_t> counts;  // NodeId -> element count, 0 for scalars
+  std::vector<rt_str> literals;  // NodeId -> value of a string literal
+  std::vector<Location> locations;  // SymbolId -> storage
+  std::vector<Procedure> procedures;  // SymbolId -> procedure
+  std::vector<Value> globals;
+  std::unique_ptr<Value[]> stack;
+  Value* frame;
+  Value* top;
+  Value ret_val;
+  TypeMark ret_type;  // Of the running procedure; TYPE_NONE in the body
+  uint32_t depth;
+  uint64_t num_evaluated;
+
+  static void* runBody(void*);
+  void resolveTypes();
+  void layout(const NodeId&, uint32_t&);
+  bool execStatements(const NodeId&);
+  bool execStatement(const NodeId&);
+  void execAssign(const NodeId&);
+  Value eval(const NodeId&);
+  void evalArray(const NodeId&, Value*);
+  Value call(const NodeId&);
+  Value callBuiltin(const int&, const NodeId&);
+  Value* getAddr(const SymbolId& sym) {
+    const Location& loc = locations[sym];
+    return (loc.global ? globals.data() : frame) + loc.offset;
+  }
+  Value* alloc(const uint32_t&);
+  Value evalConverted(const NodeId& n, const TypeMark& type) {
+    return convert(eval(n), types[n], type);
+  }
+  void evalArrayConverted(const NodeId&, const TypeMark&, Value*);
+  const Value* getArrayOperand(const NodeId&, const TypeMark&);
+  uint32_t evalIndex(const NodeId&, const uint32_t&);
+  static Value convert(const Value&, const TypeMark&, const TypeMark&);
+  static Value apply(const BinaryOp&, const TypeMark&, const Value&,
+      const Value&);
+  static Value applyUnary(const NodeKind&, const TypeMark&, const Value&);
+  static TypeMark getCommonType(const TypeMark&, const TypeMark&);
+  static Value getZero(const TypeMark&);
+  [[noreturn]] static void stackOverflow();
+};
+
+#endif // INTERPRETER_H
@@ -0,0 +1,652 @@
+#include "ir.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Name lists
+////////////////////////////////////////////////////////////////////////////////
+
+const std::string Module::op_names[NUM_OPCODES] = {
+  "nop",
+  "const",
+  "param",
+  "gload",
+  "gstore",
+  "gaddr",
+  "slot",
+  "aload",
+  "astore",
+  "add",
+  "sub",
+  "mul",
+  "div",
+  "and",
+  "or",
+  "lt",
+  "le",
+  "gt",
+  "ge",
+  "eq",
+  "ne",
+  "neg",
+  "not",
+  "itof",
+  "ftoi",
+  "itob",
+  "btoi",
+  "acopy",
+  "abin",
+  "aun",
+  "aconv",
+  "call",
+  "phi",
+  "br",
+  "cbr",
+  "ret",
+};
+
+const std::string Module::type_names[NUM_IR_TYPES] = {
+  "void",
+  "int",
+  "float",
+  "string",
+  "bool",
+  "ptr",
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Function
+////////////////////////////////////////////////////////////////////////////////
+
+Function::Function(const std::string& n, const IrType& ret,
+    const SymbolId& sym) :
+    name(n),
+    ret_type(ret),
+    symbol(sym),
+    line(0),
+    external(false),
+    is_main(false) {
+
+  // Value 0 is the "no value" sentinel
+  instrs.push_back(Instr());
+  instrs[0].op = IR_NOP;
+  instrs[0].type = IR_VOID;
+}
+
+// Create an instruction; it still has to be appended to a block
+ValueId Function::addInstr(const Opcode& op, const IrType& type,
+    std::initializer_list<ValueId> ops) {
+  return addInstr(op, type, std::vector<ValueId>(ops));
+}
+
+ValueId Function::addInstr(const Opcode& op, const IrType& type,
+    const std::vector<ValueId>& ops) {
+  Instr instr;
+  instr.op = op;
+  instr.type = type;
+  instr.src_type = IR_VOID;
+  instr.flags = 0;
+  instr.block = 0;
+  instr.ops = static_cast<uint32_t>(operands.size());
+  instr.num_ops = static_cast<uint32_t>(ops.size());
+  instr.count = 0;
+  instr.imm.u = 0;
+  operands.insert(operands.end(), ops.begin(), ops.end());
+  instrs.push_back(instr);
+  return static_cast<ValueId>(instrs.size() - 1);
+}
+
+BlockId Function::addBlock() {
+  blocks.push_back(Block());
+  return static_cast<BlockId>(blocks.size() - 1);
+}
+
+void Function::addEdge(const BlockId& from, const BlockId& to) {
+  blocks[from].succs.push_back(to);
+  blocks[to].preds.push_back(from);
+}
+
+// Remove one edge and the matching operand of every phi in the target
+void Function::removeEdge(const BlockId& from, const BlockId& to) {
+  std::vector<BlockId>& succs = blocks[from].succs;
+  auto s = std::find(succs.begin(), succs.end(), to);
+  if (s != succs.end()) succs.erase(s);
+  std::vector<BlockId>& preds = blocks[to].preds;
+  auto p = std::find(preds.begin(), preds.end(), from);
+  if (p == preds.end()) return;
+  uint32_t idx = static_cast<uint32_t>(p - preds.begin());
+  preds.erase(p);
+  for (ValueId v : blocks[to].instrs) {
+    Instr& instr = instrs[v];
+    if (instr.op != IR_PHI) break;
+    for (uint32_t i = idx; i + 1 < instr.num_ops; i++) {
+      operands[instr.ops + i] = operands[instr.ops + i + 1];
+    }
+    instr.num_ops--;
+  }
+}
+
+void Function::append(const BlockId& b, const ValueId& v) {
+  instrs[v].block = b;
+  blocks[b].instrs.push_back(v);
+}
+
+// Give an instruction a new operand list; reuses its range when it fits
+void Function::setOperands(const ValueId& v, const std::vector<ValueId>& ops) {
+  Instr& instr = instrs[v];
+  if (ops.size() > instr.num_ops) {
+    instr.ops = static_cast<uint32_t>(operands.size());
+    operands.insert(operands.end(), ops.begin(), ops.end());
+  } else {
+    std::copy(ops.begin(), ops.end(), operands.begin() + instr.ops);
+  }
+  instr.num_ops = static_cast<uint32_t>(ops.size());
+}
+
+ValueId Function::getTerminator(const BlockId& b) {
+  if (blocks[b].instrs.empty()) return NO_VALUE;
+  ValueId v = blocks[b].instrs.back();
+  return Module::isTerminator(instrs[v].op) ? v : NO_VALUE;
+}
+
+void Function::replaceAllUses(const ValueId& from, const ValueId& to) {
+  for (auto& block : blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = instrs[v];
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        if (operands[instr.ops + i] == from) operands[instr.ops + i] = to;
+      }
+    }
+  }
+}
+
+// Drop blocks that cannot be reached from the entry
+void Function::removeUnreachable() {
+  std::vector<bool> reached(blocks.size(), false);
+  std::vector<BlockId> work(1, 0);
+  reached[0] = true;
+  while (!work.empty()) {
+    BlockId b = work.back();
+    work.pop_back();
+    for (BlockId s : blocks[b].succs) {
+      if (!reached[s]) {
+        reached[s] = true;
+        work.push_back(s);
+      }
+    }
+  }
+  for (BlockId b = 0; b < blocks.size(); b++) {
+    if (reached[b]) continue;
+    while (!blocks[b].succs.empty()) removeEdge(b, blocks[b].succs.back());
+    for (ValueId v : blocks[b].instrs) instrs[v].op = IR_NOP;
+    blocks[b].instrs.clear();
+  }
+}
+
+// Replace phis whose operands are all the same value (or the phi itself)
+// until none are left; returns the number removed
+size_t Function::removeTrivialPhis() {
+  std::vector<ValueId> repl(instrs.size(), NO_VALUE);
+  auto resolve = [&](ValueId v) {
+    while (repl[v] != NO_VALUE) v = repl[v];
+    return v;
+  };
+  size_t num_removed = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& block : blocks) {
+      for (ValueId v : block.instrs) {
+        Instr& instr = instrs[v];
+        if (instr.op != IR_PHI) break;
+        if (repl[v] != NO_VALUE) continue;
+        ValueId same = NO_VALUE;
+        bool trivial = true;
+        for (uint32_t i = 0; i < instr.num_ops; i++) {
+          ValueId o = resolve(getOperand(v, i));
+          if ((o == v) || (o == same)) continue;
+          if (same != NO_VALUE) {
+            trivial = false;
+            break;
+          }
+          same = o;
+        }
+
+        // A phi of only itself is never reached from the entry
+        if (!trivial || (same == NO_VALUE)) continue;
+        repl[v] = same;
+        num_removed++;
+        changed = true;
+      }
+    }
+  }
+  if (num_removed == 0) return 0;
+  for (auto& block : blocks) {
+    std::vector<ValueId> kept;
+    for (ValueId v : block.instrs) {
+      if (repl[v] != NO_VALUE) {
+        instrs[v].op = IR_NOP;
+        continue;
+      }
+      kept.push_back(v);
+      Instr& instr = instrs[v];
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        setOperand(v, i, resolve(getOperand(v, i)));
+      }
+    }
+    block.instrs.swap(kept);
+  }
+  return num_removed;
+}
+
+// Merge each block into its predecessor when it is the predecessor's only
+// successor and has no other predecessor; returns the number merged
+size_t Function::mergeBlocks() {
+  removeTrivialPhis();
+  size_t num_merged = 0;
+  for (BlockId b = 0; b < blocks.size(); b++) {
+    while (blocks[b].succs.size() == 1) {
+      BlockId s = blocks[b].succs[0];
+      if ((s == b) || (s == 0) || (blocks[s].preds.size() != 1)) break;
+      Block& block = blocks[b];
+      Block& succ = blocks[s];
+      instrs[block.instrs.back()].op = IR_NOP;
+      block.instrs.pop_back();
+      for (ValueId v : succ.instrs) {
+        instrs[v].block = b;
+        block.instrs.push_back(v);
+      }
+      block.succs = succ.succs;
+      for (BlockId t : succ.succs) {
+        std::replace(blocks[t].preds.begin(), blocks[t].preds.end(), s, b);
+      }
+      succ.instrs.clear();
+      succ.preds.clear();
+      succ.succs.clear();
+      num_merged++;
+    }
+  }
+  return num_merged;
+}
+
+// Renumber blocks in reverse postorder and instructions in layout order, and
+// rebuild the operand array to match. Afterwards a pass that walks the blocks
+// in order reads instrs and operands front to back.
+void Function::compact() {
+  if (external || blocks.empty()) return;
+  removeUnreachable();
+
+  // Reverse postorder of the reachable blocks; successors are visited last
+  // to first so a block's first successor tends to follow it
+  std::vector<BlockId> order;
+  std::vector<uint8_t> state(blocks.size(), 0);
+  std::vector<std::pair<BlockId, size_t>> stack(1, {0, 0});
+  state[0] = 1;
+  while (!stack.empty()) {
+    BlockId b = stack.back().first;
+    size_t& next = stack.back().second;
+    if (next < blocks[b].succs.size()) {
+      const std::vector<BlockId>& succs = blocks[b].succs;
+      BlockId s = succs[succs.size() - 1 - next++];
+      if (!state[s]) {
+        state[s] = 1;
+        stack.push_back({s, 0});
+      }
+    } else {
+      order.push_back(b);
+      stack.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  std::vector<BlockId> block_map(blocks.size(), 0);
+  for (BlockId i = 0; i < order.size(); i++) block_map[order[i]] = i;
+
+  // New value numbers in layout order
+  std::vector<ValueId> value_map(instrs.size(), NO_VALUE);
+  ValueId next_val = 1;
+  for (BlockId b : order) {
+    for (ValueId v : blocks[b].instrs) {
+      if (instrs[v].op != IR_NOP) value_map[v] = next_val++;
+    }
+  }
+
+  std::vector<Instr> new_instrs(next_val);
+  new_instrs[0] = instrs[0];
+  std::vector<ValueId> new_operands;
+  new_operands.reserve(operands.size());
+  std::vector<Block> new_blocks(order.size());
+  for (BlockId nb = 0; nb < order.size(); nb++) {
+    Block& old_block = blocks[order[nb]];
+    Block& block = new_blocks[nb];
+    for (BlockId p : old_block.preds) block.preds.push_back(block_map[p]);
+    for (BlockId s : old_block.succs) block.succs.push_back(block_map[s]);
+    for (ValueId v : old_block.instrs) {
+      if (value_map[v] == NO_VALUE) continue;
+      Instr instr = instrs[v];
+      uint32_t ops_begin = static_cast<uint32_t>(new_operands.size());
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        new_operands.push_back(value_map[operands[instr.ops + i]]);
+      }
+      instr.ops = ops_begin;
+      instr.block = nb;
+      new_instrs[value_map[v]] = instr;
+      block.instrs.push_back(value_map[v]);
+    }
+  }
+  instrs.swap(new_instrs);
+  operands.swap(new_operands);
+  blocks.swap(new_blocks);
+}
+
+// Drop a slot nothing refers to any more, renumbering the ones after it
+void Function::removeSlot(const uint32_t& slot) {
+  slots.erase(slots.begin() + slot);
+  for (auto& instr : instrs) {
+    if ((instr.op == IR_SLOT) && (instr.imm.u > slot)) instr.imm.u--;
+  }
+}
+
+// Immediate dominator of every block, the entry being its own, by Cooper,
+// Harvey and Kennedy's iterative algorithm; relies on the blocks being
+// numbered in reverse postorder, as compact() leaves them
+std::vector<BlockId> Function::findIdoms() {
+  size_t num_blocks = blocks.size();
+  const BlockId none = static_cast<BlockId>(num_blocks);
+  std::vector<BlockId> idoms(num_blocks, none);
+  idoms[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (BlockId b = 1; b < num_blocks; b++) {
+      BlockId idom = none;
+      for (BlockId p : blocks[b].preds) {
+        if (idoms[p] == none) continue;
+        BlockId other = p;
+        while ((idom != none) && (other != idom)) {
+          while (other > idom) other = idoms[other];
+          while (idom > other) idom = idoms[idom];
+        }
+        idom = other;
+      }
+      if (idom != idoms[b]) {
+        idoms[b] = idom;
+        changed = true;
+      }
+    }
+  }
+  for (BlockId b = 1; b < num_blocks; b++) {
+    if (idoms[b] == none) idoms[b] = 0;
+  }
+  return idoms;
+}
+
+// Structural checks: terminators, phi arity, operands defined in the function
+bool Function::verify(std::string& err) {
+  if (external) return true;
+  std::stringstream ss;
+  std::vector<bool> placed(instrs.size(), false);
+  for (auto& block : blocks) {
+    for (ValueId v : block.instrs) placed[v] = true;
+  }
+  for (BlockId b = 0; b < blocks.size(); b++) {
+    Block& block = blocks[b];
+    if (block.instrs.empty() || (getTerminator(b) == NO_VALUE)) {
+      ss << "b" << b << " has no terminator; ";
+      continue;
+    }
+    bool in_phis = true;
+    for (size_t i = 0; i < block.instrs.size(); i++) {
+      ValueId v = block.instrs[i];
+      Instr& instr = instrs[v];
+      if (instr.block != b) ss << "%" << v << " has wrong block; ";
+      if (instr.op == IR_PHI) {
+        if (!in_phis) ss << "%" << v << " phi after non-phi; ";
+        if (instr.num_ops != block.preds.size()) {
+          ss << "%" << v << " phi arity " << instr.num_ops << " != "
+              << block.preds.size() << " preds; ";
+        }
+      } else {
+        in_phis = false;
+      }
+      if (Module::isTerminator(instr.op) && (i + 1 != block.instrs.size())) {
+        ss << "%" << v << " terminator in the middle of b" << b << "; ";
+      }
+      for (uint32_t j = 0; j < instr.num_ops; j++) {
+        ValueId o = operands[instr.ops + j];
+        if ((o == NO_VALUE) || (o >= instrs.size()) || !placed[o]) {
+          ss << "%" << v << " operand " << j << " undefined; ";
+        }
+      }
+    }
+    ValueId term = getTerminator(b);
+    size_t want = (instrs[term].op == IR_BR) ? 1
+        : ((instrs[term].op == IR_CBR) ? 2 : 0);
+    if (block.succs.size() != want) {
+      ss << "b" << b << " has " << block.succs.size() << " successors; ";
+    }
+  }
+  err = ss.str();
+  return err.empty();
+}
+
+size_t Function::getNumInstrs() {
+  size_t num = 0;
+  for (auto& block : blocks) num += block.instrs.size();
+  return num;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Module
+////////////////////////////////////////////////////////////////////////////////
+
+Module::Module() : main_func(0) {}
+
+uint32_t Module::addString(const std::string& s) {
+  auto it = string_ids.emplace(s, static_cast<uint32_t>(strings.size()));
+  if (it.second) strings.push_back(s);
+  return it.first->second;
+}
+
+void Module::print(std::ostream& os) {
+  for (uint32_t i = 0; i < strings.size(); i++) {
+    os << "string $" << i << " = \"" << strings[i] << "\"\n";
+  }
+  for (auto& g : globals) {
+    os << "global @" << g.name << " : " << getTypeName(g.type);
+    if (g.count > 0) os << "[" << g.count << "]";
+    os << "\n";
+  }
+  for (auto& f : functions) {
+    if (!globals.empty() || !strings.empty() || (&f != &functions[0])) {
+      os << "\n";
+    }
+    printFunction(os, f);
+  }
+}
+
+bool Module::hasSideEffects(const Opcode& op) {
+  switch (op) {
+    case IR_GSTORE:
+    case IR_ASTORE:
+    case IR_ACOPY:
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+    case IR_CALL:
+    case IR_BR:
+    case IR_CBR:
+    case IR_RET:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string Module::getOpName(const Opcode& op) {
+  if (op < NUM_OPCODES) {
+    return op_names[op];
+  } else {
+    return "NUM_OPCODES";
+  }
+}
+
+// Symbol of a function in generated code: the program body is main, builtins
+// are provided by the runtime as rt_<name>, and procedures are numbered since
+// local procedures in different scopes may share a name
+std::string Module::getLinkName(const uint32_t& idx) {
+  Function& f = functions[idx];
+  std::string name = f.name;
+  std::replace(name.begin(), name.end(), '.', '_');
+  if (f.is_main) {
+    return "main";
+  } else if (f.external) {
+    return "rt_" + name;
+  }
+  return "f" + std::to_string(idx) + "_" + name;
+}
+
+std::string Module::getGlobalName(const uint32_t& idx) {
+  return "g" + std::to_string(idx) + "_" + globals[idx].name;
+}
+
+std::string Module::getTypeName(const IrType& t) {
+  if (t < NUM_IR_TYPES) {
+    return type_names[t];
+  } else {
+    return "NUM_IR_TYPES";
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void Module::printFunction(std::ostream& os, Function& f) {
+  os << (f.external ? "declare" : "proc") << " @" << f.name << "(";
+  for (size_t i = 0; i < f.params.size(); i++) {
+    if (i > 0) os << ", ";
+    os << f.params[i].name << " : " << getTypeName(f.params[i].type);
+    if (f.params[i].count > 0) os << "[" << f.params[i].count << "]";
+  }
+  os << ") : " << getTypeName(f.ret_type);
+  if (f.external) {
+    os << "\n";
+    return;
+  }
+  os << " {\n";
+  for (uint32_t i = 0; i < f.slots.size(); i++) {
+    os << "  slot #" << i << " " << f.slots[i].name << " : "
+        << getTypeName(f.slots[i].type) << "[" << f.slots[i].count << "]"
+        << (f.slots[i].zeroed ? " zeroed" : "") << "\n";
+  }
+  for (BlockId b = 0; b < f.blocks.size(); b++) {
+    os << "b" << b << ":";
+    if (!f.blocks[b].preds.empty()) {
+      os << std::string(8, ' ') << "; preds";
+      for (BlockId p : f.blocks[b].preds) os << " b" << p;
+    }
+    os << "\n";
+    for (ValueId v : f.blocks[b].instrs) {
+      printInstr(os, f, v);
+    }
+  }
+  os << "}\n";
+}
+
+void Module::printInstr(std::ostream& os, Function& f, const ValueId& v) {
+  Instr& instr = f.instrs[v];
+  os << "  ";
+  if (instr.type != IR_VOID && !isTerminator(instr.op)
+      && (instr.op != IR_GSTORE) && (instr.op != IR_ASTORE)
+      && (instr.op != IR_ACOPY) && (instr.op != IR_ABIN)
+      && (instr.op != IR_AUN) && (instr.op != IR_ACONV)) {
+    os << "%" << v << " = ";
+  }
+  os << op_names[instr.op];
+  switch (instr.op) {
+    case IR_ABIN:
+    case IR_AUN:
+      os << "." << op_names[instr.imm.u];
+      break;
+    case IR_ACONV:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      os << "." << type_names[instr.src_type];
+      break;
+    default:
+      break;
+  }
+  bool first = true;
+  auto sep = [&]() { os << (first ? " " : ", "); first = false; };
+  switch (instr.op) {
+    case IR_CONST:
+      sep();
+      if (instr.type == IR_FLT) {
+        os << std::defaultfloat << std::setprecision(9) << instr.imm.f;
+      } else if (instr.type == IR_STR) {
+        os << "$" << instr.imm.u;
+      } else if (instr.type == IR_BOOL) {
+        os << (instr.imm.i ? "true" : "false");
+      } else {
+        os << instr.imm.i;
+      }
+      break;
+    case IR_PARAM:
+      sep();
+      os << instr.imm.u;
+      break;
+    case IR_GLOAD:
+    case IR_GSTORE:
+    case IR_GADDR:
+      sep();
+      os << "@" << globals[instr.imm.u].name;
+      break;
+    case IR_SLOT:
+      sep();
+      os << "#" << instr.imm.u;
+      break;
+    case IR_CALL:
+      sep();
+      os << "@" << functions[instr.imm.u].name;
+      break;
+    default:
+      break;
+  }
+  for (uint32_t i = 0; i < instr.num_ops; i++) {
+    sep();
+    os << "%" << f.getOperand(v, i);
+  }
+  Block& block = f.blocks[instr.block];
+  if ((instr.op == IR_BR) || (instr.op == IR_CBR)) {
+    for (BlockId s : block.succs) {
+      sep();
+      os << "b" << s;
+    }
+  }
+  if (instr.count > 0) {
+    os << " [" << instr.count << "]";
+  }
+  if (instr.type != IR_VOID) {
+    os << " : " << type_names[instr.type];
+  }
+  if (instr.flags & IR_FLAG_LHS_SCALAR) os << " (lhs scalar)";
+  if (instr.flags & IR_FLAG_RHS_SCALAR) os << " (rhs scalar)";
+  if (instr.flags & IR_FLAG_IN_BOUNDS) os << " (in bounds)";
+  if (instr.op == IR_PHI) {
+    os << "  ;";
+    for (BlockId p : block.preds) os << " b" << p;
+  }
+  os << "\n";
+}
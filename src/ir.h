@@ -0,0 +1,208 @@
+#ifndef IR_H
+#define IR_H
+
+#include <cstdint>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "token.h"
+
+// Value types; the first five line up with TypeMark
+enum IrType : uint8_t {
+  IR_VOID = 0,
+  IR_INT,
+  IR_FLT,
+  IR_STR,
+  IR_BOOL,
+  IR_PTR,  // Address of the first element of an array
+  NUM_IR_TYPES,
+};
+
+// Bytes an array element takes in memory: strings are one 64-bit word, and
+// the other types four bytes
+inline uint32_t getElemSize(const IrType& type) {
+  return (type == IR_STR) ? 8 : 4;
+}
+
+enum Opcode : uint8_t {
+  IR_NOP = 0, // Deleted instruction
+  IR_CONST, // imm: value (string constants: index into Module::strings)
+  IR_PARAM, // imm: parameter index
+  IR_GLOAD, // imm: global
+  IR_GSTORE, // [val]; imm: global
+  IR_GADDR, // imm: global array -> ptr
+  IR_SLOT, // imm: local array slot -> ptr
+  IR_ALOAD, // [ptr, idx]; count: array length
+  IR_ASTORE, // [ptr, idx, val]; count: array length
+  IR_ADD, // [lhs, rhs]
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_AND, // Bitwise on int, logical on bool
+  IR_OR,
+  IR_LT, // [lhs, rhs]; src_type: operand type; result is bool
+  IR_LE,
+  IR_GT,
+  IR_GE,
+  IR_EQ,
+  IR_NE,
+  IR_NEG, // [val]
+  IR_NOT, // [val]; bitwise on int, logical on bool
+  IR_ITOF, // [val]; explicit conversions
+  IR_FTOI,
+  IR_ITOB,
+  IR_BTOI,
+  IR_ACOPY, // [dst, src]; count elements of type
+  IR_ABIN, // [dst, lhs, rhs]; imm: scalar opcode; src_type: operand type
+  IR_AUN, // [dst, src]; imm: IR_NEG or IR_NOT
+  IR_ACONV, // [dst, src]; src_type: source element type
+  IR_CALL, // [args...]; imm: function
+  IR_PHI, // [vals...] in the order of the block's predecessors
+  IR_BR, // Target is succs[0] of the block
+  IR_CBR, // [cond]; targets are succs[0] (true) and succs[1] (false)
+  IR_RET, // [[val]]
+  NUM_OPCODES,
+};
+
+// Flags on IR_ABIN: which operand is a scalar broadcast over the array
+const uint8_t IR_FLAG_LHS_SCALAR = 0x01;
+const uint8_t IR_FLAG_RHS_SCALAR = 0x02;
+// Flag on IR_ALOAD and IR_ASTORE: the index is known to be in range, so it
+// needs no check
+const uint8_t IR_FLAG_IN_BOUNDS = 0x04;
+
+// Index of an instruction (and the value it defines) within its Function;
+// 0 is reserved for "no value"
+typedef uint32_t ValueId;
+const ValueId NO_VALUE = 0;
+typedef uint32_t BlockId;
+
+////////////////////////////////////////////////////////////////////////////////
+// One instruction
+// Operands are a range of Function::operands; targets of branches are the
+// successors of the block.
+////////////////////////////////////////////////////////////////////////////////
+struct Instr {
+  Opcode op;
+  IrType type;  // Result type (element type for array operations)
+  IrType src_type;  // Operand type for compares and conversions
+  uint8_t flags;
+  BlockId block;
+  uint32_t ops;  // First operand in Function::operands
+  uint32_t num_ops;
+  uint32_t count;  // Element count for array operations
+  union {
+    int32_t i;
+    float f;
+    uint32_t u;
+  } imm;
+};
+
+struct Block {
+  std::vector<ValueId> instrs;  // Phis first, terminator last
+  std::vector<BlockId> preds;
+  std::vector<BlockId> succs;
+};
+
+// Local array storage in a procedure's frame
+struct Slot {
+  std::string name;
+  IrType type;
+  uint32_t count;
+  bool zeroed;  // Cleared on entry; declared arrays start out as zeros
+  uint32_t line;  // Source line of the declaration
+};
+
+struct Param {
+  std::string name;
+  IrType type;
+  uint32_t count;  // 0 for scalars; arrays are passed as IR_PTR
+};
+
+struct Global {
+  std::string name;
+  IrType type;
+  uint32_t count;  // 0 for scalars
+  SymbolId symbol;
+  uint32_t line;  // Source line of the declaration
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// One procedure (or the program body, or an external builtin)
+////////////////////////////////////////////////////////////////////////////////
+class Function {
+public:
+  Function(const std::string&, const IrType&, const SymbolId&);
+  ValueId addInstr(const Opcode&, const IrType&,
+      std::initializer_list<ValueId> = {});
+  ValueId addInstr(const Opcode&, const IrType&, const std::vector<ValueId>&);
+  BlockId addBlock();
+  void addEdge(const BlockId&, const BlockId&);
+  void removeEdge(const BlockId&, const BlockId&);
+  void append(const BlockId&, const ValueId&);
+  ValueId getOperand(const ValueId& v, const uint32_t& n) {
+    return operands[instrs[v].ops + n];
+  }
+  void setOperand(const ValueId& v, const uint32_t& n, const ValueId& o) {
+    operands[instrs[v].ops + n] = o;
+  }
+  void setOperands(const ValueId&, const std::vector<ValueId>&);
+  ValueId getTerminator(const BlockId&);
+  void replaceAllUses(const ValueId&, const ValueId&);
+  void removeUnreachable();
+  size_t removeTrivialPhis();
+  size_t mergeBlocks();
+  void compact();
+  void removeSlot(const uint32_t&);
+  std::vector<BlockId> findIdoms();
+  bool verify(std::string&);
+  size_t getNumInstrs();
+
+  std::string name;
+  IrType ret_type;
+  SymbolId symbol;
+  uint32_t line;  // Source line of the declaration; 0 for builtins
+  bool external;  // Builtin provided by the runtime
+  bool is_main;  // Program body
+  std::vector<Param> params;
+  std::vector<Slot> slots;
+  std::vector<Instr> instrs;  // Indexed by ValueId
+  std::vector<ValueId> operands;
+  std::vector<Block> blocks;  // blocks[0] is the entry
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Whole program
+////////////////////////////////////////////////////////////////////////////////
+class Module {
+public:
+  Module();
+  uint32_t addString(const std::string&);
+  void print(std::ostream&);
+  static bool isTerminator(const Opcode& op) {
+    return (op == IR_BR) || (op == IR_CBR) || (op == IR_RET);
+  }
+  static bool hasSideEffects(const Opcode&);
+  std::string getLinkName(const uint32_t&);
+  std::string getGlobalName(const uint32_t&);
+  static std::string getOpName(const Opcode&);
+  static std::string getTypeName(const IrType&);
+
+  std::vector<Global> globals;
+  std::vector<Function> functions;
+  std::vector<std::string> strings;  // String literals, deduplicated
+  uint32_t main_func;
+
+private:
+  std::unordered_map<std::string, uint32_t> string_ids;
+
+  void printFunction(std::ostream&, Function&);
+  void printInstr(std::ostream&, Function&, const ValueId&);
+  static const std::string op_names[NUM_OPCODES];
+  static const std::string type_names[NUM_IR_TYPES];
+};
+
+#endif // IR_H
@@ -0,0 +1,673 @@
+#include "ir_builder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "ir.h"
+#include "log.h"
+#include "token.h"
+
+IrBuilder::IrBuilder(Ast& a, std::shared_ptr<Environment> e) :
+    ast(a),
+    env(e),
+    module(nullptr),
+    func(nullptr),
+    curr(0) {}
+
+// Lower the whole program; returns false if the result fails verification
+bool IrBuilder::build(Module& m) {
+  LOG(INFO) << "Begin building IR";
+  module = &m;
+  NodeId root = ast.getRoot();
+  NodeId decls = ast.getChild(root, 0);
+
+  // Program body first, then every procedure, then the builtins it calls
+  module->functions.push_back(Function("program", IR_VOID, NO_SYMBOL));
+  module->functions.back().is_main = true;
+  module->main_func = 0;
+  for (NodeId n = 1; n <= ast.getNumNodes(); n++) {
+    if (ast.getKind(n) == NODE_PROCEDURE) findNames(n);
+  }
+  declare(decls, "");
+  for (NodeId n = 1; n <= ast.getNumNodes(); n++) {
+    if ((ast.getKind(n) == NODE_CALL)
+        && (function_map.find(ast.getSymbol(n)) == function_map.end())) {
+      declareBuiltin(env->getSymbol(ast.getSymbol(n)));
+    }
+  }
+
+  lowerFunction(module->main_func, root);
+  for (auto& body : bodies) {
+    lowerFunction(body.second, body.first);
+  }
+
+  bool valid = true;
+  size_t num_instrs = 0;
+  for (auto& f : module->functions) {
+    std::string err;
+    if (!f.verify(err)) {
+      LOG(ERROR) << "Invalid IR in " << f.name << ": " << err;
+      valid = false;
+    }
+    num_instrs += f.getNumInstrs();
+  }
+  LOG(INFO) << "Done building IR: " << module->functions.size()
+      << " functions, " << num_instrs << " instructions";
+  return valid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void IrBuilder::findNames(const NodeId& node) {
+  for (NodeId n = ast.getChild(node); n != NO_NODE; n = ast.getNext(n)) {
+    if (ast.getKind(n) == NODE_NAME) proc_names.insert(ast.getSymbol(n));
+    findNames(n);
+  }
+}
+
+// Register the globals and procedures under a DECLARATIONS node; local
+// procedures are named after their enclosing procedure. A scalar of the
+// program body that no procedure names is left out, and becomes a local of
+// the body.
+void IrBuilder::declare(const NodeId& decls, const std::string& prefix) {
+  for (NodeId n = ast.getChild(decls); n != NO_NODE; n = ast.getNext(n)) {
+    SymbolId sym = ast.getSymbol(n);
+    std::shared_ptr<IdToken> id_tok = env->getSymbol(sym);
+    if (ast.getKind(n) == NODE_VARIABLE) {
+      if (!id_tok->getGlobal()) continue;
+      if (prefix.empty() && (ast.getSize(n) == 0)
+          && (proc_names.count(sym) == 0)) {
+        continue;
+      }
+      global_map[sym] = static_cast<uint32_t>(module->globals.size());
+      module->globals.push_back({id_tok->getVal(),
+          getIrType(id_tok->getTypeMark()), ast.getSize(n), sym,
+          ast.getLine(n)});
+    } else if (ast.getKind(n) == NODE_PROCEDURE) {
+      std::string name = id_tok->getVal();
+      if (!id_tok->getGlobal() && !prefix.empty()) {
+        name = prefix + "." + name;
+      }
+      uint32_t idx = static_cast<uint32_t>(module->functions.size());
+      function_map[sym] = idx;
+      module->functions.push_back(Function(name,
+          getIrType(id_tok->getTypeMark()), sym));
+      module->functions[idx].line = ast.getLine(n);
+      NodeId params = ast.getChild(n, 0);
+      for (NodeId p = ast.getChild(params); p != NO_NODE; p = ast.getNext(p)) {
+        module->functions[idx].params.push_back({
+            env->getSymbol(ast.getSymbol(p))->getVal(),
+            getIrType(ast.getTypeMark(p)), ast.getSize(p)});
+      }
+      bodies.push_back({n, idx});
+      declare(ast.getChild(n, 1), name);
+    }
+  }
+}
+
+void IrBuilder::declareBuiltin(std::shared_ptr<IdToken> id_tok) {
+  function_map[id_tok->getId()] =
+      static_cast<uint32_t>(module->functions.size());
+  module->functions.push_back(Function(id_tok->getVal(),
+      getIrType(id_tok->getTypeMark()), id_tok->getId()));
+  Function& f = module->functions.back();
+  f.external = true;
+  for (int i = 0; i < id_tok->getNumElements(); i++) {
+    std::shared_ptr<IdToken> param = id_tok->getParam(i);
+    f.params.push_back({param->getVal(), getIrType(param->getTypeMark()),
+        static_cast<uint32_t>(param->getNumElements())});
+  }
+}
+
+// Lower the program body (node is the PROGRAM) or a procedure
+void IrBuilder::lowerFunction(const uint32_t& idx, const NodeId& node) {
+  func = &module->functions[idx];
+  slot_map.clear();
+  defs.clear();
+  incomplete_phis.clear();
+  sealed.clear();
+  prologue.clear();
+  consts.clear();
+  slot_addrs.clear();
+  global_addrs.clear();
+
+  BlockId entry = newBlock();
+  sealBlock(entry);
+  curr = entry;
+  NodeId decls = ast.getChild(node, 0);
+  NodeId stmts = ast.getChild(node, 1);
+  if (!func->is_main) {
+    // Array parameters are passed by address and copied into the frame so
+    // the callee has its own copy
+    NodeId p = ast.getChild(ast.getChild(node, 0));
+    for (uint32_t i = 0; i < func->params.size(); i++, p = ast.getNext(p)) {
+      Param param = func->params[i];
+      ValueId v = func->addInstr(IR_PARAM,
+          (param.count > 0) ? IR_PTR : param.type);
+      func->instrs[v].imm.u = i;
+      prologue.push_back(v);
+      if (param.count == 0) {
+        writeVar(ast.getSymbol(p), entry, v);
+        continue;
+      }
+      uint32_t slot = static_cast<uint32_t>(func->slots.size());
+      func->slots.push_back({param.name, param.type, param.count, false,
+          ast.getLine(p)});
+      slot_map[ast.getSymbol(p)] = slot;
+      ValueId copy = emit(IR_ACOPY, param.type, {emitSlot(slot), v});
+      func->instrs[copy].count = param.count;
+    }
+    decls = ast.getChild(node, 1);
+    stmts = ast.getChild(node, 2);
+  }
+  for (NodeId n = ast.getChild(decls); n != NO_NODE; n = ast.getNext(n)) {
+    if ((ast.getKind(n) != NODE_VARIABLE) || (ast.getSize(n) == 0)) continue;
+    std::shared_ptr<IdToken> id_tok = env->getSymbol(ast.getSymbol(n));
+    if (id_tok->getGlobal()) continue;
+    slot_map[id_tok->getId()] = static_cast<uint32_t>(func->slots.size());
+    func->slots.push_back({id_tok->getVal(), getIrType(id_tok->getTypeMark()),
+        ast.getSize(n), true, ast.getLine(n)});
+  }
+
+  lowerStatements(stmts);
+
+  // Falling off the end returns a zero value
+  if (func->getTerminator(curr) == NO_VALUE) {
+    if (func->ret_type == IR_VOID) {
+      emit(IR_RET, IR_VOID, {});
+    } else {
+      emit(IR_RET, IR_VOID, {emitZero(func->ret_type)});
+    }
+  }
+
+  func->removeUnreachable();
+  func->removeTrivialPhis();
+  std::vector<ValueId>& entry_instrs = func->blocks[0].instrs;
+  entry_instrs.insert(entry_instrs.begin(), prologue.begin(), prologue.end());
+  for (ValueId v : prologue) func->instrs[v].block = 0;
+  func->compact();
+}
+
+void IrBuilder::lowerStatements(const NodeId& stmts) {
+  for (NodeId n = ast.getChild(stmts); n != NO_NODE; n = ast.getNext(n)) {
+    switch (ast.getKind(n)) {
+      case NODE_ASSIGN:
+        lowerAssign(n);
+        break;
+      case NODE_IF:
+        lowerIf(n);
+        break;
+      case NODE_LOOP:
+        lowerLoop(n);
+        break;
+      case NODE_RETURN:
+        lowerReturn(n);
+        break;
+      default:
+        LOG(ERROR) << "Unexpected statement: "
+            << Ast::getKindName(ast.getKind(n));
+        break;
+    }
+
+    // The statements after a return never run, so they are not lowered;
+    // the warning goes at the first of them
+    if ((ast.getKind(n) == NODE_RETURN) && (ast.getNext(n) != NO_NODE)) {
+      size_t num_dead = 0;
+      for (NodeId d = ast.getNext(n); d != NO_NODE; d = ast.getNext(d)) {
+        num_dead++;
+      }
+      int line = LOG::line_number;
+      LOG::line_number = static_cast<int>(ast.getLine(ast.getNext(n)));
+      LOG(WARN) << "Statements after a return never run, removed ("
+          << num_dead << ")";
+      LOG::line_number = line;
+      break;
+    }
+  }
+}
+
+void IrBuilder::lowerAssign(const NodeId& node) {
+  NodeId dest = ast.getChild(node, 0);
+  NodeId expr = ast.getNext(dest);
+  SymbolId sym = ast.getSymbol(dest);
+  std::shared_ptr<IdToken> id_tok = env->getSymbol(sym);
+  IrType type = getIrType(id_tok->getTypeMark());
+  uint32_t count = static_cast<uint32_t>(id_tok->getNumElements());
+  NodeId idx = ast.getChild(dest);
+
+  if (idx != NO_NODE) {
+    ValueId base = arrayAddr(sym);
+    ValueId i = convert(lowerExpr(idx), IR_INT);
+    ValueId val = convert(lowerExpr(expr), type);
+    ValueId v = emit(IR_ASTORE, type, {base, i, val});
+    func->instrs[v].count = count;
+  } else if (count > 0) {
+    // Whole-array assignment; the outermost operation writes straight into
+    // the destination when the types agree
+    Operand dst = {arrayAddr(sym), type, count};
+    Operand src = lowerExpr(expr, &dst);
+    if (src.val == dst.val) return;
+    ValueId v = emit((src.type == type) ? IR_ACOPY : IR_ACONV, type,
+        {dst.val, src.val});
+    func->instrs[v].src_type = src.type;
+    func->instrs[v].count = count;
+  } else {
+    ValueId val = convert(lowerExpr(expr), type);
+    if (global_map.count(sym) > 0) {
+      ValueId v = emit(IR_GSTORE, type, {val});
+      func->instrs[v].imm.u = global_map[sym];
+    } else {
+      writeVar(sym, curr, val);
+    }
+  }
+}
+
+void IrBuilder::lowerIf(const NodeId& node) {
+  NodeId cond = ast.getChild(node, 0);
+  NodeId then_stmts = ast.getNext(cond);
+  NodeId else_stmts = ast.getNext(then_stmts);
+  ValueId c = convert(lowerExpr(cond), IR_BOOL);
+  BlockId then_block = newBlock();
+  BlockId else_block = (else_stmts != NO_NODE) ? newBlock() : 0;
+  BlockId join = newBlock();
+  emit(IR_CBR, IR_VOID, {c});
+  func->addEdge(curr, then_block);
+  func->addEdge(curr, (else_stmts != NO_NODE) ? else_block : join);
+
+  sealBlock(then_block);
+  curr = then_block;
+  lowerStatements(then_stmts);
+  if (func->getTerminator(curr) == NO_VALUE) branch(join);
+  if (else_stmts != NO_NODE) {
+    sealBlock(else_block);
+    curr = else_block;
+    lowerStatements(else_stmts);
+    if (func->getTerminator(curr) == NO_VALUE) branch(join);
+  }
+  sealBlock(join);
+  curr = join;
+}
+
+void IrBuilder::lowerLoop(const NodeId& node) {
+  NodeId init = ast.getChild(node, 0);
+  NodeId cond = ast.getNext(init);
+  NodeId body = ast.getNext(cond);
+  lowerAssign(init);
+
+  // The header stays unsealed until the back edge exists
+  BlockId header = newBlock();
+  branch(header);
+  curr = header;
+  ValueId c = convert(lowerExpr(cond), IR_BOOL);
+  BlockId body_block = newBlock();
+  BlockId exit = newBlock();
+  emit(IR_CBR, IR_VOID, {c});
+  func->addEdge(header, body_block);
+  func->addEdge(header, exit);
+
+  sealBlock(body_block);
+  curr = body_block;
+  lowerStatements(body);
+  if (func->getTerminator(curr) == NO_VALUE) branch(header);
+  sealBlock(header);
+  sealBlock(exit);
+  curr = exit;
+}
+
+// Returning from the program body ends the program
+void IrBuilder::lowerReturn(const NodeId& node) {
+  Operand val = lowerExpr(ast.getChild(node));
+  if (func->ret_type == IR_VOID) {
+    emit(IR_RET, IR_VOID, {});
+  } else {
+    emit(IR_RET, IR_VOID, {convert(val, func->ret_type)});
+  }
+
+  // Anything after the return is unreachable
+  curr = newBlock();
+  sealBlock(curr);
+}
+
+IrBuilder::Operand IrBuilder::lowerExpr(const NodeId& node,
+    const Operand* dst) {
+  switch (ast.getKind(node)) {
+    case NODE_INT_LIT:
+      return {emitConst(IR_INT, static_cast<uint32_t>(ast.getInt(node))),
+          IR_INT, 0};
+    case NODE_FLT_LIT: {
+      union {
+        float f;
+        uint32_t u;
+      } bits;
+      bits.f = ast.getFloat(node);
+      return {emitConst(IR_FLT, bits.u), IR_FLT, 0};
+    }
+    case NODE_BOOL_LIT:
+      return {emitConst(IR_BOOL, ast.getBool(node) ? 1 : 0), IR_BOOL, 0};
+    case NODE_STR_LIT:
+      return {emitConst(IR_STR, module->addString(ast.getString(node))),
+          IR_STR, 0};
+    case NODE_NAME:
+      return lowerName(node);
+    case NODE_CALL:
+      return lowerCall(node);
+    case NODE_BINARY:
+      return lowerBinary(node, dst);
+    case NODE_NOT:
+    case NODE_NEGATE:
+      return lowerUnary(node, dst);
+    default:
+      LOG(ERROR) << "Unexpected expression: "
+          << Ast::getKindName(ast.getKind(node));
+      return {emitZero(IR_INT), IR_INT, 0};
+  }
+}
+
+// Operands are converted to a common type first: float for arithmetic with
+// a float side; for relations float, then int, then bool
+IrBuilder::Operand IrBuilder::lowerBinary(const NodeId& node,
+    const Operand* dst) {
+  Opcode op = getOpcode(ast.getOp(node));
+  NodeId lhs_node = ast.getChild(node, 0);
+  Operand lhs = lowerExpr(lhs_node);
+  Operand rhs = lowerExpr(ast.getNext(lhs_node));
+  bool relational = (op >= IR_LT) && (op <= IR_NE);
+  IrType type = lhs.type;
+  if ((lhs.type == IR_STR) || (rhs.type == IR_STR)) {
+    type = IR_STR;
+  } else if ((lhs.type == IR_FLT) || (rhs.type == IR_FLT)) {
+    type = IR_FLT;
+  } else if ((lhs.type == IR_INT) || (rhs.type == IR_INT)) {
+    type = IR_INT;
+  }
+  IrType result = relational ? IR_BOOL : type;
+
+  if ((lhs.count == 0) && (rhs.count == 0)) {
+    ValueId v = emit(op, result, {convert(lhs, type), convert(rhs, type)});
+    func->instrs[v].src_type = type;
+    return {v, result, 0};
+  }
+
+  // Element-wise, with a scalar side broadcast
+  uint32_t count = std::max(lhs.count, rhs.count);
+  uint8_t flags = 0;
+  ValueId l, r;
+  if (lhs.count > 0) {
+    l = convertArray(lhs, type).val;
+  } else {
+    l = convert(lhs, type);
+    flags |= IR_FLAG_LHS_SCALAR;
+  }
+  if (rhs.count > 0) {
+    r = convertArray(rhs, type).val;
+  } else {
+    r = convert(rhs, type);
+    flags |= IR_FLAG_RHS_SCALAR;
+  }
+  Operand out = (dst && (dst->type == result) && (dst->count == count))
+      ? *dst : newTemp(result, count);
+  ValueId v = emit(IR_ABIN, result, {out.val, l, r});
+  Instr& instr = func->instrs[v];
+  instr.imm.u = op;
+  instr.src_type = type;
+  instr.flags = flags;
+  instr.count = count;
+  return out;
+}
+
+IrBuilder::Operand IrBuilder::lowerUnary(const NodeId& node,
+    const Operand* dst) {
+  Opcode op = (ast.getKind(node) == NODE_NOT) ? IR_NOT : IR_NEG;
+  Operand val = lowerExpr(ast.getChild(node));
+  if (val.count == 0) {
+    return {emit(op, val.type, {val.val}), val.type, 0};
+  }
+  Operand out = (dst && (dst->type == val.type) && (dst->count == val.count))
+      ? *dst : newTemp(val.type, val.count);
+  ValueId v = emit(IR_AUN, val.type, {out.val, val.val});
+  func->instrs[v].imm.u = op;
+  func->instrs[v].count = val.count;
+  return out;
+}
+
+IrBuilder::Operand IrBuilder::lowerCall(const NodeId& node) {
+  uint32_t callee = function_map[ast.getSymbol(node)];
+  std::vector<ValueId> args;
+  uint32_t i = 0;
+  for (NodeId a = ast.getChild(node); a != NO_NODE; a = ast.getNext(a), i++) {
+    Param param = module->functions[callee].params[i];
+    Operand arg = lowerExpr(a);
+    if (param.count > 0) {
+      args.push_back(convertArray(arg, param.type).val);
+    } else {
+      args.push_back(convert(arg, param.type));
+    }
+  }
+  IrType type = module->functions[callee].ret_type;
+  ValueId v = func->addInstr(IR_CALL, type, args);
+  func->instrs[v].imm.u = callee;
+  func->append(curr, v);
+  return {v, type, 0};
+}
+
+IrBuilder::Operand IrBuilder::lowerName(const NodeId& node) {
+  SymbolId sym = ast.getSymbol(node);
+  std::shared_ptr<IdToken> id_tok = env->getSymbol(sym);
+  IrType type = getIrType(id_tok->getTypeMark());
+  uint32_t count = static_cast<uint32_t>(id_tok->getNumElements());
+  NodeId idx = ast.getChild(node);
+  if (idx != NO_NODE) {
+    ValueId base = arrayAddr(sym);
+    ValueId v = emit(IR_ALOAD, type, {base, convert(lowerExpr(idx), IR_INT)});
+    func->instrs[v].count = count;
+    return {v, type, 0};
+  } else if (count > 0) {
+    return {arrayAddr(sym), type, count};
+  } else if (global_map.count(sym) > 0) {
+    ValueId v = emit(IR_GLOAD, type, {});
+    func->instrs[v].imm.u = global_map[sym];
+    return {v, type, 0};
+  } else {
+    return {readVar(sym, curr), type, 0};
+  }
+}
+
+// Scalar conversion; bool <-> float goes through int
+ValueId IrBuilder::convert(const Operand& val, const IrType& type) {
+  if (val.type == type) return val.val;
+  ValueId v = val.val;
+  IrType from = val.type;
+  if ((from == IR_BOOL) && (type == IR_FLT)) {
+    v = convert({v, from, 0}, IR_INT);
+    from = IR_INT;
+  } else if ((from == IR_FLT) && (type == IR_BOOL)) {
+    v = convert({v, from, 0}, IR_INT);
+    from = IR_INT;
+  }
+  Opcode op = IR_NOP;
+  if ((from == IR_INT) && (type == IR_FLT)) {
+    op = IR_ITOF;
+  } else if ((from == IR_FLT) && (type == IR_INT)) {
+    op = IR_FTOI;
+  } else if ((from == IR_INT) && (type == IR_BOOL)) {
+    op = IR_ITOB;
+  } else if ((from == IR_BOOL) && (type == IR_INT)) {
+    op = IR_BTOI;
+  } else {
+    LOG(ERROR) << "Cannot convert " << Module::getTypeName(from) << " to "
+        << Module::getTypeName(type);
+    return v;
+  }
+  ValueId conv = emit(op, type, {v});
+  func->instrs[conv].src_type = from;
+  return conv;
+}
+
+// Whole-array conversion into a temporary
+IrBuilder::Operand IrBuilder::convertArray(const Operand& val,
+    const IrType& type) {
+  if (val.type == type) return val;
+  Operand out = newTemp(type, val.count);
+  ValueId v = emit(IR_ACONV, type, {out.val, val.val});
+  func->instrs[v].src_type = val.type;
+  func->instrs[v].count = val.count;
+  return out;
+}
+
+IrBuilder::Operand IrBuilder::newTemp(const IrType& type,
+    const uint32_t& count) {
+  uint32_t slot = static_cast<uint32_t>(func->slots.size());
+  func->slots.push_back({"tmp" + std::to_string(slot), type, count,
+      false});
+  return {emitSlot(slot), type, count};
+}
+
+ValueId IrBuilder::arrayAddr(const SymbolId& sym) {
+  auto s = slot_map.find(sym);
+  if (s != slot_map.end()) return emitSlot(s->second);
+  uint32_t g = global_map[sym];
+  auto a = global_addrs.find(g);
+  if (a != global_addrs.end()) return a->second;
+  ValueId v = func->addInstr(IR_GADDR, IR_PTR);
+  func->instrs[v].imm.u = g;
+  prologue.push_back(v);
+  global_addrs[g] = v;
+  return v;
+}
+
+ValueId IrBuilder::emit(const Opcode& op, const IrType& type,
+    std::initializer_list<ValueId> ops) {
+  ValueId v = func->addInstr(op, type, ops);
+  func->append(curr, v);
+  return v;
+}
+
+// Constants are shared and live in the entry block
+ValueId IrBuilder::emitConst(const IrType& type, const uint32_t& bits) {
+  auto c = consts.find({type, bits});
+  if (c != consts.end()) return c->second;
+  ValueId v = func->addInstr(IR_CONST, type);
+  func->instrs[v].imm.u = bits;
+  prologue.push_back(v);
+  consts[{type, bits}] = v;
+  return v;
+}
+
+ValueId IrBuilder::emitZero(const IrType& type) {
+  if (type == IR_STR) return emitConst(IR_STR, module->addString(""));
+  return emitConst(type, 0);
+}
+
+ValueId IrBuilder::emitSlot(const uint32_t& slot) {
+  auto a = slot_addrs.find(slot);
+  if (a != slot_addrs.end()) return a->second;
+  ValueId v = func->addInstr(IR_SLOT, IR_PTR);
+  func->instrs[v].imm.u = slot;
+  prologue.push_back(v);
+  slot_addrs[slot] = v;
+  return v;
+}
+
+BlockId IrBuilder::newBlock() {
+  defs.emplace_back();
+  incomplete_phis.emplace_back();
+  sealed.push_back(false);
+  return func->addBlock();
+}
+
+void IrBuilder::branch(const BlockId& target) {
+  emit(IR_BR, IR_VOID, {});
+  func->addEdge(curr, target);
+}
+
+// All predecessors of the block are known; finish its pending phis
+void IrBuilder::sealBlock(const BlockId& b) {
+  std::vector<std::pair<SymbolId, ValueId>> pending;
+  pending.swap(incomplete_phis[b]);
+  for (auto& p : pending) addPhiOperands(p.first, p.second);
+  sealed[b] = true;
+}
+
+void IrBuilder::writeVar(const SymbolId& sym, const BlockId& b,
+    const ValueId& v) {
+  defs[b][sym] = v;
+}
+
+ValueId IrBuilder::readVar(const SymbolId& sym, const BlockId& b) {
+  auto d = defs[b].find(sym);
+  if (d != defs[b].end()) return d->second;
+  return readVarRecursive(sym, b);
+}
+
+// A read with no reaching definition is zero
+ValueId IrBuilder::readVarRecursive(const SymbolId& sym, const BlockId& b) {
+  IrType type = getIrType(env->getSymbol(sym)->getTypeMark());
+  size_t num_preds = func->blocks[b].preds.size();
+  ValueId v;
+  if (!sealed[b]) {
+    v = newPhi(b, type);
+    incomplete_phis[b].push_back({sym, v});
+  } else if (num_preds == 1) {
+    v = readVar(sym, func->blocks[b].preds[0]);
+  } else if (num_preds == 0) {
+    v = emitZero(type);
+  } else {
+    // Break cycles through the phi before reading the predecessors
+    v = newPhi(b, type);
+    writeVar(sym, b, v);
+    addPhiOperands(sym, v);
+  }
+  writeVar(sym, b, v);
+  return v;
+}
+
+ValueId IrBuilder::newPhi(const BlockId& b, const IrType& type) {
+  ValueId v = func->addInstr(IR_PHI, type);
+  func->instrs[v].block = b;
+  std::vector<ValueId>& instrs = func->blocks[b].instrs;
+  auto pos = instrs.begin();
+  while ((pos != instrs.end()) && (func->instrs[*pos].op == IR_PHI)) pos++;
+  instrs.insert(pos, v);
+  return v;
+}
+
+void IrBuilder::addPhiOperands(const SymbolId& sym, const ValueId& phi) {
+  BlockId b = func->instrs[phi].block;
+  std::vector<ValueId> ops;
+  for (size_t i = 0; i < func->blocks[b].preds.size(); i++) {
+    ops.push_back(readVar(sym, func->blocks[b].preds[i]));
+  }
+  func->setOperands(phi, ops);
+}
+
+IrType IrBuilder::getIrType(const TypeMark& tm) {
+  return static_cast<IrType>(tm);
+}
+
+Opcode IrBuilder::getOpcode(const BinaryOp& op) {
+  switch (op) {
+    case OP_AND: return IR_AND;
+    case OP_OR: return IR_OR;
+    case OP_ADD: return IR_ADD;
+    case OP_SUB: return IR_SUB;
+    case OP_MUL: return IR_MUL;
+    case OP_DIV: return IR_DIV;
+    case OP_LT: return IR_LT;
+    case OP_LE: return IR_LE;
+    case OP_GT: return IR_GT;
+    case OP_GE: return IR_GE;
+    case OP_EQ: return IR_EQ;
+    case OP_NE: return IR_NE;
+    default: return IR_NOP;
+  }
+}
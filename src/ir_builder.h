@@ -0,0 +1,98 @@
+#ifndef IR_BUILDER_H
+#define IR_BUILDER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "ir.h"
+#include "token.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Lowers a checked syntax tree to SSA form
+// Scalar locals and parameters become SSA values (Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form"), and so do scalar
+// globals that no procedure names, since only the program body can see them;
+// other globals are loaded and stored, and arrays live in frame slots or
+// global storage. Every
+// implicit conversion in the source language becomes an explicit instruction.
+// Passes that only look for nodes of one kind scan the node arrays in order;
+// lowering itself follows the child and sibling links, since blocks and
+// definitions must be made in source order, not the arrays' post-order.
+////////////////////////////////////////////////////////////////////////////////
+class IrBuilder {
+public:
+  IrBuilder(Ast&, std::shared_ptr<Environment>);
+  bool build(Module&);
+
+private:
+  // Result of lowering an expression; count > 0 means val is the address of
+  // count elements of type
+  struct Operand {
+    ValueId val;
+    IrType type;
+    uint32_t count;
+  };
+
+  Ast& ast;
+  std::shared_ptr<Environment> env;
+  Module* module;
+  std::unordered_map<SymbolId, uint32_t> global_map;
+  std::unordered_map<SymbolId, uint32_t> function_map;
+  std::unordered_set<SymbolId> proc_names;  // Named inside some procedure
+  std::vector<std::pair<NodeId, uint32_t>> bodies;  // PROCEDURE node, function
+
+  // Per-function state
+  Function* func;
+  BlockId curr;
+  std::unordered_map<SymbolId, uint32_t> slot_map;
+  std::vector<std::unordered_map<SymbolId, ValueId>> defs;  // Per block
+  std::vector<std::vector<std::pair<SymbolId, ValueId>>> incomplete_phis;
+  std::vector<bool> sealed;
+  std::vector<ValueId> prologue;  // Spliced in front of the entry block
+  std::map<std::pair<IrType, uint32_t>, ValueId> consts;
+  std::unordered_map<uint32_t, ValueId> slot_addrs;
+  std::unordered_map<uint32_t, ValueId> global_addrs;
+
+  void findNames(const NodeId&);
+  void declare(const NodeId&, const std::string&);
+  void declareBuiltin(std::shared_ptr<IdToken>);
+  void lowerFunction(const uint32_t&, const NodeId&);
+  void lowerStatements(const NodeId&);
+  void lowerAssign(const NodeId&);
+  void lowerIf(const NodeId&);
+  void lowerLoop(const NodeId&);
+  void lowerReturn(const NodeId&);
+  Operand lowerExpr(const NodeId&, const Operand* = nullptr);
+  Operand lowerBinary(const NodeId&, const Operand*);
+  Operand lowerUnary(const NodeId&, const Operand*);
+  Operand lowerCall(const NodeId&);
+  Operand lowerName(const NodeId&);
+  ValueId convert(const Operand&, const IrType&);
+  Operand convertArray(const Operand&, const IrType&);
+  Operand newTemp(const IrType&, const uint32_t&);
+  ValueId arrayAddr(const SymbolId&);
+  ValueId emit(const Opcode&, const IrType&, std::initializer_list<ValueId>);
+  ValueId emitConst(const IrType&, const uint32_t&);
+  ValueId emitZero(const IrType&);
+  ValueId emitSlot(const uint32_t&);
+  BlockId newBlock();
+  void branch(const BlockId&);
+  void sealBlock(const BlockId&);
+  void writeVar(const SymbolId&, const BlockId&, const ValueId&);
+  ValueId readVar(const SymbolId&, const BlockId&);
+  ValueId readVarRecursive(const SymbolId&, const BlockId&);
+  ValueId newPhi(const BlockId&, const IrType&);
+  void addPhiOperands(const SymbolId&, const ValueId&);
+  static IrType getIrType(const TypeMark&);
+  static Opcode getOpcode(const BinaryOp&);
+};
+
+#endif // IR_BUILDER_H
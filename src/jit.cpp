@@ -0,0 +1,534 @@
+#include "jit.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "log.h"
+#include "vm.h"
+
+// Condition codes, the low nibble of jcc and setcc
+enum Cond : uint8_t {
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_A = 0x7,
+  CC_P = 0xa,
+  CC_NP = 0xb,
+  CC_L = 0xc,
+  CC_GE = 0xd,
+  CC_LE = 0xe,
+  CC_G = 0xf,
+};
+
+static const uint8_t REX_W = 0x48;
+
+Jit::Jit(const JitContext& c) :
+    context(c),
+    cached(NO_REG),
+    stored(NO_REG),
+    num_bytes(0) {}
+
+Jit::~Jit() {
+  for (auto& map : maps) munmap(map.first, map.second);
+}
+
+// Compiles the instructions in [begin, end), a procedure whose frame is
+// frame_size words; returns nullptr if any of them has no template. Jump
+// targets are read from the threaded code.
+JitCode Jit::compile(const std::vector<VmInsn>& code, const uint32_t& begin,
+    const uint32_t& end, const uint32_t& frame_size,
+    const std::vector<uint32_t>& call_args) {
+  buf.clear();
+  offsets.clear();
+  fixups.clear();
+  stubs.clear();
+  scan(code, begin, end, frame_size);
+  cached = NO_REG;
+
+  // push rbx; push r12; sub rsp, 8; mov rbx, rdi; mov r12, rsi
+  uint32_t num_insns = end - begin;
+  emit({0x53, 0x41, 0x54, REX_W, 0x83, 0xec, 0x08, REX_W, 0x89, 0xfb, 0x49,
+      0x89, 0xf4});
+
+  // Both stacks are checked on entry: cmp rsp, limit; then the end of the
+  // frame against the end of the value stack
+  emit({REX_W, 0xb8});
+  emit64(reinterpret_cast<uint64_t>(context.native_limit));
+  emit({REX_W, 0x39, 0xc4});
+  emitStubJump(CC_B, STUB_OVERFLOW, num_insns);
+  emitFrame({REX_W, 0x8d}, EAX, frame_size);
+  emit({REX_W, 0xb9});  // mov rcx, stack_end; cmp rax, rcx
+  emit64(reinterpret_cast<uint64_t>(context.stack_end));
+  emit({REX_W, 0x39, 0xc8});
+  emitStubJump(CC_A, STUB_OVERFLOW, num_insns);
+  for (uint32_t i = begin; i < end; i++) {
+    offsets.push_back(buf.size());
+    const VmInsn& insn = code[i];
+    uint32_t target = 0;
+    if ((insn.op >= V_JMP) && (insn.op <= V_JNE)) {
+      size_t t = insn.imm.target - code.data();
+      if ((t < begin) || (t >= end)) return nullptr;
+      target = static_cast<uint32_t>(t - begin);
+    }
+    if (targets[i - begin]) cached = NO_REG;
+    stored = NO_REG;
+    if (!compileInsn(insn, target, num_insns, frame_size, call_args)) {
+      return nullptr;
+    }
+    cached = stored;
+  }
+
+  // Error paths, out of line; neither call returns
+  for (auto& stub : stubs) {
+    offsets.push_back(buf.size());
+    switch (stub.kind) {
+      case STUB_BOUNDS:
+        emit({0x89, 0xcf, 0xbe});  // mov edi, ecx; mov esi, count
+        emit32(stub.count);
+        emitCall(reinterpret_cast<const void*>(&rt_bounds_error));
+        break;
+      case STUB_DIV:
+        emitCall(reinterpret_cast<const void*>(&rt_div_error));
+        break;
+      case STUB_OVERFLOW:
+        emitCall(context.overflow);
+        break;
+    }
+  }
+  for (auto& fixup : fixups) {
+    uint32_t rel = static_cast<uint32_t>(offsets[fixup.target] - fixup.pos
+        - 4);
+    std::memcpy(&buf[fixup.pos], &rel, 4);
+  }
+  return reinterpret_cast<JitCode>(install());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Finds jump targets and registers that hold one constant throughout
+void Jit::scan(const std::vector<VmInsn>& code, const uint32_t& begin,
+    const uint32_t& end, const uint32_t& frame_size) {
+  std::vector<uint32_t> writes(frame_size, 0);
+  targets.assign(end - begin, false);
+  is_const.assign(frame_size, false);
+  const_vals.assign(frame_size, 0);
+  for (uint32_t i = begin; i < end; i++) {
+    const VmInsn& insn = code[i];
+    if ((insn.op >= V_JMP) && (insn.op <= V_JNE)) {
+      size_t t = insn.imm.target - code.data();
+      if ((t >= begin) && (t < end)) targets[t - begin] = true;
+    }
+    if (!writesA(insn.op) || (insn.a >= frame_size)) continue;
+    writes[insn.a]++;
+    if ((insn.op == V_LOADK) && (insn.imm.bits <= UINT32_MAX)) {
+      is_const[insn.a] = true;
+      const_vals[insn.a] = insn.imm.u;
+    }
+  }
+  for (uint32_t r = 0; r < frame_size; r++) {
+    if (writes[r] != 1) is_const[r] = false;
+  }
+}
+
+// Operands are frame words: a, b and c all address [rbx + 8 * n]
+bool Jit::compileInsn(const VmInsn& insn, const uint32_t& target,
+    const uint32_t& num_insns, const uint32_t& frame_size,
+    const std::vector<uint32_t>& call_args) {
+  // Opcodes with a memory operand, and the /digit of the immediate forms
+  static const uint8_t int_ops[] = {0x03, 0x2b, 0, 0, 0x23, 0x0b};
+  static const uint8_t int_exts[] = {0, 5, 0, 0, 4, 1};
+  static const uint8_t flt_ops[] = {0x58, 0x5c, 0x59, 0x5e};
+  static const uint8_t int_conds[] = {CC_L, CC_LE, CC_G, CC_GE, CC_E, CC_NE};
+  switch (insn.op) {
+    case V_LOADK:
+      if (insn.imm.bits <= UINT32_MAX) {
+        emit({0xb8});  // mov eax, imm32
+        emit32(insn.imm.u);
+      } else {
+        emit({REX_W, 0xb8});  // mov rax, imm64
+        emit64(insn.imm.bits);
+      }
+      emitStore(insn.a, true);
+      break;
+    case V_MOV:
+      emitLoad(insn.b, true);
+      emitStore(insn.a, true);
+      break;
+    case V_SLOT:
+      emitFrame({REX_W, 0x8d}, EAX, insn.b);
+      emitStore(insn.a, true);
+      break;
+    case V_ZERO:
+      emitFrame({REX_W, 0x8d}, EDI, insn.b);
+      emit({0x31, 0xf6, 0xba});  // xor esi, esi; mov edx, bytes
+      emit32(insn.c);
+      emitCall(reinterpret_cast<const void*>(&memset));
+      break;
+    case V_GLOAD32:
+    case V_GLOAD64: {
+      bool wide = (insn.op == V_GLOAD64);
+      emit({REX_W, 0xb8});
+      emit64(insn.imm.bits);
+      if (wide) emit({REX_W});
+      emit({0x8b, 0x00});  // mov eax, [rax]
+      emitStore(insn.a, wide);
+      break;
+    }
+    case V_GSTORE32:
+    case V_GSTORE64: {
+      bool wide = (insn.op == V_GSTORE64);
+      emitLoad(insn.a, wide);
+      emit({REX_W, 0xb9});  // mov rcx, imm64
+      emit64(insn.imm.bits);
+      if (wide) emit({REX_W});
+      emit({0x89, 0x01});  // mov [rcx], eax
+      break;
+    }
+    case V_ALOAD32:
+    case V_ALOAD64:
+    case V_ASTORE32:
+    case V_ASTORE64: {
+      bool wide = (insn.op == V_ALOAD64) || (insn.op == V_ASTORE64);
+      bool load = (insn.op == V_ALOAD32) || (insn.op == V_ALOAD64);
+      if (!load && (cached == insn.a)) {
+        if (wide) emit({REX_W});
+        emit({0x89, 0xc2});  // mov edx, eax
+      } else if (!load) {
+        emitLoadTo(EDX, insn.a, wide);
+      }
+      emitFrame({REX_W, 0x8b}, EAX, insn.b);
+      // A constant index in range needs no check
+      if ((insn.imm.u != V_UNCHECKED)
+          && (!is_const[insn.c] || (const_vals[insn.c] >= insn.imm.u))) {
+        emitLoadTo(ECX, insn.c);
+        emit({0x81, 0xf9});  // cmp ecx, count
+        emit32(insn.imm.u);
+        emitStubJump(CC_AE, STUB_BOUNDS, num_insns, insn.imm.u);
+      } else {
+        emitLoadTo(ECX, insn.c);
+      }
+      if (load) {
+        // mov eax, [rax + rcx * 4] or mov rax, [rax + rcx * 8]
+        if (wide) {
+          emit({REX_W, 0x8b, 0x04, 0xc8});
+        } else {
+          emit({0x8b, 0x04, 0x88});
+        }
+        emitStore(insn.a, wide);
+      } else if (wide) {
+        emit({REX_W, 0x89, 0x14, 0xc8});
+      } else {
+        emit({0x89, 0x14, 0x88});
+      }
+      break;
+    }
+    case V_ACOPY:
+      emitFrame({REX_W, 0x8b}, EDI, insn.a);
+      emitFrame({REX_W, 0x8b}, ESI, insn.b);
+      emit({0xba});
+      emit32(insn.imm.u);
+      emitCall(reinterpret_cast<const void*>(&memmove));
+      break;
+    case V_AOP:
+      emit({0x4c, 0x89, 0xe7, REX_W, 0x89, 0xde, 0xba});  // rdi, rsi, edx
+      emit32(insn.imm.u);
+      emitCall(context.array_op);
+      break;
+    case V_ADDI:
+    case V_SUBI:
+    case V_AND:
+    case V_OR:
+      emitLoad(insn.b);
+      emitAlu(int_ops[insn.op - V_ADDI], int_exts[insn.op - V_ADDI], insn.c);
+      emitStore(insn.a);
+      break;
+    case V_MULI:
+      emitLoad(insn.b);
+      if (is_const[insn.c]) {
+        emit({0x69, 0xc0});  // imul eax, eax, imm32
+        emit32(const_vals[insn.c]);
+      } else {
+        emitFrame({0x0f, 0xaf}, EAX, insn.c);
+      }
+      emitStore(insn.a);
+      break;
+    case V_DIVI:
+      // INT32_MIN / -1 would trap in idiv, so -1 negates instead
+      emitLoadTo(ECX, insn.c);
+      emit({0x85, 0xc9});  // test ecx, ecx
+      emitStubJump(CC_E, STUB_DIV, num_insns);
+      emitLoad(insn.b);
+      // cmp ecx, -1; jne 1f; neg eax; jmp 2f; 1: cdq; idiv ecx; 2:
+      emit({0x83, 0xf9, 0xff, 0x75, 0x04, 0xf7, 0xd8, 0xeb, 0x03, 0x99, 0xf7,
+          0xf9});
+      emitStore(insn.a);
+      break;
+    case V_ADDF:
+    case V_SUBF:
+    case V_MULF:
+    case V_DIVF:
+      emitFrame({0xf3, 0x0f, 0x10}, EAX, insn.b);
+      emitFrame({0xf3, 0x0f, flt_ops[insn.op - V_ADDF]}, EAX, insn.c);
+      emitFrame({0xf3, 0x0f, 0x11}, EAX, insn.a);
+      break;
+    case V_LTI:
+    case V_LEI:
+    case V_GTI:
+    case V_GEI:
+    case V_EQI:
+    case V_NEI:
+      emitLoad(insn.b);
+      emitAlu(0x3b, 7, insn.c);
+      emitSet(int_conds[insn.op - V_LTI], insn.a);
+      break;
+    case V_LTF:
+    case V_LEF:
+      // b < c is c > b: "above" is false when unordered
+      emitFrame({0xf3, 0x0f, 0x10}, EAX, insn.c);
+      emitFrame({0x0f, 0x2e}, EAX, insn.b);
+      emitSet((insn.op == V_LTF) ? CC_A : CC_AE, insn.a);
+      break;
+    case V_GTF:
+    case V_GEF:
+      emitFrame({0xf3, 0x0f, 0x10}, EAX, insn.b);
+      emitFrame({0x0f, 0x2e}, EAX, insn.c);
+      emitSet((insn.op == V_GTF) ? CC_A : CC_AE, insn.a);
+      break;
+    case V_EQF:
+    case V_NEF: {
+      bool eq = (insn.op == V_EQF);
+      emitFrame({0xf3, 0x0f, 0x10}, EAX, insn.b);
+      emitFrame({0x0f, 0x2e}, EAX, insn.c);
+      // sete al; setnp cl; and al, cl, or the inverse for !=
+      emit({0x0f, static_cast<uint8_t>(0x90 | (eq ? CC_E : CC_NE)), 0xc0,
+          0x0f, static_cast<uint8_t>(0x90 | (eq ? CC_NP : CC_P)), 0xc1,
+          static_cast<uint8_t>(eq ? 0x20 : 0x08), 0xc8, 0x0f, 0xb6, 0xc0});
+      emitStore(insn.a);
+      break;
+    }
+    case V_EQS:
+    case V_NES:
+      emitFrame({REX_W, 0x8b}, EDI, insn.b);
+      emitFrame({REX_W, 0x8b}, ESI, insn.c);
+      emitCall(reinterpret_cast<const void*>(&rt_streq));
+      if (insn.op == V_NES) emit({0x83, 0xf0, 0x01});  // xor eax, 1
+      emitStore(insn.a);
+      break;
+    case V_NEGI:
+    case V_NOTI:
+      emitLoad(insn.b);
+      emit({0xf7, static_cast<uint8_t>((insn.op == V_NEGI) ? 0xd8 : 0xd0)});
+      emitStore(insn.a);
+      break;
+    case V_NEGF:
+      emitLoad(insn.b);
+      emit({0x35});  // xor eax, sign bit
+      emit32(0x80000000u);
+      emitStore(insn.a);
+      break;
+    case V_NOTB:
+    case V_ITOB:
+      emitLoad(insn.b);
+      emit({0x85, 0xc0});  // test eax, eax
+      emitSet((insn.op == V_NOTB) ? CC_E : CC_NE, insn.a);
+      break;
+    case V_ITOF:
+      emitLoad(insn.b);
+      emit({0xf3, 0x0f, 0x2a, 0xc0});  // cvtsi2ss xmm0, eax
+      emitFrame({0xf3, 0x0f, 0x11}, EAX, insn.a);
+      break;
+    case V_FTOI:
+      // cvttss2si gives INT32_MIN out of range, as the interpreter does
+      emitFrame({0xf3, 0x0f, 0x2c}, EAX, insn.b);
+      emitStore(insn.a);
+      break;
+    case V_JMP:
+      emitJump({0xe9}, target);
+      break;
+    case V_BRT:
+    case V_BRF:
+      emitLoad(insn.a);
+      emit({0x85, 0xc0});
+      emitJump({0x0f, static_cast<uint8_t>(0x80
+          | ((insn.op == V_BRT) ? CC_NE : CC_E))}, target);
+      break;
+    case V_JLT:
+    case V_JLE:
+    case V_JGT:
+    case V_JGE:
+    case V_JEQ:
+    case V_JNE:
+      emitLoad(insn.a);
+      emitAlu(0x3b, 7, insn.b);
+      emitJump({0x0f, static_cast<uint8_t>(0x80 | int_conds[insn.op
+          - V_JLT])}, target);
+      break;
+    case V_CALL:
+      // Arguments go straight into the callee's frame, after this one
+      for (uint32_t i = 0; i < insn.imm.u; i++) {
+        emitLoad(call_args[insn.c + i], true);
+        emitFrame({REX_W, 0x89}, EAX, frame_size + i);
+      }
+      // The callee's code if it has any, else the VM, which takes the
+      // function in edx: lea rdi, frame; mov rsi, r12; mov edx, function;
+      // mov rax, [natives + function]; test rax, rax; jnz 1f;
+      // mov rax, call; 1: call rax
+      emitFrame({REX_W, 0x8d}, EDI, frame_size);
+      emit({0x4c, 0x89, 0xe6, 0xba});
+      emit32(insn.b);
+      emit({REX_W, 0xb8});
+      emit64(reinterpret_cast<uint64_t>(context.natives + insn.b));
+      emit({REX_W, 0x8b, 0x00, REX_W, 0x85, 0xc0, 0x75, 0x0a, REX_W, 0xb8});
+      emit64(reinterpret_cast<uint64_t>(context.call));
+      emit({0xff, 0xd0});
+      emitStore(insn.a, true);
+      break;
+    case V_CALLB:
+      emit({0xbf});
+      emit32(insn.b);
+      emitFrame({REX_W, 0x8b}, ESI, insn.c);
+      emitCall(context.builtin);
+      emitStore(insn.a, true);
+      break;
+    case V_RET:
+      emitLoad(insn.a, true);
+      emitEpilogue();
+      break;
+    case V_RETV:
+      emit({0x31, 0xc0});  // xor eax, eax
+      emitEpilogue();
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool Jit::writesA(const VmOp& op) {
+  return (op <= V_SLOT) || (op == V_GLOAD32) || (op == V_GLOAD64)
+      || (op == V_ALOAD32) || (op == V_ALOAD64)
+      || ((op >= V_ADDI) && (op <= V_ITOB)) || (op == V_CALL)
+      || (op == V_CALLB);
+}
+
+void Jit::emit(std::initializer_list<uint8_t> bytes) {
+  buf.insert(buf.end(), bytes);
+}
+
+void Jit::emit32(const uint32_t& val) {
+  for (int i = 0; i < 4; i++) buf.push_back((val >> (8 * i)) & 0xff);
+}
+
+void Jit::emit64(const uint64_t& val) {
+  for (int i = 0; i < 8; i++) buf.push_back((val >> (8 * i)) & 0xff);
+}
+
+// An instruction whose memory operand is frame word n: [rbx + disp32]
+void Jit::emitFrame(std::initializer_list<uint8_t> op, const uint8_t& reg,
+    const uint32_t& n) {
+  emit(op);
+  buf.push_back(0x83 | (reg << 3));
+  emit32(n * static_cast<uint32_t>(sizeof(VmValue)));
+}
+
+// eax (rax if wide) = frame word n
+void Jit::emitLoad(const uint32_t& n, const bool& wide) {
+  if (is_const[n]) {
+    emit({0xb8});  // mov eax, imm32, which clears the top of rax
+    emit32(const_vals[n]);
+  } else if (cached != n) {
+    if (wide) emit({REX_W});
+    emitFrame({0x8b}, EAX, n);
+  }
+  cached = n;
+}
+
+// A register other than eax = frame word n
+void Jit::emitLoadTo(const uint8_t& reg, const uint32_t& n, const bool& wide) {
+  if (is_const[n]) {
+    emit({static_cast<uint8_t>(0xb8 | reg)});
+    emit32(const_vals[n]);
+  } else {
+    if (wide) emit({REX_W});
+    emitFrame({0x8b}, reg, n);
+  }
+}
+
+// eax = eax op frame word n; ext picks the operation in the immediate form
+void Jit::emitAlu(const uint8_t& op, const uint8_t& ext, const uint32_t& n) {
+  if (is_const[n]) {
+    emit({0x81, static_cast<uint8_t>(0xc0 | (ext << 3))});
+    emit32(const_vals[n]);
+  } else {
+    emitFrame({op}, EAX, n);
+  }
+}
+
+// Frame word n = eax (rax if wide), which keeps it
+void Jit::emitStore(const uint32_t& n, const bool& wide) {
+  if (wide) emit({REX_W});
+  emitFrame({0x89}, EAX, n);
+  stored = n;
+}
+
+// Through rax, since the target can be anywhere in the address space
+void Jit::emitCall(const void* fn) {
+  emit({REX_W, 0xb8});
+  emit64(reinterpret_cast<uint64_t>(fn));
+  emit({0xff, 0xd0});
+}
+
+void Jit::emitJump(std::initializer_list<uint8_t> op, const uint32_t& target) {
+  emit(op);
+  fixups.push_back({buf.size(), target});
+  emit32(0);
+}
+
+// Jumps to a new error stub if the condition holds
+void Jit::emitStubJump(const uint8_t& cc, const StubKind& kind,
+    const uint32_t& num_insns, const uint32_t& count) {
+  emitJump({0x0f, static_cast<uint8_t>(0x80 | cc)}, num_insns
+      + static_cast<uint32_t>(stubs.size()));
+  stubs.push_back({kind, count});
+}
+
+// Frame word n = 1 if the condition holds, else 0
+void Jit::emitSet(const uint8_t& cc, const uint32_t& n) {
+  emit({0x0f, static_cast<uint8_t>(0x90 | cc), 0xc0, 0x0f, 0xb6, 0xc0});
+  emitStore(n);
+}
+
+// add rsp, 8; pop r12; pop rbx; ret
+void Jit::emitEpilogue() {
+  emit({REX_W, 0x83, 0xc4, 0x08, 0x41, 0x5c, 0x5b, 0xc3});
+}
+
+// Copies the code into pages of its own; they are never writable and
+// executable at once
+void* Jit::install() {
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t len = (buf.size() + page - 1) / page * page;
+  void* mem = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    LOG(ERROR) << "Cannot map memory for native code";
+    return nullptr;
+  }
+  std::memcpy(mem, buf.data(), buf.size());
+  if (mprotect(mem, len, PROT_READ | PROT_EXEC) != 0) {
+    LOG(ERROR) << "Cannot make native code executable";
+    munmap(mem, len);
+    return nullptr;
+  }
+  maps.push_back({mem, len});
+  num_bytes += buf.size();
+  return mem;
+}
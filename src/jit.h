@@ -0,0 +1,115 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "vm.h"
+
+// What the generated code needs from the VM that runs it
+struct JitContext {
+  // uint64_t call(VmValue* callee_regs, Vm*, uint32_t func), for callees
+  // that are not native yet; it takes the arguments of a JitCode
+  const void* call;
+  // uint64_t builtin(uint32_t builtin, uint64_t arg)
+  const void* builtin;
+  // void array_op(Vm*, VmValue* regs, uint32_t op)
+  const void* array_op;
+  // void overflow(), which does not return
+  const void* overflow;
+  const JitCode* natives;  // Function -> native code, patched as it appears
+  const VmValue* stack_end;  // Of the VM's value stack
+  const void* native_limit;  // Lowest safe stack pointer
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Baseline JIT
+// Translates the bytecode of one procedure to x86-64, one fixed template per
+// instruction. Registers stay in the VM frame, addressed off rbx, so native
+// and interpreted frames look the same and either can call the other. Calls
+// go through the table of native code pointers, so a callee compiled later is
+// picked up without touching its callers. Two things keep the templates from
+// being pure loads and stores: registers only ever loaded with one constant
+// are used as immediates, and a value just stored from eax is taken from eax
+// by the next instruction, unless control can reach it from elsewhere. Each
+// procedure gets its own mapping, written first and then made executable.
+// Anything without a template makes compile() give up, and the procedure
+// stays interpreted.
+////////////////////////////////////////////////////////////////////////////////
+class Jit {
+public:
+  Jit(const JitContext&);
+  ~Jit();
+  JitCode compile(const std::vector<VmInsn>&, const uint32_t&,
+      const uint32_t&, const uint32_t&, const std::vector<uint32_t>&);
+  size_t getNumBytes() { return num_bytes; }
+
+private:
+  enum Reg : uint8_t {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    ESI = 6,
+    EDI = 7,
+  };
+
+  // Where a rel32 needs patching, and what it points at
+  struct Fixup {
+    size_t pos;
+    uint32_t target;  // Instruction, or stub when past the end
+  };
+
+  enum StubKind {
+    STUB_BOUNDS,
+    STUB_DIV,
+    STUB_OVERFLOW,
+  };
+
+  // Out of line error path, with the array size for bounds errors
+  struct Stub {
+    StubKind kind;
+    uint32_t count;
+  };
+
+  static const uint32_t NO_REG = UINT32_MAX;
+
+  JitContext context;
+  std::vector<uint8_t> buf;
+  std::vector<size_t> offsets;  // Instruction -> position in buf
+  std::vector<Fixup> fixups;
+  std::vector<Stub> stubs;
+  std::vector<bool> targets;  // Instructions control can jump to
+  std::vector<bool> is_const;  // Register -> only ever holds const_vals
+  std::vector<uint32_t> const_vals;
+  uint32_t cached;  // Register whose value is in eax, or NO_REG
+  uint32_t stored;  // Register the current instruction left in eax
+  std::vector<std::pair<void*, size_t>> maps;
+  size_t num_bytes;
+
+  void scan(const std::vector<VmInsn>&, const uint32_t&, const uint32_t&,
+      const uint32_t&);
+  bool compileInsn(const VmInsn&, const uint32_t&, const uint32_t&,
+      const uint32_t&, const std::vector<uint32_t>&);
+  static bool writesA(const VmOp&);
+  void emit(std::initializer_list<uint8_t>);
+  void emit32(const uint32_t&);
+  void emit64(const uint64_t&);
+  void emitFrame(std::initializer_list<uint8_t>, const uint8_t&,
+      const uint32_t&);
+  void emitLoad(const uint32_t&, const bool& = false);
+  void emitLoadTo(const uint8_t&, const uint32_t&, const bool& = false);
+  void emitAlu(const uint8_t&, const uint8_t&, const uint32_t&);
+  void emitStore(const uint32_t&, const bool& = false);
+  void emitCall(const void*);
+  void emitJump(std::initializer_list<uint8_t>, const uint32_t&);
+  void emitStubJump(const uint8_t&, const StubKind&, const uint32_t&,
+      const uint32_t& = 0);
+  void emitSet(const uint8_t&, const uint32_t&);
+  void emitEpilogue();
+  void* install();
+};
+
+#endif // JIT_H
@@ -0,0 +1,718 @@
+#include "llvm_backend.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "array_fusion.h"
+#include "ir.h"
+#include "log.h"
+
+extern "C" {
+#include "../runtime/runtime.h"
+}
+
+LlvmBackend::LlvmBackend(Module& m, const bool& typed,
+    const uint32_t& par_min) :
+    module(m),
+    typed_ptrs(typed),
+    parallel_min(par_min),
+    func(nullptr),
+    func_idx(0),
+    fusion(nullptr),
+    next_tmp(0) {}
+
+void LlvmBackend::emit(std::ostream& os) {
+  // The vectorizer needs to know the target
+  os << "target datalayout = \"e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64"
+      << "-f80:128-n8:16:32:64-S128\"\n"
+      << "target triple = \"x86_64-pc-linux-gnu\"\n\n";
+  std::string str = getLlvmType(IR_STR);
+  os << "declare i32 @rt_streq(" << str << ", " << str << ")\n"
+      << "declare void @rt_bounds_error(i32, i32) noreturn nounwind\n"
+      << "declare void @rt_div_error() noreturn nounwind\n"
+      << "declare void @rt_flush() nounwind\n"
+      << "declare void @rt_parallel(" << (typed_ptrs ? "void (i8*, i32, i32)*"
+      : "ptr") << ", " << str << ", i32, " << str << ", i32)\n"
+      << "declare void @llvm.memset." << getMemIntrinsic() << "(" << str
+      << ", i8, i64, i1)\n"
+      << "declare void @llvm.memmove." << getMemIntrinsic(2) << "(" << str
+      << ", " << str << ", i64, i1)\n";
+  for (uint32_t i = 0; i < module.functions.size(); i++) {
+    Function& f = module.functions[i];
+    if (!f.external) continue;
+    os << "declare " << getLlvmType(f.ret_type) << " @"
+        << module.getLinkName(i) << "(";
+    for (uint32_t p = 0; p < f.params.size(); p++) {
+      if (p > 0) os << ", ";
+      os << getParamType(f.params[p]);
+    }
+    os << ")\n";
+  }
+  os << "\n";
+
+  // Short strings are constants; longer ones are data after their lengths
+  for (uint32_t i = 0; i < module.strings.size(); i++) {
+    size_t len = module.strings[i].size();
+    if (len <= RT_STR_INLINE) continue;
+    os << "@.str" << i << " = private unnamed_addr constant "
+        << getStringType(len) << " { i64 " << len << ", [" << len + 1
+        << " x i8] c\"";
+    for (unsigned char c : module.strings[i]) {
+      if ((c < 0x20) || (c >= 0x7f) || (c == '"') || (c == '\\')) {
+        static const char hex[] = "0123456789ABCDEF";
+        os << '\\' << hex[c >> 4] << hex[c & 15];
+      } else {
+        os << c;
+      }
+    }
+    os << "\\00\" }, align 8\n";
+  }
+  for (uint32_t i = 0; i < module.globals.size(); i++) {
+    Global& g = module.globals[i];
+    os << "@" << module.getGlobalName(i) << " = internal global ";
+    if (g.count > 0) {
+      os << "[" << g.count << " x " << getLlvmType(g.type)
+          << "] zeroinitializer, align 16\n";
+    } else {
+      os << getLlvmType(g.type)
+          << ((g.type == IR_STR) ? " null\n" : " zeroinitializer\n");
+    }
+  }
+
+  for (func_idx = 0; func_idx < module.functions.size(); func_idx++) {
+    func = &module.functions[func_idx];
+    if (func->external) continue;
+    os << "\n";
+    emitFunction(os);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void LlvmBackend::emitFunction(std::ostream& os) {
+  names.assign(func->instrs.size(), "");
+  elem_types.assign(func->instrs.size(), IR_VOID);
+  end_labels.assign(func->blocks.size(), "");
+  tail.str("");
+  tail.clear();
+  allocas.str("");
+  workers.str("");
+  next_tmp = 0;
+  ArrayFusion func_fusion(*func);
+  fusion = &func_fusion;
+
+  // Names are known up front since phis can refer to later values
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      switch (instr.op) {
+        case IR_CONST:
+          names[v] = getConst(instr);
+          break;
+        case IR_PARAM:
+          names[v] = "%a" + std::to_string(instr.imm.u);
+          elem_types[v] = func->params[instr.imm.u].type;
+          break;
+        case IR_SLOT:
+          names[v] = fusion->isSlotUnused(instr.imm.u)
+              ? "null" : "%s" + std::to_string(instr.imm.u);
+          elem_types[v] = func->slots[instr.imm.u].type;
+          break;
+        case IR_GADDR: {
+          Global& g = module.globals[instr.imm.u];
+          names[v] = getElemAddr(g.count, g.type,
+              "@" + module.getGlobalName(instr.imm.u));
+          elem_types[v] = g.type;
+          break;
+        }
+        case IR_BTOI:
+          // Bools are already the int they convert to
+          names[v] = names[func->getOperand(v, 0)];
+          break;
+        default:
+          names[v] = "%v" + std::to_string(v);
+          break;
+      }
+    }
+  }
+
+  // Bodies first, so each phi knows the block its incoming edges leave from
+  // and the entry block has the contexts of parallel operations
+  std::vector<std::string> bodies;
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    std::ostringstream body;
+    curr_label = "L" + std::to_string(b);
+    for (ValueId v : func->blocks[b].instrs) {
+      if (func->instrs[v].op != IR_PHI) emitInstr(body, v);
+    }
+    end_labels[b] = curr_label;
+    bodies.push_back(body.str());
+  }
+
+  // Bools are i32 0 or 1 to match the runtime
+  if (func->is_main) {
+    os << "define i32 @main() {\n";
+  } else {
+    os << "define internal " << getLlvmType(func->ret_type) << " @"
+        << module.getLinkName(func_idx) << "(";
+    for (uint32_t i = 0; i < func->params.size(); i++) {
+      if (i > 0) os << ", ";
+      os << getParamType(func->params[i]) << " %a" << i;
+    }
+    os << ") {\n";
+  }
+
+  // A separate entry block holds the frame, since the first block of the IR
+  // may be a branch target
+  os << "entry:\n";
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (fusion->isSlotUnused(i)) continue;
+    std::string name = "%s" + std::to_string(i);
+    std::string array = typed_ptrs ? name + ".a" : name;
+    os << "  " << array << " = alloca [" << slot.count << " x "
+        << getLlvmType(slot.type) << "], align 16\n";
+    if (typed_ptrs) {
+      std::string array_type = "[" + std::to_string(slot.count) + " x "
+          + getLlvmType(slot.type) + "]";
+      os << "  " << name << " = getelementptr inbounds " << array_type << ", "
+          << array_type << "* " << array << ", i64 0, i64 0\n";
+    }
+  }
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (!slot.zeroed) continue;
+    uint32_t bytes = slot.count * getElemSize(slot.type);
+    std::string ptr = getBytePtr(os, slot.type, "%s" + std::to_string(i));
+    os << "  call void @llvm.memset." << getMemIntrinsic() << "("
+        << getLlvmType(IR_STR) << " " << ptr << ", i8 0, i64 " << bytes
+        << ", i1 false)\n";
+  }
+  os << allocas.str()
+      << "  br label %L0\n";
+
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    Block& block = func->blocks[b];
+    os << "L" << b << ":\n";
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      if (instr.op != IR_PHI) break;
+      os << "  " << names[v] << " = phi " << getValueType(v) << " ";
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        if (i > 0) os << ", ";
+        os << "[ " << getName(v, i) << ", %" << end_labels[block.preds[i]]
+            << " ]";
+      }
+      os << "\n";
+    }
+    os << bodies[b];
+  }
+  os << tail.str() << "}\n" << workers.str();
+  fusion = nullptr;
+}
+
+void LlvmBackend::emitInstr(std::ostream& os, const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  std::string type = getLlvmType(instr.type);
+  IrType src_type = (instr.src_type != IR_VOID) ? instr.src_type : instr.type;
+  switch (instr.op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_SLOT:
+    case IR_GADDR:
+      // Used directly as operands
+      break;
+    case IR_GLOAD:
+      os << "  " << names[v] << " = load " << type << ", "
+          << getPtrType(instr.type) << " @"
+          << module.getGlobalName(instr.imm.u) << "\n";
+      break;
+    case IR_GSTORE:
+      os << "  store " << type << " " << getName(v, 0) << ", "
+          << getPtrType(instr.type) << " @"
+          << module.getGlobalName(instr.imm.u) << "\n";
+      break;
+    case IR_ALOAD:
+    case IR_ASTORE: {
+      std::string idx = getName(v, 1);
+      if (!(instr.flags & IR_FLAG_IN_BOUNDS)) {
+        std::string oob = newTmp();
+        os << "  " << oob << " = icmp uge i32 " << idx << ", " << instr.count
+            << "\n";
+        emitCheck(os, oob, "call void @rt_bounds_error(i32 " + idx + ", i32 "
+            + std::to_string(instr.count) + ")");
+      }
+      std::string addr = newTmp();
+      std::string ptr = getPtrType(instr.type);
+      os << "  " << addr << " = getelementptr inbounds " << type << ", "
+          << ptr << " " << getName(v, 0) << ", i32 " << idx << "\n";
+      if (instr.op == IR_ALOAD) {
+        os << "  " << names[v] << " = load " << type << ", " << ptr << " "
+            << addr << "\n";
+      } else {
+        os << "  store " << type << " " << getName(v, 2) << ", " << ptr << " "
+            << addr << "\n";
+      }
+      break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      emitScalarOp(os, instr.op, src_type, names[v], getName(v, 0),
+          getName(v, 1));
+      break;
+    case IR_NEG:
+    case IR_NOT:
+      emitScalarOp(os, instr.op, src_type, names[v], getName(v, 0));
+      break;
+    case IR_ITOF:
+    case IR_FTOI:
+    case IR_ITOB:
+      emitConversion(os, instr.src_type, instr.type, names[v], getName(v, 0));
+      break;
+    case IR_BTOI:
+      break;
+    case IR_ACOPY: {
+      std::string dst = getBytePtr(os, instr.type, getName(v, 0));
+      std::string src = getBytePtr(os, instr.type, getName(v, 1));
+      std::string bytes = getLlvmType(IR_STR);
+      os << "  call void @llvm.memmove." << getMemIntrinsic(2) << "(" << bytes
+          << " " << dst << ", " << bytes << " " << src << ", i64 "
+          << instr.count * getElemSize(instr.type) << ", i1 false)\n";
+      break;
+    }
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      if (fusion->isFused(v)) break;
+      if ((parallel_min > 0) && (instr.count >= parallel_min)
+          && !fusion->canFail(v)) {
+        emitParallelOp(os, v);
+      } else {
+        emitArrayOp(os, v, "0", std::to_string(instr.count));
+      }
+      break;
+    case IR_CALL: {
+      Function& callee = module.functions[instr.imm.u];
+      os << "  ";
+      if (instr.type != IR_VOID) os << names[v] << " = ";
+      os << "call " << type << " @" << module.getLinkName(instr.imm.u) << "(";
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        if (i > 0) os << ", ";
+        os << getParamType(callee.params[i]) << " " << getName(v, i);
+      }
+      os << ")\n";
+      break;
+    }
+    case IR_BR:
+      os << "  br label %L" << func->blocks[instr.block].succs[0] << "\n";
+      break;
+    case IR_CBR: {
+      std::string c = newTmp();
+      os << "  " << c << " = icmp ne i32 " << getName(v, 0) << ", 0\n"
+          << "  br i1 " << c << ", label %L"
+          << func->blocks[instr.block].succs[0] << ", label %L"
+          << func->blocks[instr.block].succs[1] << "\n";
+      break;
+    }
+    case IR_RET:
+      if (instr.num_ops > 0) {
+        Instr& val = func->instrs[func->getOperand(v, 0)];
+        os << "  ret " << getLlvmType(val.type) << " " << getName(v, 0)
+            << "\n";
+      } else if (func->is_main) {
+        os << "  call void @rt_flush()\n  ret i32 0\n";
+      } else {
+        os << "  ret void\n";
+      }
+      break;
+    default:
+      LOG(ERROR) << "Cannot translate " << Module::getOpName(instr.op);
+      break;
+  }
+}
+
+// A counted loop over elements begin to end; the loop vectorizer takes it
+// from here
+void LlvmBackend::emitArrayOp(std::ostream& os, const ValueId& v,
+    const std::string& begin, const std::string& end) {
+  Instr& instr = func->instrs[v];
+  std::string loop = "A" + std::to_string(v);
+  std::string i = "%" + loop + ".i";
+  std::string next = "%" + loop + ".next";
+  std::string pre = curr_label;
+  os << "  br label %" << loop << ".head\n";
+  emitLabel(os, loop + ".head");
+  os << "  " << i << " = phi i64 [ " << begin << ", %" << pre << " ], [ "
+      << next << ", %" << loop << ".latch ]\n";
+  std::string more = newTmp();
+  os << "  " << more << " = icmp ult i64 " << i << ", " << end << "\n"
+      << "  br i1 " << more << ", label %" << loop << ".body, label %" << loop
+      << ".done\n";
+  emitLabel(os, loop + ".body");
+  std::string r = emitElemOp(os, v, i);
+  std::string dst = getLlvmType(instr.type);
+  std::string dst_ptr = getPtrType(instr.type);
+  std::string addr = newTmp();
+  os << "  " << addr << " = getelementptr inbounds " << dst << ", " << dst_ptr
+      << " " << getName(v, 0) << ", i64 " << i << "\n"
+      << "  store " << dst << " " << r << ", " << dst_ptr << " " << addr
+      << "\n"
+      << "  br label %" << loop << ".latch\n";
+  emitLabel(os, loop + ".latch");
+  os << "  " << next << " = add nuw i64 " << i << ", 1\n"
+      << "  br label %" << loop << ".head\n";
+  emitLabel(os, loop + ".done");
+}
+
+// The loop moves to a worker over a chunk of the elements, which loads the
+// values it uses from a struct the caller fills in, and uses the loaded
+// copies in place of the originals while its loop is emitted
+void LlvmBackend::emitParallelOp(std::ostream& os, const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  std::string name = "@par" + std::to_string(func_idx) + "_"
+      + std::to_string(v);
+  std::string ctx = "%c" + std::to_string(v);
+  std::vector<ValueId> args = {func->getOperand(v, 0)};
+  fusion->findArgs(v, args);
+  std::string type = "{ ";
+  for (uint32_t k = 0; k < args.size(); k++) {
+    type += ((k > 0) ? ", " : "") + getValueType(args[k]);
+  }
+  type += " }";
+  std::string type_ptr = typed_ptrs ? type + "*" : "ptr";
+  allocas << "  " << ctx << " = alloca " << type << ", align 8\n";
+  for (uint32_t k = 0; k < args.size(); k++) {
+    std::string field = newTmp();
+    std::string arg_type = getValueType(args[k]);
+    os << "  " << field << " = getelementptr inbounds " << type << ", "
+        << type_ptr << " " << ctx << ", i32 0, i32 " << k << "\n"
+        << "  store " << arg_type << " " << names[args[k]] << ", "
+        << (typed_ptrs ? arg_type + "*" : "ptr") << " " << field << "\n";
+  }
+  std::string byte_ptr = getLlvmType(IR_STR);
+  std::string ctx_ptr = ctx;
+  if (typed_ptrs) {
+    ctx_ptr = newTmp();
+    os << "  " << ctx_ptr << " = bitcast " << type_ptr << " " << ctx
+        << " to i8*\n";
+  }
+  std::string dst = getBytePtr(os, instr.type, getName(v, 0));
+  os << "  call void @rt_parallel(" << (typed_ptrs ? "void (i8*, i32, i32)*"
+      : "ptr") << " " << name << ", " << byte_ptr << " " << ctx_ptr
+      << ", i32 " << instr.count << ", " << byte_ptr << " " << dst << ", i32 "
+      << getElemSize(instr.type) << ")\n";
+
+  std::string saved_label = curr_label;
+  std::vector<std::string> saved_names;
+  workers << "\ndefine internal void " << name << "(" << byte_ptr
+      << " %ctx, i32 %begin, i32 %end) {\n";
+  emitLabel(workers, "entry");
+  std::string fields = "%ctx";
+  if (typed_ptrs) {
+    fields = newTmp();
+    workers << "  " << fields << " = bitcast i8* %ctx to " << type_ptr
+        << "\n";
+  }
+  for (uint32_t k = 0; k < args.size(); k++) {
+    std::string field = newTmp();
+    std::string val = newTmp();
+    std::string arg_type = getValueType(args[k]);
+    workers << "  " << field << " = getelementptr inbounds " << type << ", "
+        << type_ptr << " " << fields << ", i32 0, i32 " << k << "\n"
+        << "  " << val << " = load " << arg_type << ", "
+        << (typed_ptrs ? arg_type + "*" : "ptr") << " " << field << "\n";
+    saved_names.push_back(names[args[k]]);
+    names[args[k]] = val;
+  }
+  workers << "  %b = zext i32 %begin to i64\n"
+      << "  %e = zext i32 %end to i64\n";
+  emitArrayOp(workers, v, "%b", "%e");
+  workers << "  ret void\n"
+      << "}\n";
+  for (uint32_t k = 0; k < args.size(); k++) names[args[k]] = saved_names[k];
+  curr_label = saved_label;
+}
+
+// Element i of the result of an array operation
+std::string LlvmBackend::emitElemOp(std::ostream& os, const ValueId& v,
+    const std::string& i) {
+  Instr& instr = func->instrs[v];
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  Opcode op = static_cast<Opcode>(instr.imm.u);
+  std::string a = emitElem(os, v, 1, i);
+  if ((instr.op == IR_ACONV) && (src_type == IR_BOOL)
+      && (instr.type == IR_INT)) {
+    return a;
+  }
+  std::string r = newTmp();
+  if (instr.op == IR_ABIN) {
+    emitScalarOp(os, op, src_type, r, a, emitElem(os, v, 2, i));
+  } else if (instr.op == IR_AUN) {
+    emitScalarOp(os, op, src_type, r, a);
+  } else {
+    emitConversion(os, src_type, instr.type, r, a);
+  }
+  return r;
+}
+
+// Element i of operand n of an array operation: the scalar itself, a load,
+// or the fused operation computing it
+std::string LlvmBackend::emitElem(std::ostream& os, const ValueId& v,
+    const uint32_t& n, const std::string& i) {
+  Instr& instr = func->instrs[v];
+  uint8_t scalar = (n == 1) ? IR_FLAG_LHS_SCALAR : IR_FLAG_RHS_SCALAR;
+  if ((instr.op == IR_ABIN) && (instr.flags & scalar)) return getName(v, n);
+  ValueId source = fusion->getSource(v, n);
+  if (source != NO_VALUE) return emitElemOp(os, source, i);
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  std::string src = getLlvmType(src_type);
+  std::string src_ptr = getPtrType(src_type);
+  std::string addr = newTmp();
+  std::string val = newTmp();
+  os << "  " << addr << " = getelementptr inbounds " << src << ", "
+      << src_ptr << " " << getName(v, n) << ", i64 " << i << "\n"
+      << "  " << val << " = load " << src << ", " << src_ptr << " " << addr
+      << "\n";
+  return val;
+}
+
+// A scalar operation on operands of type type, defining r
+void LlvmBackend::emitScalarOp(std::ostream& os, const Opcode& op,
+    const IrType& type, const std::string& r, const std::string& a,
+    const std::string& b) {
+  static const std::string int_ops[] = {"add", "sub", "mul", "sdiv", "and",
+    "or"};
+  static const std::string flt_ops[] = {"fadd", "fsub", "fmul", "fdiv"};
+  static const std::string icmps[] = {"slt", "sle", "sgt", "sge", "eq", "ne"};
+  // Unordered compares are false, except for !=
+  static const std::string fcmps[] = {"olt", "ole", "ogt", "oge", "oeq",
+    "une"};
+  std::string t = getLlvmType(type);
+  switch (op) {
+    case IR_DIV:
+      if (type == IR_INT) {
+        // Division by zero is an error, and INT_MIN / -1 wraps
+        std::string zero = newTmp();
+        os << "  " << zero << " = icmp eq i32 " << b << ", 0\n";
+        emitCheck(os, zero, "call void @rt_div_error()");
+        std::string minus1 = newTmp();
+        std::string divisor = newTmp();
+        std::string quot = newTmp();
+        std::string neg = newTmp();
+        os << "  " << minus1 << " = icmp eq i32 " << b << ", -1\n"
+            << "  " << divisor << " = select i1 " << minus1 << ", i32 1, i32 "
+            << b << "\n"
+            << "  " << quot << " = sdiv i32 " << a << ", " << divisor << "\n"
+            << "  " << neg << " = sub i32 0, " << a << "\n"
+            << "  " << r << " = select i1 " << minus1 << ", i32 " << neg
+            << ", i32 " << quot << "\n";
+        return;
+      }
+      // Fall through
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+      os << "  " << r << " = "
+          << ((type == IR_FLT) ? flt_ops[op - IR_ADD] : int_ops[op - IR_ADD])
+          << " " << t << " " << a << ", " << b << "\n";
+      return;
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE: {
+      std::string c = newTmp();
+      if (type == IR_STR) {
+        std::string eq = newTmp();
+        os << "  " << eq << " = call i32 @rt_streq(" << t << " " << a << ", "
+            << t << " " << b << ")\n"
+            << "  " << r << " = xor i32 " << eq << ", "
+            << ((op == IR_NE) ? 1 : 0) << "\n";
+        return;
+      } else if (type == IR_FLT) {
+        os << "  " << c << " = fcmp " << fcmps[op - IR_LT] << " float " << a
+            << ", " << b << "\n";
+      } else {
+        os << "  " << c << " = icmp " << icmps[op - IR_LT] << " i32 " << a
+            << ", " << b << "\n";
+      }
+      os << "  " << r << " = zext i1 " << c << " to i32\n";
+      return;
+    }
+    case IR_NEG:
+      if (type == IR_FLT) {
+        os << "  " << r << " = fneg float " << a << "\n";
+      } else {
+        os << "  " << r << " = sub i32 0, " << a << "\n";
+      }
+      return;
+    case IR_NOT:
+      os << "  " << r << " = xor i32 " << a << ", "
+          << ((type == IR_BOOL) ? 1 : -1) << "\n";
+      return;
+    default:
+      LOG(ERROR) << "Cannot translate " << Module::getOpName(op);
+      return;
+  }
+}
+
+// Bools are 0 or 1, so they convert to float like the int they hold; out of
+// range float to int conversions give INT_MIN, as cvttss2si does
+void LlvmBackend::emitConversion(std::ostream& os, const IrType& from,
+    const IrType& to, const std::string& r, const std::string& a) {
+  if (to == IR_FLT) {
+    os << "  " << r << " = sitofp i32 " << a << " to float\n";
+    return;
+  }
+  std::string val = a;
+  if (from == IR_FLT) {
+    std::string lo = newTmp();
+    std::string hi = newTmp();
+    std::string in_range = newTmp();
+    std::string conv = newTmp();
+    val = (to == IR_INT) ? r : newTmp();
+    os << "  " << lo << " = fcmp ogt float " << a << ", 0xC1E0000020000000\n"
+        << "  " << hi << " = fcmp olt float " << a << ", 0x41E0000000000000\n"
+        << "  " << in_range << " = and i1 " << lo << ", " << hi << "\n"
+        << "  " << conv << " = fptosi float " << a << " to i32\n"
+        << "  " << val << " = select i1 " << in_range << ", i32 " << conv
+        << ", i32 -2147483648\n";
+  }
+  if (to == IR_BOOL) {
+    std::string c = newTmp();
+    os << "  " << c << " = icmp ne i32 " << val << ", 0\n"
+        << "  " << r << " = zext i1 " << c << " to i32\n";
+  }
+}
+
+// Branch to an out-of-line call to a noreturn runtime routine when cond holds
+void LlvmBackend::emitCheck(std::ostream& os, const std::string& cond,
+    const std::string& call) {
+  std::string label = "E" + std::to_string(next_tmp++);
+  os << "  br i1 " << cond << ", label %" << label << ".fail, label %" << label
+      << ".ok\n";
+  tail << label << ".fail:\n  " << call << "\n  unreachable\n";
+  emitLabel(os, label + ".ok");
+}
+
+void LlvmBackend::emitLabel(std::ostream& os, const std::string& label) {
+  os << label << ":\n";
+  curr_label = label;
+}
+
+// LLVM writes float constants as the hex bits of the equivalent double
+std::string LlvmBackend::getConst(const Instr& instr) {
+  if (instr.type == IR_FLT) {
+    double d = instr.imm.f;
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    std::ostringstream ss;
+    ss << "0x" << std::hex << std::uppercase << std::setw(16)
+        << std::setfill('0') << bits;
+    return ss.str();
+  } else if (instr.type == IR_STR) {
+    const std::string& s = module.strings[instr.imm.u];
+    if (s.empty()) return "null";
+    if (s.size() <= RT_STR_INLINE) {
+      return "inttoptr (i64 " + std::to_string(rt_str_inline(s.data(),
+          static_cast<uint32_t>(s.size()))) + " to " + getLlvmType(IR_STR)
+          + ")";
+    }
+    std::string type = getStringType(s.size());
+    std::string str = "@.str" + std::to_string(instr.imm.u);
+    if (!typed_ptrs) {
+      return "getelementptr inbounds (" + type + ", ptr " + str
+          + ", i64 0, i32 1)";
+    }
+    return "getelementptr inbounds (" + type + ", " + type + "* " + str
+        + ", i64 0, i32 1, i64 0)";
+  }
+  return std::to_string(instr.imm.i);
+}
+
+// A long string literal: its length, then its bytes and a NUL
+std::string LlvmBackend::getStringType(const size_t& len) {
+  return "{ i64, [" + std::to_string(len + 1) + " x i8] }";
+}
+
+// Address of the first element of a global array; with typed pointers that
+// takes a getelementptr
+std::string LlvmBackend::getElemAddr(const uint32_t& count, const IrType& type,
+    const std::string& array) {
+  if (!typed_ptrs) return array;
+  std::string array_type = "[" + std::to_string(count) + " x "
+      + getLlvmType(type) + "]";
+  return "getelementptr inbounds (" + array_type + ", " + array_type + "* "
+      + array + ", i64 0, i64 0)";
+}
+
+// Array pointer as the i8* the memory intrinsics take
+std::string LlvmBackend::getBytePtr(std::ostream& os, const IrType& type,
+    const std::string& ptr) {
+  if (!typed_ptrs) return ptr;
+  std::string r = newTmp();
+  os << "  " << r << " = bitcast " << getPtrType(type) << " " << ptr
+      << " to i8*\n";
+  return r;
+}
+
+// Overload suffix of llvm.memset (one pointer) or llvm.memmove (two)
+std::string LlvmBackend::getMemIntrinsic(const int& num_ptrs) {
+  std::string ptr = typed_ptrs ? "p0i8." : "p0.";
+  return (num_ptrs == 2) ? ptr + ptr + "i64" : ptr + "i64";
+}
+
+std::string LlvmBackend::getParamType(const Param& param) {
+  return (param.count > 0) ? getPtrType(param.type) : getLlvmType(param.type);
+}
+
+std::string LlvmBackend::getValueType(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  if (instr.type != IR_PTR) return getLlvmType(instr.type);
+  IrType elem = elem_types[v];
+  if ((elem == IR_VOID) && (instr.op == IR_PHI)) {
+    elem = elem_types[func->getOperand(v, 0)];
+  }
+  return getPtrType(elem);
+}
+
+// Pointer to an element of type type
+std::string LlvmBackend::getPtrType(const IrType& type) {
+  return typed_ptrs ? getLlvmType(type) + "*" : "ptr";
+}
+
+std::string LlvmBackend::getLlvmType(const IrType& type) {
+  switch (type) {
+    case IR_INT:
+    case IR_BOOL:
+      return "i32";
+    case IR_FLT:
+      return "float";
+    case IR_STR:
+      return typed_ptrs ? "i8*" : "ptr";
+    case IR_PTR:
+      return "ptr";
+    default:
+      return "void";
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef LLVM_BACKEND_H
+#define LLVM_BACKEND_H
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "array_fusion.h"
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// LLVM IR generator
+// Prints textual LLVM IR for opt and llc, with opaque pointers or, for LLVM
+// releases before 15, typed pointers. The IR is already in SSA form, so
+// values and phis carry over directly; globals and frame arrays become
+// fixed-size array objects, builtins are declared external, and whole-array
+// operations become counted loops for the loop vectorizer, with fused
+// operations computed inside the loop that reads them. Large ones that cannot
+// fail run in a worker function that rt_parallel calls on each thread's chunk.
+// Bounds checks, division by zero and out of range conversions keep the
+// semantics of the other backends rather than becoming undefined behavior.
+////////////////////////////////////////////////////////////////////////////////
+class LlvmBackend {
+public:
+  LlvmBackend(Module&, const bool& = false,
+      const uint32_t& = DEFAULT_PARALLEL_MIN);
+  void emit(std::ostream&);
+
+private:
+  Module& module;
+  bool typed_ptrs;
+  uint32_t parallel_min;  // Elements; 0 never splits an operation
+  Function* func;
+  uint32_t func_idx;
+  ArrayFusion* fusion;
+  std::vector<std::string> names;  // ValueId -> operand text
+  std::vector<IrType> elem_types;  // ValueId of an array address -> element
+  std::vector<std::string> end_labels;  // Block -> label its terminator is in
+  std::ostringstream tail;  // Error blocks, after the function body
+  std::ostringstream allocas;  // Parallel operation contexts, in the entry
+  std::ostringstream workers;  // After the function that uses them
+  std::string curr_label;
+  uint32_t next_tmp;
+
+  void emitFunction(std::ostream&);
+  void emitInstr(std::ostream&, const ValueId&);
+  void emitArrayOp(std::ostream&, const ValueId&, const std::string&,
+      const std::string&);
+  void emitParallelOp(std::ostream&, const ValueId&);
+  std::string emitElemOp(std::ostream&, const ValueId&, const std::string&);
+  std::string emitElem(std::ostream&, const ValueId&, const uint32_t&,
+      const std::string&);
+  void emitScalarOp(std::ostream&, const Opcode&, const IrType&,
+      const std::string&, const std::string&, const std::string& = "");
+  void emitConversion(std::ostream&, const IrType&, const IrType&,
+      const std::string&, const std::string&);
+  void emitCheck(std::ostream&, const std::string&, const std::string&);
+  void emitLabel(std::ostream&, const std::string&);
+  std::string newTmp() { return "%t" + std::to_string(next_tmp++); }
+  std::string getName(const ValueId& v, const uint32_t& n) {
+    return names[func->getOperand(v, n)];
+  }
+  std::string getConst(const Instr&);
+  std::string getElemAddr(const uint32_t&, const IrType&, const std::string&);
+  std::string getStringType(const size_t&);
+  std::string getBytePtr(std::ostream&, const IrType&, const std::string&);
+  std::string getMemIntrinsic(const int& = 1);
+  std::string getParamType(const Param&);
+  std::string getValueType(const ValueId&);
+  std::string getPtrType(const IrType&);
+  std::string getLlvmType(const IrType&);
+};
+
+#endif // LLVM_BACKEND_H
@@ -40,14 +40,18 @@ public:
       has_errored = true;
     }
     log_fstream.open(log_file, std::ios::app);
-    std::cout << COLORS[type];
+    if (msg_level >= min_level) {
+      std::cout << COLORS[type];
+    }
     operator<<(LABELS[type]);
     operator<<(" Line ") << std::setfill(' ') << std::setw(3) << line_number
         << ' ';
   }
   ~LOG() {
     // Reset color, new line, and handle stream
-    std::cout << COL_RST;
+    if (msg_level >= min_level) {
+      std::cout << COL_RST;
+    }
     operator<<('\n');
     std::cout << std::flush;
     if (log_fstream) {
@@ -0,0 +1,360 @@
+#include "loop_optimizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+LoopOptimizer::LoopOptimizer(Module& m) :
+    module(m),
+    func(nullptr),
+    writes_arrays(false),
+    has_calls(false),
+    num_loops(0),
+    num_ivs(0),
+    num_reduced(0),
+    num_hoisted(0) {}
+
+void LoopOptimizer::run() {
+  for (auto& f : module.functions) {
+    if (f.external) continue;
+    func = &f;
+    runFunction();
+  }
+  LOG(INFO) << "Loop optimization: " << num_loops << " loops, " << num_ivs
+      << " induction variables, " << num_reduced
+      << " multiplications reduced, " << num_hoisted
+      << " instructions hoisted";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void LoopOptimizer::runFunction() {
+  findLoops();
+  if (loops.empty()) return;
+  for (auto& loop : loops) {
+    if (!findPreheader(loop)) continue;
+    num_loops++;
+    hoistInvariants(loop);
+    reduceStrength(loop);
+  }
+  func->compact();
+}
+
+// A back edge goes to a block that dominates its source; the loop is the
+// header and every block that reaches the source without passing it. Loops
+// sharing a header are one loop. Sorted by size, so an inner loop comes
+// before the ones around it.
+void LoopOptimizer::findLoops() {
+  loops.clear();
+  std::vector<BlockId> idoms = func->findIdoms();
+  size_t num_blocks = func->blocks.size();
+  std::vector<uint32_t> loop_of(num_blocks, UINT32_MAX);
+  for (BlockId t = 0; t < num_blocks; t++) {
+    for (BlockId h : func->blocks[t].succs) {
+      BlockId x = t;
+      while ((x != h) && (x != 0)) x = idoms[x];
+      if (x != h) continue;
+      if (loop_of[h] == UINT32_MAX) {
+        loop_of[h] = static_cast<uint32_t>(loops.size());
+        loops.push_back({h, h, std::vector<bool>(num_blocks, false), 1});
+        loops.back().body[h] = true;
+      }
+      Loop& loop = loops[loop_of[h]];
+      std::vector<BlockId> work(1, t);
+      while (!work.empty()) {
+        BlockId b = work.back();
+        work.pop_back();
+        if (loop.body[b]) continue;
+        loop.body[b] = true;
+        loop.size++;
+        for (BlockId p : func->blocks[b].preds) work.push_back(p);
+      }
+    }
+  }
+  std::stable_sort(loops.begin(), loops.end(),
+      [](const Loop& a, const Loop& b) { return a.size < b.size; });
+}
+
+// The loop's one predecessor from outside, given a block of its own if it
+// also branches elsewhere; false if the loop is entered from more than one
+// place
+bool LoopOptimizer::findPreheader(Loop& loop) {
+  BlockId h = loop.header;
+  uint32_t pos = 0;
+  uint32_t num_outside = 0;
+  std::vector<BlockId>& preds = func->blocks[h].preds;
+  for (uint32_t i = 0; i < preds.size(); i++) {
+    if (loop.body[preds[i]]) continue;
+    pos = i;
+    num_outside++;
+  }
+  if (num_outside != 1) return false;
+  BlockId p = preds[pos];
+  if (func->blocks[p].succs.size() == 1) {
+    loop.preheader = p;
+    return true;
+  }
+
+  // Split the edge in place, so the phis in the header keep their order
+  BlockId n = func->addBlock();
+  func->blocks[h].preds[pos] = n;
+  std::replace(func->blocks[p].succs.begin(), func->blocks[p].succs.end(),
+      h, n);
+  func->blocks[n].preds.push_back(p);
+  func->blocks[n].succs.push_back(h);
+  func->append(n, func->addInstr(IR_BR, IR_VOID));
+  for (auto& other : loops) {
+    other.body.push_back(other.body[p] && other.body[h]);
+  }
+  loop.preheader = n;
+  return true;
+}
+
+void LoopOptimizer::hoistInvariants(Loop& loop) {
+  findEffects(loop);
+
+  // Moving one instruction out can make others invariant, and the blocks of
+  // an inner loop's preheader are numbered after its body
+  BlockId pre = loop.preheader;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (BlockId b = 0; b < func->blocks.size(); b++) {
+      if (!loop.body[b]) continue;
+      std::vector<ValueId>& instrs = func->blocks[b].instrs;
+      for (uint32_t i = 0; i < instrs.size();) {
+        ValueId v = instrs[i];
+        if (!canHoist(loop, v)) {
+          i++;
+          continue;
+        }
+        instrs.erase(instrs.begin() + i);
+        insertBefore(pre, static_cast<uint32_t>(func->blocks[pre].instrs.size()
+            - 1), v);
+        num_hoisted++;
+        changed = true;
+      }
+    }
+  }
+}
+
+// What the loop writes that a load moved out of it could miss; a call can
+// write any global
+void LoopOptimizer::findEffects(const Loop& loop) {
+  writes_arrays = false;
+  has_calls = false;
+  stored.clear();
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    if (!loop.body[b]) continue;
+    for (ValueId v : func->blocks[b].instrs) {
+      Instr& instr = func->instrs[v];
+      switch (instr.op) {
+        case IR_CALL:
+          has_calls = true;
+          writes_arrays = true;
+          break;
+        case IR_GSTORE:
+          stored.insert(instr.imm.u);
+          break;
+        case IR_ASTORE:
+        case IR_ACOPY:
+        case IR_ABIN:
+        case IR_AUN:
+        case IR_ACONV:
+          writes_arrays = true;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+}
+
+// Whether v computes the same thing before the loop as in it and cannot
+// fail or be seen to run when the loop does not
+bool LoopOptimizer::canHoist(const Loop& loop, const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  switch (instr.op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+    case IR_NEG:
+    case IR_NOT:
+    case IR_ITOF:
+    case IR_FTOI:
+    case IR_ITOB:
+    case IR_BTOI:
+      break;
+    case IR_DIV: {
+      if (instr.type != IR_INT) break;
+      Instr& rhs = func->instrs[func->getOperand(v, 1)];
+      if ((rhs.op != IR_CONST) || (rhs.imm.i == 0) || (rhs.imm.i == -1)) {
+        return false;
+      }
+      break;
+    }
+    case IR_GLOAD:
+      if (has_calls || (stored.count(instr.imm.u) > 0)) return false;
+      break;
+    case IR_ALOAD: {
+      // Only a constant index is known to be in range wherever it is used;
+      // other proofs can depend on a branch taken inside the loop
+      if (writes_arrays) return false;
+      Instr& idx = func->instrs[func->getOperand(v, 1)];
+      if ((idx.op != IR_CONST) || (idx.imm.i < 0)
+          || (idx.imm.u >= instr.count)) {
+        return false;
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+  for (uint32_t i = 0; i < instr.num_ops; i++) {
+    if (!isInvariant(loop, func->getOperand(v, i))) return false;
+  }
+  return true;
+}
+
+void LoopOptimizer::reduceStrength(Loop& loop) {
+  BlockId h = loop.header;
+  Block& header = func->blocks[h];
+  if (header.preds.size() != 2) return;
+  uint32_t pre_idx = (header.preds[0] == loop.preheader) ? 0 : 1;
+  uint32_t latch_idx = 1 - pre_idx;
+
+  std::vector<Induction> ivs;
+  for (ValueId v : header.instrs) {
+    Instr& phi = func->instrs[v];
+    if (phi.op != IR_PHI) break;
+    if (phi.type != IR_INT) continue;
+    ValueId next = func->getOperand(v, latch_idx);
+    Instr& update = func->instrs[next];
+    if (!loop.body[update.block]
+        || ((update.op != IR_ADD) && (update.op != IR_SUB))) {
+      continue;
+    }
+    ValueId lhs = func->getOperand(next, 0);
+    ValueId rhs = func->getOperand(next, 1);
+    ValueId step = NO_VALUE;
+    if ((lhs == v) && isInvariant(loop, rhs)) {
+      step = rhs;
+    } else if ((update.op == IR_ADD) && (rhs == v) && isInvariant(loop, lhs)) {
+      step = lhs;
+    }
+    if (step == NO_VALUE) continue;
+    ivs.push_back({v, func->getOperand(v, pre_idx), next, step, update.op});
+  }
+  num_ivs += ivs.size();
+  if (ivs.empty()) return;
+
+  // iv * k for an invariant k, by induction variable and k
+  std::map<std::pair<uint32_t, ValueId>, std::vector<ValueId>> muls;
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    if (!loop.body[b]) continue;
+    for (ValueId v : func->blocks[b].instrs) {
+      Instr& instr = func->instrs[v];
+      if ((instr.op != IR_MUL) || (instr.type != IR_INT)) continue;
+      for (uint32_t n = 0; n < 2; n++) {
+        ValueId iv = func->getOperand(v, n);
+        ValueId k = func->getOperand(v, 1 - n);
+        if (!isInvariant(loop, k)) continue;
+        auto it = std::find_if(ivs.begin(), ivs.end(),
+            [&](const Induction& ind) { return ind.phi == iv; });
+        if (it == ivs.end()) continue;
+        muls[{static_cast<uint32_t>(it - ivs.begin()), k}].push_back(v);
+        break;
+      }
+    }
+  }
+
+  // Arithmetic wraps, so (i + step) * k is still i * k + step * k
+  for (auto& entry : muls) {
+    Induction& ind = ivs[entry.first.first];
+    ValueId k = entry.first.second;
+    ValueId init = product(loop, ind.init, k);
+    ValueId step = product(loop, ind.step, k);
+    ValueId phi = func->addInstr(IR_PHI, IR_INT, {NO_VALUE, NO_VALUE});
+    insertBefore(h, 0, phi);
+    ValueId next = func->addInstr(ind.op, IR_INT, {phi, step});
+    BlockId nb = func->instrs[ind.next].block;
+    std::vector<ValueId>& instrs = func->blocks[nb].instrs;
+    uint32_t pos = static_cast<uint32_t>(
+        std::find(instrs.begin(), instrs.end(), ind.next) - instrs.begin());
+    insertBefore(nb, pos + 1, next);
+    func->setOperand(phi, pre_idx, init);
+    func->setOperand(phi, latch_idx, next);
+    for (ValueId v : entry.second) {
+      func->replaceAllUses(v, phi);
+      remove(v);
+      num_reduced++;
+    }
+  }
+}
+
+// a * b for invariants a and b, folded when both are constants and
+// otherwise computed in the preheader
+ValueId LoopOptimizer::product(const Loop& loop, const ValueId& a,
+    const ValueId& b) {
+  Instr& x = func->instrs[a];
+  Instr& y = func->instrs[b];
+  if ((x.op == IR_CONST) && (y.op == IR_CONST)) {
+    return getConst(static_cast<int32_t>(x.imm.u * y.imm.u));
+  }
+  if (x.op == IR_CONST) {
+    if (x.imm.i == 0) return a;
+    if (x.imm.i == 1) return b;
+  }
+  if (y.op == IR_CONST) {
+    if (y.imm.i == 0) return b;
+    if (y.imm.i == 1) return a;
+  }
+  ValueId v = func->addInstr(IR_MUL, IR_INT, {a, b});
+  insertBefore(loop.preheader, static_cast<uint32_t>(
+      func->blocks[loop.preheader].instrs.size() - 1), v);
+  return v;
+}
+
+// An int constant in the entry block, where the IR builder puts them
+ValueId LoopOptimizer::getConst(const int32_t& value) {
+  for (ValueId v : func->blocks[0].instrs) {
+    Instr& instr = func->instrs[v];
+    if ((instr.op == IR_CONST) && (instr.type == IR_INT)
+        && (instr.imm.i == value)) {
+      return v;
+    }
+  }
+  ValueId v = func->addInstr(IR_CONST, IR_INT);
+  func->instrs[v].imm.i = value;
+  insertBefore(0, 0, v);
+  return v;
+}
+
+void LoopOptimizer::insertBefore(const BlockId& b, const uint32_t& pos,
+    const ValueId& v) {
+  std::vector<ValueId>& instrs = func->blocks[b].instrs;
+  instrs.insert(instrs.begin() + pos, v);
+  func->instrs[v].block = b;
+}
+
+void LoopOptimizer::remove(const ValueId& v) {
+  std::vector<ValueId>& instrs = func->blocks[func->instrs[v].block].instrs;
+  instrs.erase(std::find(instrs.begin(), instrs.end(), v));
+  func->instrs[v].op = IR_NOP;
+}
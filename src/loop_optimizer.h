@@ -0,0 +1,77 @@
+#ifndef LOOP_OPTIMIZER_H
+#define LOOP_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Loop-invariant code motion and strength reduction
+// Natural loops are found from the back edges of the dominator tree and
+// handled innermost first. Each gets a preheader: the one block outside the
+// loop that jumps to its header. Instructions that cannot fail and whose
+// operands are all defined outside the loop move to the end of the
+// preheader, so an invariant of an inner loop can keep moving out through
+// the loops around it. A basic induction variable is a header phi that
+// starts at some value and has an invariant added to or subtracted from it
+// on the way round; a multiplication of one by an invariant becomes a new
+// induction variable that starts at the product and steps by the product
+// of the step.
+////////////////////////////////////////////////////////////////////////////////
+class LoopOptimizer {
+public:
+  LoopOptimizer(Module&);
+  void run();
+  size_t getNumLoops() { return num_loops; }
+  size_t getNumInductionVars() { return num_ivs; }
+  size_t getNumReduced() { return num_reduced; }
+  size_t getNumHoisted() { return num_hoisted; }
+
+private:
+  struct Loop {
+    BlockId header;
+    BlockId preheader;
+    std::vector<bool> body;  // BlockId -> in the loop
+    size_t size;
+  };
+
+  // i = phi(init, i op step) with op IR_ADD or IR_SUB
+  struct Induction {
+    ValueId phi;
+    ValueId init;
+    ValueId next;
+    ValueId step;
+    Opcode op;
+  };
+
+  Module& module;
+  Function* func;
+  std::vector<Loop> loops;
+  bool writes_arrays;  // Effects of the loop being optimized
+  bool has_calls;
+  std::set<uint32_t> stored;  // Globals it writes
+  size_t num_loops;
+  size_t num_ivs;
+  size_t num_reduced;
+  size_t num_hoisted;
+
+  void runFunction();
+  void findLoops();
+  bool findPreheader(Loop&);
+  void hoistInvariants(Loop&);
+  void findEffects(const Loop&);
+  bool canHoist(const Loop&, const ValueId&);
+  void reduceStrength(Loop&);
+  bool isInvariant(const Loop& loop, const ValueId& v) {
+    return !loop.body[func->instrs[v].block];
+  }
+  ValueId product(const Loop&, const ValueId&, const ValueId&);
+  ValueId getConst(const int32_t&);
+  void insertBefore(const BlockId&, const uint32_t&, const ValueId&);
+  void remove(const ValueId&);
+};
+
+#endif // LOOP_OPTIMIZER_H
@@ -1,25 +1,90 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "array_fusion.h"
+#include "c_backend.h"
+#include "call_evaluator.h"
+#include "dead_code.h"
+#include "escape_analysis.h"
+#include "gvn.h"
+#include "inliner.h"
+#include "interpreter.h"
+#include "ir.h"
+#include "ir_builder.h"
+#include "llvm_backend.h"
 #include "log.h"
+#include "loop_optimizer.h"
 #include "token.h"
 #include "parser.h"
+#include "range_analysis.h"
+#include "sccp.h"
+#include "tail_calls.h"
+#include "vm.h"
+#include "x86.h"
+
+// Long-only options
+enum LongOpt {
+  OPT_EMIT_IR = 256,
+  OPT_EMIT_ASM,
+  OPT_EMIT_C,
+  OPT_EMIT_LLVM,
+  OPT_BACKEND,
+  OPT_RUN,
+  OPT_JIT,
+  OPT_INTERPRET,
+  OPT_PARALLEL_MIN,
+};
+
+// How -o builds the executable
+enum Backend {
+  BACKEND_ASM = 0,
+  BACKEND_C,
+  BACKEND_LLVM,
+};
 
 bool parse_args(int argc, char* argv[], std::string &src_file,
-    std::string &log_file, bool &show_welcome);
+    std::string &log_file, std::string &out_file, bool &show_welcome,
+    bool &dump_ast, bool &emit_ir, bool &emit_asm, bool &emit_c,
+    bool &emit_llvm, Backend &backend, bool &run, bool &jit,
+    bool &interpret, int &opt_level, uint32_t &parallel_min);
+bool build_exe(Module& module, const Backend& backend,
+    const uint32_t& parallel_min, const std::string& out_file);
+bool make_temp_dir(std::string& dir);
+bool run_tool(const std::vector<std::string>& args);
+bool use_typed_ptrs();
 void show_usage(std::string prog_name);
 void welcome_msg();
 
 int main(int argc, char* argv[]) {
   // Set up, parse args, etc
-  std::string src_file, log_file;
+  std::string src_file, log_file, out_file;
   bool show_welcome = true;
-  if (!parse_args(argc, argv, src_file, log_file, show_welcome)) {
+  bool dump_ast = false;
+  bool emit_ir = false;
+  bool emit_asm = false;
+  bool emit_c = false;
+  bool emit_llvm = false;
+  Backend backend = BACKEND_ASM;
+  bool run = false;
+  bool jit = false;
+  bool interpret = false;
+  int opt_level = 1;
+  uint32_t parallel_min = DEFAULT_PARALLEL_MIN;
+  if (!parse_args(argc, argv, src_file, log_file, out_file, show_welcome,
+      dump_ast, emit_ir, emit_asm, emit_c, emit_llvm, backend, run,
+      jit, interpret, opt_level, parallel_min)) {
     exit(EXIT_FAILURE);
   }
   if (show_welcome) welcome_msg();
@@ -32,19 +97,148 @@ int main(int argc, char* argv[]) {
   }
 
   // Parse the file
-  if (parser.parse()) {
-    exit(EXIT_SUCCESS);
-  } else {
+  if (!parser.parse()) {
+    exit(EXIT_FAILURE);
+  }
+  if (dump_ast) parser.getAst().dump(std::cout);
+
+  // Lower to IR
+  Module module;
+  IrBuilder builder(parser.getAst(), parser.getEnv());
+  if (!builder.build(module)) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Optimize
+  if (opt_level > 0) {
+    // First, so the passes after it only see code that can run, and what
+    // it reports was dead in the source
+    DeadCode dead_code(module, true);
+    dead_code.run();
+
+    // Before inlining, so procedures whose only recursion was a tail call
+    // can be inlined as loops
+    TailCalls tail_calls(module);
+    tail_calls.run();
+
+    // Also before inlining, so inlined procedures read their arguments in
+    // place rather than copying them
+    EscapeAnalysis escapes(module);
+    escapes.run();
+
+    // Before inlining too, while calls with constant arguments are still
+    // calls rather than copies of the callee's body
+    CallEvaluator evaluator(module);
+    evaluator.run();
+
+    Inliner inliner(module);
+    inliner.run();
+    Sccp sccp(module);
+    sccp.run();
+    Gvn gvn(module);
+    gvn.run();
+    RangeAnalysis ranges(module);
+    ranges.run();
+
+    // After the range analysis, which cannot see through the induction
+    // variables strength reduction makes
+    LoopOptimizer loops(module);
+    loops.run();
+
+    // Again, for the procedures inlined or evaluated away and the values
+    // the passes before it left unused
+    DeadCode cleanup(module, false);
+    cleanup.run();
+  }
+  if (emit_ir) module.print(std::cout);
+
+  // Generate code
+  if (emit_asm) X86Backend(module, parallel_min).emit(std::cout);
+  if (emit_c) CBackend(module, parallel_min).emit(std::cout);
+  if (emit_llvm) {
+    LlvmBackend(module, use_typed_ptrs(), parallel_min).emit(std::cout);
+  }
+  if (!out_file.empty()
+      && !build_exe(module, backend, parallel_min, out_file)) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Interpret it in process
+  if (run && !Vm(module, jit).run()) {
+    exit(EXIT_FAILURE);
+  }
+  if (interpret && !Interpreter(parser.getAst(), parser.getEnv()).run()) {
     exit(EXIT_FAILURE);
   }
+  exit(EXIT_SUCCESS);
 }
 
 bool parse_args(int argc, char* argv[], std::string &src_file,
-    std::string &log_file, bool &show_welcome) {
+    std::string &log_file, std::string &out_file, bool &show_welcome,
+    bool &dump_ast, bool &emit_ir, bool &emit_asm, bool &emit_c,
+    bool &emit_llvm, Backend &backend, bool &run, bool &jit,
+    bool &interpret, int &opt_level, uint32_t &parallel_min) {
+  static const struct option long_opts[] = {
+    {"emit-ir", no_argument, nullptr, OPT_EMIT_IR},
+    {"emit-asm", no_argument, nullptr, OPT_EMIT_ASM},
+    {"emit-c", no_argument, nullptr, OPT_EMIT_C},
+    {"emit-llvm", no_argument, nullptr, OPT_EMIT_LLVM},
+    {"backend", required_argument, nullptr, OPT_BACKEND},
+    {"run", no_argument, nullptr, OPT_RUN},
+    {"jit", no_argument, nullptr, OPT_JIT},
+    {"interpret", no_argument, nullptr, OPT_INTERPRET},
+    {"parallel-min", required_argument, nullptr, OPT_PARALLEL_MIN},
+    {nullptr, 0, nullptr, 0},
+  };
   int opt;
   bool error = false;
-  while ((opt = getopt(argc, argv, "hv:i:l:w")) != -1) {
+  while ((opt = getopt_long(argc, argv, "ahv:i:l:o:wO:", long_opts, nullptr))
+      != -1) {
     switch (opt) {
+      case OPT_EMIT_IR:
+        emit_ir = true;
+        break;
+      case OPT_EMIT_ASM:
+        emit_asm = true;
+        break;
+      case OPT_EMIT_C:
+        emit_c = true;
+        break;
+      case OPT_EMIT_LLVM:
+        emit_llvm = true;
+        break;
+      case OPT_BACKEND:
+        if (std::string(optarg) == "asm") {
+          backend = BACKEND_ASM;
+        } else if (std::string(optarg) == "c") {
+          backend = BACKEND_C;
+        } else if (std::string(optarg) == "llvm") {
+          backend = BACKEND_LLVM;
+        } else {
+          LOG(ERROR) << "Unknown backend: " << optarg;
+          error = true;
+        }
+        break;
+      case OPT_RUN:
+        run = true;
+        break;
+      case OPT_JIT:
+        run = true;
+        jit = true;
+        break;
+      case OPT_INTERPRET:
+        interpret = true;
+        break;
+      case OPT_PARALLEL_MIN:
+        if (std::atoi(optarg) < 0) {
+          LOG(ERROR) << "Parallel threshold must be at least 0";
+          error = true;
+        }
+        parallel_min = static_cast<uint32_t>(std::atoi(optarg));
+        break;
+      case 'a':
+        dump_ast = true;
+        break;
       case 'h':
         error = true;
         break;
@@ -66,9 +260,19 @@ bool parse_args(int argc, char* argv[], std::string &src_file,
         }
         log_file = optarg;
         break;
+      case 'o':
+        out_file = optarg;
+        break;
       case 'w':
         show_welcome = false;
         break;
+      case 'O':
+        opt_level = std::atoi(optarg);
+        if ((opt_level < 0) || (opt_level > 1)) {
+          LOG(ERROR) << "Optimization level must be 0 or 1";
+          error = true;
+        }
+        break;
       case '?':
         LOG(ERROR) << "Invalid flag: " << static_cast<char>(optopt);
         error = true;
@@ -82,13 +286,140 @@ bool parse_args(int argc, char* argv[], std::string &src_file,
   return !error;
 }
 
+// Generate assembly, C or LLVM IR in a private temporary directory and hand
+// it to the system tools along with the runtime library, which is installed
+// next to the compiler
+bool build_exe(Module& module, const Backend& backend,
+    const uint32_t& parallel_min, const std::string& out_file) {
+  std::string tmp_dir;
+  if (!make_temp_dir(tmp_dir)) return false;
+  static const std::string exts[] = {".s", ".c", ".ll"};
+  std::string src_file = tmp_dir + "/out" + exts[backend];
+  std::ofstream src_stream(src_file);
+  if (!src_stream) {
+    LOG(ERROR) << "Cannot open file for write: " << src_file;
+    rmdir(tmp_dir.c_str());
+    return false;
+  }
+  if (backend == BACKEND_C) {
+    CBackend(module, parallel_min).emit(src_stream);
+  } else if (backend == BACKEND_LLVM) {
+    LlvmBackend(module, use_typed_ptrs(), parallel_min).emit(src_stream);
+  } else {
+    X86Backend(module, parallel_min).emit(src_stream);
+  }
+  src_stream.close();
+
+  char exe[4096];
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  std::string dir = ".";
+  if (len > 0) {
+    exe[len] = '\0';
+    dir = exe;
+    dir = dir.substr(0, dir.rfind('/'));
+  }
+  bool built = true;
+  std::string asm_file = src_file;
+  std::string bc_file = tmp_dir + "/out.bc";
+  if (backend == BACKEND_LLVM) {
+    asm_file = tmp_dir + "/out.s";
+    built = run_tool({"opt", "-O2", src_file, "-o", bc_file})
+        && run_tool({"llc", "-O2", "-relocation-model=pic", bc_file, "-o",
+            asm_file});
+  }
+  std::vector<std::string> args = {"gcc"};
+  if (backend == BACKEND_C) {
+    // The loops in parallel workers have a variable trip count and pointers
+    // gcc cannot prove distinct, which the -O2 cost model will not vectorize
+    args.insert(args.end(), {"-O2", "-fvect-cost-model=dynamic", "-std=c99"});
+  }
+  args.insert(args.end(), {"-o", out_file, asm_file, dir + "/libruntime.a",
+      "-lm", "-pthread"});
+  built = built && run_tool(args);
+  unlink(src_file.c_str());
+  if (backend == BACKEND_LLVM) {
+    unlink(bc_file.c_str());
+    unlink(asm_file.c_str());
+  }
+  rmdir(tmp_dir.c_str());
+  if (!built) LOG(ERROR) << "Could not build " << out_file;
+  return built;
+}
+
+// Create a directory only this process uses under $TMPDIR, or /tmp
+bool make_temp_dir(std::string& dir) {
+  const char* tmp = getenv("TMPDIR");
+  std::string path = std::string((tmp && *tmp) ? tmp : "/tmp")
+      + "/compiler.XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  if (!mkdtemp(name.data())) {
+    LOG(ERROR) << "Cannot create a temporary directory: " << path << ": "
+        << strerror(errno);
+    return false;
+  }
+  dir = name.data();
+  return true;
+}
+
+// Run a system tool without a shell, so paths need no quoting; true if it
+// exits with status 0
+bool run_tool(const std::vector<std::string>& args) {
+  std::string cmd;
+  std::vector<char*> argv;
+  for (auto& arg : args) {
+    cmd += (cmd.empty() ? "" : " ") + arg;
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  LOG(DEBUG) << "Running: " << cmd;
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG(ERROR) << "Cannot run " << args[0] << ": " << strerror(errno);
+    return false;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return false;
+  }
+  return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+// Opaque pointers are the default from LLVM 15 on, and too immature to use in
+// earlier releases; emit typed pointers for the tools on the path if they are
+// that old
+bool use_typed_ptrs() {
+  FILE* pipe = popen("llc --version 2>/dev/null", "r");
+  if (!pipe) return false;
+  char line[256];
+  int version = 0;
+  while (fgets(line, sizeof(line), pipe)) {
+    const char* v = strstr(line, "LLVM version ");
+    if (v) version = std::atoi(v + strlen("LLVM version "));
+  }
+  pclose(pipe);
+  return (version > 0) && (version < 15);
+}
+
 void show_usage(std::string prog_name) {
   std::cerr  << "Usage: " << prog_name << " [options]\n"
         << "Please be gentle; I did not rigorously test arg parsing.\n"
         << "Options:\n"
+        << "\t-a\t\tDump the syntax tree after a successful parse\n"
         << "\t-h\t\tShow this help message\n"
         << "\t-i INFILE\tSpecify input file to compile\n"
         << "\t-l LOGFILE\tSpecify log file to store debug log\n"
+        << "\t-o OUTFILE\tAssemble and link an executable\n"
+        << "\t-O LEVEL\tSpecify optimization level (default 1):\n"
+        << "\t\t\t0 - none\n"
+        << "\t\t\t1 - dead code elimination, tail calls,\n"
+        << "\t\t\t    escape analysis, compile-time calls,\n"
+        << "\t\t\t    inlining, constant propagation, GVN,\n"
+        << "\t\t\t    range and loop optimizations\n"
         << "\t-v LEVEL\tSpecify verbosity level (default 2):\n"
         << "\t\t\t0 - DEBUG\n"
         << "\t\t\t1 - INFO\n"
@@ -96,6 +427,20 @@ void show_usage(std::string prog_name) {
         << "\t\t\t3 - ERROR\n"
         << "\t-w\t\tDo not show welcome Tux.\n"
         << "\t\t\tThis will make Tux sad. :(\n"
+        << "\t--emit-ir\tPrint the SSA intermediate representation\n"
+        << "\t--emit-asm\tPrint the generated x86-64 assembly\n"
+        << "\t--emit-c\tPrint the program translated to C\n"
+        << "\t--emit-llvm\tPrint the program as LLVM IR\n"
+        << "\t--backend NAME\tHow -o builds the executable (default asm):\n"
+        << "\t\t\tasm - x86-64 code generator\n"
+        << "\t\t\tc - translate to C and compile with gcc -O2\n"
+        << "\t\t\tllvm - translate to LLVM IR, run opt -O2 and llc\n"
+        << "\t--run\t\tRun the program in the bytecode interpreter\n"
+        << "\t--jit\t\tLike --run, compiling hot procedures to native code\n"
+        << "\t--interpret\tRun the program by walking the syntax tree\n"
+        << "\t--parallel-min N\tSplit whole-array operations of at least N\n"
+        << "\t\t\telements across threads (default "
+        << DEFAULT_PARALLEL_MIN << ", 0 never)\n"
         << std::endl;
 }
 
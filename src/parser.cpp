@@ -2,23 +2,91 @@
 
 #include <algorithm>
 #include <fstream>
+#include <iomanip>
+#include <initializer_list>
 #include <memory>
 #include <stack>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "ast.h"
 #include "environment.h"
 #include "log.h"
 #include "scanner.h"
 #include "token.h"
 #include "type_checker.h"
 
+////////////////////////////////////////////////////////////////////////////////
+// Synchronization sets
+// Each set is (roughly) the FOLLOW set of its production plus the closing
+// tokens of the production itself. While a production is active its set is on
+// sync_stack, so panic mode stops at the nearest token some enclosing
+// construct knows how to resume from.
+////////////////////////////////////////////////////////////////////////////////
+
+// FOLLOW(<program_body>) = {.}
+const SyncSet Parser::PROGRAM_SYNC = Parser::makeSyncSet({TOK_PERIOD});
+
+// FOLLOW(<declarations>) = {begin}; FIRST(<declaration>) restarts the loop
+const SyncSet Parser::DECLARATIONS_SYNC = Parser::makeSyncSet({TOK_SEMICOL,
+    TOK_RW_BEG, TOK_RW_GLOB, TOK_RW_PROC, TOK_RW_VAR});
+
+// FOLLOW(<statements>) = {end, else}; keyword-led statements restart the loop
+const SyncSet Parser::STATEMENTS_SYNC = Parser::makeSyncSet({TOK_SEMICOL,
+    TOK_RW_END, TOK_RW_ELSE, TOK_RW_IF, TOK_RW_FOR, TOK_RW_RET});
+
+// `:' and the parameter parentheses of <procedure_header>
+const SyncSet Parser::PROCEDURE_HEADER_SYNC = Parser::makeSyncSet({TOK_COLON,
+    TOK_LPAREN, TOK_RPAREN});
+
+// `begin' and `end' of <procedure_body>
+const SyncSet Parser::PROCEDURE_BODY_SYNC = Parser::makeSyncSet({TOK_RW_BEG,
+    TOK_RW_END});
+
+// FOLLOW(<parameter>) = {, )}
+const SyncSet Parser::PARAMETER_LIST_SYNC = Parser::makeSyncSet({TOK_COMMA,
+    TOK_RPAREN});
+
+// Closing tokens of the condition and branches of <if_statement>
+const SyncSet Parser::IF_SYNC = Parser::makeSyncSet({TOK_RPAREN, TOK_RW_THEN,
+    TOK_RW_ELSE, TOK_RW_END});
+
+// Closing tokens of the header and body of <loop_statement>
+const SyncSet Parser::LOOP_SYNC = Parser::makeSyncSet({TOK_SEMICOL,
+    TOK_RPAREN, TOK_RW_END});
+
+// FOLLOW(<expression>) inside `(' <expression> `)'
+const SyncSet Parser::PAREN_SYNC = Parser::makeSyncSet({TOK_RPAREN});
+
+// FOLLOW(<expression>) inside `[' <expression> `]' and FOLLOW(<bound>)
+const SyncSet Parser::BRACKET_SYNC = Parser::makeSyncSet({TOK_RBRACK});
+
+// FOLLOW(<expression>) inside <argument_list>
+const SyncSet Parser::ARGUMENT_LIST_SYNC = Parser::makeSyncSet({TOK_COMMA,
+    TOK_RPAREN});
+
+SyncSet Parser::makeSyncSet(std::initializer_list<TokenType> toks) {
+  SyncSet sync;
+  for (auto t : toks) {
+    sync.set(t);
+  }
+  return sync;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public functions
+////////////////////////////////////////////////////////////////////////////////
+
 Parser::Parser() : env(new Environment()), scanner(env), type_checker(),
-    panic_mode(false) {}
+    panic_mode(false), ast(env), src_bytes(0), tok_offset(0) {}
 
 bool Parser::init(const std::string& src_file) {
   bool init_success = true;
   panic_mode = false;
+  sync_stack.clear();
+  std::ifstream src_fstream(src_file, std::ios::in | std::ios::ate);
+  src_bytes = src_fstream ? static_cast<size_t>(src_fstream.tellg()) : 0;
   if (!scanner.init(src_file)) {
     init_success = false;
     LOG(ERROR) << "Failed to initialize parser";
@@ -34,11 +102,22 @@ bool Parser::init(const std::string& src_file) {
 bool Parser::parse() {
   LOG(INFO) << "Begin parsing";
   LOG(DEBUG) << "<program>";
+  SyncGuard guard(this, PROGRAM_SYNC);
+  ast.clear();
+
+  // Roughly one node per 7 source bytes on the sample programs
+  ast.reserve(src_bytes / 6);
   programHeader();
-  programBody();
+  ast.setRoot(programBody());
   expectToken(TOK_PERIOD);
   scan();
+  ast.setLineStarts(scanner.getLineStarts());
   LOG(INFO) << "Done parsing";
+  LOG(INFO) << "Syntax tree: " << ast.getNumNodes() << " nodes, "
+      << ast.getBytes() << " bytes for " << src_bytes << " source bytes ("
+      << std::fixed << std::setprecision(2)
+      << (src_bytes ? static_cast<double>(ast.getBytes()) / src_bytes : 0.0)
+      << " bytes per source byte)";
   if (LOG::hasErrored()) {
     LOG(WARN) << "Parsing had errors; no code generated";
   }
@@ -56,6 +135,7 @@ void Parser::scan() {
   do {
     tok = scanner.getToken();
   } while(tok->getType() == TOK_INVALID);
+  tok_offset = scanner.getTokenOffset();
 }
 
 void Parser::push_scope(std::shared_ptr<IdToken> id_tok) {
@@ -86,15 +166,25 @@ bool Parser::matchToken(const TokenType& t) {
   return false;
 }
 
+// While in panic mode, a missing token is not reported again; the parser is
+// still skipping towards a construct it can resume at. Finding the expected
+// token ends panic mode.
 bool Parser::expectToken(const TokenType& t) {
   if (matchToken(t)) {
     LOG(DEBUG) << "Expect passed for token " << Token::getTokenName(t);
+    if (panic_mode) {
+      LOG(DEBUG) << "Resynchronized on " << tok->getStr();
+      panic_mode = false;
+    }
     return true;
   }
+  if (panic_mode) return false;
   LOG(ERROR) << "Expected " << Token::getTokenName(t)
       << ", got " << tok->getStr() << " instead";
   panic();
-  return false;
+
+  // Panic mode may have stopped right at the token we wanted
+  return expectToken(t);
 }
 
 void Parser::panic() {
@@ -102,15 +192,30 @@ void Parser::panic() {
   // Flag that panic mode happened so the rest of the parser can respond
   panic_mode = true;
   LOG(ERROR) << "Start panic mode";
-  LOG(ERROR) << "Scanning for `;' or `EOF'";
-
-  // Eat tokens until a sync point
-  // Currently syncing on semicolon and EOF
-  // Pretty basic for now, but a more advanced solution would require
-  // significant infrastructure and refactoring
-  while (tok->getType() != TOK_SEMICOL && tok->getType() != TOK_EOF) {
+  LOG(ERROR) << "Scanning for a synchronizing token";
+
+  // Eat tokens until one of the active productions can resume
+  // The sets are derived from FOLLOW sets of the enclosing productions, so the
+  // innermost construct that knows the token picks the parse back up
+  SyncSet sync;
+  sync.set(TOK_EOF);
+  for (const auto& s : sync_stack) {
+    sync |= s;
+  }
+  while (!sync[tok->getType()]) {
     scan();
   }
+  LOG(DEBUG) << "Panic mode stopped at " << tok->getStr();
+}
+
+// Leave panic mode if the current token is in the given synchronization set.
+// Returns whether the parser is synchronized.
+bool Parser::resync(const SyncSet& sync) {
+  if (panic_mode && sync[tok->getType()]) {
+    LOG(DEBUG) << "Resynchronized on " << tok->getStr();
+    panic_mode = false;
+  }
+  return !panic_mode;
 }
 
 //  <program_header> ::=
@@ -136,126 +241,173 @@ void Parser::programHeader() {
 //    `begin'
 //      <statements>
 //    `end' `program'
-void Parser::programBody() {
+NodeId Parser::programBody() {
   LOG(DEBUG) << "<program_body>";
-  declarations(true); // These are global declarations by default
+  SyncGuard guard(this, PROCEDURE_BODY_SYNC);
+  uint32_t offset = tok_offset;
+  NodeId first = NO_NODE, tail = NO_NODE;
+  ast.link(first, tail, declarations(true)); // Global declarations by default
   LOG(DEBUG) << "Done parsing global declarations";
   LOG(DEBUG) << "Global symbol table:\n" << env->getGlobalStr();
-  expectToken(TOK_RW_BEG);
-  scan();
-  statements();
-  expectToken(TOK_RW_END);
-  scan();
-  expectToken(TOK_RW_PROG);
-  scan();
+  if (expectToken(TOK_RW_BEG)) scan();
+  ast.link(first, tail, statements());
+  if (expectToken(TOK_RW_END)) scan();
+  if (expectToken(TOK_RW_PROG)) scan();
+  return ast.makeNode(NODE_PROGRAM, TYPE_NONE, 0, offset, first);
 }
 
 //  <declarations> ::=
 //    (<declaration>`;')*
-void Parser::declarations(bool is_global) {
+NodeId Parser::declarations(bool is_global) {
   LOG(DEBUG) << "<declarations>";
-  // FIRST(<declaration>) = {global, procedure, variable}
-  while (matchToken(TOK_RW_GLOB) || matchToken(TOK_RW_PROC)
-      || matchToken(TOK_RW_VAR)) {
-    panic_mode = false;  // Reset panic mode
-    declaration(is_global);
-
-    // Even if we entered panic mode, this should pass unless we hit EOF
-    expectToken(TOK_SEMICOL);
-    scan();
+  SyncGuard guard(this, DECLARATIONS_SYNC);
+  uint32_t offset = tok_offset;
+  NodeId first = NO_NODE, tail = NO_NODE;
+
+  // An enclosing production may hand over an unfinished panic
+  if (resync(DECLARATIONS_SYNC)) {
+    if (matchToken(TOK_SEMICOL)) scan();
+
+    // FIRST(<declaration>) = {global, procedure, variable}
+    while (matchToken(TOK_RW_GLOB) || matchToken(TOK_RW_PROC)
+        || matchToken(TOK_RW_VAR)) {
+      ast.link(first, tail, declaration(is_global));
+
+      // Anything we cannot resume at belongs to an enclosing construct
+      if (!resync(DECLARATIONS_SYNC)) break;
+      if (expectToken(TOK_SEMICOL)) {
+        scan();
+      } else if (!resync(DECLARATIONS_SYNC)) {
+        break;
+      }
+    }
   }
+  return ast.makeNode(NODE_DECLARATIONS, TYPE_NONE, 0, offset, first);
 }
 
 //  <statements> ::=
 //    (<statement>`;')*
-void Parser::statements() {
+NodeId Parser::statements() {
   LOG(DEBUG) << "<statements>";
-  // FIRST(<statement>) = {<identifier>, if, for, return}
-  while(matchToken(TOK_IDENT) || matchToken(TOK_RW_IF) || matchToken(TOK_RW_FOR)
-      || matchToken(TOK_RW_RET)) {
-    panic_mode = false;  // Reset panic mode
-    statement();
-
-    // Even if we entered panic mode, this should pass unless we hit EOF
-    expectToken(TOK_SEMICOL);
-    scan();
+  SyncGuard guard(this, STATEMENTS_SYNC);
+  uint32_t offset = tok_offset;
+  NodeId first = NO_NODE, tail = NO_NODE;
+
+  // An enclosing production may hand over an unfinished panic
+  if (resync(STATEMENTS_SYNC)) {
+    if (matchToken(TOK_SEMICOL)) scan();
+
+    // FIRST(<statement>) = {<identifier>, if, for, return}
+    while(matchToken(TOK_IDENT) || matchToken(TOK_RW_IF)
+        || matchToken(TOK_RW_FOR) || matchToken(TOK_RW_RET)) {
+      ast.link(first, tail, statement());
+
+      // Anything we cannot resume at belongs to an enclosing construct
+      if (!resync(STATEMENTS_SYNC)) break;
+      if (expectToken(TOK_SEMICOL)) {
+        scan();
+      } else if (!resync(STATEMENTS_SYNC)) {
+        break;
+      }
+    }
   }
+  return ast.makeNode(NODE_STATEMENTS, TYPE_NONE, 0, offset, first);
 }
 
 //  <declaration> ::=
 //    [`global'] <procedure_declaration>
 //  | [`global'] <variable_declaration>
-void Parser::declaration(bool is_global) {
+NodeId Parser::declaration(bool is_global) {
   LOG(DEBUG) << "<declaration>";
+  uint32_t offset = tok_offset;
   if (matchToken(TOK_RW_GLOB)) {
     is_global = true;
     scan();
   }
   if (matchToken(TOK_RW_PROC)) {
-    procedureDeclaration(is_global);
+    return procedureDeclaration(is_global);
   } else if(matchToken(TOK_RW_VAR)) {
-    variableDeclaration(is_global);
+    return ast.makeSymbol(NODE_VARIABLE, variableDeclaration(is_global),
+        offset);
   } else {
     LOG(ERROR) << "Unexpected token: " << tok->getStr();
     LOG(ERROR) << "Expected: " << Token::getTokenName(TOK_RW_PROC) << " or "
         << Token::getTokenName(TOK_RW_VAR);
     panic();
+    return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   }
 }
 
 //  <procedure_declaration> ::=
 //    <procedure_header> <procedure_body>
-void Parser::procedureDeclaration(const bool& is_global) {
+NodeId Parser::procedureDeclaration(const bool& is_global) {
   LOG(DEBUG) << "<procedure_declaration>";
-  panic_mode = false;  // Reset panic mode
-  procedureHeader(is_global);
-  panic_mode = false;  // Reset panic mode
-  procedureBody();
+  uint32_t offset = tok_offset;
+  std::shared_ptr<IdToken> id_tok;
+  NodeId first = NO_NODE, tail = NO_NODE;
+
+  // Always pushes the scope
+  ast.link(first, tail, procedureHeader(is_global, id_tok));
+  procedureBody(first, tail);
   pop_scope();
+  return ast.makeSymbol(NODE_PROCEDURE, id_tok, offset, first);
 }
 
 //  <procedure_header>
 //    `procedure' <identifier> `:' <type_mark> `('[<parameter_list>]`)'
-void Parser::procedureHeader(const bool& is_global) {
+// Returns the parameters node; id_tok receives the procedure symbol
+NodeId Parser::procedureHeader(const bool& is_global,
+    std::shared_ptr<IdToken>& id_tok) {
   LOG(DEBUG) << "<procedure_header>";
-  expectToken(TOK_RW_PROC);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  std::shared_ptr<IdToken> id_tok = identifier(false);
-  env->insert(id_tok->getVal(), id_tok, is_global);
-  expectToken(TOK_COLON);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  TypeMark tm = typeMark();
+  SyncGuard guard(this, PROCEDURE_HEADER_SYNC);
+  if (expectToken(TOK_RW_PROC)) scan();
+  id_tok = identifier(false);
+  if (id_tok->isValid()) {
+    env->insert(id_tok->getVal(), id_tok, is_global);
+  }
+  TypeMark tm = TYPE_NONE;
+  if (expectToken(TOK_COLON)) {
+    scan();
+    tm = typeMark();
+  }
   id_tok->setTypeMark(tm);
   id_tok->setProcedure(true);
 
   // Begin new scope
+  // The scope is pushed even for a broken header so that pop_scope() in
+  // procedureDeclaration() stays balanced
   push_scope(id_tok);  // This adds id_tok to the new scope for recursion
-  expectToken(TOK_LPAREN);
-  scan();
-  if (matchToken(TOK_RW_VAR)) {
-    parameterList();
+  uint32_t offset = tok_offset;
+  NodeId first = NO_NODE, tail = NO_NODE;
+  if (expectToken(TOK_LPAREN)) {
+    scan();
+    if (matchToken(TOK_RW_VAR)) {
+      parameterList(first, tail);
+    }
   }
-  expectToken(TOK_RPAREN);
-  scan();
+  if (expectToken(TOK_RPAREN)) scan();
+  return ast.makeNode(NODE_PARAMETERS, TYPE_NONE, 0, offset, first);
 }
 
 //  <parameter_list> ::=
 //    <parameter>`,' <parameter_list>
 //  | <parameter>
-void Parser::parameterList() {
+void Parser::parameterList(NodeId& first, NodeId& tail) {
   LOG(DEBUG) << "<parameter_list>";
+  SyncGuard guard(this, PARAMETER_LIST_SYNC);
+  uint32_t offset = tok_offset;
   std::shared_ptr<IdToken> par_tok = parameter();
   if (!par_tok->isValid()) {
     LOG(ERROR) << "Ill-formed parameter: " << par_tok->getStr() << "; skipping";
   } else {
     function_stack.top()->addParam(par_tok);
+    ast.link(first, tail, ast.makeSymbol(NODE_VARIABLE, par_tok, offset));
   }
 
+  if (!resync(PARAMETER_LIST_SYNC)) return;
   if (matchToken(TOK_COMMA)) {
     scan();
-    parameterList();
+    parameterList(first, tail);
   }
 }
 
@@ -271,18 +423,15 @@ std::shared_ptr<IdToken> Parser::parameter() {
 //    `begin'
 //      <statements>
 //    `end' `procedure'
-void Parser::procedureBody() {
+void Parser::procedureBody(NodeId& first, NodeId& tail) {
   LOG(DEBUG) << "<procedure_body>";
-  declarations(false);
-  expectToken(TOK_RW_BEG);
-  scan();
-  statements();
-  expectToken(TOK_RW_END);
-  scan();
-  expectToken(TOK_RW_PROC);
-  scan();
+  SyncGuard guard(this, PROCEDURE_BODY_SYNC);
+  ast.link(first, tail, declarations(false));
+  if (expectToken(TOK_RW_BEG)) scan();
+  ast.link(first, tail, statements());
+  if (expectToken(TOK_RW_END)) scan();
+  if (expectToken(TOK_RW_PROC)) scan();
 }
-
 //  <variable_declaration> ::=
 //    `variable' <identifier> `:' <type_mark> [`['<bound>`]']
 std::shared_ptr<IdToken> Parser::variableDeclaration(const bool& is_global) {
@@ -295,6 +444,7 @@ std::shared_ptr<IdToken> Parser::variableDeclaration(const bool& is_global) {
   if (panic_mode) return id_tok;  // No need to continue
   scan();
   id_tok = identifier(false);
+  if (panic_mode) return id_tok;  // No need to continue
   env->insert(id_tok->getVal(), id_tok, is_global);
   expectToken(TOK_COLON);
   if (panic_mode) return id_tok;  // No need to continue
@@ -304,6 +454,7 @@ std::shared_ptr<IdToken> Parser::variableDeclaration(const bool& is_global) {
   id_tok->setProcedure(false);
   if (matchToken(TOK_LBRACK)) {
     LOG(DEBUG) << "Variable is an array";
+    SyncGuard guard(this, BRACKET_SYNC);
     scan();
     id_tok->setNumElements(bound());
     expectToken(TOK_RBRACK);
@@ -344,11 +495,15 @@ TypeMark Parser::typeMark() {
 //    <number>
 int Parser::bound() {
   LOG(DEBUG) << "<bound>";
-  std::shared_ptr<Token> num_tok = number();
-  std::shared_ptr<LiteralToken<int>> bound_tok =
-      std::dynamic_pointer_cast<LiteralToken<int>>(num_tok);
-  if (bound_tok) {
-    int bound_val = bound_tok->getVal();
+
+  // Read the literal directly; the bound lives in the symbol, not the tree
+  std::shared_ptr<LiteralToken<int>> int_tok;
+  if (expectToken(TOK_NUM)) {
+    int_tok = std::dynamic_pointer_cast<LiteralToken<int>>(tok);
+  }
+  if (!panic_mode) scan();
+  if (int_tok) {
+    int bound_val = int_tok->getVal();
     if (bound_val < 1) {
       LOG(ERROR) << "Bound must be at least 1; received bound " << bound_val;
       LOG(WARN) << "Using bound of 1";
@@ -356,7 +511,7 @@ int Parser::bound() {
     }
     return bound_val;
   } else {
-    LOG(ERROR) << "Invalid bound received: " << num_tok->getVal();
+    LOG(ERROR) << "Invalid bound received; expected an integer literal";
     LOG(WARN) << "Using bound of 1";
     return 1;
   }
@@ -367,196 +522,235 @@ int Parser::bound() {
 //  | <if_statement>
 //  | <loop_statement>
 //  | <return_statement>
-void Parser::statement() {
+NodeId Parser::statement() {
   LOG(DEBUG) << "<statement>";
   if (matchToken(TOK_IDENT)) {
-    assignmentStatement();
+    return assignmentStatement();
   } else if (matchToken(TOK_RW_IF)) {
-    ifStatement();
+    return ifStatement();
   } else if (matchToken(TOK_RW_FOR)) {
-    loopStatement();
+    return loopStatement();
   } else if (matchToken(TOK_RW_RET)) {
-    returnStatement();
+    return returnStatement();
   } else {
     LOG(ERROR) << "Unexpected token: " << tok->getVal()
         << "; expected statement";
+    uint32_t offset = tok_offset;
     panic();
+    return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   }
 }
 
 //  <procedure_call> ::=
 //    <identifier>`('[<argument_list>]`)'
-TypeMark Parser::procedureCall() {
+NodeId Parser::procedureCall() {
   LOG(DEBUG) << "<procedure_call>";
+  uint32_t offset = tok_offset;
   std::shared_ptr<IdToken> id_tok = identifier(true);
   if (!id_tok->getProcedure()) {
     LOG(ERROR) << "Expected procedure; got variable " << id_tok->getVal();
   }
-  expectToken(TOK_LPAREN);
-  if (panic_mode) return TYPE_NONE;  // No need to continue
-  scan();
-  if (!matchToken(TOK_RPAREN)) {
-    argumentList(0, id_tok);
+  NodeId first = NO_NODE, tail = NO_NODE;
+  if (expectToken(TOK_LPAREN)) {
+    scan();
+    if (!matchToken(TOK_RPAREN)) {
+      SyncGuard guard(this, ARGUMENT_LIST_SYNC);
+      argumentList(0, id_tok, first, tail);
+    }
+    expectToken(TOK_RPAREN);
+    if (!panic_mode) scan();
   }
-  expectToken(TOK_RPAREN);
-  if (!panic_mode) scan();
-  return id_tok->getTypeMark();
+  NodeId node = ast.makeSymbol(NODE_CALL, id_tok, offset, first);
+  ast.setSize(node, 0);  // Procedure calls return scalars
+  return node;
 }
 
 //  <assignment_statement> ::=
 //    <destination> `:=' <expression>
-void Parser::assignmentStatement() {
+NodeId Parser::assignmentStatement() {
   LOG(DEBUG) << "<assignment_statement>";
-  int dest_size = 0;
-  TypeMark tm_dest = destination(dest_size);
-  expectToken(TOK_OP_ASS);
-  if (panic_mode) return;  // No need to continue
-  std::shared_ptr<Token> op_tok = tok;
-  scan();
-  int expr_size = 0;
-  TypeMark tm_expr = expression(expr_size);
-  type_checker.checkCompatible(op_tok, tm_dest, tm_expr);
-  type_checker.checkArraySize(op_tok, dest_size, expr_size);
+  uint32_t offset = tok_offset;
+  NodeId dest = destination();
+  NodeId tail = dest;
+  if (expectToken(TOK_OP_ASS)) {
+    std::shared_ptr<Token> op_tok = tok;
+    scan();
+    NodeId expr = expression();
+
+    // Operand types are unreliable after an error
+    if (!panic_mode) {
+      type_checker.checkCompatible(op_tok, ast.getTypeMark(dest),
+          ast.getTypeMark(expr));
+      type_checker.checkArraySize(op_tok, ast.getSize(dest),
+          ast.getSize(expr));
+    }
+    ast.link(dest, tail, expr);
+  }
+  return ast.makeNode(NODE_ASSIGN, TYPE_NONE, 0, offset, dest);
 }
 
 //  <destination> ::=
 //    <identifier>[`['<expression>`]']
-TypeMark Parser::destination(int& size) {
+NodeId Parser::destination() {
   LOG(DEBUG) << "<destination>";
+  uint32_t offset = tok_offset;
   expectToken(TOK_IDENT);
-  if (panic_mode) return TYPE_NONE;  // No need to continue
+  if (panic_mode) return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   std::shared_ptr<IdToken> id_tok = identifier(true);
   if (id_tok->getProcedure()) {
     LOG(ERROR) << "Expected variable; got procedure " << id_tok->getVal();
   }
-  TypeMark tm = id_tok->getTypeMark();
-  size = id_tok->getNumElements();
+  NodeId idx = NO_NODE;
   if (matchToken(TOK_LBRACK)) {
     LOG(DEBUG) << "Indexing array";
-    size = 0;  // If indexing, it's a single element not an array
     if (id_tok->getProcedure() || (id_tok->getNumElements() < 1)) {
       LOG(ERROR) << "Attempt to index non-array symbol " << id_tok->getVal();
     }
+    SyncGuard guard(this, BRACKET_SYNC);
     scan();
-    int idx_size = 0;
-    TypeMark tm_idx = expression(idx_size);
-    type_checker.checkArrayIndex(tm_idx);
-    if (idx_size > 0) {
-      LOG(ERROR) << "Invalid index; Expected scalar, got array";
+    idx = expression();
+    if (!panic_mode) {
+      type_checker.checkArrayIndex(ast.getTypeMark(idx));
+      if (ast.getSize(idx) > 0) {
+        LOG(ERROR) << "Invalid index; Expected scalar, got array";
+      }
     }
     expectToken(TOK_RBRACK);
-    if (panic_mode) return TYPE_NONE;  // No need to continue
-    scan();
+    if (!panic_mode) scan();
   }
-  return tm;
+  NodeId node = ast.makeSymbol(NODE_NAME, id_tok, offset, idx);
+
+  // If indexing, it's a single element not an array
+  if (idx != NO_NODE) ast.setSize(node, 0);
+  return node;
 }
 
 //  <if_statement> ::=
 //    `if' `(' <expression> `)' `then' <statements>
 //    [`else' <statements>]
 //    `end' `if'
-void Parser::ifStatement() {
+NodeId Parser::ifStatement() {
   LOG(DEBUG) << "<if_statement>";
+  SyncGuard guard(this, IF_SYNC);
+  uint32_t offset = tok_offset;
   expectToken(TOK_RW_IF);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  expectToken(TOK_LPAREN);
-  if (panic_mode) return;  // No need to continue
+  if (panic_mode) return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   scan();
 
-  // Ensure expression parses to `bool'
-  int expr_size = 0;
-  TypeMark tm = expression(expr_size);
-  if (!type_checker.checkCompatible(tm, TYPE_BOOL)) {
-    LOG(ERROR) << "Invalid if statement expression of type "
-      << Token::getTypeMarkName(tm) << " received";
-    LOG(ERROR) << "If statement expression must resolve to type "
-        << Token::getTypeMarkName(TYPE_BOOL);
-  } else if (expr_size > 0) {
-    LOG(ERROR) << "Invalid if statement; expected scalar, got array";
-  }
-  expectToken(TOK_RPAREN);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  expectToken(TOK_RW_THEN);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  statements();
+  // From here on, each part of the statement is attempted even after an
+  // error so that recovery can resume at `then', `else', or `end'
+  NodeId cond = NO_NODE;
+  if (expectToken(TOK_LPAREN)) {
+    scan();
+
+    // Ensure expression parses to `bool'
+    cond = expression();
+    if (panic_mode) {
+      // Condition is broken; the error is already reported
+    } else if (!type_checker.checkCompatible(ast.getTypeMark(cond),
+          TYPE_BOOL)) {
+      LOG(ERROR) << "Invalid if statement expression of type "
+        << Token::getTypeMarkName(ast.getTypeMark(cond)) << " received";
+      LOG(ERROR) << "If statement expression must resolve to type "
+          << Token::getTypeMarkName(TYPE_BOOL);
+    } else if (ast.getSize(cond) > 0) {
+      LOG(ERROR) << "Invalid if statement; expected scalar, got array";
+    }
+  }
+  if (cond == NO_NODE) cond = ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
+  NodeId tail = cond;
+  if (expectToken(TOK_RPAREN)) scan();
+  if (expectToken(TOK_RW_THEN)) scan();
+  ast.link(cond, tail, statements());
   if (matchToken(TOK_RW_ELSE)) {
     LOG(DEBUG) << "Else";
+    resync(IF_SYNC);
     scan();
-    statements();
+    ast.link(cond, tail, statements());
   }
-  expectToken(TOK_RW_END);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  expectToken(TOK_RW_IF);
-  if (panic_mode) return;  // No need to continue
-  scan();
+  if (expectToken(TOK_RW_END)) scan();
+  if (expectToken(TOK_RW_IF)) scan();
+  return ast.makeNode(NODE_IF, TYPE_NONE, 0, offset, cond);
 }
 
 //  <loop_statement> ::=
 //    `for' `(' <assignment_statement>`;' <expression> `)'
 //      <statements>
 //    `end' `for'
-void Parser::loopStatement() {
+NodeId Parser::loopStatement() {
   LOG(DEBUG) << "<loop_statement>";
+  SyncGuard guard(this, LOOP_SYNC);
+  uint32_t offset = tok_offset;
   expectToken(TOK_RW_FOR);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  expectToken(TOK_LPAREN);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  assignmentStatement();
-  expectToken(TOK_SEMICOL);
-  if (panic_mode) return;  // No need to continue
+  if (panic_mode) return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   scan();
 
-  // Ensure expression parses to `bool'
-  int expr_size = 0;
-  TypeMark tm = expression(expr_size);
-  if (!type_checker.checkCompatible(tm, TYPE_BOOL)) {
-    LOG(ERROR) << "Invalid loop statement expression of type "
-      << Token::getTypeMarkName(tm) << " received";
-    LOG(ERROR) << "Loop statement expression must resolve to type "
-        << Token::getTypeMarkName(TYPE_BOOL);
-  } else if (expr_size > 0) {
-    LOG(ERROR) << "Invalid loop statement; expected scalar, got array";
-  }
-  expectToken(TOK_RPAREN);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  statements();
-  expectToken(TOK_RW_END);
-  if (panic_mode) return;  // No need to continue
-  scan();
-  expectToken(TOK_RW_FOR);
-  if (panic_mode) return;  // No need to continue
-  scan();
+  // From here on, each part of the statement is attempted even after an
+  // error so that recovery can resume at `;', `)', or `end'
+  NodeId init = NO_NODE;
+  if (expectToken(TOK_LPAREN)) {
+    scan();
+    init = assignmentStatement();
+  }
+  if (init == NO_NODE) init = ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
+  NodeId tail = init;
+  NodeId cond = NO_NODE;
+  if (expectToken(TOK_SEMICOL)) {
+    scan();
+
+    // Ensure expression parses to `bool'
+    cond = expression();
+    if (panic_mode) {
+      // Condition is broken; the error is already reported
+    } else if (!type_checker.checkCompatible(ast.getTypeMark(cond),
+          TYPE_BOOL)) {
+      LOG(ERROR) << "Invalid loop statement expression of type "
+        << Token::getTypeMarkName(ast.getTypeMark(cond)) << " received";
+      LOG(ERROR) << "Loop statement expression must resolve to type "
+          << Token::getTypeMarkName(TYPE_BOOL);
+    } else if (ast.getSize(cond) > 0) {
+      LOG(ERROR) << "Invalid loop statement; expected scalar, got array";
+    }
+  }
+  if (cond == NO_NODE) cond = ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
+  ast.link(init, tail, cond);
+  if (expectToken(TOK_RPAREN)) scan();
+  ast.link(init, tail, statements());
+  if (expectToken(TOK_RW_END)) scan();
+  if (expectToken(TOK_RW_FOR)) scan();
+  return ast.makeNode(NODE_LOOP, TYPE_NONE, 0, offset, init);
 }
 
 //  <return_statement> ::=
 //    `return' <expression>
-void Parser::returnStatement() {
+NodeId Parser::returnStatement() {
   LOG(DEBUG) << "<return_statement>";
+  uint32_t offset = tok_offset;
   expectToken(TOK_RW_RET);
-  if (panic_mode) return;  // No need to continue
+  if (panic_mode) return ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
   scan();
 
   // Make sure <expression> type matches return type for this function
-  int expr_size = 0;
-  TypeMark tm_expr = expression(expr_size);
-  TypeMark tm_ret = function_stack.top()->getTypeMark();
-  if (!type_checker.checkCompatible(tm_expr, tm_ret)) {
-    LOG(ERROR) << "Expression type " << Token::getTypeMarkName(tm_expr)
-        << " not compatible with return type "
-        << Token::getTypeMarkName(tm_ret);
+  NodeId expr = expression();
+  TypeMark tm_expr = ast.getTypeMark(expr);
+  TypeMark tm_ret = TYPE_NONE;
+
+  // Returning from the program body has no declared type to check against
+  // Expression type is unreliable after an error
+  if (!function_stack.empty()) {
+    tm_ret = function_stack.top()->getTypeMark();
+    if (!panic_mode && !type_checker.checkCompatible(tm_expr, tm_ret)) {
+      LOG(ERROR) << "Expression type " << Token::getTypeMarkName(tm_expr)
+          << " not compatible with return type "
+          << Token::getTypeMarkName(tm_ret);
+    }
   }
 
   // Return types are scalar only (unless I misunderstand the spec)
-  if (expr_size > 0) {
+  if (!panic_mode && (ast.getSize(expr) > 0)) {
     LOG(ERROR) << "Invalid return type; expected scalar, got array";
   }
+  return ast.makeNode(NODE_RETURN, tm_ret, 0, offset, expr);
 }
 
 //  <identifier> ::=
@@ -582,8 +776,9 @@ std::shared_ptr<IdToken> Parser::identifier(const bool& lookup) {
 
 //  <expression> ::=
 //    [`not'] <arith_op> <expression_prime>
-TypeMark Parser::expression(int& size) {
+NodeId Parser::expression() {
   LOG(DEBUG) << "<expression>";
+  uint32_t offset = tok_offset;
   bool bitwise_not = matchToken(TOK_RW_NOT);
   std::shared_ptr<Token> op_tok;
   if (bitwise_not) {
@@ -591,81 +786,90 @@ TypeMark Parser::expression(int& size) {
     op_tok = std::shared_ptr<Token>(new Token(TOK_OP_EXPR, "not"));
     scan();
   }
-  TypeMark tm_arith = arithOp(size);
+  NodeId arith = arithOp();
 
   // Check type compatibility for bitwise not
   if (bitwise_not) {
-    type_checker.checkCompatible(op_tok, tm_arith);
-    type_checker.checkArraySize(op_tok, size);
+    if (!panic_mode) {
+      type_checker.checkCompatible(op_tok, ast.getTypeMark(arith));
+      type_checker.checkArraySize(op_tok, ast.getSize(arith));
+    }
+    arith = ast.makeNode(NODE_NOT, ast.getTypeMark(arith), ast.getSize(arith),
+        offset, arith);
   }
-  return expressionPrime(tm_arith, size);
+  return expressionPrime(arith, ast.getTypeMark(arith));
 }
 
 //  <expression_prime> ::=
 //    `&' <arith_op> <expression_prime>
 //  | `|' <arith_op> <expression_prime>
 //  | epsilon
-TypeMark Parser::expressionPrime(const TypeMark& tm, int& size) {
+NodeId Parser::expressionPrime(const NodeId& lhs, const TypeMark& tm) {
   LOG(DEBUG) << "<expression_prime>";
   if (!matchToken(TOK_OP_EXPR)) {
     LOG(DEBUG) << "epsilon";
-  } else {
-    std::shared_ptr<Token> op_tok = tok;
-    scan();
-    int arith_size = 0;
-    TypeMark tm_arith = arithOp(arith_size);
-    type_checker.checkCompatible(op_tok, tm, tm_arith);
-    type_checker.checkArraySize(op_tok, size, arith_size);
-    size = std::max(size, arith_size);
-    expressionPrime(tm_arith, size);
+    return lhs;
   }
-  return tm;
+  std::shared_ptr<Token> op_tok = tok;
+  uint32_t offset = tok_offset;
+  scan();
+  NodeId arith = arithOp();
+  if (panic_mode) return lhs;  // Operand types are unreliable
+  type_checker.checkCompatible(op_tok, tm, ast.getTypeMark(arith));
+  type_checker.checkArraySize(op_tok, ast.getSize(lhs), ast.getSize(arith));
+  NodeId node = ast.makeBinary(op_tok, lhs, arith, ast.getTypeMark(lhs),
+      std::max(ast.getSize(lhs), ast.getSize(arith)), offset);
+  return expressionPrime(node, ast.getTypeMark(arith));
 }
 
 //  <arith_op> ::=
 //    <relation> <arith_op_prime>
-TypeMark Parser::arithOp(int& size) {
+NodeId Parser::arithOp() {
   LOG(DEBUG) << "<arith_op>";
-  TypeMark tm_relat = relation(size);
+  NodeId relat = relation();
 
   // tm_relat and tm_arith are checked in arithOpPrime
-  return arithOpPrime(tm_relat, size);
+  return arithOpPrime(relat);
 }
 
 //  <arith_op_prime> ::=
 //    `+' <relation> <arith_op_prime>
 //  | `-' <relation> <arith_op_prime>
 //  | epsilon
-TypeMark Parser::arithOpPrime(const TypeMark& tm, int& size) {
+NodeId Parser::arithOpPrime(const NodeId& lhs) {
   LOG(DEBUG) << "<arith_op_prime>";
   if (!matchToken(TOK_OP_ARITH)) {
     LOG(DEBUG) << "epsilon";
-    return tm;
+    return lhs;
   }
   std::shared_ptr<Token> op_tok = tok;
+  uint32_t offset = tok_offset;
   scan();
-  int relat_size = 0;
-  TypeMark tm_relat = relation(relat_size);
-  type_checker.checkCompatible(op_tok, tm, tm_relat);
-  type_checker.checkArraySize(op_tok, size, relat_size);
+  NodeId relat = relation();
+  if (panic_mode) return lhs;  // Operand types are unreliable
+  TypeMark tm_lhs = ast.getTypeMark(lhs);
+  TypeMark tm_relat = ast.getTypeMark(relat);
+  type_checker.checkCompatible(op_tok, tm_lhs, tm_relat);
+  type_checker.checkArraySize(op_tok, ast.getSize(lhs), ast.getSize(relat));
 
   // If either side is `float', cast to `float'
   TypeMark tm_result;
-  if ((tm == TYPE_FLT) || (tm_relat == TYPE_FLT)) {
+  if ((tm_lhs == TYPE_FLT) || (tm_relat == TYPE_FLT)) {
     tm_result = TYPE_FLT;
   } else {
     tm_result = TYPE_INT;
   }
-  size = std::max(size, relat_size);
-  return arithOpPrime(tm_result, size);
+  NodeId node = ast.makeBinary(op_tok, lhs, relat, tm_result,
+      std::max(ast.getSize(lhs), ast.getSize(relat)), offset);
+  return arithOpPrime(node);
 }
 
 //  <relation> ::=
 //    <term> <relation_prime>
-TypeMark Parser::relation(int& size) {
+NodeId Parser::relation() {
   LOG(DEBUG) << "<relation>";
-  TypeMark tm_term = term(size);
-  return relationPrime(tm_term, size);
+  NodeId trm = term();
+  return relationPrime(trm, ast.getTypeMark(trm));
 }
 
 //  <relation_prime> ::=
@@ -676,57 +880,62 @@ TypeMark Parser::relation(int& size) {
 //  | `==' <term> <relation_prime>
 //  | `!=' <term> <relation_prime>
 //  | epsilon
-TypeMark Parser::relationPrime(const TypeMark& tm, int& size) {
+NodeId Parser::relationPrime(const NodeId& lhs, const TypeMark& tm) {
   LOG(DEBUG) << "<relation_prime>";
   if (!matchToken(TOK_OP_RELAT)) {
     LOG(DEBUG) << "epsilon";
-    return tm;
+    return lhs;
   }
   std::shared_ptr<Token> op_tok = tok;
+  uint32_t offset = tok_offset;
   scan();
-  int term_size = 0;
-  TypeMark tm_term = term(term_size);
-  type_checker.checkCompatible(op_tok, tm, tm_term);
-  type_checker.checkArraySize(op_tok, size, term_size);
-  size = std::max(size, term_size);
-  relationPrime(tm_term, size);
-  return TYPE_BOOL;
+  NodeId trm = term();
+  if (panic_mode) return lhs;  // Operand types are unreliable
+  type_checker.checkCompatible(op_tok, tm, ast.getTypeMark(trm));
+  type_checker.checkArraySize(op_tok, ast.getSize(lhs), ast.getSize(trm));
+  NodeId node = ast.makeBinary(op_tok, lhs, trm, TYPE_BOOL,
+      std::max(ast.getSize(lhs), ast.getSize(trm)), offset);
+  return relationPrime(node, ast.getTypeMark(trm));
 }
 
 //  <term> ::=
 //    <factor> <term_prime>
-TypeMark Parser::term(int& size) {
+NodeId Parser::term() {
   LOG(DEBUG) << "<term>";
-  TypeMark tm_fact = factor(size);
-  return termPrime(tm_fact, size);
+  NodeId fact = factor();
+  return termPrime(fact);
 }
 
 //  <term_prime> ::=
 //    `*' <factor> <term_prime>
 //  | `/' <factor> <term_prime>
 //  | epsilon
-TypeMark Parser::termPrime(const TypeMark& tm, int& size) {
+NodeId Parser::termPrime(const NodeId& lhs) {
   LOG(DEBUG) << "<term_prime>";
   if (!matchToken(TOK_OP_TERM)) {
     LOG(DEBUG) << "epsilon";
-    return tm;
+    return lhs;
   }
   std::shared_ptr<Token> op_tok = tok;
+  uint32_t offset = tok_offset;
   scan();
-  int fact_size = 0;
-  TypeMark tm_fact = factor(fact_size);
-  type_checker.checkCompatible(op_tok, tm, tm_fact);
-  type_checker.checkArraySize(op_tok, size, fact_size);
+  NodeId fact = factor();
+  if (panic_mode) return lhs;  // Operand types are unreliable
+  TypeMark tm_lhs = ast.getTypeMark(lhs);
+  TypeMark tm_fact = ast.getTypeMark(fact);
+  type_checker.checkCompatible(op_tok, tm_lhs, tm_fact);
+  type_checker.checkArraySize(op_tok, ast.getSize(lhs), ast.getSize(fact));
 
   // If either side is `float', cast to `float'
   TypeMark tm_result;
-  if ((tm == TYPE_FLT) || (tm_fact == TYPE_FLT)) {
+  if ((tm_lhs == TYPE_FLT) || (tm_fact == TYPE_FLT)) {
     tm_result = TYPE_FLT;
   } else {
     tm_result = TYPE_INT;
   }
-  size = std::max(size, fact_size);
-  return termPrime(tm_result, size);
+  NodeId node = ast.makeBinary(op_tok, lhs, fact, tm_result,
+      std::max(ast.getSize(lhs), ast.getSize(fact)), offset);
+  return termPrime(node);
 }
 
 //  <factor> ::=
@@ -737,39 +946,45 @@ TypeMark Parser::termPrime(const TypeMark& tm, int& size) {
 //  | <string>
 //  | `true'
 //  | `false'
-TypeMark Parser::factor(int& size) {
+NodeId Parser::factor() {
   LOG(DEBUG) << "<factor>";
-  TypeMark tm = TYPE_NONE;
+  uint32_t offset = tok_offset;
+  NodeId node = NO_NODE;
 
   // Negative sign can only happen before <number> and <name>
   if (matchToken(TOK_OP_ARITH) && (tok->getVal() == "-")) {
     scan();
+    NodeId operand = NO_NODE;
     if (matchToken(TOK_IDENT)) {
       std::shared_ptr<IdToken> id_tok = std::dynamic_pointer_cast<IdToken>(
           env->lookup(tok->getVal(), false));
       if (!id_tok) {
         LOG(ERROR) << "Identifier not declared in this scope: "
             << tok->getStr();
+        scan();  // Consume it so the rest of the expression still parses
       } else if (!id_tok->getProcedure()) {
-        tm = name(size);
+        operand = name();
       } else {
         LOG(ERROR) << "Expected variable; got: " << tok->getStr();
       }
     } else if (matchToken(TOK_NUM)) {
-      std::shared_ptr<Token> num_tok = number();
-      tm = num_tok->getTypeMark();
-      size = 0;  // <number> literals are scalar
+      operand = number();
     } else {
       LOG(ERROR) << "Minus sign must be followed by <name> or <number>.";
       LOG(ERROR) << "Got: " << tok->getStr();
     }
+    if (operand != NO_NODE) {
+      node = ast.makeNode(NODE_NEGATE, ast.getTypeMark(operand),
+          ast.getSize(operand), offset, operand);
+    }
 
   // `('<expression>`)'
   } else if (matchToken(TOK_LPAREN)) {
+    SyncGuard guard(this, PAREN_SYNC);
     scan();
-    tm = expression(size);
+    node = expression();
     expectToken(TOK_RPAREN);
-    if (panic_mode) return tm;  // No need to continue
+    if (panic_mode) return node;  // No need to continue
     scan();
 
   // <procedure_call> or <name>
@@ -779,99 +994,101 @@ TypeMark Parser::factor(int& size) {
     if (!id_tok) {
       LOG(ERROR) << "Identifier not declared in this scope: "
           << tok->getStr();
+      scan();  // Consume it so the rest of the expression still parses
     } else if (id_tok->getProcedure()) {
-      tm = procedureCall();
-      size = 0;  // Procedure calls return scalars
+      node = procedureCall();
     } else {
-      tm = name(size);
+      node = name();
     }
 
   // <number>
   } else if (matchToken(TOK_NUM)) {
-    std::shared_ptr<Token> num_tok = number();
-    tm = num_tok->getTypeMark();
-    size = 0;  // <number> literals are scalars
+    node = number();
 
   // <string>
   } else if (matchToken(TOK_STR)) {
-    std::shared_ptr<LiteralToken<std::string>> str_tok = string();
-    tm = str_tok->getTypeMark();
-    size = 0;  // <string> literals are scalars
+    node = string();
 
   // `true'
   } else if (matchToken(TOK_RW_TRUE)) {
-    tm = TYPE_BOOL;
-    size = 0;  // `true' literals are scalars
+    node = ast.makeBool(true, offset);
     scan();
 
   // `false'
   } else if (matchToken(TOK_RW_FALSE)) {
-    tm = TYPE_BOOL;
-    size = 0;  // `false' literals are scalars
+    node = ast.makeBool(false, offset);
     scan();
 
   // Oof
   } else {
     LOG(ERROR) << "Unexpected token: " << tok->getStr();
-    tm = TYPE_NONE;
-    size = 0;
     panic();
   }
-  return tm;
+  if (node == NO_NODE) node = ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
+  return node;
 }
 
 //  <name> ::=
 //    <identifier> [`['<expression>`]']
-TypeMark Parser::name(int& size) {
+NodeId Parser::name() {
   LOG(DEBUG) << "<name>";
+  uint32_t offset = tok_offset;
   std::shared_ptr<IdToken> id_tok = identifier(true);
   if (id_tok->getProcedure()) {
     LOG(ERROR) << "Expected variable; got procedure " << id_tok->getVal();
   }
-  TypeMark tm = id_tok->getTypeMark();
-  size = id_tok->getNumElements();
+  NodeId idx = NO_NODE;
   if (matchToken(TOK_LBRACK)) {
     LOG(DEBUG) << "Indexing array";
-    size = 0;  // If indexing, it's a single element not an array
     if (id_tok->getProcedure() || (id_tok->getNumElements() < 1)) {
       LOG(ERROR) << "Attempt to index non-array symbol " << id_tok->getVal();
     }
+    SyncGuard guard(this, BRACKET_SYNC);
     scan();
-    int idx_size = 0;
-    TypeMark tm_idx = expression(idx_size);
-    type_checker.checkArrayIndex(tm_idx);
-    if (idx_size > 0) {
-      LOG(ERROR) << "Invalid index; expected scalar, got array";
+    idx = expression();
+    if (!panic_mode) {
+      type_checker.checkArrayIndex(ast.getTypeMark(idx));
+      if (ast.getSize(idx) > 0) {
+        LOG(ERROR) << "Invalid index; expected scalar, got array";
+      }
     }
     expectToken(TOK_RBRACK);
-    if (panic_mode) return tm;  // No need to continue
-    scan();
+    if (!panic_mode) scan();
   }
-  return tm;
+  NodeId node = ast.makeSymbol(NODE_NAME, id_tok, offset, idx);
+
+  // If indexing, it's a single element not an array
+  if (idx != NO_NODE) ast.setSize(node, 0);
+  return node;
 }
 
 //  <argument_list> ::=
 //    <expression> `,' <argument_list>
 //  | <expression>
-void Parser::argumentList(const int& idx, std::shared_ptr<IdToken> fun_tok) {
+void Parser::argumentList(const int& idx, std::shared_ptr<IdToken> fun_tok,
+    NodeId& first, NodeId& tail) {
   LOG(DEBUG) << "<argument_list>";
-  int expr_size = 0;
-  TypeMark tm_arg = expression(expr_size);
+  NodeId arg = expression();
+  ast.link(first, tail, arg);
+  TypeMark tm_arg = ast.getTypeMark(arg);
   std::shared_ptr<IdToken> param = fun_tok->getParam(idx);
-  if (!param) {
+  if (panic_mode) {
+    // Argument is broken; the error is already reported
+    if (!resync(ARGUMENT_LIST_SYNC)) return;
+  } else if (!param) {
     LOG(ERROR) << "Unexpected parameter with type "
         << Token::getTypeMarkName(tm_arg);
   } else if (!type_checker.checkCompatible(param->getTypeMark(), tm_arg)) {
     LOG(ERROR) << "Expected parameter with type "
         << Token::getTypeMarkName(param->getTypeMark()) << "; got "
         << Token::getTypeMarkName(tm_arg);
-  } else if (expr_size != param->getNumElements()) {
-    LOG(ERROR) << "Size of argument (" << expr_size
+  } else if (static_cast<int>(ast.getSize(arg)) != param->getNumElements()) {
+    LOG(ERROR) << "Size of argument (" << ast.getSize(arg)
         << ") != size of parameter (" << param->getNumElements() << ")";
   }
   if (matchToken(TOK_COMMA)) {
     scan();
-    argumentList(idx + 1, fun_tok);
+    argumentList(idx + 1, fun_tok, first, tail);
   } else if (idx < fun_tok->getNumElements() - 1) {
     LOG(ERROR) << "Not enough parameters for procedure call "
         << fun_tok->getVal();
@@ -880,20 +1097,31 @@ void Parser::argumentList(const int& idx, std::shared_ptr<IdToken> fun_tok) {
 
 //  <number> ::=
 //    [0-9][0-9_]*[.[0-9_]*]
-std::shared_ptr<Token> Parser::number() {
+NodeId Parser::number() {
   LOG(DEBUG) << "<number>";
-  std::shared_ptr<Token> num_tok = std::shared_ptr<Token>(new Token());
+  uint32_t offset = tok_offset;
+  NodeId node = NO_NODE;
   if (expectToken(TOK_NUM)) {
-    num_tok = tok;
+    std::shared_ptr<LiteralToken<int>> int_tok =
+        std::dynamic_pointer_cast<LiteralToken<int>>(tok);
+    std::shared_ptr<LiteralToken<float>> flt_tok =
+        std::dynamic_pointer_cast<LiteralToken<float>>(tok);
+    if (int_tok) {
+      node = ast.makeInt(int_tok->getVal(), offset);
+    } else if (flt_tok) {
+      node = ast.makeFloat(flt_tok->getVal(), offset);
+    }
   }
   if (!panic_mode) scan();
-  return num_tok;
+  if (node == NO_NODE) node = ast.makeNode(NODE_ERROR, TYPE_NONE, 0, offset);
+  return node;
 }
 
 //  <string> ::=
 //    `"'[^"]*`"'
-std::shared_ptr<LiteralToken<std::string>> Parser::string() {
+NodeId Parser::string() {
   LOG(DEBUG) << "<string>";
+  uint32_t offset = tok_offset;
   std::shared_ptr<LiteralToken<std::string>> str_tok =
       std::shared_ptr<LiteralToken<std::string>>(
         new LiteralToken<std::string>(TOK_STR, "", TYPE_STR));
@@ -903,5 +1131,5 @@ std::shared_ptr<LiteralToken<std::string>> Parser::string() {
     LOG(ERROR) << "Using empty string";
   }
   if (!panic_mode) scan();
-  return str_tok;
+  return ast.makeString(str_tok->getVal(), offset);
 }
@@ -1,22 +1,32 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <bitset>
+#include <cstdint>
 #include <fstream>
+#include <initializer_list>
 #include <memory>
 #include <stack>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "ast.h"
 #include "environment.h"
 #include "scanner.h"
 #include "token.h"
 #include "type_checker.h"
 
+// Set of tokens the parser can resume at after an error
+typedef std::bitset<NUM_TOK_ENUMS> SyncSet;
+
 class Parser {
 public:
   Parser();
   bool init(const std::string&);
   bool parse();  // program
+  Ast& getAst() { return ast; }
+  std::shared_ptr<Environment> getEnv() { return env; }
 
 private:
   std::shared_ptr<Environment> env;
@@ -25,46 +35,77 @@ private:
   std::shared_ptr<Token> tok;
   std::stack<std::shared_ptr<IdToken>> function_stack;
   bool panic_mode;
+  std::vector<SyncSet> sync_stack;
+  Ast ast;
+  size_t src_bytes;
+  uint32_t tok_offset;  // Source offset of tok
+
+  // Pushes a synchronization set for the lifetime of a production
+  class SyncGuard {
+  public:
+    SyncGuard(Parser* p, const SyncSet& s) : parser(p) {
+      parser->sync_stack.push_back(s);
+    }
+    ~SyncGuard() { parser->sync_stack.pop_back(); }
+  private:
+    Parser* parser;
+  };
+
+  // FOLLOW-derived synchronization sets
+  static const SyncSet PROGRAM_SYNC;
+  static const SyncSet DECLARATIONS_SYNC;
+  static const SyncSet STATEMENTS_SYNC;
+  static const SyncSet PROCEDURE_HEADER_SYNC;
+  static const SyncSet PROCEDURE_BODY_SYNC;
+  static const SyncSet PARAMETER_LIST_SYNC;
+  static const SyncSet IF_SYNC;
+  static const SyncSet LOOP_SYNC;
+  static const SyncSet PAREN_SYNC;
+  static const SyncSet BRACKET_SYNC;
+  static const SyncSet ARGUMENT_LIST_SYNC;
+  static SyncSet makeSyncSet(std::initializer_list<TokenType>);
+
   void scan();
   bool matchToken(const TokenType&);
   bool expectToken(const TokenType&);
   void panic();
+  bool resync(const SyncSet&);
   void push_scope(std::shared_ptr<IdToken>);
   void pop_scope();
   void programHeader();
-  void programBody();
-  void declarations(bool);
-  void statements();
-  void declaration(bool);
-  void procedureDeclaration(const bool&);
-  void procedureHeader(const bool&);
-  void parameterList();
+  NodeId programBody();
+  NodeId declarations(bool);
+  NodeId statements();
+  NodeId declaration(bool);
+  NodeId procedureDeclaration(const bool&);
+  NodeId procedureHeader(const bool&, std::shared_ptr<IdToken>&);
+  void parameterList(NodeId&, NodeId&);
   std::shared_ptr<IdToken> parameter();
-  void procedureBody();
+  void procedureBody(NodeId&, NodeId&);
   std::shared_ptr<IdToken> variableDeclaration(const bool&);
   TypeMark typeMark();
   int bound();
-  void statement();
-  TypeMark procedureCall();
-  void assignmentStatement();
-  TypeMark destination(int&);
-  void ifStatement();
-  void loopStatement();
-  void returnStatement();
+  NodeId statement();
+  NodeId procedureCall();
+  NodeId assignmentStatement();
+  NodeId destination();
+  NodeId ifStatement();
+  NodeId loopStatement();
+  NodeId returnStatement();
   std::shared_ptr<IdToken> identifier(const bool&);
-  TypeMark expression(int&);
-  TypeMark expressionPrime(const TypeMark&, int&);
-  TypeMark arithOp(int&);
-  TypeMark arithOpPrime(const TypeMark&, int&);
-  TypeMark relation(int&);
-  TypeMark relationPrime(const TypeMark&, int&);
-  TypeMark term(int&);
-  TypeMark termPrime(const TypeMark&, int&);
-  TypeMark factor(int&);
-  TypeMark name(int&);
-  void argumentList(const int&, std::shared_ptr<IdToken>);
-  std::shared_ptr<Token> number();
-  std::shared_ptr<LiteralToken<std::string>> string();
+  NodeId expression();
+  NodeId expressionPrime(const NodeId&, const TypeMark&);
+  NodeId arithOp();
+  NodeId arithOpPrime(const NodeId&);
+  NodeId relation();
+  NodeId relationPrime(const NodeId&, const TypeMark&);
+  NodeId term();
+  NodeId termPrime(const NodeId&);
+  NodeId factor();
+  NodeId name();
+  void argumentList(const int&, std::shared_ptr<IdToken>, NodeId&, NodeId&);
+  NodeId number();
+  NodeId string();
 };
 
 #endif // PARSER_H
@@ -0,0 +1,333 @@
+#include "peephole.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "register_allocator.h"
+#include "x86.h"
+
+namespace {
+
+// Sweeps over a function before giving up on reaching a fixed point
+const size_t MAX_SWEEPS = 16;
+
+// The condition that holds exactly when the given one does not
+const Cond inverse[NUM_CONDS] = {
+  CC_NE, CC_E, CC_GE, CC_G, CC_LE, CC_L, CC_AE, CC_A, CC_BE, CC_B, CC_NP, CC_P,
+};
+
+// A return hands back its result and the callee-saved registers
+const Reg return_regs[] = {RAX, XMM0, RBX, R12, R13, R14, R15};
+
+bool sameMem(const MOperand& a, const MOperand& b) {
+  return (a.kind == MO_MEM) && (b.kind == MO_MEM) && (a.reg == b.reg)
+      && (a.index == b.index) && (a.scale == b.scale) && (a.imm == b.imm)
+      && (a.sym == b.sym);
+}
+
+bool isReg(const MOperand& o, const Reg& r) {
+  return (o.kind == MO_REG) && (o.reg == r);
+}
+
+void getMasks(const MInstr& instr, uint64_t& uses, uint64_t& defs) {
+  static std::vector<Reg> use_regs;
+  static std::vector<Reg> def_regs;
+  RegisterAllocator::getUsesDefs(instr, use_regs, def_regs);
+  uses = defs = 0;
+  for (Reg r : use_regs) uses |= uint64_t(1) << r;
+  for (Reg r : def_regs) defs |= uint64_t(1) << r;
+  if (instr.op == M_RET) {
+    for (Reg r : return_regs) uses |= uint64_t(1) << r;
+  }
+}
+
+}  // namespace
+
+// Earlier entries are tried first where several start at one instruction
+const Peephole::Pattern Peephole::patterns[NUM_PATTERNS] = {
+  {"set and branch", {M_SETCC, M_MOVZB, M_CMP, M_JCC},
+      &Peephole::branchOnFlags},
+  {"move back", {M_MOV, M_MOV}, &Peephole::removeMoveBack},
+  {"float move back", {M_MOVSS, M_MOVSS}, &Peephole::removeMoveBack},
+  {"store then load", {M_MOV, M_MOV}, &Peephole::forwardStore},
+  {"float store then load", {M_MOVSS, M_MOVSS}, &Peephole::forwardStore},
+  {"compare with zero", {M_CMP}, &Peephole::testForZero},
+  {"branch over jump", {M_JCC, M_JMP, M_LABEL}, &Peephole::invertBranch},
+  {"jump to jump", {M_JMP}, &Peephole::skipJumpChain},
+  {"branch to jump", {M_JCC}, &Peephole::skipJumpChain},
+  {"jump to next", {M_JMP}, &Peephole::removeJumpToNext},
+  {"unused label", {M_LABEL}, &Peephole::removeLabel},
+};
+
+Peephole::Peephole(std::vector<MInstr>& c) : code(c), num_rewrites() {}
+
+void Peephole::run() {
+  for (size_t s = 0; (s < MAX_SWEEPS) && sweep(); s++) {}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+bool Peephole::sweep() {
+  findLabels();
+  findLiveness();
+  removed.assign(code.size(), false);
+  bool changed = false;
+  std::vector<size_t> at;
+  for (size_t i = 0; i < code.size(); i = next(i)) {
+    for (size_t p = 0; (p < NUM_PATTERNS) && !removed[i]; p++) {
+      at.clear();
+      size_t j = i;
+      for (MOp op : patterns[p].ops) {
+        if ((j >= code.size()) || (code[j].op != op)) break;
+        at.push_back(j);
+        j = next(j);
+      }
+      if (at.size() < patterns[p].ops.size()) continue;
+      if ((this->*patterns[p].rewrite)(at)) {
+        num_rewrites[p]++;
+        changed = true;
+      }
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < code.size(); i++) {
+    if (!removed[i]) code[n++] = code[i];
+  }
+  code.resize(n);
+  return changed;
+}
+
+void Peephole::findLabels() {
+  labels.clear();
+  label_refs.clear();
+  for (size_t i = 0; i < code.size(); i++) {
+    const MInstr& instr = code[i];
+    if (instr.op == M_LABEL) {
+      labels[instr.ops[0].imm] = i;
+      continue;
+    }
+    for (uint8_t n = 0; n < instr.num_ops; n++) {
+      if (instr.ops[n].kind == MO_LABEL) label_refs[instr.ops[n].imm]++;
+    }
+  }
+}
+
+// Registers live into each label, over blocks that start at labels and
+// after jumps and returns. Rewrites within a sweep only remove uses, or
+// extend a register's life between neighbouring instructions, so the sets
+// stay safe until the next one.
+void Peephole::findLiveness() {
+  std::vector<size_t> starts;
+  std::unordered_map<int64_t, size_t> label_blocks;
+  for (size_t i = 0; i < code.size(); i++) {
+    MOp prev = (i > 0) ? code[i - 1].op : M_LABEL;
+    if ((i == 0) || (code[i].op == M_LABEL) || (prev == M_JMP)
+        || (prev == M_JCC) || (prev == M_RET)) {
+      starts.push_back(i);
+    }
+    if (code[i].op == M_LABEL) {
+      label_blocks[code[i].ops[0].imm] = starts.size() - 1;
+    }
+  }
+  size_t num_blocks = starts.size();
+  starts.push_back(code.size());
+
+  std::vector<uint64_t> gen(num_blocks, 0);
+  std::vector<uint64_t> kill(num_blocks, 0);
+  std::vector<uint64_t> live_in(num_blocks, 0);
+  for (size_t b = 0; b < num_blocks; b++) {
+    for (size_t i = starts[b + 1]; i-- > starts[b]; ) {
+      uint64_t uses;
+      uint64_t defs;
+      getMasks(code[i], uses, defs);
+      gen[b] = (gen[b] & ~defs) | uses;
+      kill[b] |= defs;
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = num_blocks; b-- > 0; ) {
+      const MInstr& last = code[starts[b + 1] - 1];
+      uint64_t out = 0;
+      if ((last.op == M_JMP) || (last.op == M_JCC)) {
+        auto it = label_blocks.find(last.ops[0].imm);
+        out |= (it != label_blocks.end()) ? live_in[it->second]
+            : ~uint64_t(0);
+      }
+      if ((last.op != M_JMP) && (last.op != M_RET) && (b + 1 < num_blocks)) {
+        out |= live_in[b + 1];
+      }
+      uint64_t in = gen[b] | (out & ~kill[b]);
+      if (in != live_in[b]) {
+        live_in[b] = in;
+        changed = true;
+      }
+    }
+  }
+  label_live.clear();
+  for (auto& entry : label_blocks) {
+    label_live[entry.first] = live_in[entry.second];
+  }
+}
+
+// The next instruction still in place
+size_t Peephole::next(size_t i) const {
+  for (i++; (i < code.size()) && removed[i]; i++) {}
+  return i;
+}
+
+// Whether the code after instruction i, on any path, reads r before writing it
+bool Peephole::isLiveAfter(const size_t& i, const Reg& r) {
+  uint64_t bit = uint64_t(1) << r;
+  for (size_t j = i; j < code.size(); j = next(j)) {
+    const MInstr& instr = code[j];
+    if (j != i) {
+      uint64_t uses;
+      uint64_t defs;
+      getMasks(instr, uses, defs);
+      if (uses & bit) return true;
+      if (defs & bit) return false;
+    }
+    if (instr.op == M_RET) return false;
+    if ((instr.op == M_JMP) || (instr.op == M_JCC)) {
+      auto it = label_live.find(instr.ops[0].imm);
+      if ((it == label_live.end()) || (it->second & bit)) return true;
+      if (instr.op == M_JMP) return false;
+    }
+  }
+  return false;
+}
+
+void Peephole::remove(const size_t& i) {
+  removed[i] = true;
+  const MInstr& instr = code[i];
+  for (uint8_t n = 0; n < instr.num_ops; n++) {
+    if ((instr.op != M_LABEL) && (instr.ops[n].kind == MO_LABEL)) {
+      label_refs[instr.ops[n].imm]--;
+    }
+  }
+}
+
+void Peephole::retarget(MInstr& jump, const int64_t& label) {
+  label_refs[jump.ops[0].imm]--;
+  label_refs[label]++;
+  jump.ops[0].imm = label;
+}
+
+// mov a, b; mov b, a: the second copies b back to where it came from
+bool Peephole::removeMoveBack(const std::vector<size_t>& at) {
+  const MInstr& first = code[at[0]];
+  const MInstr& second = code[at[1]];
+  if ((first.size != second.size) || (first.ops[0].kind != MO_REG)
+      || (first.ops[1].kind != MO_REG)
+      || !isReg(second.ops[0], first.ops[1].reg)
+      || !isReg(second.ops[1], first.ops[0].reg)) {
+    return false;
+  }
+  remove(at[1]);
+  return true;
+}
+
+// mov r, m; mov m, s: the load reads what r still holds. A float load also
+// clears the upper lanes, which a move between registers does not, so it
+// only goes when it reloads r itself.
+bool Peephole::forwardStore(const std::vector<size_t>& at) {
+  const MInstr& store = code[at[0]];
+  MInstr& load = code[at[1]];
+  if ((store.size != load.size) || (store.ops[0].kind != MO_REG)
+      || !sameMem(store.ops[1], load.ops[0]) || (load.ops[1].kind != MO_REG)) {
+    return false;
+  }
+  if (load.ops[1].reg == store.ops[0].reg) {
+    remove(at[1]);
+    return true;
+  }
+  if (load.op != M_MOV) return false;
+  load.ops[0] = store.ops[0];
+  return true;
+}
+
+// setcc %al; movzbl %al, r; cmp $0, r; je/jne: a condition only branched on
+// can branch on the flags directly, if neither register is read later
+bool Peephole::branchOnFlags(const std::vector<size_t>& at) {
+  const MInstr& set = code[at[0]];
+  const MInstr& ext = code[at[1]];
+  const MInstr& cmp = code[at[2]];
+  MInstr& jcc = code[at[3]];
+  Reg flag = set.ops[0].reg;
+  if (!isReg(ext.ops[0], flag) || (ext.ops[1].kind != MO_REG)) return false;
+  Reg value = ext.ops[1].reg;
+  if ((cmp.ops[0].kind != MO_IMM) || (cmp.ops[0].imm != 0)
+      || !isReg(cmp.ops[1], value) || ((jcc.cc != CC_E) && (jcc.cc != CC_NE))
+      || isLiveAfter(at[3], flag) || isLiveAfter(at[3], value)) {
+    return false;
+  }
+  jcc.cc = (jcc.cc == CC_E) ? inverse[set.cc] : set.cc;
+  remove(at[0]);
+  remove(at[1]);
+  remove(at[2]);
+  return true;
+}
+
+// cmp $0, r sets the flags as test r, r does, in a shorter encoding
+bool Peephole::testForZero(const std::vector<size_t>& at) {
+  MInstr& cmp = code[at[0]];
+  if ((cmp.ops[0].kind != MO_IMM) || (cmp.ops[0].imm != 0)
+      || (cmp.ops[1].kind != MO_REG)) {
+    return false;
+  }
+  cmp.op = M_TEST;
+  cmp.ops[0] = cmp.ops[1];
+  return true;
+}
+
+// jcc l1; jmp l2; l1: becomes the inverse branch to l2
+bool Peephole::invertBranch(const std::vector<size_t>& at) {
+  MInstr& jcc = code[at[0]];
+  const MInstr& jmp = code[at[1]];
+  if (jcc.ops[0].imm != code[at[2]].ops[0].imm) return false;
+  jcc.cc = inverse[jcc.cc];
+  retarget(jcc, jmp.ops[0].imm);
+  remove(at[1]);
+  return true;
+}
+
+// A jump to a label followed by a jump goes straight to the second target
+bool Peephole::skipJumpChain(const std::vector<size_t>& at) {
+  MInstr& jump = code[at[0]];
+  auto it = labels.find(jump.ops[0].imm);
+  if (it == labels.end()) return false;
+  size_t j = next(it->second);
+  while ((j < code.size()) && (code[j].op == M_LABEL)) j = next(j);
+  if ((j >= code.size()) || (code[j].op != M_JMP)
+      || (code[j].ops[0].imm == jump.ops[0].imm)) {
+    return false;
+  }
+  retarget(jump, code[j].ops[0].imm);
+  return true;
+}
+
+// A jump to one of the labels right after it
+bool Peephole::removeJumpToNext(const std::vector<size_t>& at) {
+  int64_t target = code[at[0]].ops[0].imm;
+  for (size_t j = next(at[0]); (j < code.size()) && (code[j].op == M_LABEL);
+      j = next(j)) {
+    if (code[j].ops[0].imm == target) {
+      remove(at[0]);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Labels nothing jumps to no longer split the code for the patterns above
+bool Peephole::removeLabel(const std::vector<size_t>& at) {
+  if (label_refs[code[at[0]].ops[0].imm] > 0) return false;
+  remove(at[0]);
+  return true;
+}
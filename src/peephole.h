@@ -0,0 +1,72 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "x86.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Peephole optimizer
+// Runs over a function's allocated machine code, before it is printed. Each
+// entry of the pattern table names a sequence of opcodes and a rewrite that
+// checks the operands and, if they fit, replaces the instructions; sweeps
+// over the code try every pattern at every instruction until none applies.
+// Removed instructions are only marked until the end of a sweep, so labels
+// keep their positions and the instructions a pattern sees are the next
+// ones still in place. Rewrites that must know a register is no longer
+// needed look ahead in the code, using the registers live into each label.
+// Only the x86 backend's code goes through it: the JIT writes bytes from
+// templates, with no instruction list to match against.
+////////////////////////////////////////////////////////////////////////////////
+class Peephole {
+public:
+  static const size_t NUM_PATTERNS = 11;
+
+  Peephole(std::vector<MInstr>&);
+  void run();
+  size_t getNumRewrites(const size_t& p) { return num_rewrites[p]; }
+  static const char* getPatternName(const size_t& p) {
+    return patterns[p].name;
+  }
+
+private:
+  // Opcodes of the instructions a pattern starts at, and its rewrite, given
+  // their positions; it returns false to leave them as they are
+  struct Pattern {
+    const char* name;
+    std::vector<MOp> ops;
+    bool (Peephole::*rewrite)(const std::vector<size_t>&);
+  };
+
+  std::vector<MInstr>& code;
+  std::vector<bool> removed;
+  std::unordered_map<int64_t, size_t> labels;  // Label -> position
+  std::unordered_map<int64_t, size_t> label_refs;  // Label -> jumps to it
+  std::unordered_map<int64_t, uint64_t> label_live;  // Label -> live registers
+  size_t num_rewrites[NUM_PATTERNS];
+
+  bool sweep();
+  void findLabels();
+  void findLiveness();
+  size_t next(size_t) const;
+  bool isLiveAfter(const size_t&, const Reg&);
+  void remove(const size_t&);
+  void retarget(MInstr&, const int64_t&);
+
+  // Rewrites
+  bool removeMoveBack(const std::vector<size_t>&);
+  bool forwardStore(const std::vector<size_t>&);
+  bool branchOnFlags(const std::vector<size_t>&);
+  bool testForZero(const std::vector<size_t>&);
+  bool skipJumpChain(const std::vector<size_t>&);
+  bool invertBranch(const std::vector<size_t>&);
+  bool removeJumpToNext(const std::vector<size_t>&);
+  bool removeLabel(const std::vector<size_t>&);
+
+  static const Pattern patterns[NUM_PATTERNS];
+};
+
+#endif // PEEPHOLE_H
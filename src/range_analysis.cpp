@@ -0,0 +1,325 @@
+#include "range_analysis.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+namespace {
+
+const int64_t INT_MIN32 = std::numeric_limits<int32_t>::min();
+const int64_t INT_MAX32 = std::numeric_limits<int32_t>::max();
+
+// Growing intervals are widened after this many changes
+const uint32_t WIDEN_AFTER = 2;
+// Passes that narrow the widened intervals again
+const uint32_t NARROW_PASSES = 2;
+
+// The compare that holds when op does not
+Opcode negate(const Opcode& op) {
+  switch (op) {
+    case IR_LT: return IR_GE;
+    case IR_LE: return IR_GT;
+    case IR_GT: return IR_LE;
+    case IR_GE: return IR_LT;
+    case IR_EQ: return IR_NE;
+    default: return IR_EQ;
+  }
+}
+
+// The compare with its operands swapped
+Opcode swap(const Opcode& op) {
+  switch (op) {
+    case IR_LT: return IR_GT;
+    case IR_LE: return IR_GE;
+    case IR_GT: return IR_LT;
+    case IR_GE: return IR_LE;
+    default: return op;
+  }
+}
+
+}  // namespace
+
+RangeAnalysis::RangeAnalysis(Module& m) :
+    module(m),
+    func(nullptr),
+    num_checks(0),
+    num_removed(0) {}
+
+void RangeAnalysis::run() {
+  for (auto& f : module.functions) {
+    if (f.external) continue;
+    func = &f;
+    runFunction();
+  }
+  LOG(INFO) << "Range analysis: " << num_removed << " of " << num_checks
+      << " bounds checks removed";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void RangeAnalysis::runFunction() {
+  size_t num_values = func->instrs.size();
+  ranges.assign(num_values, {1, 0});
+  positions.assign(num_values, 0);
+  checks.assign(num_values, {});
+  std::vector<ValueId> ints;
+  for (auto& block : func->blocks) {
+    for (uint32_t i = 0; i < block.instrs.size(); i++) {
+      ValueId v = block.instrs[i];
+      Instr& instr = func->instrs[v];
+      positions[v] = i;
+      if (instr.type == IR_INT) ints.push_back(v);
+      if ((instr.op == IR_ALOAD) || (instr.op == IR_ASTORE)) {
+        checks[func->getOperand(v, 1)].push_back(v);
+      }
+    }
+  }
+  findDominators();
+
+  // Blocks are in reverse postorder, so one pass sees every definition
+  // before its uses except around loops
+  std::vector<uint32_t> changes(num_values, 0);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (ValueId v : ints) {
+      Range old = ranges[v];
+      Range r = join(old, evaluate(v));
+      if ((r.lo == old.lo) && (r.hi == old.hi)) continue;
+      if (!isEmpty(old) && (++changes[v] > WIDEN_AFTER)) {
+        if (r.lo < old.lo) r.lo = INT_MIN32;
+        if (r.hi > old.hi) r.hi = INT_MAX32;
+      }
+      ranges[v] = r;
+      changed = true;
+    }
+  }
+  for (uint32_t pass = 0; pass < NARROW_PASSES; pass++) {
+    for (ValueId v : ints) {
+      Range r = evaluate(v);
+      ranges[v].lo = std::max(ranges[v].lo, r.lo);
+      ranges[v].hi = std::min(ranges[v].hi, r.hi);
+    }
+  }
+
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      if ((instr.op != IR_ALOAD) && (instr.op != IR_ASTORE)) continue;
+      num_checks++;
+      Range r = getRangeAt(func->getOperand(v, 1), instr.block, positions[v]);
+      if (isEmpty(r) || ((r.lo >= 0) && (r.hi < instr.count))) {
+        instr.flags |= IR_FLAG_IN_BOUNDS;
+        num_removed++;
+      }
+    }
+  }
+}
+
+// A preorder numbering of the dominator tree, so a block dominates the ones
+// numbered from it to its last descendant
+void RangeAnalysis::findDominators() {
+  size_t num_blocks = func->blocks.size();
+  idoms = func->findIdoms();
+  std::vector<std::vector<BlockId>> children(num_blocks);
+  for (BlockId b = 1; b < num_blocks; b++) children[idoms[b]].push_back(b);
+  dom_pre.assign(num_blocks, 0);
+  dom_last.assign(num_blocks, 0);
+  uint32_t next = 0;
+  std::vector<std::pair<BlockId, size_t>> stack(1, {0, 0});
+  dom_pre[0] = next++;
+  while (!stack.empty()) {
+    BlockId b = stack.back().first;
+    size_t& child = stack.back().second;
+    if (child < children[b].size()) {
+      BlockId c = children[b][child++];
+      dom_pre[c] = next++;
+      stack.push_back({c, 0});
+    } else {
+      dom_last[b] = next - 1;
+      stack.pop_back();
+    }
+  }
+}
+
+// The values an int instruction can produce, from its operands as they are
+// where it is
+RangeAnalysis::Range RangeAnalysis::evaluate(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  if (instr.op == IR_CONST) return {instr.imm.i, instr.imm.i};
+  if (instr.op == IR_BTOI) return {0, 1};
+  if (instr.op == IR_PHI) {
+    Block& block = func->blocks[instr.block];
+    Range r = {1, 0};
+    for (uint32_t i = 0; i < instr.num_ops; i++) {
+      BlockId pred = block.preds[i];
+      r = join(r, getRangeAt(func->getOperand(v, i), pred,
+          static_cast<uint32_t>(func->blocks[pred].instrs.size())));
+    }
+    return r;
+  }
+
+  switch (instr.op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_NEG:
+    case IR_NOT:
+      break;
+    default:
+      return full();
+  }
+  Range a = getRangeAt(func->getOperand(v, 0), instr.block, positions[v]);
+  Range b = a;
+  if (instr.num_ops > 1) {
+    b = getRangeAt(func->getOperand(v, 1), instr.block, positions[v]);
+  }
+  if (isEmpty(a) || isEmpty(b)) return {1, 0};
+  switch (instr.op) {
+    case IR_ADD:
+      return clamp(a.lo + b.lo, a.hi + b.hi);
+    case IR_SUB:
+      return clamp(a.lo - b.hi, a.hi - b.lo);
+    case IR_MUL: {
+      int64_t p[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+      return clamp(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+    }
+    case IR_DIV:
+      // Division truncates, which keeps the order for a positive divisor
+      if ((b.lo == b.hi) && (b.lo > 0)) return {a.lo / b.lo, a.hi / b.lo};
+      return full();
+    case IR_AND:
+      if ((a.lo >= 0) && (b.lo >= 0)) return {0, std::min(a.hi, b.hi)};
+      if (a.lo >= 0) return {0, a.hi};
+      if (b.lo >= 0) return {0, b.hi};
+      return full();
+    case IR_NEG:
+      return clamp(-a.hi, -a.lo);
+    default:
+      return {-a.hi - 1, -a.lo - 1};
+  }
+}
+
+// The values v can have at instruction pos of block b: its range, narrowed
+// by the bounds checks on it that have passed and the conditions of the
+// branches taken to get there
+RangeAnalysis::Range RangeAnalysis::getRangeAt(const ValueId& v,
+    const BlockId& b, const uint32_t& pos) {
+  Range r = ranges[v];
+  if (isEmpty(r)) return r;
+  for (ValueId c : checks[v]) {
+    Instr& check = func->instrs[c];
+    bool passed = (check.block == b) ? (positions[c] < pos)
+        : dominates(check.block, b);
+    if (!passed) continue;
+    r.lo = std::max<int64_t>(r.lo, 0);
+    r.hi = std::min<int64_t>(r.hi, static_cast<int64_t>(check.count) - 1);
+  }
+
+  // A block with one predecessor is only entered along that edge
+  for (BlockId x = b; x != 0; x = idoms[x]) {
+    Block& block = func->blocks[x];
+    if (block.preds.size() != 1) continue;
+    Block& pred = func->blocks[block.preds[0]];
+    ValueId term = pred.instrs.back();
+    if ((func->instrs[term].op != IR_CBR) || (pred.succs[0] == pred.succs[1])) {
+      continue;
+    }
+    applyCondition(func->getOperand(term, 0), pred.succs[0] == x, v, r);
+  }
+  return r;
+}
+
+// Narrow r, the range of v, by cond having been found to equal truth
+void RangeAnalysis::applyCondition(const ValueId& cond, const bool& truth,
+    const ValueId& v, Range& r) {
+  Instr& instr = func->instrs[cond];
+  if (instr.type != IR_BOOL) return;
+  switch (instr.op) {
+    case IR_NOT:
+      applyCondition(func->getOperand(cond, 0), !truth, v, r);
+      return;
+    case IR_AND:
+    case IR_OR:
+      // Both sides are known when an and is true or an or is false
+      if (truth == (instr.op == IR_AND)) {
+        applyCondition(func->getOperand(cond, 0), truth, v, r);
+        applyCondition(func->getOperand(cond, 1), truth, v, r);
+      }
+      return;
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      break;
+    default:
+      return;
+  }
+  if (instr.src_type != IR_INT) return;
+  Opcode op = truth ? instr.op : negate(instr.op);
+  ValueId lhs = func->getOperand(cond, 0);
+  ValueId rhs = func->getOperand(cond, 1);
+  if (lhs == v) applyCompare(op, ranges[rhs], r);
+  if (rhs == v) applyCompare(swap(op), ranges[lhs], r);
+}
+
+// Narrow r by "r op other" holding
+void RangeAnalysis::applyCompare(const Opcode& op, const Range& other,
+    Range& r) {
+  if (isEmpty(other)) {
+    r = other;
+    return;
+  }
+  switch (op) {
+    case IR_LT:
+      r.hi = std::min(r.hi, other.hi - 1);
+      break;
+    case IR_LE:
+      r.hi = std::min(r.hi, other.hi);
+      break;
+    case IR_GT:
+      r.lo = std::max(r.lo, other.lo + 1);
+      break;
+    case IR_GE:
+      r.lo = std::max(r.lo, other.lo);
+      break;
+    case IR_EQ:
+      r.lo = std::max(r.lo, other.lo);
+      r.hi = std::min(r.hi, other.hi);
+      break;
+    default:
+      // Only a constant at either end of the range can be excluded
+      if (other.lo != other.hi) break;
+      if (r.lo == other.lo) r.lo++;
+      if (r.hi == other.lo) r.hi--;
+      break;
+  }
+}
+
+RangeAnalysis::Range RangeAnalysis::full() {
+  return {INT_MIN32, INT_MAX32};
+}
+
+RangeAnalysis::Range RangeAnalysis::join(const Range& a, const Range& b) {
+  if (isEmpty(a)) return b;
+  if (isEmpty(b)) return a;
+  return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+
+// Arithmetic that can overflow wraps, so the result could be anything
+RangeAnalysis::Range RangeAnalysis::clamp(const int64_t& lo,
+    const int64_t& hi) {
+  if ((lo < INT_MIN32) || (hi > INT_MAX32)) return full();
+  return {lo, hi};
+}
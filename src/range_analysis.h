@@ -0,0 +1,60 @@
+#ifndef RANGE_ANALYSIS_H
+#define RANGE_ANALYSIS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Integer range analysis and bounds check elimination
+// Every int value gets an interval of the values it can take. Phis join the
+// intervals of their inputs, widened to the int limits when a loop keeps
+// growing them and then narrowed again. A use is narrowed further by what
+// must hold to reach it: the outcome of each compare the branches into a
+// dominating block depend on, and each bounds check on the same value that
+// has already passed. An array access whose index is then always within the
+// array is marked IR_FLAG_IN_BOUNDS, and the backends drop its check.
+////////////////////////////////////////////////////////////////////////////////
+class RangeAnalysis {
+public:
+  RangeAnalysis(Module&);
+  void run();
+  size_t getNumChecks() { return num_checks; }
+  size_t getNumRemoved() { return num_removed; }
+
+private:
+  struct Range {
+    int64_t lo;
+    int64_t hi;
+  };
+
+  Module& module;
+  Function* func;
+  std::vector<Range> ranges;  // ValueId -> values it can take
+  std::vector<uint32_t> positions;  // ValueId -> index within its block
+  std::vector<std::vector<ValueId>> checks;  // ValueId -> accesses it indexes
+  std::vector<BlockId> idoms;
+  std::vector<uint32_t> dom_pre;  // Dominator tree preorder number
+  std::vector<uint32_t> dom_last;  // Largest preorder number below a block
+  size_t num_checks;
+  size_t num_removed;
+
+  void runFunction();
+  void findDominators();
+  bool dominates(const BlockId& a, const BlockId& b) {
+    return (dom_pre[a] <= dom_pre[b]) && (dom_pre[b] <= dom_last[a]);
+  }
+  Range evaluate(const ValueId&);
+  Range getRangeAt(const ValueId&, const BlockId&, const uint32_t&);
+  void applyCondition(const ValueId&, const bool&, const ValueId&, Range&);
+  void applyCompare(const Opcode&, const Range&, Range&);
+
+  static Range full();
+  static Range join(const Range&, const Range&);
+  static Range clamp(const int64_t&, const int64_t&);
+  static bool isEmpty(const Range& r) { return r.lo > r.hi; }
+};
+
+#endif // RANGE_ANALYSIS_H
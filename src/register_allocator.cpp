@@ -0,0 +1,736 @@
+#include "register_allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "x86.h"
+
+namespace {
+
+// Allocatable registers, in order of preference: those the code names least
+// first, and callee-saved ones, which cost a save and restore, last. r10,
+// r11, xmm14 and xmm15 are kept for values on the stack.
+const Reg int_regs[] = {
+  R8, R9, RSI, RDI, RDX, RCX, RAX, RBX, R12, R13, R14, R15,
+};
+const Reg flt_regs[] = {
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7, XMM8, XMM9, XMM10, XMM11,
+  XMM12, XMM13,
+};
+const Reg callee_saved[] = {RBX, R12, R13, R14, R15};
+const Reg caller_saved[] = {
+  RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11,
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7, XMM8, XMM9, XMM10, XMM11,
+  XMM12, XMM13, XMM14, XMM15,
+};
+const Reg int_scratch[] = {R10, R11};
+const Reg flt_scratch[] = {XMM14, XMM15};
+
+// Cost of a use or definition nested this deep in loops
+const uint32_t LOOP_WEIGHT_SHIFT = 3;
+const uint32_t MAX_LOOP_DEPTH = 5;
+
+const uint32_t NOT_LIVE = UINT32_MAX;
+
+MOperand regOperand(const Reg& r) {
+  return {MO_REG, 1, r, NO_REG, 0, NO_SYM};
+}
+
+MOperand frameOperand(const int64_t& disp) {
+  return {MO_MEM, 1, RBP, NO_REG, disp, NO_SYM};
+}
+
+}  // namespace
+
+RegisterAllocator::RegisterAllocator(std::vector<MInstr>& c,
+    const std::vector<uint8_t>& sizes, const std::vector<bool>& floats) :
+    code(c),
+    vreg_sizes(sizes),
+    vreg_floats(floats),
+    num_values(0),
+    num_spilled(0),
+    num_constants(0),
+    num_moves(0),
+    num_saved(0) {}
+
+void RegisterAllocator::run(uint32_t& frame_size, const size_t& frame_instr) {
+  findBlocks();
+  findConstants();
+  buildIntervals();
+  allocate();
+  rewrite(frame_size, frame_instr);
+}
+
+void RegisterAllocator::getUsesDefs(const MInstr& instr,
+    std::vector<Reg>& uses, std::vector<Reg>& defs) {
+  uses.clear();
+  defs.clear();
+  bool reads[2];
+  bool writes[2];
+  bool mem_ok[2];
+  getRoles(instr.op, reads, writes, mem_ok);
+
+  // Zeroing and all-ones idioms do not depend on the register's value
+  if ((instr.num_ops == 2) && (instr.ops[0].kind == MO_REG)
+      && (instr.ops[1].kind == MO_REG)
+      && (instr.ops[0].reg == instr.ops[1].reg)
+      && ((instr.op == M_XOR) || (instr.op == M_PXOR)
+      || (instr.op == M_PCMPEQD))) {
+    reads[0] = reads[1] = false;
+  }
+  for (uint8_t n = 0; n < instr.num_ops; n++) {
+    const MOperand& o = instr.ops[n];
+    if (o.kind == MO_REG) {
+      if (reads[n]) uses.push_back(o.reg);
+      if (writes[n]) defs.push_back(o.reg);
+    } else if (o.kind == MO_MEM) {
+      if (o.reg != NO_REG) uses.push_back(o.reg);
+      if (o.index != NO_REG) uses.push_back(o.index);
+    }
+  }
+  switch (instr.op) {
+    case M_CLTD:
+      uses.push_back(RAX);
+      defs.push_back(RDX);
+      break;
+    case M_IDIV:
+      uses.push_back(RAX);
+      uses.push_back(RDX);
+      defs.push_back(RAX);
+      defs.push_back(RDX);
+      break;
+    case M_CALL:
+      for (Reg r = 0; r < NUM_PHYS_REGS; r++) {
+        if (instr.ops[1].imm & (int64_t(1) << r)) uses.push_back(r);
+      }
+      defs.insert(defs.end(), std::begin(caller_saved),
+          std::end(caller_saved));
+      break;
+    default:
+      break;
+  }
+  auto isFrame = [](const Reg& r) { return (r == RSP) || (r == RBP); };
+  uses.erase(std::remove_if(uses.begin(), uses.end(), isFrame), uses.end());
+  defs.erase(std::remove_if(defs.begin(), defs.end(), isFrame), defs.end());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Blocks start at labels and after jumps and returns
+void RegisterAllocator::findBlocks() {
+  std::unordered_map<int64_t, size_t> labels;
+  block_starts.clear();
+  for (size_t i = 0; i < code.size(); i++) {
+    MOp prev = (i > 0) ? code[i - 1].op : M_LABEL;
+    if ((i == 0) || (code[i].op == M_LABEL) || (prev == M_JMP)
+        || (prev == M_JCC) || (prev == M_RET)) {
+      block_starts.push_back(i);
+    }
+    if (code[i].op == M_LABEL) {
+      labels[code[i].ops[0].imm] = block_starts.size() - 1;
+    }
+  }
+  size_t num_blocks = block_starts.size();
+  block_starts.push_back(code.size());
+  succs.assign(num_blocks, std::vector<size_t>());
+  for (size_t b = 0; b < num_blocks; b++) {
+    const MInstr& last = code[block_starts[b + 1] - 1];
+    if ((last.op == M_JMP) || (last.op == M_JCC)) {
+      auto it = labels.find(last.ops[0].imm);
+      if (it != labels.end()) succs[b].push_back(it->second);
+    }
+    if ((last.op != M_JMP) && (last.op != M_RET) && (b + 1 < num_blocks)) {
+      succs[b].push_back(b + 1);
+    }
+  }
+}
+
+// Virtual registers written once, by a move of an immediate
+void RegisterAllocator::findConstants() {
+  std::vector<uint32_t> num_defs(vreg_sizes.size(), 0);
+  is_constant.assign(vreg_sizes.size(), false);
+  constants.assign(vreg_sizes.size(), 0);
+  std::vector<Reg> uses;
+  std::vector<Reg> defs;
+  for (auto& instr : code) {
+    getUsesDefs(instr, uses, defs);
+    for (Reg r : defs) {
+      if (r < VREG_BASE) continue;
+      uint32_t v = r - VREG_BASE;
+      num_defs[v]++;
+      is_constant[v] = (num_defs[v] == 1) && (instr.op == M_MOV)
+          && (instr.ops[0].kind == MO_IMM) && (instr.ops[0].imm >= INT32_MIN)
+          && (instr.ops[0].imm <= INT32_MAX);
+      constants[v] = instr.ops[0].imm;
+    }
+  }
+}
+
+// Only registers read before they are written in some block can be live
+// from one block into another, so only those take part in the data flow
+void RegisterAllocator::buildIntervals() {
+  size_t num_blocks = block_starts.size() - 1;
+  size_t num_regs = NUM_PHYS_REGS + vreg_sizes.size();
+  std::vector<Reg> uses;
+  std::vector<Reg> defs;
+
+  std::vector<uint32_t> global_index(num_regs, NOT_LIVE);
+  std::vector<uint32_t> globals;
+  std::vector<std::vector<uint32_t>> gen(num_blocks);
+  std::vector<std::vector<uint32_t>> kill(num_blocks);
+  {
+    std::vector<size_t> def_stamp(num_regs, SIZE_MAX);
+    std::vector<size_t> use_stamp(num_regs, SIZE_MAX);
+    for (size_t b = 0; b < num_blocks; b++) {
+      for (size_t i = block_starts[b]; i < block_starts[b + 1]; i++) {
+        getUsesDefs(code[i], uses, defs);
+        for (Reg r : uses) {
+          uint32_t x = getIndex(r);
+          if ((def_stamp[x] == b) || (use_stamp[x] == b)) continue;
+          use_stamp[x] = b;
+          gen[b].push_back(x);
+          if (global_index[x] == NOT_LIVE) {
+            global_index[x] = static_cast<uint32_t>(globals.size());
+            globals.push_back(x);
+          }
+        }
+        for (Reg r : defs) {
+          uint32_t x = getIndex(r);
+          if (def_stamp[x] == b) continue;
+          def_stamp[x] = b;
+          kill[b].push_back(x);
+        }
+      }
+    }
+  }
+
+  // live_in = gen + (live_out - kill), iterated backwards to a fixed point
+  size_t words = (globals.size() + 63) / 64;
+  std::vector<std::vector<uint64_t>> live_in(num_blocks,
+      std::vector<uint64_t>(words, 0));
+  std::vector<std::vector<uint64_t>> live_out = live_in;
+  std::vector<std::vector<uint64_t>> kill_bits = live_in;
+  for (size_t b = 0; b < num_blocks; b++) {
+    for (uint32_t x : kill[b]) {
+      uint32_t g = global_index[x];
+      if (g != NOT_LIVE) kill_bits[b][g / 64] |= uint64_t(1) << (g % 64);
+    }
+    for (uint32_t x : gen[b]) {
+      uint32_t g = global_index[x];
+      live_in[b][g / 64] |= uint64_t(1) << (g % 64);
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = num_blocks; b-- > 0;) {
+      for (size_t w = 0; w < words; w++) {
+        uint64_t out = 0;
+        for (size_t s : succs[b]) out |= live_in[s][w];
+        live_out[b][w] = out;
+        uint64_t in = live_in[b][w] | (out & ~kill_bits[b][w]);
+        if (in != live_in[b][w]) {
+          live_in[b][w] = in;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Walk each block backwards from what is live out of it
+  std::vector<uint32_t> depths;
+  findLoopDepths(depths);
+  ranges.assign(num_regs, std::vector<Range>());
+  weights.assign(num_regs, 0);
+  hints.assign(num_regs, NO_REG);
+  std::vector<uint32_t> ends(num_regs, NOT_LIVE);
+  std::vector<uint32_t> live;
+  for (size_t b = 0; b < num_blocks; b++) {
+    uint32_t first = static_cast<uint32_t>(block_starts[b]);
+    uint32_t last = static_cast<uint32_t>(block_starts[b + 1] - 1);
+    for (size_t g = 0; g < globals.size(); g++) {
+      if (live_out[b][g / 64] & (uint64_t(1) << (g % 64))) {
+        ends[globals[g]] = 2 * last + 1;
+        live.push_back(globals[g]);
+      }
+    }
+    for (uint32_t i = last + 1; i-- > first;) {
+      const MInstr& instr = code[i];
+      getUsesDefs(instr, uses, defs);
+      uint32_t weight = 1u << (LOOP_WEIGHT_SHIFT
+          * std::min(depths[i], MAX_LOOP_DEPTH));
+      for (Reg r : defs) {
+        uint32_t x = getIndex(r);
+        uint32_t end = (ends[x] != NOT_LIVE) ? ends[x] : 2 * i + 1;
+        ranges[x].push_back({2 * i + 1, end});
+        ends[x] = NOT_LIVE;
+        if ((r < VREG_BASE) || !is_constant[r - VREG_BASE]) {
+          weights[x] += weight;
+        }
+      }
+      for (Reg r : uses) {
+        uint32_t x = getIndex(r);
+        if (ends[x] == NOT_LIVE) {
+          ends[x] = 2 * i;
+          live.push_back(x);
+        }
+        if ((r < VREG_BASE) || !is_constant[r - VREG_BASE]
+            || !isImmediate(instr, 0) || (instr.ops[0].kind != MO_REG)
+            || (instr.ops[0].reg != r)) {
+          weights[x] += weight;
+        }
+      }
+      bool is_move = (instr.op == M_MOV) || (instr.op == M_MOVSS)
+          || (instr.op == M_MOVAPS);
+      if (is_move && (instr.ops[0].kind == MO_REG)
+          && (instr.ops[1].kind == MO_REG)) {
+        Reg src = instr.ops[0].reg;
+        Reg dst = instr.ops[1].reg;
+        if (hints[getIndex(dst)] == NO_REG) hints[getIndex(dst)] = src;
+        if (hints[getIndex(src)] == NO_REG) hints[getIndex(src)] = dst;
+      }
+    }
+    for (uint32_t x : live) {
+      if (ends[x] == NOT_LIVE) continue;
+      ranges[x].push_back({2 * first, ends[x]});
+      ends[x] = NOT_LIVE;
+    }
+    live.clear();
+  }
+
+  // In order, with touching ranges joined
+  for (auto& list : ranges) {
+    if (list.size() < 2) continue;
+    std::sort(list.begin(), list.end(), [](const Range& a, const Range& b) {
+      return a.start < b.start;
+    });
+    size_t n = 0;
+    for (size_t k = 1; k < list.size(); k++) {
+      if (list[k].start <= list[n].end + 1) {
+        list[n].end = std::max(list[n].end, list[k].end);
+      } else {
+        list[++n] = list[k];
+      }
+    }
+    list.resize(n + 1);
+  }
+}
+
+// A jump back to an earlier label closes a loop over everything in between
+void RegisterAllocator::findLoopDepths(std::vector<uint32_t>& depths) {
+  std::unordered_map<int64_t, size_t> labels;
+  std::vector<int32_t> deltas(code.size() + 1, 0);
+  for (size_t i = 0; i < code.size(); i++) {
+    const MInstr& instr = code[i];
+    if (instr.op == M_LABEL) labels[instr.ops[0].imm] = i;
+    if ((instr.op != M_JMP) && (instr.op != M_JCC)) continue;
+    auto it = labels.find(instr.ops[0].imm);
+    if (it == labels.end()) continue;
+    deltas[it->second]++;
+    deltas[i + 1]--;
+  }
+  depths.assign(code.size(), 0);
+  int32_t depth = 0;
+  for (size_t i = 0; i < code.size(); i++) {
+    depth += deltas[i];
+    depths[i] = static_cast<uint32_t>(depth);
+  }
+}
+
+// Values in order of where they start
+void RegisterAllocator::allocate() {
+  assigned.assign(vreg_sizes.size(), NO_REG);
+  std::vector<uint32_t> order;
+  for (uint32_t v = 0; v < vreg_sizes.size(); v++) {
+    if (!ranges[NUM_PHYS_REGS + v].empty()) order.push_back(v);
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return ranges[NUM_PHYS_REGS + a][0].start
+        < ranges[NUM_PHYS_REGS + b][0].start;
+  });
+  std::vector<std::vector<uint32_t>> holders(NUM_PHYS_REGS);
+  for (uint32_t v : order) {
+    num_values++;
+    assigned[v] = findReg(v, holders);
+  }
+}
+
+// A register free over all of v's interval, preferably the one it is copied
+// to or from; failing that the one whose values cost least to spill, if they
+// cost less than v does
+Reg RegisterAllocator::findReg(const uint32_t& v,
+    std::vector<std::vector<uint32_t>>& holders) {
+  const std::vector<Range>& interval = ranges[NUM_PHYS_REGS + v];
+  uint32_t start = interval[0].start;
+  bool flt = vreg_floats[v];
+  const Reg* pool = flt ? std::begin(flt_regs) : std::begin(int_regs);
+  const Reg* pool_end = flt ? std::end(flt_regs) : std::end(int_regs);
+
+  std::vector<Reg> candidates;
+  Reg hint = hints[NUM_PHYS_REGS + v];
+  if ((hint != NO_REG) && (hint >= VREG_BASE)) {
+    hint = assigned[hint - VREG_BASE];
+  }
+  if ((hint != NO_REG) && (std::find(pool, pool_end, hint) != pool_end)) {
+    candidates.push_back(hint);
+  }
+  candidates.insert(candidates.end(), pool, pool_end);
+
+  Reg best = NO_REG;
+  uint32_t best_cost = UINT32_MAX;
+  for (Reg r : candidates) {
+    // Named by the code itself somewhere in the interval
+    if (overlaps(ranges[r], interval)) continue;
+    std::vector<uint32_t>& held = holders[r];
+    held.erase(std::remove_if(held.begin(), held.end(), [&](uint32_t u) {
+      return ranges[NUM_PHYS_REGS + u].back().end < start;
+    }), held.end());
+    bool fits = true;
+    uint32_t cost = 0;
+    for (uint32_t u : held) {
+      if (!overlaps(ranges[NUM_PHYS_REGS + u], interval)) continue;
+      fits = false;
+      cost += weights[NUM_PHYS_REGS + u];
+    }
+    if (fits) {
+      held.push_back(v);
+      return r;
+    }
+    if (cost < best_cost) {
+      best = r;
+      best_cost = cost;
+    }
+  }
+
+  if ((best == NO_REG) || (best_cost >= weights[NUM_PHYS_REGS + v])) {
+    return NO_REG;
+  }
+  std::vector<uint32_t>& held = holders[best];
+  held.erase(std::remove_if(held.begin(), held.end(), [&](uint32_t u) {
+    if (!overlaps(ranges[NUM_PHYS_REGS + u], interval)) return false;
+    assigned[u] = NO_REG;
+    return true;
+  }), held.end());
+  held.push_back(v);
+  return best;
+}
+
+// Put the registers in place, drop the copies that became no-ops, and give
+// the values left without one stack slots, read and written through scratch
+// registers; an operand that can be a memory reference uses the slot directly
+void RegisterAllocator::rewrite(uint32_t& frame_size,
+    const size_t& frame_instr) {
+  int64_t base = frame_size;
+  std::vector<int64_t> slots(vreg_sizes.size(), 0);
+  int64_t next_slot = base;
+  for (uint32_t v = 0; v < vreg_sizes.size(); v++) {
+    if (ranges[NUM_PHYS_REGS + v].empty() || (assigned[v] != NO_REG)) continue;
+    if (is_constant[v]) {
+      num_constants++;
+      continue;
+    }
+    num_spilled++;
+    next_slot += 8;
+    slots[v] = -next_slot;
+  }
+  std::vector<Reg> saved;
+  for (Reg r : callee_saved) {
+    if (std::find(assigned.begin(), assigned.end(), r) != assigned.end()) {
+      saved.push_back(r);
+    }
+  }
+  num_saved += saved.size();
+  std::vector<int64_t> save_slots;
+  for (size_t k = 0; k < saved.size(); k++) {
+    next_slot += 8;
+    save_slots.push_back(-next_slot);
+  }
+  frame_size = static_cast<uint32_t>((next_slot + 15) & ~int64_t(15));
+  code[frame_instr].ops[0].imm = frame_size;
+
+  std::vector<MInstr> out;
+  out.reserve(code.size() * 2);
+  auto isSpilledConstant = [&](const MOperand& o) {
+    return (o.kind == MO_REG) && (o.reg >= VREG_BASE)
+        && (assigned[o.reg - VREG_BASE] == NO_REG)
+        && is_constant[o.reg - VREG_BASE];
+  };
+  for (size_t i = 0; i < code.size(); i++) {
+    MInstr instr = code[i];
+    if ((instr.op == M_MOV) && (instr.ops[0].kind == MO_IMM)
+        && isSpilledConstant(instr.ops[1])) {
+      continue;
+    }
+    if (isImmediate(instr, 0) && isSpilledConstant(instr.ops[0])) {
+      instr.ops[0] = {MO_IMM, 1, NO_REG, NO_REG,
+          constants[instr.ops[0].reg - VREG_BASE], NO_SYM};
+    }
+    for (uint8_t n = 0; n < instr.num_ops; n++) {
+      MOperand& o = instr.ops[n];
+      if ((o.kind != MO_REG) && (o.kind != MO_MEM)) continue;
+      if ((o.reg != NO_REG) && (o.reg >= VREG_BASE)
+          && (assigned[o.reg - VREG_BASE] != NO_REG)) {
+        o.reg = assigned[o.reg - VREG_BASE];
+      }
+      if ((o.kind == MO_MEM) && (o.index != NO_REG) && (o.index >= VREG_BASE)
+          && (assigned[o.index - VREG_BASE] != NO_REG)) {
+        o.index = assigned[o.index - VREG_BASE];
+      }
+    }
+    if (((instr.op == M_MOV) || (instr.op == M_MOVSS)
+        || (instr.op == M_MOVAPS)) && (instr.ops[0].kind == MO_REG)
+        && (instr.ops[1].kind == MO_REG)
+        && (instr.ops[0].reg == instr.ops[1].reg)) {
+      num_moves++;
+      continue;
+    }
+    if (instr.op == M_LEAVE) {
+      for (size_t k = 0; k < saved.size(); k++) {
+        out.push_back({M_MOV, 8, CC_E, 2,
+            {frameOperand(save_slots[k]), regOperand(saved[k])}});
+      }
+    }
+
+    bool reads[2];
+    bool writes[2];
+    bool mem_ok[2];
+    getRoles(instr.op, reads, writes, mem_ok);
+
+    // At most one memory operand per instruction; prefer the destination
+    bool has_mem = false;
+    for (uint8_t n = 0; n < instr.num_ops; n++) {
+      has_mem |= (instr.ops[n].kind == MO_MEM);
+    }
+    for (int n = instr.num_ops - 1; (n >= 0) && !has_mem; n--) {
+      MOperand& o = instr.ops[n];
+      if ((o.kind == MO_REG) && (o.reg >= VREG_BASE) && mem_ok[n]
+          && !is_constant[o.reg - VREG_BASE]) {
+        o = frameOperand(slots[o.reg - VREG_BASE]);
+        has_mem = true;
+      }
+    }
+
+    // Everything else is loaded into a scratch register, and written back if
+    // it is defined
+    Reg vregs[4];
+    Reg phys[4];
+    bool is_def[4];
+    bool is_use[4];
+    int num = 0;
+    auto note = [&](const Reg& r, const bool& use, const bool& def) {
+      for (int k = 0; k < num; k++) {
+        if (vregs[k] == r) {
+          is_use[k] |= use;
+          is_def[k] |= def;
+          return;
+        }
+      }
+      vregs[num] = r;
+      is_use[num] = use;
+      is_def[num] = def;
+      num++;
+    };
+    for (uint8_t n = 0; n < instr.num_ops; n++) {
+      MOperand& o = instr.ops[n];
+      if (o.kind == MO_REG) {
+        if (o.reg >= VREG_BASE) note(o.reg, reads[n], writes[n]);
+      } else if (o.kind == MO_MEM) {
+        if ((o.reg != NO_REG) && (o.reg >= VREG_BASE)) note(o.reg, true, false);
+        if ((o.index != NO_REG) && (o.index >= VREG_BASE)) {
+          note(o.index, true, false);
+        }
+      }
+    }
+    // Values that are only written can share a register with an input
+    int next_int = 0;
+    int next_flt = 0;
+    for (int k = 0; k < num; k++) {
+      if (!is_use[k]) continue;
+      bool flt = vreg_floats[vregs[k] - VREG_BASE];
+      phys[k] = flt ? flt_scratch[next_flt++] : int_scratch[next_int++];
+    }
+    for (int k = 0; k < num; k++) {
+      if (is_use[k]) continue;
+      bool flt = vreg_floats[vregs[k] - VREG_BASE];
+      phys[k] = flt ? flt_scratch[0] : int_scratch[0];
+    }
+    for (int k = 0; k < num; k++) {
+      if (!is_use[k]) continue;
+      Reg r = vregs[k];
+      bool flt = vreg_floats[r - VREG_BASE];
+      MOperand src = frameOperand(slots[r - VREG_BASE]);
+      if (is_constant[r - VREG_BASE]) {
+        src = {MO_IMM, 1, NO_REG, NO_REG, constants[r - VREG_BASE], NO_SYM};
+      }
+      out.push_back({flt ? M_MOVSS : M_MOV, vreg_sizes[r - VREG_BASE], CC_E, 2,
+          {src, regOperand(phys[k])}});
+    }
+    for (uint8_t n = 0; n < instr.num_ops; n++) {
+      MOperand& o = instr.ops[n];
+      for (int k = 0; k < num; k++) {
+        if ((o.kind == MO_REG) || (o.kind == MO_MEM)) {
+          if (o.reg == vregs[k]) o.reg = phys[k];
+        }
+        if ((o.kind == MO_MEM) && (o.index == vregs[k])) o.index = phys[k];
+      }
+    }
+    out.push_back(instr);
+    for (int k = 0; k < num; k++) {
+      if (!is_def[k]) continue;
+      Reg r = vregs[k];
+      bool flt = vreg_floats[r - VREG_BASE];
+      out.push_back({flt ? M_MOVSS : M_MOV, vreg_sizes[r - VREG_BASE], CC_E, 2,
+          {regOperand(phys[k]), frameOperand(slots[r - VREG_BASE])}});
+    }
+    if (i == frame_instr) {
+      for (size_t k = 0; k < saved.size(); k++) {
+        out.push_back({M_MOV, 8, CC_E, 2,
+            {regOperand(saved[k]), frameOperand(save_slots[k])}});
+      }
+    }
+  }
+  code.swap(out);
+}
+
+// Whether operand n of the instruction can be an immediate instead of a
+// register
+bool RegisterAllocator::isImmediate(const MInstr& instr, const uint8_t& n) {
+  if ((n != 0) || (instr.num_ops != 2) || (instr.ops[1].kind == MO_IMM)) {
+    return false;
+  }
+  switch (instr.op) {
+    case M_MOV:
+    case M_ADD:
+    case M_SUB:
+    case M_IMUL:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+    case M_CMP:
+    case M_TEST:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether two intervals share an instruction
+bool RegisterAllocator::overlaps(const std::vector<Range>& a,
+    const std::vector<Range>& b) {
+  if (a.empty() || b.empty()) return false;
+  auto i = std::lower_bound(a.begin(), a.end(), b[0].start,
+      [](const Range& r, const uint32_t& pos) { return r.end < pos; });
+  auto j = b.begin();
+  while ((i != a.end()) && (j != b.end())) {
+    if (i->end < j->start) {
+      i++;
+    } else if (j->end < i->start) {
+      j++;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Does the instruction read and/or write each operand, and can the operand be
+// a memory reference?
+void RegisterAllocator::getRoles(const MOp& op, bool* reads, bool* writes,
+    bool* mem_ok) {
+  reads[0] = reads[1] = true;
+  writes[0] = writes[1] = false;
+  mem_ok[0] = mem_ok[1] = false;
+  switch (op) {
+    case M_MOV:
+    case M_MOVSS:
+      mem_ok[0] = mem_ok[1] = true;
+      reads[1] = false;
+      writes[1] = true;
+      break;
+    case M_MOVSLQ:
+    case M_CVTSI2SS:
+    case M_CVTTSS2SI:
+      mem_ok[0] = true;
+      reads[1] = false;
+      writes[1] = true;
+      break;
+    case M_MOVZB:
+    case M_LEA:
+    case M_MOVD:
+    case M_MOVUPS:
+    case M_MOVAPS:
+    case M_CVTDQ2PS:
+    case M_CVTTPS2DQ:
+      reads[1] = false;
+      writes[1] = true;
+      break;
+    case M_ADDPS:
+    case M_SUBPS:
+    case M_MULPS:
+    case M_DIVPS:
+    case M_CMPLTPS:
+    case M_CMPLEPS:
+    case M_CMPEQPS:
+    case M_CMPNEQPS:
+    case M_PADDD:
+    case M_PSUBD:
+    case M_PMULUDQ:
+    case M_PAND:
+    case M_POR:
+    case M_PXOR:
+    case M_PCMPEQD:
+    case M_PCMPGTD:
+    case M_PUNPCKLDQ:
+    case M_PUNPCKLQDQ:
+    case M_PSLLD:
+    case M_PSRLD:
+    case M_PSLLQ:
+    case M_PSRLQ:
+      writes[1] = true;
+      break;
+    case M_ADD:
+    case M_SUB:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+      mem_ok[0] = mem_ok[1] = true;
+      writes[1] = true;
+      break;
+    case M_IMUL:
+    case M_ADDSS:
+    case M_SUBSS:
+    case M_MULSS:
+    case M_DIVSS:
+      mem_ok[0] = true;
+      writes[1] = true;
+      break;
+    case M_CMP:
+    case M_TEST:
+      mem_ok[0] = mem_ok[1] = true;
+      break;
+    case M_UCOMISS:
+      mem_ok[0] = true;
+      break;
+    case M_NOT:
+    case M_NEG:
+      mem_ok[0] = true;
+      writes[0] = true;
+      break;
+    case M_SETCC:
+    case M_POP:
+      mem_ok[0] = true;
+      reads[0] = false;
+      writes[0] = true;
+      break;
+    case M_IDIV:
+    case M_PUSH:
+      mem_ok[0] = true;
+      break;
+    default:
+      break;
+  }
+}
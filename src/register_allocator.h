@@ -0,0 +1,86 @@
+#ifndef REGISTER_ALLOCATOR_H
+#define REGISTER_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "x86.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Linear scan register allocation
+// Liveness is solved over the blocks of the selected code, for the physical
+// registers it names as well as the virtual ones, and each register gets a
+// live interval: the ranges of instructions over which it holds a value,
+// with holes where it does not. Virtual registers are then taken in order of
+// their first definition and given a physical register whose intervals,
+// those of the values already given it and its own uses in the code, do not
+// overlap theirs. Calls write every caller-saved register, so a value live
+// across one can only have a callee-saved register, saved in the frame; as
+// every xmm register is caller-saved, floats live across calls go to the
+// stack. When nothing fits, whatever would cost the fewest loads and stores,
+// counting uses in loops as more, goes to the stack: the new value or the
+// values in its way. Stack values are read and written through scratch
+// registers that are never allocated. Integer constants need no stack slot:
+// a spilled one is an immediate operand where the instruction takes one,
+// and is loaded into a scratch register again elsewhere.
+////////////////////////////////////////////////////////////////////////////////
+class RegisterAllocator {
+public:
+  RegisterAllocator(std::vector<MInstr>&, const std::vector<uint8_t>&,
+      const std::vector<bool>&);
+  // frame_size is what the frame already holds below rbp, and grows by the
+  // stack slots and saved registers; frame_instr reserves it
+  void run(uint32_t& frame_size, const size_t& frame_instr);
+  size_t getNumValues() { return num_values; }
+  size_t getNumSpilled() { return num_spilled; }
+  size_t getNumConstants() { return num_constants; }
+  size_t getNumMoves() { return num_moves; }
+  size_t getNumSaved() { return num_saved; }
+
+  // Registers an instruction reads and writes, including those it uses
+  // implicitly; rsp and rbp are left out
+  static void getUsesDefs(const MInstr&, std::vector<Reg>&, std::vector<Reg>&);
+
+private:
+  // Instructions i and j, inclusive, with i's definitions at 2i + 1 and its
+  // uses at 2i so a value can take the register of one that dies where it is
+  // defined
+  struct Range {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  std::vector<MInstr>& code;
+  const std::vector<uint8_t>& vreg_sizes;
+  const std::vector<bool>& vreg_floats;
+  std::vector<size_t> block_starts;  // Plus the end of the code
+  std::vector<std::vector<size_t>> succs;
+  std::vector<std::vector<Range>> ranges;  // Register index -> live ranges
+  std::vector<uint32_t> weights;  // Register index -> spill cost
+  std::vector<Reg> hints;  // Register index -> register it is copied with
+  std::vector<bool> is_constant;  // Virtual register -> only ever one value
+  std::vector<int64_t> constants;  // Virtual register -> that value
+  std::vector<Reg> assigned;  // Virtual register -> physical, or NO_REG
+  size_t num_values;
+  size_t num_spilled;
+  size_t num_constants;  // Spilled, but as immediates rather than to slots
+  size_t num_moves;
+  size_t num_saved;
+
+  void findBlocks();
+  void findConstants();
+  void buildIntervals();
+  void findLoopDepths(std::vector<uint32_t>&);
+  void allocate();
+  Reg findReg(const uint32_t&, std::vector<std::vector<uint32_t>>&);
+  void rewrite(uint32_t&, const size_t&);
+  uint32_t getIndex(const Reg& r) {
+    return (r >= VREG_BASE) ? NUM_PHYS_REGS + r - VREG_BASE : r;
+  }
+  bool isImmediate(const MInstr&, const uint8_t&);
+  static bool overlaps(const std::vector<Range>&, const std::vector<Range>&);
+  static void getRoles(const MOp&, bool*, bool*, bool*);
+};
+
+#endif // REGISTER_ALLOCATOR_H
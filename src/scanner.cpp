@@ -16,6 +16,8 @@
 
 Scanner::Scanner(std::shared_ptr<Environment> e) :
     line_number(1),
+    char_offset(0),
+    tok_offset(0),
     env(e){}
 
 Scanner::~Scanner() {
@@ -28,6 +30,10 @@ bool Scanner::init(const std::string& src_file) {
   LOG(INFO) << "Initializing scanner for the file " << src_file;
   line_number = 1;
   LOG::line_number = line_number;
+  curr_c = -1;
+  char_offset = static_cast<uint32_t>(-1);  // First nextChar() reads offset 0
+  tok_offset = 0;
+  line_starts.assign(1, 0);
   src_fstream.open(src_file, std::ios::in);
   if (!src_fstream) {
     LOG(ERROR) << "Failed to initialize scanner";
@@ -48,6 +54,7 @@ std::shared_ptr<Token> Scanner::getToken() {
     if (isLineComment()) eatLineComment();
     if (isBlockComment()) eatBlockComment();
   }
+  tok_offset = char_offset;
   switch (curr_ct) {
     // Alphanumerics (symbols: IDs and RWs)
     case C_UPPER:
@@ -189,8 +196,10 @@ void Scanner::nextChar() {
     if (curr_c == '\n') {
       line_number++;
       LOG::line_number = line_number;
+      line_starts.push_back(char_offset + 1);
     }
     curr_c = src_fstream.get();
+    char_offset++;
     curr_ct = curr_c < 0 ? C_EOF : char_table.getCharType(curr_c);
     next_c = src_fstream.peek();
     next_ct = next_c < 0 ? C_EOF : char_table.getCharType(next_c);
@@ -1,10 +1,12 @@
 #ifndef SCANNER_H
 #define SCANNER_H
 
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "char_table.h"
 #include "environment.h"
@@ -16,8 +18,13 @@ public:
   ~Scanner();
   bool init(const std::string&);
   std::shared_ptr<Token> getToken();
+  uint32_t getTokenOffset() { return tok_offset; }
+  const std::vector<uint32_t>& getLineStarts() { return line_starts; }
 private:
   int line_number;
+  uint32_t char_offset;  // Offset of curr_c in the file
+  uint32_t tok_offset;  // Offset of the first character of the last token
+  std::vector<uint32_t> line_starts;
   CharTable char_table;
   int curr_c;
   CharType curr_ct;
@@ -0,0 +1,374 @@
+#include "sccp.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+Sccp::Sccp(Module& m) :
+    module(m),
+    func(nullptr),
+    num_folded(0),
+    num_branches(0),
+    num_blocks(0) {}
+
+void Sccp::run() {
+  for (auto& f : module.functions) {
+    if (f.external) continue;
+    func = &f;
+    runFunction();
+  }
+  LOG(INFO) << "Constant propagation: " << num_folded << " values folded, "
+      << num_branches << " branches folded, " << num_blocks
+      << " blocks removed";
+}
+
+// Integer arithmetic wraps; float arithmetic is single precision like the
+// generated code
+bool Sccp::evaluate(const Instr& instr, const uint32_t* args, uint32_t& out) {
+  IrType type = (instr.src_type != IR_VOID) ? instr.src_type : instr.type;
+  uint32_t a = args[0];
+  uint32_t b = (instr.num_ops > 1) ? args[1] : 0;
+  int32_t ia = static_cast<int32_t>(a);
+  int32_t ib = static_cast<int32_t>(b);
+  float fa, fb, fr;
+  std::memcpy(&fa, &a, sizeof(fa));
+  std::memcpy(&fb, &b, sizeof(fb));
+  bool is_flt = (type == IR_FLT);
+  switch (instr.op) {
+    case IR_ADD:
+      fr = fa + fb;
+      out = is_flt ? 0 : a + b;
+      break;
+    case IR_SUB:
+      fr = fa - fb;
+      out = is_flt ? 0 : a - b;
+      break;
+    case IR_MUL:
+      fr = fa * fb;
+      out = is_flt ? 0 : a * b;
+      break;
+    case IR_DIV:
+      if (is_flt) {
+        fr = fa / fb;
+      } else if ((ib == 0)
+          || ((ia == std::numeric_limits<int32_t>::min()) && (ib == -1))) {
+        return false;
+      } else {
+        out = static_cast<uint32_t>(ia / ib);
+      }
+      break;
+    case IR_AND:
+      out = a & b;
+      return true;
+    case IR_OR:
+      out = a | b;
+      return true;
+    case IR_NOT:
+      out = (type == IR_BOOL) ? !a : ~a;
+      return true;
+    case IR_NEG:
+      fr = -fa;
+      out = is_flt ? 0 : 0u - a;
+      break;
+    case IR_LT:
+      out = is_flt ? (fa < fb) : (ia < ib);
+      return true;
+    case IR_LE:
+      out = is_flt ? (fa <= fb) : (ia <= ib);
+      return true;
+    case IR_GT:
+      out = is_flt ? (fa > fb) : (ia > ib);
+      return true;
+    case IR_GE:
+      out = is_flt ? (fa >= fb) : (ia >= ib);
+      return true;
+
+    // String constants are deduplicated, so equal contents means equal index
+    case IR_EQ:
+      out = is_flt ? (fa == fb) : (a == b);
+      return true;
+    case IR_NE:
+      out = is_flt ? (fa != fb) : (a != b);
+      return true;
+    case IR_ITOF:
+      fr = static_cast<float>(ia);
+      is_flt = true;
+      break;
+    case IR_FTOI:
+      // Out of range conversions are left to the target
+      if (!(fa > -2147483904.0f) || !(fa < 2147483648.0f)) return false;
+      out = static_cast<uint32_t>(static_cast<int32_t>(fa));
+      return true;
+    case IR_ITOB:
+      out = (a != 0);
+      return true;
+    case IR_BTOI:
+      out = a;
+      return true;
+    default:
+      return false;
+  }
+  if (is_flt) std::memcpy(&out, &fr, sizeof(out));
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void Sccp::runFunction() {
+  size_t num_instrs = func->instrs.size();
+  states.assign(num_instrs, LAT_UNKNOWN);
+  values.assign(num_instrs, 0);
+  users.assign(num_instrs, std::vector<ValueId>());
+  reached.assign(func->blocks.size(), false);
+  edges.clear();
+  for (auto& block : func->blocks) {
+    edges.push_back(std::vector<bool>(block.succs.size(), false));
+    for (ValueId v : block.instrs) {
+      for (uint32_t i = 0; i < func->instrs[v].num_ops; i++) {
+        users[func->getOperand(v, i)].push_back(v);
+      }
+    }
+  }
+
+  // The entry block is always executed
+  reached[0] = true;
+  for (ValueId v : func->blocks[0].instrs) visit(v);
+  while (!edge_work.empty() || !value_work.empty()) {
+    while (!edge_work.empty()) {
+      BlockId from = edge_work.back().first;
+      BlockId to = func->blocks[from].succs[edge_work.back().second];
+      edge_work.pop_back();
+      if (!reached[to]) {
+        reached[to] = true;
+        for (ValueId v : func->blocks[to].instrs) visit(v);
+      } else {
+        for (ValueId v : func->blocks[to].instrs) {
+          if (func->instrs[v].op != IR_PHI) break;
+          visitPhi(v);
+        }
+      }
+    }
+    while (!value_work.empty()) {
+      ValueId v = value_work.back();
+      value_work.pop_back();
+      for (ValueId u : users[v]) {
+        if (reached[func->instrs[u].block]) visit(u);
+      }
+    }
+  }
+  rewrite();
+}
+
+void Sccp::markEdge(const BlockId& b, const uint32_t& idx) {
+  if (edges[b][idx]) return;
+  edges[b][idx] = true;
+  edge_work.push_back({b, idx});
+}
+
+void Sccp::visit(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  switch (instr.op) {
+    case IR_PHI:
+      visitPhi(v);
+      return;
+    case IR_CONST:
+      setState(v, LAT_CONST, instr.imm.u);
+      return;
+    case IR_BR:
+      markEdge(instr.block, 0);
+      return;
+    case IR_CBR: {
+      ValueId c = func->getOperand(v, 0);
+      if (states[c] == LAT_CONST) {
+        markEdge(instr.block, values[c] ? 0 : 1);
+      } else if (states[c] == LAT_VARYING) {
+        markEdge(instr.block, 0);
+        markEdge(instr.block, 1);
+      }
+      return;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+    case IR_NEG:
+    case IR_NOT:
+    case IR_ITOF:
+    case IR_FTOI:
+    case IR_ITOB:
+    case IR_BTOI: {
+      uint32_t args[2] = {0, 0};
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        ValueId o = func->getOperand(v, i);
+        if (states[o] == LAT_VARYING) {
+          setState(v, LAT_VARYING);
+          return;
+        } else if (states[o] == LAT_UNKNOWN) {
+          return;
+        }
+        args[i] = values[o];
+      }
+      uint32_t out;
+      if (evaluate(instr, args, out)) {
+        setState(v, LAT_CONST, out);
+      } else {
+        setState(v, LAT_VARYING);
+      }
+      return;
+    }
+    default:
+      // Loads, calls, parameters and addresses are not known
+      if (instr.type != IR_VOID) setState(v, LAT_VARYING);
+      return;
+  }
+}
+
+// Meet over the operands whose incoming edge is executable
+void Sccp::visitPhi(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  Block& block = func->blocks[instr.block];
+  Lattice state = LAT_UNKNOWN;
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < instr.num_ops; i++) {
+    BlockId p = block.preds[i];
+    bool executable = false;
+    for (uint32_t s = 0; s < func->blocks[p].succs.size(); s++) {
+      executable |= (func->blocks[p].succs[s] == instr.block) && edges[p][s];
+    }
+    if (!executable) continue;
+    ValueId o = func->getOperand(v, i);
+    if (states[o] == LAT_VARYING) {
+      state = LAT_VARYING;
+      break;
+    } else if (states[o] == LAT_CONST) {
+      if ((state == LAT_CONST) && (value != values[o])) {
+        state = LAT_VARYING;
+        break;
+      }
+      state = LAT_CONST;
+      value = values[o];
+    }
+  }
+  if (state != LAT_UNKNOWN) setState(v, state, value);
+}
+
+// States only ever move down the lattice
+void Sccp::setState(const ValueId& v, const Lattice& state,
+    const uint32_t& value) {
+  if (states[v] >= state) return;
+  states[v] = state;
+  values[v] = value;
+  value_work.push_back(v);
+}
+
+void Sccp::rewrite() {
+  // Replace every folded value by a constant
+  consts.clear();
+  for (ValueId v : func->blocks[0].instrs) {
+    Instr& instr = func->instrs[v];
+    if (instr.op == IR_CONST) consts.insert({{instr.type, instr.imm.u}, v});
+  }
+  std::vector<ValueId> repl(func->instrs.size(), NO_VALUE);
+  std::vector<ValueId> folded;
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    if (!reached[b]) continue;
+    for (ValueId v : func->blocks[b].instrs) {
+      Instr& instr = func->instrs[v];
+      if ((states[v] == LAT_CONST) && (instr.op != IR_CONST)) {
+        folded.push_back(v);
+      }
+    }
+  }
+  for (ValueId v : folded) {
+    repl[v] = getConst(func->instrs[v].type, values[v]);
+    func->instrs[v].op = IR_NOP;
+  }
+  num_folded += folded.size();
+  repl.resize(func->instrs.size(), NO_VALUE);
+  for (auto& block : func->blocks) {
+    std::vector<ValueId> kept;
+    for (ValueId v : block.instrs) {
+      if (func->instrs[v].op == IR_NOP) continue;
+      kept.push_back(v);
+      Instr& instr = func->instrs[v];
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        ValueId o = func->getOperand(v, i);
+        if (repl[o] != NO_VALUE) func->setOperand(v, i, repl[o]);
+      }
+    }
+    block.instrs.swap(kept);
+  }
+
+  // Branches on constants become jumps
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    ValueId term = func->getTerminator(b);
+    if (!reached[b] || (term == NO_VALUE)
+        || (func->instrs[term].op != IR_CBR)) {
+      continue;
+    }
+    if (edges[b][0] && edges[b][1]) continue;
+    BlockId taken = func->blocks[b].succs[edges[b][0] ? 0 : 1];
+    BlockId dropped = func->blocks[b].succs[edges[b][0] ? 1 : 0];
+    func->removeEdge(b, dropped);
+    if (taken == dropped) func->addEdge(b, taken);
+    func->instrs[term].op = IR_BR;
+    func->instrs[term].num_ops = 0;
+    num_branches++;
+  }
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    if (!reached[b] && !func->blocks[b].instrs.empty()) num_blocks++;
+  }
+  func->removeUnreachable();
+  func->mergeBlocks();
+
+  // Constants nothing refers to any more
+  std::vector<uint32_t> uses(func->instrs.size(), 0);
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      for (uint32_t i = 0; i < func->instrs[v].num_ops; i++) {
+        uses[func->getOperand(v, i)]++;
+      }
+    }
+  }
+  std::vector<ValueId>& entry = func->blocks[0].instrs;
+  std::vector<ValueId> kept;
+  for (ValueId v : entry) {
+    if ((func->instrs[v].op == IR_CONST) && (uses[v] == 0)) {
+      func->instrs[v].op = IR_NOP;
+    } else {
+      kept.push_back(v);
+    }
+  }
+  entry.swap(kept);
+  func->compact();
+}
+
+// Reuse a constant from the entry block or add one at its start
+ValueId Sccp::getConst(const IrType& type, const uint32_t& bits) {
+  auto c = consts.find({type, bits});
+  if (c != consts.end()) return c->second;
+  ValueId v = func->addInstr(IR_CONST, type);
+  consts[{type, bits}] = v;
+  func->instrs[v].imm.u = bits;
+  func->instrs[v].block = 0;
+  std::vector<ValueId>& entry = func->blocks[0].instrs;
+  entry.insert(entry.begin(), v);
+  return v;
+}
@@ -0,0 +1,60 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Sparse conditional constant propagation (Wegman and Zadeck)
+// Values start unknown and only move down the lattice to a constant and then
+// to "varying"; blocks are only considered once an edge into them is found to
+// be executable. Constant values are replaced by constants, branches on
+// constants become jumps, and blocks that were never reached are removed.
+////////////////////////////////////////////////////////////////////////////////
+class Sccp {
+public:
+  Sccp(Module&);
+  void run();
+  size_t getNumFolded() { return num_folded; }
+  size_t getNumBranches() { return num_branches; }
+  size_t getNumBlocks() { return num_blocks; }
+
+  // Evaluate a scalar instruction on constant operands (as raw bits); false if
+  // it has no compile-time value, e.g. integer division by zero
+  static bool evaluate(const Instr&, const uint32_t*, uint32_t&);
+
+private:
+  enum Lattice : uint8_t {
+    LAT_UNKNOWN = 0,
+    LAT_CONST,
+    LAT_VARYING,
+  };
+
+  Module& module;
+  Function* func;
+  std::vector<Lattice> states;
+  std::vector<uint32_t> values;
+  std::vector<std::vector<ValueId>> users;
+  std::vector<bool> reached;
+  std::vector<std::vector<bool>> edges;  // Per block, per successor
+  std::vector<std::pair<BlockId, uint32_t>> edge_work;
+  std::vector<ValueId> value_work;
+  std::map<std::pair<IrType, uint32_t>, ValueId> consts;
+  size_t num_folded;
+  size_t num_branches;
+  size_t num_blocks;
+
+  void runFunction();
+  void markEdge(const BlockId&, const uint32_t&);
+  void visit(const ValueId&);
+  void visitPhi(const ValueId&);
+  void setState(const ValueId&, const Lattice&, const uint32_t& = 0);
+  void rewrite();
+  ValueId getConst(const IrType&, const uint32_t&);
+};
+
+#endif // SCCP_H
@@ -0,0 +1,174 @@
+#include "tail_calls.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+#include "log.h"
+
+TailCalls::TailCalls(Module& m) :
+    module(m),
+    func(nullptr),
+    func_idx(0),
+    num_calls(0),
+    num_eliminated(0) {}
+
+void TailCalls::run() {
+  for (uint32_t f = 0; f < module.functions.size(); f++) {
+    func = &module.functions[f];
+    if (func->external || func->is_main) continue;
+    func_idx = f;
+    runFunction();
+  }
+  LOG(INFO) << "Tail calls: " << num_eliminated << " of " << num_calls
+      << " self-recursive tail calls turned into jumps";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void TailCalls::runFunction() {
+  std::vector<BlockId> tails;
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    if (isTailCall(b)) tails.push_back(b);
+  }
+  num_calls += tails.size();
+  if (tails.empty()) return;
+
+  // Declared arrays would have to be cleared again on every jump back
+  for (auto& slot : func->slots) {
+    if (slot.zeroed) return;
+  }
+  if (!func->blocks[0].preds.empty()) return;
+
+  params.assign(func->params.size(), NO_VALUE);
+  copies.assign(func->params.size(), NO_VALUE);
+  for (ValueId v : func->blocks[0].instrs) {
+    Instr& instr = func->instrs[v];
+    if (instr.op == IR_PARAM) params[instr.imm.u] = v;
+    if ((instr.op == IR_ACOPY)
+        && (func->instrs[func->getOperand(v, 1)].op == IR_PARAM)) {
+      copies[func->instrs[func->getOperand(v, 1)].imm.u] = v;
+    }
+  }
+  tails.erase(std::remove_if(tails.begin(), tails.end(), [&](BlockId b) {
+    return !canEliminate(func->blocks[b].instrs.rbegin()[1]);
+  }), tails.end());
+  if (tails.empty()) return;
+
+  BlockId header = splitEntry();
+  std::vector<ValueId> phis(params.size(), NO_VALUE);
+  for (uint32_t i = 0; i < params.size(); i++) {
+    if ((params[i] == NO_VALUE) || (copies[i] != NO_VALUE)) continue;
+    IrType type = func->instrs[params[i]].type;
+    phis[i] = func->addInstr(IR_PHI, type);
+    func->replaceAllUses(params[i], phis[i]);
+    func->instrs[phis[i]].block = header;
+    std::vector<ValueId>& instrs = func->blocks[header].instrs;
+    instrs.insert(instrs.begin(), phis[i]);
+  }
+
+  // Each tail call's arguments go to the phis, or over the array copies,
+  // and the call and its return become a jump to the header
+  std::vector<std::vector<ValueId>> incoming(params.size());
+  for (uint32_t i = 0; i < params.size(); i++) incoming[i].push_back(params[i]);
+  for (BlockId b : tails) {
+    std::vector<ValueId>& instrs = func->blocks[b].instrs;
+    ValueId call = instrs.rbegin()[1];
+    ValueId ret = instrs.back();
+    for (uint32_t i = 0; i < params.size(); i++) {
+      ValueId arg = func->getOperand(call, i);
+      if (copies[i] == NO_VALUE) {
+        incoming[i].push_back(arg);
+        continue;
+      }
+      ValueId slot = func->getOperand(copies[i], 0);
+      if (arg == slot) continue;
+      Instr prev = func->instrs[copies[i]];
+      ValueId copy = func->addInstr(IR_ACOPY, prev.type, {slot, arg});
+      func->instrs[copy].count = prev.count;
+      func->instrs[copy].block = b;
+      instrs.insert(instrs.end() - 2, copy);
+    }
+    func->instrs[call].op = IR_NOP;
+    func->instrs[ret].op = IR_NOP;
+    func->append(b, func->addInstr(IR_BR, IR_VOID));
+    func->addEdge(b, header);
+    num_eliminated++;
+  }
+  for (uint32_t i = 0; i < params.size(); i++) {
+    if (phis[i] != NO_VALUE) func->setOperands(phis[i], incoming[i]);
+  }
+  func->removeTrivialPhis();
+  func->compact();
+}
+
+// A block that ends by returning the result of calling its own procedure
+bool TailCalls::isTailCall(const BlockId& b) {
+  std::vector<ValueId>& instrs = func->blocks[b].instrs;
+  if (instrs.size() < 2) return false;
+  ValueId call = instrs.rbegin()[1];
+  ValueId ret = instrs.back();
+  if ((func->instrs[call].op != IR_CALL)
+      || (func->instrs[call].imm.u != func_idx)
+      || (func->instrs[ret].op != IR_RET)) {
+    return false;
+  }
+  if (func->instrs[ret].num_ops == 0) return true;
+  return func->getOperand(ret, 0) == call;
+}
+
+// An array argument is copied over the parameter's copy before the jump, so
+// it must not be another parameter's copy, which may already have been
+// overwritten; its own copy is left as it is
+bool TailCalls::canEliminate(const ValueId& call) {
+  for (uint32_t i = 0; i < params.size(); i++) {
+    if (copies[i] == NO_VALUE) continue;
+    ValueId arg = func->getOperand(call, i);
+    for (uint32_t j = 0; j < params.size(); j++) {
+      if ((j != i) && (copies[j] != NO_VALUE)
+          && (func->getOperand(copies[j], 0) == arg)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The entry keeps what is set up once and falls through to a new header
+// with the rest of its instructions and its successors
+BlockId TailCalls::splitEntry() {
+  BlockId header = func->addBlock();
+  std::vector<ValueId> kept;
+  for (ValueId v : func->blocks[0].instrs) {
+    Instr& instr = func->instrs[v];
+    switch (instr.op) {
+      case IR_CONST:
+      case IR_PARAM:
+      case IR_GADDR:
+      case IR_SLOT:
+        kept.push_back(v);
+        continue;
+      case IR_ACOPY:
+        if (func->instrs[func->getOperand(v, 1)].op == IR_PARAM) {
+          kept.push_back(v);
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    func->append(header, v);
+  }
+  func->blocks[0].instrs.swap(kept);
+  func->blocks[header].succs.swap(func->blocks[0].succs);
+  for (BlockId s : func->blocks[header].succs) {
+    std::replace(func->blocks[s].preds.begin(), func->blocks[s].preds.end(),
+        static_cast<BlockId>(0), header);
+  }
+  func->append(0, func->addInstr(IR_BR, IR_VOID));
+  func->addEdge(0, header);
+  return header;
+}
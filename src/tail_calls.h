@@ -0,0 +1,42 @@
+#ifndef TAIL_CALLS_H
+#define TAIL_CALLS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ir.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Self-recursive tail call elimination
+// A procedure that returns the result of calling itself, "return f(...)",
+// has nothing left to do in its own frame, so the call becomes a jump back
+// to the top of the body. The entry block keeps only what is set up once
+// (constants, addresses, parameters and the copies of array parameters);
+// the rest of it moves to a loop header with a phi per scalar parameter,
+// and each tail call feeds its arguments to the phis instead. An array
+// argument is copied over the parameter's copy, unless it is that copy.
+////////////////////////////////////////////////////////////////////////////////
+class TailCalls {
+public:
+  TailCalls(Module&);
+  void run();
+  size_t getNumCalls() { return num_calls; }
+  size_t getNumEliminated() { return num_eliminated; }
+
+private:
+  Module& module;
+  Function* func;
+  uint32_t func_idx;
+  std::vector<ValueId> params;  // Parameter index -> its IR_PARAM
+  std::vector<ValueId> copies;  // Parameter index -> IR_ACOPY of an array
+  size_t num_calls;
+  size_t num_eliminated;
+
+  void runFunction();
+  bool isTailCall(const BlockId&);
+  bool canEliminate(const ValueId&);
+  BlockId splitEntry();
+};
+
+#endif // TAIL_CALLS_H
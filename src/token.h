@@ -6,6 +6,7 @@
 // All of the classes are inlined where appropriate for consistency.
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <cstdint>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -63,6 +64,10 @@ enum TypeMark {
   NUM_TYPE_ENUMS,
 };
 
+// Handle to a symbol registered in the Environment; 0 means no symbol
+typedef uint32_t SymbolId;
+const SymbolId NO_SYMBOL = 0;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Base token class
 // Reserve words, invalid, and punctuation
@@ -137,7 +142,9 @@ public:
   // Constructor
   IdToken(const TokenType& t, const std::string& v) :
       num_elements(0),
-      procedure(false) {
+      procedure(false),
+      global(false),
+      id(NO_SYMBOL) {
     type = t;
     type_mark = TYPE_NONE;
     val = v;
@@ -181,6 +188,14 @@ public:
   void setProcedure(bool b) { procedure = b; }
   bool getProcedure() { return procedure; }
 
+  // global setter/getter
+  void setGlobal(bool b) { global = b; }
+  bool getGlobal() { return global; }
+
+  // id setter/getter (assigned by the Environment)
+  void setId(const SymbolId& i) { id = i; }
+  SymbolId getId() { return id; }
+
   // param_list adder/getter
   void addParam(std::shared_ptr<IdToken> param_token) {
     if (!procedure) {
@@ -215,6 +230,8 @@ public:
 private:
   int num_elements;
   bool procedure;
+  bool global;
+  SymbolId id;
   std::vector<std::shared_ptr<IdToken>> param_list;
 };
 
@@ -0,0 +1,958 @@
+#include "vm.h"
+
+#include <pthread.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ir.h"
+#include "jit.h"
+#include "log.h"
+
+Vm::Vm(Module& m, const bool& j) :
+    module(m),
+    use_jit(j),
+    func(nullptr),
+    scratch(0),
+    phi_tmps(0),
+    stack_end(nullptr),
+    frames_end(nullptr),
+    fp(nullptr),
+    num_compiled(0),
+    num_executed(0) {}
+
+Vm::~Vm() {}
+
+bool Vm::compile() {
+  // Scalar globals take a word each, arrays are packed and rounded up
+  std::vector<size_t> offsets;
+  size_t words = 0;
+  for (auto& g : module.globals) {
+    offsets.push_back(words);
+    words += getWords(g.type, (g.count > 0) ? g.count : 1);
+  }
+  globals.assign(words + 1, 0);
+  for (size_t offset : offsets) global_addrs.push_back(&globals[offset]);
+  for (auto& s : module.strings) {
+    strings.push_back(rt_string(s.data(), static_cast<uint32_t>(s.size())));
+  }
+
+  static const std::string builtin_names[NUM_BUILTINS] = {"getbool",
+    "getinteger", "getfloat", "getstring", "putbool", "putinteger", "putfloat",
+    "putstring", "sqrt"};
+  funcs.resize(module.functions.size());
+  for (uint32_t i = 0; i < module.functions.size(); i++) {
+    Function& f = module.functions[i];
+    if (!f.external) continue;
+    funcs[i] = {0, 0, 0, static_cast<uint32_t>(f.params.size()), 0, 0};
+    while ((funcs[i].builtin < NUM_BUILTINS)
+        && (builtin_names[funcs[i].builtin] != f.name)) {
+      funcs[i].builtin++;
+    }
+    if (funcs[i].builtin == NUM_BUILTINS) {
+      LOG(ERROR) << "No builtin named " << f.name;
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < module.functions.size(); i++) {
+    if (!module.functions[i].external && !compileFunction(i)) return false;
+    funcs[i].end = static_cast<uint32_t>(code.size());
+  }
+  LOG(INFO) << "Done compiling bytecode: " << code.size() << " instructions";
+  return true;
+}
+
+bool Vm::run() {
+  if (code.empty() && !compile()) return false;
+  natives.assign(funcs.size(), nullptr);
+
+  // Neither stack is touched beyond what the program uses, so the memory is
+  // only reserved, not committed
+  stack.reset(new VmValue[STACK_SIZE]);
+  frames.reset(new Frame[MAX_DEPTH]);
+  stack_end = stack.get() + STACK_SIZE;
+  frames_end = frames.get() + MAX_DEPTH;
+  fp = frames.get();
+  if (funcs[module.main_func].frame_size > STACK_SIZE) stackOverflow();
+
+  // Native code recurses on the machine stack, so the program gets a thread
+  // with a stack as deep as the VM's
+  auto start = std::chrono::steady_clock::now();
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, NATIVE_STACK_SIZE);
+  bool started = (pthread_create(&thread, &attr, &Vm::runBody, this) == 0);
+  pthread_attr_destroy(&attr);
+  if (!started) {
+    LOG(ERROR) << "Cannot start the interpreter thread";
+    return false;
+  }
+  pthread_join(thread, nullptr);
+  rt_flush();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now()
+      - start;
+  LOG(INFO) << "Executed " << num_executed << " instructions in "
+      << secs.count() << " s (" << (num_executed / secs.count() / 1e6)
+      << " million/s)";
+  if (jit) {
+    LOG(INFO) << "Compiled " << num_compiled << " procedures to "
+        << jit->getNumBytes() << " bytes of native code";
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+bool Vm::compileFunction(const uint32_t& idx) {
+  func = &module.functions[idx];
+  VmFunc& vf = funcs[idx];
+  vf.entry = static_cast<uint32_t>(code.size());
+  vf.num_params = static_cast<uint32_t>(func->params.size());
+  vf.builtin = NUM_BUILTINS;
+
+  // Parameters are the first registers, so callers can store arguments
+  // straight into the new frame
+  size_t num_instrs = func->instrs.size();
+  regs.assign(num_instrs, 0);
+  uses.assign(num_instrs, 0);
+  fused.assign(num_instrs, false);
+  uint32_t num_regs = vf.num_params;
+  uint32_t max_phis = 0;
+  for (auto& block : func->blocks) {
+    uint32_t num_phis = 0;
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      if (instr.op == IR_PARAM) {
+        regs[v] = instr.imm.u;
+      } else if (instr.type != IR_VOID) {
+        regs[v] = num_regs++;
+      }
+      if (instr.op == IR_PHI) num_phis++;
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        uses[func->getOperand(v, i)]++;
+      }
+    }
+    if (num_phis > max_phis) max_phis = num_phis;
+  }
+  scratch = num_regs++;
+  phi_tmps = num_regs;
+  num_regs += max_phis;
+  slot_offsets.clear();
+  vf.frame_size = num_regs;
+  for (auto& slot : func->slots) {
+    slot_offsets.push_back(vf.frame_size);
+    vf.frame_size += getWords(slot.type, slot.count);
+  }
+
+  // Constants and addresses do not change while the frame is live, so they
+  // are loaded once on entry
+  for (auto& block : func->blocks) {
+    for (ValueId v : block.instrs) {
+      Instr& instr = func->instrs[v];
+      if (instr.op == IR_CONST) {
+        uint32_t insn = addInsn(V_LOADK, regs[v]);
+        if (instr.type == IR_STR) {
+          code[insn].imm.bits = strings[instr.imm.u];
+        } else {
+          code[insn].imm.u = instr.imm.u;
+        }
+      } else if (instr.op == IR_GADDR) {
+        uint32_t insn = addInsn(V_LOADK, regs[v]);
+        code[insn].imm.p = global_addrs[instr.imm.u];
+      } else if (instr.op == IR_SLOT) {
+        addInsn(V_SLOT, regs[v], slot_offsets[instr.imm.u]);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (slot.zeroed) {
+      addInsn(V_ZERO, 0, slot_offsets[i],
+          getWords(slot.type, slot.count) * sizeof(VmValue));
+    }
+  }
+
+  // An integer compare used only by the branch right after it becomes part
+  // of the branch
+  for (auto& block : func->blocks) {
+    size_t n = block.instrs.size();
+    if (n < 2) continue;
+    ValueId term = block.instrs[n - 1];
+    ValueId cond = block.instrs[n - 2];
+    Instr& instr = func->instrs[cond];
+    if ((func->instrs[term].op == IR_CBR) && (func->getOperand(term, 0) == cond)
+        && (uses[cond] == 1) && (instr.op >= IR_LT) && (instr.op <= IR_NE)
+        && ((instr.src_type == IR_INT) || (instr.src_type == IR_BOOL))) {
+      fused[cond] = true;
+    }
+  }
+
+  labels.assign(func->blocks.size(), 0);
+  fixups.clear();
+  stubs.clear();
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    labels[b] = static_cast<uint32_t>(code.size());
+    for (ValueId v : func->blocks[b].instrs) {
+      if (!compileInstr(v)) return false;
+    }
+  }
+
+  // Phi copies for edges out of conditional branches
+  for (uint32_t i = 0; i < stubs.size(); i++) {
+    labels.push_back(static_cast<uint32_t>(code.size()));
+    compileEdge(stubs[i].first, stubs[i].second);
+    addJump(V_JMP, stubs[i].second);
+  }
+  for (auto& fixup : fixups) code[fixup.insn].imm.u = labels[fixup.label];
+  return true;
+}
+
+bool Vm::compileInstr(const ValueId& v) {
+  static const VmOp int_ops[] = {V_ADDI, V_SUBI, V_MULI, V_DIVI, V_AND, V_OR,
+    V_LTI, V_LEI, V_GTI, V_GEI, V_EQI, V_NEI};
+  static const VmOp flt_ops[] = {V_ADDF, V_SUBF, V_MULF, V_DIVF, V_AND, V_OR,
+    V_LTF, V_LEF, V_GTF, V_GEF, V_EQF, V_NEF};
+  Instr& instr = func->instrs[v];
+  IrType src_type = (instr.src_type != IR_VOID) ? instr.src_type : instr.type;
+  bool wide = (instr.type == IR_STR);
+  switch (instr.op) {
+    case IR_NOP:
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_GADDR:
+    case IR_SLOT:
+    case IR_PHI:
+      break;
+    case IR_GLOAD: {
+      uint32_t insn = addInsn(wide ? V_GLOAD64 : V_GLOAD32, regs[v]);
+      code[insn].imm.p = global_addrs[instr.imm.u];
+      break;
+    }
+    case IR_GSTORE: {
+      uint32_t insn = addInsn(wide ? V_GSTORE64 : V_GSTORE32, getReg(v, 0));
+      code[insn].imm.p = global_addrs[instr.imm.u];
+      break;
+    }
+    case IR_ALOAD: {
+      uint32_t insn = addInsn(wide ? V_ALOAD64 : V_ALOAD32, regs[v],
+          getReg(v, 0), getReg(v, 1));
+      code[insn].imm.u = (instr.flags & IR_FLAG_IN_BOUNDS) ? V_UNCHECKED
+          : instr.count;
+      break;
+    }
+    case IR_ASTORE: {
+      uint32_t insn = addInsn(wide ? V_ASTORE64 : V_ASTORE32, getReg(v, 2),
+          getReg(v, 0), getReg(v, 1));
+      code[insn].imm.u = (instr.flags & IR_FLAG_IN_BOUNDS) ? V_UNCHECKED
+          : instr.count;
+      break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE: {
+      if (fused[v]) break;
+      VmOp op = (src_type == IR_FLT) ? flt_ops[instr.op - IR_ADD]
+          : int_ops[instr.op - IR_ADD];
+      if (src_type == IR_STR) op = (instr.op == IR_EQ) ? V_EQS : V_NES;
+      addInsn(op, regs[v], getReg(v, 0), getReg(v, 1));
+      break;
+    }
+    case IR_NEG:
+      addInsn((src_type == IR_FLT) ? V_NEGF : V_NEGI, regs[v], getReg(v, 0));
+      break;
+    case IR_NOT:
+      addInsn((src_type == IR_BOOL) ? V_NOTB : V_NOTI, regs[v], getReg(v, 0));
+      break;
+    case IR_ITOF:
+      addInsn(V_ITOF, regs[v], getReg(v, 0));
+      break;
+    case IR_FTOI:
+      addInsn(V_FTOI, regs[v], getReg(v, 0));
+      break;
+    case IR_ITOB:
+      addInsn(V_ITOB, regs[v], getReg(v, 0));
+      break;
+    case IR_BTOI:
+      addInsn(V_MOV, regs[v], getReg(v, 0));
+      break;
+    case IR_ACOPY: {
+      uint32_t insn = addInsn(V_ACOPY, getReg(v, 0), getReg(v, 1));
+      code[insn].imm.u = instr.count * getElemSize(instr.type);
+      break;
+    }
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV: {
+      VmArrayOp op = {instr.op, static_cast<Opcode>(instr.imm.u),
+        (instr.op == IR_AUN) ? instr.type : instr.src_type, instr.type,
+        instr.flags, getReg(v, 0), getReg(v, 1),
+        (instr.op == IR_ABIN) ? getReg(v, 2) : 0, instr.count};
+      if ((instr.op == IR_ABIN) && (op.op >= IR_LT) && (op.op <= IR_NE)) {
+        op.dst_type = IR_BOOL;
+      }
+      uint32_t insn = addInsn(V_AOP);
+      code[insn].imm.u = static_cast<uint32_t>(array_ops.size());
+      array_ops.push_back(op);
+      break;
+    }
+    case IR_CALL: {
+      uint32_t dst = (instr.type != IR_VOID) ? regs[v] : scratch;
+      Function& callee = module.functions[instr.imm.u];
+      if (callee.external) {
+        addInsn(V_CALLB, dst, funcs[instr.imm.u].builtin,
+            (instr.num_ops > 0) ? getReg(v, 0) : 0);
+        break;
+      }
+      uint32_t insn = addInsn(V_CALL, dst, instr.imm.u,
+          static_cast<uint32_t>(call_args.size()));
+      code[insn].imm.u = instr.num_ops;
+      for (uint32_t i = 0; i < instr.num_ops; i++) {
+        call_args.push_back(getReg(v, i));
+      }
+      break;
+    }
+    case IR_BR: {
+      BlockId target = func->blocks[instr.block].succs[0];
+      compileEdge(instr.block, target);
+      if (target != instr.block + 1) addJump(V_JMP, target);
+      break;
+    }
+    case IR_CBR:
+      compileBranch(v);
+      break;
+    case IR_RET:
+      if (func->is_main) {
+        addInsn(V_HALT);
+      } else if (instr.num_ops > 0) {
+        addInsn(V_RET, getReg(v, 0));
+      } else {
+        addInsn(V_RETV);
+      }
+      break;
+    default:
+      LOG(ERROR) << "Cannot compile " << Module::getOpName(instr.op);
+      return false;
+  }
+  return true;
+}
+
+// Falls through to whichever target comes next
+void Vm::compileBranch(const ValueId& v) {
+  static const VmOp jumps[] = {V_JLT, V_JLE, V_JGT, V_JGE, V_JEQ, V_JNE};
+  static const VmOp inverse[] = {V_JGE, V_JGT, V_JLE, V_JLT, V_JNE, V_JEQ};
+  Instr& instr = func->instrs[v];
+  Block& block = func->blocks[instr.block];
+  uint32_t t = getEdgeLabel(instr.block, block.succs[0]);
+  uint32_t f = getEdgeLabel(instr.block, block.succs[1]);
+  uint32_t next = instr.block + 1;
+  ValueId cond = func->getOperand(v, 0);
+  if (fused[cond]) {
+    uint32_t a = getReg(cond, 0);
+    uint32_t b = getReg(cond, 1);
+    uint32_t cc = func->instrs[cond].op - IR_LT;
+    if (t == next) {
+      addJump(inverse[cc], f, a, b);
+      return;
+    }
+    addJump(jumps[cc], t, a, b);
+  } else {
+    if (t == next) {
+      addJump(V_BRF, f, regs[cond]);
+      return;
+    }
+    addJump(V_BRT, t, regs[cond]);
+  }
+  if (f != next) addJump(V_JMP, f);
+}
+
+// Phi inputs for the edge from one block to another, as moves; when a phi
+// reads another phi of the same block, all inputs go through temporaries
+void Vm::compileEdge(const BlockId& from, const BlockId& to) {
+  Block& succ = func->blocks[to];
+  uint32_t idx = 0;
+  while (succ.preds[idx] != from) idx++;
+  std::vector<std::pair<uint32_t, uint32_t>> moves;
+  for (ValueId phi : succ.instrs) {
+    if (func->instrs[phi].op != IR_PHI) break;
+    uint32_t src = getReg(phi, idx);
+    if (src != regs[phi]) moves.push_back({regs[phi], src});
+  }
+  bool overlap = false;
+  for (auto& dst : moves) {
+    for (auto& src : moves) overlap |= (dst.first == src.second);
+  }
+  if (!overlap) {
+    for (auto& move : moves) addInsn(V_MOV, move.first, move.second);
+    return;
+  }
+  for (uint32_t i = 0; i < moves.size(); i++) {
+    addInsn(V_MOV, phi_tmps + i, moves[i].second);
+  }
+  for (uint32_t i = 0; i < moves.size(); i++) {
+    addInsn(V_MOV, moves[i].first, phi_tmps + i);
+  }
+}
+
+uint32_t Vm::addInsn(const VmOp& op, const uint32_t& a, const uint32_t& b,
+    const uint32_t& c) {
+  VmInsn insn = {nullptr, op, a, b, c, {0}};
+  insn.imm.bits = 0;
+  code.push_back(insn);
+  return static_cast<uint32_t>(code.size() - 1);
+}
+
+void Vm::addJump(const VmOp& op, const uint32_t& label, const uint32_t& a,
+    const uint32_t& b) {
+  fixups.push_back({addInsn(op, a, b), label});
+}
+
+// A conditional branch cannot do the moves for a phi before it knows which
+// way it goes, so edges into blocks with phis get a stub of their own
+uint32_t Vm::getEdgeLabel(const BlockId& from, const BlockId& to) {
+  Block& succ = func->blocks[to];
+  if (succ.instrs.empty() || (func->instrs[succ.instrs[0]].op != IR_PHI)) {
+    return to;
+  }
+  stubs.push_back({from, to});
+  return static_cast<uint32_t>(func->blocks.size() + stubs.size() - 1);
+}
+
+void* Vm::runBody(void* arg) {
+  Vm* vm = static_cast<Vm*>(arg);
+  if (vm->use_jit) {
+    char top;
+    uintptr_t limit = reinterpret_cast<uintptr_t>(&top) - NATIVE_STACK_SIZE
+        + NATIVE_STACK_SLACK;
+    JitContext context = {reinterpret_cast<const void*>(&Vm::callFromNative),
+      reinterpret_cast<const void*>(&Vm::builtinFromNative),
+      reinterpret_cast<const void*>(&Vm::arrayOpFromNative),
+      reinterpret_cast<const void*>(&Vm::stackOverflow), vm->natives.data(),
+      vm->stack_end, reinterpret_cast<const void*>(limit)};
+    vm->jit.reset(new Jit(context));
+  }
+  vm->execute(vm->module.main_func, vm->stack.get());
+  return nullptr;
+}
+
+// Runs function idx on the frame at regs, whose arguments are in place, until
+// it returns; calls it makes to other interpreted functions stay in this loop
+VmValue Vm::execute(const uint32_t& idx, VmValue* regs) {
+  static const void* const handlers[NUM_VM_OPS] = {
+    &&L_LOADK, &&L_MOV, &&L_SLOT, &&L_ZERO, &&L_GLOAD32, &&L_GLOAD64,
+    &&L_GSTORE32, &&L_GSTORE64, &&L_ALOAD32, &&L_ALOAD64, &&L_ASTORE32,
+    &&L_ASTORE64, &&L_ACOPY, &&L_AOP, &&L_ADDI, &&L_SUBI, &&L_MULI, &&L_DIVI,
+    &&L_AND, &&L_OR, &&L_ADDF, &&L_SUBF, &&L_MULF, &&L_DIVF, &&L_LTI, &&L_LEI,
+    &&L_GTI, &&L_GEI, &&L_EQI, &&L_NEI, &&L_LTF, &&L_LEF, &&L_GTF, &&L_GEF,
+    &&L_EQF, &&L_NEF, &&L_EQS, &&L_NES, &&L_NEGI, &&L_NEGF, &&L_NOTI,
+    &&L_NOTB, &&L_ITOF, &&L_FTOI, &&L_ITOB, &&L_JMP, &&L_BRT, &&L_BRF,
+    &&L_JLT, &&L_JLE, &&L_JGT, &&L_JGE, &&L_JEQ, &&L_JNE, &&L_CALL,
+    &&L_CALLB, &&L_RET, &&L_RETV, &&L_HALT,
+  };
+
+  // Thread the code: handlers and jump targets become addresses
+  if (code[0].handler == nullptr) {
+    for (auto& insn : code) {
+      insn.handler = handlers[insn.op];
+      if ((insn.op >= V_JMP) && (insn.op <= V_JNE)) {
+        uint32_t target = insn.imm.u;
+        insn.imm.target = &code[target];
+      }
+    }
+  }
+
+  const VmInsn* insns = code.data();
+  const VmFunc* procs = funcs.data();
+  const uint32_t* args = call_args.data();
+  Frame* base = fp;
+  VmValue* r = regs;
+  uint32_t frame_size = funcs[idx].frame_size;
+  const VmInsn* pc = insns + funcs[idx].entry;
+  uint64_t n = 0;
+
+#define NEXT() do { n++; goto *pc->handler; } while (0)
+#define STEP() do { pc++; NEXT(); } while (0)
+#define JUMP_IF(cond) do { \
+    pc = (cond) ? pc->imm.target : pc + 1; \
+    NEXT(); \
+  } while (0)
+#define INT_OP(expr) do { \
+    uint32_t a = static_cast<uint32_t>(r[pc->b].i); \
+    uint32_t b = static_cast<uint32_t>(r[pc->c].i); \
+    r[pc->a].i = static_cast<int32_t>(expr); \
+    STEP(); \
+  } while (0)
+
+  NEXT();
+L_LOADK:
+  r[pc->a].bits = pc->imm.bits;
+  STEP();
+L_MOV:
+  r[pc->a] = r[pc->b];
+  STEP();
+L_SLOT:
+  r[pc->a].p = r + pc->b;
+  STEP();
+L_ZERO:
+  std::memset(r + pc->b, 0, pc->c);
+  STEP();
+L_GLOAD32:
+  std::memcpy(&r[pc->a].i, pc->imm.p, 4);
+  STEP();
+L_GLOAD64:
+  std::memcpy(&r[pc->a].s, pc->imm.p, 8);
+  STEP();
+L_GSTORE32:
+  std::memcpy(pc->imm.p, &r[pc->a].i, 4);
+  STEP();
+L_GSTORE64:
+  std::memcpy(pc->imm.p, &r[pc->a].s, 8);
+  STEP();
+L_ALOAD32: {
+  uint32_t idx = static_cast<uint32_t>(r[pc->c].i);
+  if (idx >= pc->imm.u) rt_bounds_error(r[pc->c].i, pc->imm.u);
+  r[pc->a].i = static_cast<const int32_t*>(r[pc->b].p)[idx];
+  STEP();
+}
+L_ALOAD64: {
+  uint32_t idx = static_cast<uint32_t>(r[pc->c].i);
+  if (idx >= pc->imm.u) rt_bounds_error(r[pc->c].i, pc->imm.u);
+  r[pc->a].s = static_cast<const rt_str*>(r[pc->b].p)[idx];
+  STEP();
+}
+L_ASTORE32: {
+  uint32_t idx = static_cast<uint32_t>(r[pc->c].i);
+  if (idx >= pc->imm.u) rt_bounds_error(r[pc->c].i, pc->imm.u);
+  static_cast<int32_t*>(r[pc->b].p)[idx] = r[pc->a].i;
+  STEP();
+}
+L_ASTORE64: {
+  uint32_t idx = static_cast<uint32_t>(r[pc->c].i);
+  if (idx >= pc->imm.u) rt_bounds_error(r[pc->c].i, pc->imm.u);
+  static_cast<rt_str*>(r[pc->b].p)[idx] = r[pc->a].s;
+  STEP();
+}
+L_ACOPY:
+  std::memmove(r[pc->a].p, r[pc->b].p, pc->imm.u);
+  STEP();
+L_AOP:
+  runArrayOp(array_ops[pc->imm.u], r);
+  STEP();
+L_ADDI:
+  INT_OP(a + b);
+L_SUBI:
+  INT_OP(a - b);
+L_MULI:
+  INT_OP(a * b);
+L_DIVI:
+  r[pc->a].i = divInt(r[pc->b].i, r[pc->c].i);
+  STEP();
+L_AND:
+  INT_OP(a & b);
+L_OR:
+  INT_OP(a | b);
+L_ADDF:
+  r[pc->a].f = r[pc->b].f + r[pc->c].f;
+  STEP();
+L_SUBF:
+  r[pc->a].f = r[pc->b].f - r[pc->c].f;
+  STEP();
+L_MULF:
+  r[pc->a].f = r[pc->b].f * r[pc->c].f;
+  STEP();
+L_DIVF:
+  r[pc->a].f = r[pc->b].f / r[pc->c].f;
+  STEP();
+L_LTI:
+  r[pc->a].i = (r[pc->b].i < r[pc->c].i);
+  STEP();
+L_LEI:
+  r[pc->a].i = (r[pc->b].i <= r[pc->c].i);
+  STEP();
+L_GTI:
+  r[pc->a].i = (r[pc->b].i > r[pc->c].i);
+  STEP();
+L_GEI:
+  r[pc->a].i = (r[pc->b].i >= r[pc->c].i);
+  STEP();
+L_EQI:
+  r[pc->a].i = (r[pc->b].i == r[pc->c].i);
+  STEP();
+L_NEI:
+  r[pc->a].i = (r[pc->b].i != r[pc->c].i);
+  STEP();
+L_LTF:
+  r[pc->a].i = (r[pc->b].f < r[pc->c].f);
+  STEP();
+L_LEF:
+  r[pc->a].i = (r[pc->b].f <= r[pc->c].f);
+  STEP();
+L_GTF:
+  r[pc->a].i = (r[pc->b].f > r[pc->c].f);
+  STEP();
+L_GEF:
+  r[pc->a].i = (r[pc->b].f >= r[pc->c].f);
+  STEP();
+L_EQF:
+  r[pc->a].i = (r[pc->b].f == r[pc->c].f);
+  STEP();
+L_NEF:
+  r[pc->a].i = (r[pc->b].f != r[pc->c].f);
+  STEP();
+L_EQS:
+  r[pc->a].i = rt_streq(r[pc->b].s, r[pc->c].s);
+  STEP();
+L_NES:
+  r[pc->a].i = !rt_streq(r[pc->b].s, r[pc->c].s);
+  STEP();
+L_NEGI:
+  r[pc->a].i = static_cast<int32_t>(0u - static_cast<uint32_t>(r[pc->b].i));
+  STEP();
+L_NEGF:
+  r[pc->a].f = -r[pc->b].f;
+  STEP();
+L_NOTI:
+  r[pc->a].i = ~r[pc->b].i;
+  STEP();
+L_NOTB:
+  r[pc->a].i = !r[pc->b].i;
+  STEP();
+L_ITOF:
+  r[pc->a].f = static_cast<float>(r[pc->b].i);
+  STEP();
+L_FTOI:
+  r[pc->a].i = floatToInt(r[pc->b].f);
+  STEP();
+L_ITOB:
+  r[pc->a].i = (r[pc->b].i != 0);
+  STEP();
+L_JMP:
+  pc = pc->imm.target;
+  NEXT();
+L_BRT:
+  JUMP_IF(r[pc->a].i);
+L_BRF:
+  JUMP_IF(!r[pc->a].i);
+L_JLT:
+  JUMP_IF(r[pc->a].i < r[pc->b].i);
+L_JLE:
+  JUMP_IF(r[pc->a].i <= r[pc->b].i);
+L_JGT:
+  JUMP_IF(r[pc->a].i > r[pc->b].i);
+L_JGE:
+  JUMP_IF(r[pc->a].i >= r[pc->b].i);
+L_JEQ:
+  JUMP_IF(r[pc->a].i == r[pc->b].i);
+L_JNE:
+  JUMP_IF(r[pc->a].i != r[pc->b].i);
+L_CALL: {
+  const VmFunc& callee = procs[pc->b];
+  VmValue* callee_regs = r + frame_size;
+  if ((callee.frame_size > static_cast<size_t>(stack_end - callee_regs))
+      || (fp == frames_end)) {
+    stackOverflow();
+  }
+  const uint32_t* arg = args + pc->c;
+  for (uint32_t i = 0; i < pc->imm.u; i++) callee_regs[i] = r[arg[i]];
+  if (jit && getNative(pc->b)) {
+    r[pc->a] = callNative(pc->b, callee_regs);
+    STEP();
+  }
+  *fp++ = {pc + 1, r, frame_size, pc->a};
+  r = callee_regs;
+  frame_size = callee.frame_size;
+  pc = insns + callee.entry;
+  NEXT();
+}
+L_CALLB:
+  r[pc->a] = callBuiltin(pc->b, r[pc->c]);
+  STEP();
+L_RET: {
+  VmValue val = r[pc->a];
+  if (fp == base) {
+    num_executed += n;
+    return val;
+  }
+  fp--;
+  r = fp->regs;
+  frame_size = fp->size;
+  r[fp->dst] = val;
+  pc = fp->ret;
+  NEXT();
+}
+L_RETV:
+  if (fp == base) {
+    num_executed += n;
+    return VmValue();
+  }
+  fp--;
+  r = fp->regs;
+  frame_size = fp->size;
+  pc = fp->ret;
+  NEXT();
+L_HALT:
+  num_executed += n;
+  return VmValue();
+
+#undef INT_OP
+#undef JUMP_IF
+#undef STEP
+#undef NEXT
+}
+
+// The native code of function idx, compiled now if this call makes it hot
+JitCode Vm::getNative(const uint32_t& idx) {
+  VmFunc& f = funcs[idx];
+  if (natives[idx] || (++f.calls != JIT_THRESHOLD)) return natives[idx];
+  natives[idx] = jit->compile(code, f.entry, f.end, f.frame_size, call_args);
+  Function& fn = module.functions[idx];
+  if (!natives[idx]) {
+    LOG(DEBUG) << "Procedure " << fn.name << " stays interpreted";
+    return nullptr;
+  }
+  LOG(DEBUG) << "Compiled procedure " << fn.name << " to native code";
+  num_compiled++;
+  return natives[idx];
+}
+
+// Native code checks both stacks itself
+VmValue Vm::callNative(const uint32_t& idx, VmValue* regs) {
+  VmValue val;
+  val.bits = natives[idx](regs, this);
+  return val;
+}
+
+// Called by native code for a callee with no native code; it may get some
+// now, else it runs in a nested interpreter loop
+uint64_t Vm::callFromNative(VmValue* regs, Vm* vm, uint32_t idx) {
+  if (vm->funcs[idx].frame_size > static_cast<size_t>(vm->stack_end - regs)) {
+    stackOverflow();
+  }
+  if (vm->getNative(idx)) return vm->callNative(idx, regs).bits;
+  return vm->execute(idx, regs).bits;
+}
+
+uint64_t Vm::builtinFromNative(uint32_t builtin, uint64_t arg) {
+  VmValue val;
+  val.bits = arg;
+  return callBuiltin(builtin, val).bits;
+}
+
+void Vm::arrayOpFromNative(Vm* vm, VmValue* regs, uint32_t op) {
+  runArrayOp(vm->array_ops[op], regs);
+}
+
+VmValue Vm::callBuiltin(const uint32_t& builtin, const VmValue& arg) {
+  VmValue val;
+  val.bits = 0;
+  switch (builtin) {
+    case B_GETBOOL:
+      val.i = rt_getbool();
+      break;
+    case B_GETINTEGER:
+      val.i = rt_getinteger();
+      break;
+    case B_GETFLOAT:
+      val.f = rt_getfloat();
+      break;
+    case B_GETSTRING:
+      val.s = rt_getstring();
+      break;
+    case B_PUTBOOL:
+      val.i = rt_putbool(arg.i);
+      break;
+    case B_PUTINTEGER:
+      val.i = rt_putinteger(arg.i);
+      break;
+    case B_PUTFLOAT:
+      val.i = rt_putfloat(arg.f);
+      break;
+    case B_PUTSTRING:
+      val.i = rt_putstring(arg.s);
+      break;
+    case B_SQRT:
+      val.f = rt_sqrt(arg.i);
+      break;
+  }
+  return val;
+}
+
+// Whole-array operations run as native loops, one per operation and type
+void Vm::runArrayOp(const VmArrayOp& op, VmValue* r) {
+  typedef rt_str Str;
+  bool is_flt = (op.src_type == IR_FLT);
+  switch (op.kind) {
+    case IR_ACONV:
+      if (op.dst_type == IR_FLT) {
+        mapArray<float, int32_t>(op, r, [](int32_t a, int32_t) {
+          return static_cast<float>(a);
+        });
+      } else if (is_flt && (op.dst_type == IR_BOOL)) {
+        mapArray<int32_t, float>(op, r, [](float a, float) {
+          return static_cast<int32_t>(floatToInt(a) != 0);
+        });
+      } else if (is_flt) {
+        mapArray<int32_t, float>(op, r, [](float a, float) {
+          return floatToInt(a);
+        });
+      } else if (op.dst_type == IR_BOOL) {
+        mapArray<int32_t, int32_t>(op, r, [](int32_t a, int32_t) {
+          return static_cast<int32_t>(a != 0);
+        });
+      } else {
+        mapArray<int32_t, int32_t>(op, r, [](int32_t a, int32_t) {
+          return a;
+        });
+      }
+      return;
+    case IR_AUN:
+      if (is_flt) {
+        mapArray<float, float>(op, r, [](float a, float) { return -a; });
+      } else if (op.op == IR_NEG) {
+        mapArray<int32_t, int32_t>(op, r, [](int32_t a, int32_t) {
+          return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+        });
+      } else if (op.src_type == IR_BOOL) {
+        mapArray<int32_t, int32_t>(op, r, [](int32_t a, int32_t) {
+          return static_cast<int32_t>(!a);
+        });
+      } else {
+        mapArray<int32_t, int32_t>(op, r, [](int32_t a, int32_t) {
+          return ~a;
+        });
+      }
+      return;
+    default:
+      break;
+  }
+
+#define MAP_INT(expr) mapArray<int32_t, int32_t>(op, r, \
+    [](int32_t x, int32_t y) { \
+      uint32_t a = static_cast<uint32_t>(x); \
+      uint32_t b = static_cast<uint32_t>(y); \
+      (void) a; \
+      (void) b; \
+      return static_cast<int32_t>(expr); \
+    })
+#define MAP_FLT(D, expr) mapArray<D, float>(op, r, \
+    [](float a, float b) { return static_cast<D>(expr); })
+  if (op.src_type == IR_STR) {
+    bool eq = (op.op == IR_EQ);
+    if (eq) {
+      mapArray<int32_t, Str>(op, r, [](Str a, Str b) { return rt_streq(a, b); });
+    } else {
+      mapArray<int32_t, Str>(op, r, [](Str a, Str b) {
+        return static_cast<int32_t>(!rt_streq(a, b));
+      });
+    }
+    return;
+  }
+  switch (op.op) {
+    case IR_ADD:
+      if (is_flt) MAP_FLT(float, a + b); else MAP_INT(a + b);
+      break;
+    case IR_SUB:
+      if (is_flt) MAP_FLT(float, a - b); else MAP_INT(a - b);
+      break;
+    case IR_MUL:
+      if (is_flt) MAP_FLT(float, a * b); else MAP_INT(a * b);
+      break;
+    case IR_DIV:
+      if (is_flt) MAP_FLT(float, a / b); else MAP_INT(divInt(x, y));
+      break;
+    case IR_AND:
+      MAP_INT(a & b);
+      break;
+    case IR_OR:
+      MAP_INT(a | b);
+      break;
+    case IR_LT:
+      if (is_flt) MAP_FLT(int32_t, a < b); else MAP_INT(x < y);
+      break;
+    case IR_LE:
+      if (is_flt) MAP_FLT(int32_t, a <= b); else MAP_INT(x <= y);
+      break;
+    case IR_GT:
+      if (is_flt) MAP_FLT(int32_t, a > b); else MAP_INT(x > y);
+      break;
+    case IR_GE:
+      if (is_flt) MAP_FLT(int32_t, a >= b); else MAP_INT(x >= y);
+      break;
+    case IR_EQ:
+      if (is_flt) MAP_FLT(int32_t, a == b); else MAP_INT(a == b);
+      break;
+    case IR_NE:
+      if (is_flt) MAP_FLT(int32_t, a != b); else MAP_INT(a != b);
+      break;
+    default:
+      break;
+  }
+#undef MAP_FLT
+#undef MAP_INT
+}
+
+// dst[i] = f(lhs[i], rhs[i]), with scalar operands broadcast; unary
+// operations ignore the second argument
+template <typename D, typename S, typename F>
+void Vm::mapArray(const VmArrayOp& op, VmValue* r, F f) {
+  D* dst = static_cast<D*>(r[op.dst].p);
+  S lhs_val, rhs_val = S();
+  std::memcpy(&lhs_val, &r[op.lhs], sizeof(S));
+  if (op.kind != IR_ABIN) {
+    const S* lhs = static_cast<const S*>(r[op.lhs].p);
+    for (uint32_t i = 0; i < op.count; i++) dst[i] = f(lhs[i], rhs_val);
+    return;
+  }
+  std::memcpy(&rhs_val, &r[op.rhs], sizeof(S));
+  const S* lhs = static_cast<const S*>(r[op.lhs].p);
+  const S* rhs = static_cast<const S*>(r[op.rhs].p);
+  if (op.flags & IR_FLAG_LHS_SCALAR) {
+    for (uint32_t i = 0; i < op.count; i++) dst[i] = f(lhs_val, rhs[i]);
+  } else if (op.flags & IR_FLAG_RHS_SCALAR) {
+    for (uint32_t i = 0; i < op.count; i++) dst[i] = f(lhs[i], rhs_val);
+  } else {
+    for (uint32_t i = 0; i < op.count; i++) dst[i] = f(lhs[i], rhs[i]);
+  }
+}
+
+// Wraps on INT32_MIN / -1 like the other backends
+int32_t Vm::divInt(const int32_t& a, const int32_t& b) {
+  if (b == 0) rt_div_error();
+  if (b == -1) return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+  return a / b;
+}
+
+// Out of range conversions give INT32_MIN, like cvttss2si
+int32_t Vm::floatToInt(const float& f) {
+  if (!(f > -2147483904.0f) || !(f < 2147483648.0f)) return INT32_MIN;
+  return static_cast<int32_t>(f);
+}
+
+void Vm::stackOverflow() {
+  rt_flush();
+  std::fprintf(stderr, "Runtime error: stack overflow\n");
+  std::exit(EXIT_FAILURE);
+}
+
+// Size of count elements of type in VmValues
+uint32_t Vm::getWords(const IrType& type, const uint32_t& count) {
+  uint32_t bytes = count * getElemSize(type);
+  return (bytes + sizeof(VmValue) - 1) / sizeof(VmValue);
+}
@@ -0,0 +1,248 @@
+#ifndef VM_H
+#define VM_H
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+extern "C" {
+#include "../runtime/runtime.h"
+}
+
+class Jit;
+class Vm;
+
+// A register holds any scalar; which member is live is known statically from
+// the instruction that reads it
+union VmValue {
+  int32_t i;
+  float f;
+  rt_str s;
+  void* p;
+  uint64_t bits;
+};
+
+// Element count of an array access whose index is known to be in range; no
+// index compares as out of range against it
+const uint32_t V_UNCHECKED = 0xffffffff;
+
+enum VmOp : uint32_t {
+  V_LOADK = 0, // a = imm
+  V_MOV, // a = b
+  V_SLOT, // a = address of frame word b
+  V_ZERO, // Clear c bytes from frame word b
+  V_GLOAD32, // a = *imm.p
+  V_GLOAD64,
+  V_GSTORE32, // *imm.p = a
+  V_GSTORE64,
+  V_ALOAD32, // a = b[c]; imm.u: element count, or V_UNCHECKED
+  V_ALOAD64,
+  V_ASTORE32, // b[c] = a; imm.u: element count, or V_UNCHECKED
+  V_ASTORE64,
+  V_ACOPY, // Move imm.u bytes from b to a
+  V_AOP, // Whole-array operation; imm.u: index into the array op table
+  V_ADDI, // a = b op c
+  V_SUBI,
+  V_MULI,
+  V_DIVI,
+  V_AND,
+  V_OR,
+  V_ADDF,
+  V_SUBF,
+  V_MULF,
+  V_DIVF,
+  V_LTI,
+  V_LEI,
+  V_GTI,
+  V_GEI,
+  V_EQI,
+  V_NEI,
+  V_LTF,
+  V_LEF,
+  V_GTF,
+  V_GEF,
+  V_EQF,
+  V_NEF,
+  V_EQS,
+  V_NES,
+  V_NEGI, // a = op b
+  V_NEGF,
+  V_NOTI,
+  V_NOTB,
+  V_ITOF,
+  V_FTOI,
+  V_ITOB,
+  V_JMP, // Jump to imm.target
+  V_BRT, // Jump if a is true
+  V_BRF, // Jump if a is false
+  V_JLT, // Jump if a op b (integers)
+  V_JLE,
+  V_JGT,
+  V_JGE,
+  V_JEQ,
+  V_JNE,
+  V_CALL, // a = function b with the c-th argument list; imm.u: arguments
+  V_CALLB, // a = builtin b applied to c
+  V_RET, // Return a
+  V_RETV, // Return nothing
+  V_HALT, // End of the program
+  NUM_VM_OPS,
+};
+
+struct VmInsn {
+  const void* handler;  // Dispatch target, filled in before the first run
+  VmOp op;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  union {
+    int32_t i;
+    float f;
+    uint32_t u;
+    void* p;
+    const VmInsn* target;
+    uint64_t bits;
+  } imm;
+};
+
+// A procedure compiled to native code: takes its frame and returns the value
+// of its return register
+typedef uint64_t (*JitCode)(VmValue*, Vm*);
+
+////////////////////////////////////////////////////////////////////////////////
+// Bytecode interpreter
+// Compiles the IR to a register bytecode and runs it in process, so a program
+// can be tried out without an assembler or linker. Every SSA value gets a
+// register in its procedure's frame and every operation has a version per
+// operand type, so nothing is checked at run time but bounds and division.
+// Frames, with the procedure's local arrays after its registers, are carved
+// out of one preallocated stack. Dispatch is threaded through a table of label
+// addresses (a GNU extension) rather than a switch. With the JIT on, a
+// procedure called JIT_THRESHOLD times is handed to the Jit; from then on its
+// calls run the native code, found through a table indexed by function.
+////////////////////////////////////////////////////////////////////////////////
+class Vm {
+public:
+  Vm(Module&, const bool& = false);
+  ~Vm();
+  bool compile();
+  bool run();
+  uint64_t getNumExecuted() { return num_executed; }
+
+private:
+  enum Builtin : uint32_t {
+    B_GETBOOL = 0,
+    B_GETINTEGER,
+    B_GETFLOAT,
+    B_GETSTRING,
+    B_PUTBOOL,
+    B_PUTINTEGER,
+    B_PUTFLOAT,
+    B_PUTSTRING,
+    B_SQRT,
+    NUM_BUILTINS,
+  };
+
+  struct VmFunc {
+    uint32_t entry;  // First instruction
+    uint32_t end;  // Past the last instruction
+    uint32_t frame_size;  // Registers and local arrays, in VmValues
+    uint32_t num_params;  // Parameters are the first registers
+    uint32_t builtin;  // NUM_BUILTINS unless external
+    uint32_t calls;  // Counted until the JIT sees it
+  };
+
+  struct VmArrayOp {
+    Opcode kind;  // IR_ABIN, IR_AUN or IR_ACONV
+    Opcode op;  // Scalar operation
+    IrType src_type;
+    IrType dst_type;
+    uint8_t flags;
+    uint32_t dst;
+    uint32_t lhs;
+    uint32_t rhs;
+    uint32_t count;
+  };
+
+  // Jumps whose target is not known yet: instruction, label
+  struct Fixup {
+    uint32_t insn;
+    uint32_t label;
+  };
+
+  // Saved state of a caller
+  struct Frame {
+    const VmInsn* ret;
+    VmValue* regs;
+    uint32_t size;
+    uint32_t dst;
+  };
+
+  static const size_t STACK_SIZE = size_t(1) << 24;  // VmValues
+  static const size_t MAX_DEPTH = size_t(1) << 22;  // Frames
+  static const size_t NATIVE_STACK_SIZE = size_t(1) << 30;  // Bytes
+  static const size_t NATIVE_STACK_SLACK = size_t(1) << 20;  // For callees
+  static const uint32_t JIT_THRESHOLD = 50;  // Calls
+
+  Module& module;
+  bool use_jit;
+  std::unique_ptr<Jit> jit;
+  Function* func;
+  std::vector<VmInsn> code;
+  std::vector<VmFunc> funcs;
+  std::vector<JitCode> natives;  // Function -> native code, or nullptr
+  std::vector<VmArrayOp> array_ops;
+  std::vector<uint32_t> call_args;
+  std::vector<uint64_t> globals;
+  std::vector<void*> global_addrs;
+  std::vector<rt_str> strings;  // Module::strings as values
+  std::vector<uint32_t> regs;  // ValueId -> register
+  std::vector<uint32_t> uses;  // ValueId -> number of uses
+  std::vector<bool> fused;  // Compares folded into the branch after them
+  std::vector<uint32_t> slot_offsets;
+  std::vector<uint32_t> labels;  // Blocks, then edge stubs -> instruction
+  std::vector<Fixup> fixups;
+  std::vector<std::pair<BlockId, BlockId>> stubs;  // Edges that need copies
+  uint32_t scratch;  // Register for results nobody reads
+  uint32_t phi_tmps;  // First of the registers for swapping phi inputs
+  std::unique_ptr<VmValue[]> stack;
+  std::unique_ptr<Frame[]> frames;
+  VmValue* stack_end;
+  Frame* frames_end;
+  Frame* fp;
+  uint32_t num_compiled;
+  uint64_t num_executed;
+
+  bool compileFunction(const uint32_t&);
+  bool compileInstr(const ValueId&);
+  void compileBranch(const ValueId&);
+  void compileEdge(const BlockId&, const BlockId&);
+  uint32_t addInsn(const VmOp&, const uint32_t& = 0, const uint32_t& = 0,
+      const uint32_t& = 0);
+  void addJump(const VmOp&, const uint32_t&, const uint32_t& = 0,
+      const uint32_t& = 0);
+  uint32_t getReg(const ValueId& v, const uint32_t& n) {
+    return regs[func->getOperand(v, n)];
+  }
+  uint32_t getEdgeLabel(const BlockId&, const BlockId&);
+  static void* runBody(void*);
+  VmValue execute(const uint32_t&, VmValue*);
+  JitCode getNative(const uint32_t&);
+  VmValue callNative(const uint32_t&, VmValue*);
+  static uint64_t callFromNative(VmValue*, Vm*, uint32_t);
+  static uint64_t builtinFromNative(uint32_t, uint64_t);
+  static void arrayOpFromNative(Vm*, VmValue*, uint32_t);
+  static VmValue callBuiltin(const uint32_t&, const VmValue&);
+  static void runArrayOp(const VmArrayOp&, VmValue*);
+  template <typename D, typename S, typename F>
+  static void mapArray(const VmArrayOp&, VmValue*, F);
+  static int32_t divInt(const int32_t&, const int32_t&);
+  static int32_t floatToInt(const float&);
+  [[noreturn]] static void stackOverflow();
+  static uint32_t getWords(const IrType&, const uint32_t&);
+};
+
+#endif // VM_H
@@ -0,0 +1,1221 @@
+#include "x86.h"
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "array_fusion.h"
+#include "ir.h"
+#include "log.h"
+#include "peephole.h"
+#include "register_allocator.h"
+
+extern "C" {
+#include "../runtime/runtime.h"
+}
+
+const std::string X86Backend::op_names[NUM_MOPS] = {
+  "", "mov", "movzb", "movslq", "lea", "add", "sub", "imul", "and", "or", "xor",
+  "not", "neg", "cmp", "test", "cltd", "idiv", "set", "j", "jmp", "call", "ret",
+  "push", "pop", "leave", "movss", "movd", "addss", "subss", "mulss", "divss",
+  "ucomiss", "cvtsi2ss", "cvttss2si", "movups", "movaps", "addps", "subps",
+  "mulps", "divps", "cmpltps", "cmpleps", "cmpeqps", "cmpneqps", "paddd",
+  "psubd", "pmuludq", "pand", "por", "pxor", "pcmpeqd", "pcmpgtd",
+  "punpckldq", "punpcklqdq", "pslld", "psrld", "psllq", "psrlq", "cvtdq2ps",
+  "cvttps2dq",
+};
+
+const std::string X86Backend::cond_names[NUM_CONDS] = {
+  "e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae", "p", "np",
+};
+
+// 8-, 32- and 64-bit names
+const std::string X86Backend::reg_names[NUM_PHYS_REGS][3] = {
+  {"al", "eax", "rax"}, {"cl", "ecx", "rcx"}, {"dl", "edx", "rdx"},
+  {"bl", "ebx", "rbx"}, {"spl", "esp", "rsp"}, {"bpl", "ebp", "rbp"},
+  {"sil", "esi", "rsi"}, {"dil", "edi", "rdi"}, {"r8b", "r8d", "r8"},
+  {"r9b", "r9d", "r9"}, {"r10b", "r10d", "r10"}, {"r11b", "r11d", "r11"},
+  {"r12b", "r12d", "r12"}, {"r13b", "r13d", "r13"}, {"r14b", "r14d", "r14"},
+  {"r15b", "r15d", "r15"},
+  {"xmm0", "xmm0", "xmm0"}, {"xmm1", "xmm1", "xmm1"}, {"xmm2", "xmm2", "xmm2"},
+  {"xmm3", "xmm3", "xmm3"}, {"xmm4", "xmm4", "xmm4"}, {"xmm5", "xmm5", "xmm5"},
+  {"xmm6", "xmm6", "xmm6"}, {"xmm7", "xmm7", "xmm7"}, {"xmm8", "xmm8", "xmm8"},
+  {"xmm9", "xmm9", "xmm9"}, {"xmm10", "xmm10", "xmm10"},
+  {"xmm11", "xmm11", "xmm11"}, {"xmm12", "xmm12", "xmm12"},
+  {"xmm13", "xmm13", "xmm13"}, {"xmm14", "xmm14", "xmm14"},
+  {"xmm15", "xmm15", "xmm15"},
+};
+
+static const Reg int_arg_regs[] = {RDI, RSI, RDX, RCX, R8, R9};
+static const Reg flt_arg_regs[] = {
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+};
+
+X86Backend::X86Backend(Module& m, const uint32_t& par_min) :
+    module(m),
+    parallel_min(par_min),
+    func(nullptr),
+    func_idx(0),
+    next_label(0),
+    frame_size(0),
+    frame_instr(0),
+    fusion(nullptr),
+    free_xmm(0),
+    out_of_xmm(false),
+    num_vector_loops(0),
+    num_values(0),
+    num_spilled(0),
+    num_constants(0),
+    num_moves(0),
+    num_saved(0),
+    num_rewrites(Peephole::NUM_PATTERNS, 0) {
+  for (uint32_t i = 0; i < module.globals.size(); i++) {
+    symbols.push_back(module.getGlobalName(i));
+    sym_external.push_back(false);
+  }
+  func_syms = static_cast<uint32_t>(symbols.size());
+  for (uint32_t i = 0; i < module.functions.size(); i++) {
+    symbols.push_back(module.getLinkName(i));
+    sym_external.push_back(module.functions[i].external);
+  }
+  string_syms = static_cast<uint32_t>(symbols.size());
+  for (uint32_t i = 0; i < module.strings.size(); i++) {
+    symbols.push_back(".Lstr" + std::to_string(i));
+    sym_external.push_back(false);
+  }
+}
+
+void X86Backend::emit(std::ostream& os) {
+  size_t num_instrs = 0;
+  size_t num_fused = 0;
+  size_t num_parallel = 0;
+  num_vector_loops = 0;
+  num_values = num_spilled = num_constants = num_moves = num_saved = 0;
+  num_rewrites.assign(Peephole::NUM_PATTERNS, 0);
+  os << "\t.text\n";
+  for (func_idx = 0; func_idx < module.functions.size(); func_idx++) {
+    func = &module.functions[func_idx];
+    if (func->external) continue;
+    ArrayFusion func_fusion(*func);
+    fusion = &func_fusion;
+    jobs.clear();
+    selectFunction();
+    allocateRegisters();
+    runPeephole();
+    printFunction(os, func_syms + func_idx);
+    num_instrs += code.size();
+    for (auto& job : jobs) {
+      selectWorker(job);
+      allocateRegisters();
+      runPeephole();
+      printFunction(os, job.sym);
+      num_instrs += code.size();
+    }
+    num_parallel += jobs.size();
+    num_fused += fusion->getNumFused();
+    fusion = nullptr;
+  }
+
+  // String literals too long to be immediates, after their lengths
+  bool rodata = false;
+  for (uint32_t i = 0; i < module.strings.size(); i++) {
+    if (module.strings[i].size() <= RT_STR_INLINE) continue;
+    if (!rodata) os << "\t.section .rodata\n";
+    rodata = true;
+    os << "\t.balign 8\n\t.quad " << module.strings[i].size() << "\n"
+        << symbols[string_syms + i] << ":\n\t.string \"";
+    for (unsigned char c : module.strings[i]) {
+      if ((c == '"') || (c == '\\')) {
+        os << '\\' << c;
+      } else if ((c < 0x20) || (c >= 0x7f)) {
+        os << '\\' << static_cast<char>('0' + ((c >> 6) & 7))
+            << static_cast<char>('0' + ((c >> 3) & 7))
+            << static_cast<char>('0' + (c & 7));
+      } else {
+        os << c;
+      }
+    }
+    os << "\"\n";
+  }
+
+  // Globals are zero initialized
+  if (!module.globals.empty()) os << "\t.bss\n";
+  for (uint32_t i = 0; i < module.globals.size(); i++) {
+    Global& g = module.globals[i];
+    uint32_t bytes = (g.count > 0) ? g.count * getElemSize(g.type) : 8;
+    os << "\t.align 16\n" << symbols[i] << ":\n\t.zero " << bytes << "\n";
+  }
+  os << "\t.section .note.GNU-stack,\"\",@progbits\n";
+  LOG(INFO) << "Done generating code: " << num_instrs << " instructions, "
+      << num_fused << " array operations fused, " << num_vector_loops
+      << " vector loops, " << num_parallel << " split across threads";
+  LOG(INFO) << "Register allocation: " << num_spilled << " of " << num_values
+      << " values spilled, " << num_constants << " constants left as "
+      << "immediates, " << num_moves << " moves removed, " << num_saved
+      << " callee-saved registers used";
+  size_t total = 0;
+  std::string counts;
+  for (size_t p = 0; p < Peephole::NUM_PATTERNS; p++) {
+    total += num_rewrites[p];
+    counts += std::string((p == 0) ? "" : ", ") + Peephole::getPatternName(p)
+        + " " + std::to_string(num_rewrites[p]);
+  }
+  LOG(INFO) << "Peephole: " << total << " rewrites (" << counts << ")";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private functions
+////////////////////////////////////////////////////////////////////////////////
+
+void X86Backend::selectFunction() {
+  code.clear();
+  vreg_sizes.clear();
+  vreg_floats.clear();
+  value_regs.assign(func->instrs.size(), NO_REG);
+  phi_in_regs.assign(func->instrs.size(), NO_REG);
+  slot_offsets.clear();
+  stubs.clear();
+  next_label = static_cast<int64_t>(func->blocks.size());
+
+  // Arrays sit just below the saved frame pointer; temporaries that fusion
+  // left unused take no space
+  uint32_t offset = 0;
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (!fusion->isSlotUnused(i)) {
+      offset += (slot.count * getElemSize(slot.type) + 15) & ~15u;
+    }
+    slot_offsets.push_back(-static_cast<int32_t>(offset));
+  }
+  frame_size = offset;
+
+  add(M_PUSH, 8, reg(RBP));
+  add(M_MOV, 8, reg(RSP), reg(RBP));
+  frame_instr = code.size();
+  add(M_SUB, 8, imm(0), reg(RSP));
+
+  // Move the parameters out of the argument registers before anything else
+  // can clobber them
+  std::vector<ArgLoc> locs = getArgLocs(*func);
+  for (ValueId v : func->blocks[0].instrs) {
+    Instr& instr = func->instrs[v];
+    if (instr.op != IR_PARAM) continue;
+    ArgLoc& loc = locs[instr.imm.u];
+    Reg r = getReg(v);
+    if (loc.reg != NO_REG) {
+      move(loc.reg, r);
+    } else {
+      add(isFloat(r) ? M_MOVSS : M_MOV, getSize(instr.type),
+          mem(RBP, 16 + 8 * static_cast<int64_t>(loc.stack)), reg(r));
+    }
+  }
+  for (uint32_t i = 0; i < func->slots.size(); i++) {
+    Slot& slot = func->slots[i];
+    if (!slot.zeroed) continue;
+    add(M_LEA, 8, mem(RBP, slot_offsets[i]), reg(RDI));
+    add(M_XOR, 4, reg(RSI), reg(RSI));
+    add(M_MOV, 8, imm(slot.count * getElemSize(slot.type)), reg(RDX));
+    call(getRuntimeSym("memset"), {RDI, RSI, RDX});
+  }
+
+  for (BlockId b = 0; b < func->blocks.size(); b++) {
+    add(M_LABEL, 0, label(b));
+    for (ValueId v : func->blocks[b].instrs) {
+      if (func->instrs[v].op == IR_PHI) {
+        move(getPhiIn(v), getReg(v));
+      } else {
+        selectInstr(v);
+      }
+    }
+  }
+
+  for (auto& stub : stubs) {
+    add(M_LABEL, 0, label(stub.label));
+    if (stub.idx != NO_REG) {
+      add(M_MOV, 4, reg(stub.idx), reg(RDI));
+      add(M_MOV, 4, imm(stub.count), reg(RSI));
+      call(stub.sym, {RDI, RSI});
+    } else {
+      call(stub.sym, {});
+    }
+  }
+}
+
+void X86Backend::selectInstr(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  uint8_t size = getSize(instr.type);
+  MOp mov = (instr.type == IR_FLT) ? M_MOVSS : M_MOV;
+  switch (instr.op) {
+    case IR_CONST:
+      if (instr.type == IR_STR) {
+        const std::string& s = module.strings[instr.imm.u];
+        if (s.size() > RT_STR_INLINE) {
+          add(M_LEA, 8, symMem(string_syms + instr.imm.u), reg(getReg(v)));
+          break;
+        }
+        int64_t word = static_cast<int64_t>(rt_str_inline(s.data(),
+            static_cast<uint32_t>(s.size())));
+        if ((word >= INT32_MIN) && (word <= INT32_MAX)) {
+          add(M_MOV, 8, imm(word), reg(getReg(v)));
+        } else {
+          add(M_MOV, 8, imm(word), reg(RAX));  // Only movabs takes 64 bits
+          add(M_MOV, 8, reg(RAX), reg(getReg(v)));
+        }
+      } else if (instr.type == IR_FLT) {
+        add(M_MOV, 4, imm(instr.imm.u), reg(RAX));
+        add(M_MOVD, 4, reg(RAX), reg(getReg(v)));
+      } else {
+        add(M_MOV, size, imm(instr.imm.i), reg(getReg(v)));
+      }
+      break;
+    case IR_PARAM:
+      // Done in the prologue
+      break;
+    case IR_GLOAD:
+      add(mov, size, symMem(instr.imm.u), reg(getReg(v)));
+      break;
+    case IR_GSTORE:
+      add(mov, size, reg(getReg(func->getOperand(v, 0))),
+          symMem(instr.imm.u));
+      break;
+    case IR_GADDR:
+      add(M_LEA, 8, symMem(instr.imm.u), reg(getReg(v)));
+      break;
+    case IR_SLOT:
+      if (fusion->isSlotUnused(instr.imm.u)) break;
+      add(M_LEA, 8, mem(RBP, slot_offsets[instr.imm.u]), reg(getReg(v)));
+      break;
+    case IR_ALOAD:
+    case IR_ASTORE: {
+      Reg base = getReg(func->getOperand(v, 0));
+      Reg idx = getReg(func->getOperand(v, 1));
+      if (!(instr.flags & IR_FLAG_IN_BOUNDS)) {
+        selectBoundsCheck(idx, instr.count);
+      }
+      Reg idx64 = newVreg(IR_PTR);
+      add(M_MOVSLQ, 8, reg(idx), reg(idx64));
+      uint8_t elem_size = getElemSize(instr.type);
+      if (instr.op == IR_ALOAD) {
+        add(mov, size, mem(base, 0, idx64, elem_size), reg(getReg(v)));
+      } else {
+        Reg addr = newVreg(IR_PTR);
+        add(M_LEA, 8, mem(base, 0, idx64, elem_size), reg(addr));
+        add(mov, size, reg(getReg(func->getOperand(v, 2))), mem(addr));
+      }
+      break;
+    }
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_DIV:
+    case IR_AND:
+    case IR_OR:
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      selectScalarOp(instr.op,
+          (instr.src_type != IR_VOID) ? instr.src_type : instr.type,
+          getReg(v), getReg(func->getOperand(v, 0)),
+          getReg(func->getOperand(v, 1)));
+      break;
+    case IR_NEG:
+    case IR_NOT:
+    case IR_ITOF:
+    case IR_FTOI:
+    case IR_ITOB:
+    case IR_BTOI:
+      selectScalarOp(instr.op,
+          (instr.src_type != IR_VOID) ? instr.src_type : instr.type,
+          getReg(v), getReg(func->getOperand(v, 0)));
+      break;
+    case IR_ACOPY:
+      move(getReg(func->getOperand(v, 0)), RDI);
+      move(getReg(func->getOperand(v, 1)), RSI);
+      add(M_MOV, 8, imm(instr.count * getElemSize(instr.type)), reg(RDX));
+      call(getRuntimeSym("memmove"), {RDI, RSI, RDX});
+      break;
+    case IR_ABIN:
+    case IR_AUN:
+    case IR_ACONV:
+      if (!fusion->isFused(v)) selectArrayOp(v);
+      break;
+    case IR_CALL:
+      selectCall(v);
+      break;
+    case IR_BR: {
+      selectPhiCopies(instr.block);
+      BlockId target = func->blocks[instr.block].succs[0];
+      if (target != instr.block + 1) add(M_JMP, 0, label(target));
+      break;
+    }
+    case IR_CBR: {
+      selectPhiCopies(instr.block);
+      BlockId t = func->blocks[instr.block].succs[0];
+      BlockId f = func->blocks[instr.block].succs[1];
+      add(M_CMP, 4, imm(0), reg(getReg(func->getOperand(v, 0))));
+      if (t == instr.block + 1) {
+        add(M_JCC, 0, label(f), MOperand(), CC_E);
+      } else {
+        add(M_JCC, 0, label(t), MOperand(), CC_NE);
+        if (f != instr.block + 1) add(M_JMP, 0, label(f));
+      }
+      break;
+    }
+    case IR_RET:
+      if (instr.num_ops > 0) {
+        Reg r = getReg(func->getOperand(v, 0));
+        move(r, isFloat(r) ? XMM0 : RAX);
+      } else if (func->is_main) {
+        call(getRuntimeSym("flush"), {});
+        add(M_XOR, 4, reg(RAX), reg(RAX));
+      }
+      add(M_LEAVE, 0);
+      add(M_RET, 0);
+      break;
+    default:
+      LOG(ERROR) << "Cannot select " << Module::getOpName(instr.op);
+      break;
+  }
+}
+
+// Each predecessor writes the incoming value into a register owned by the
+// phi, which the phi reads at the top of its block; that way a value that is
+// live across the edge is never overwritten, and no edge needs splitting
+void X86Backend::selectPhiCopies(const BlockId& b) {
+  for (BlockId s : func->blocks[b].succs) {
+    Block& succ = func->blocks[s];
+    uint32_t idx = 0;
+    while (succ.preds[idx] != b) idx++;
+    for (ValueId phi : succ.instrs) {
+      if (func->instrs[phi].op != IR_PHI) break;
+      move(getReg(func->getOperand(phi, idx)), getPhiIn(phi));
+    }
+  }
+}
+
+// Whole-array operations become a loop over the elements, or a worker
+// function run on every thread if they are large and cannot fail
+void X86Backend::selectArrayOp(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  if ((parallel_min > 0) && (instr.count >= parallel_min)
+      && !fusion->canFail(v)) {
+    selectParallelOp(v);
+    return;
+  }
+  Reg i = newVreg(IR_PTR);
+  add(M_MOV, 8, imm(0), reg(i));
+  selectArrayLoop(v, i, NO_REG);
+}
+
+// The loop from element i to end, or to the end of the array if end is
+// NO_REG: four at a time in xmm registers when every operation in the fused
+// tree has a vector form, and then one at a time for whatever is left
+void X86Backend::selectArrayLoop(const ValueId& v, const Reg& i,
+    const Reg& end) {
+  Instr& instr = func->instrs[v];
+  Reg dst = getReg(func->getOperand(v, 0));
+  uint32_t vector_count = instr.count & ~3u;
+  if ((vector_count > 0) && canVectorize(v)) {
+    // xmm14 and xmm15 stay free for the register assignment pass
+    size_t start = code.size();
+    broadcasts.clear();
+    free_xmm = (1u << 14) - 1;
+    out_of_xmm = false;
+    selectBroadcasts(v);
+    MOperand vector_end = imm(vector_count);
+    int64_t skip = newLabel();
+    if (end != NO_REG) {
+      // While at least four are left
+      Reg last = newVreg(IR_PTR);
+      move(end, last);
+      add(M_SUB, 8, imm(3), reg(last));
+      vector_end = reg(last);
+      add(M_CMP, 8, vector_end, reg(i));
+      add(M_JCC, 0, label(skip), MOperand(), CC_GE);
+    }
+    int64_t top = newLabel();
+    add(M_LABEL, 0, label(top));
+    Reg r = selectVectorOp(v, i);
+    add(M_MOVUPS, 16, reg(r), mem(dst, 0, i, 4));
+    add(M_ADD, 8, imm(4), reg(i));
+    add(M_CMP, 8, vector_end, reg(i));
+    add(M_JCC, 0, label(top), MOperand(), CC_L);
+    if (end != NO_REG) add(M_LABEL, 0, label(skip));
+    if (out_of_xmm) {
+      // Too deep to keep in registers; do it all one element at a time
+      code.resize(start);
+    } else {
+      num_vector_loops++;
+      if ((end == NO_REG) && (vector_count == instr.count)) return;
+    }
+  }
+
+  int64_t top = newLabel();
+  int64_t done = newLabel();
+  add(M_LABEL, 0, label(top));
+  add(M_CMP, 8, (end != NO_REG) ? reg(end) : imm(instr.count), reg(i));
+  add(M_JCC, 0, label(done), MOperand(), CC_GE);
+  Reg r = selectElemOp(v, i);
+  Reg addr = newVreg(IR_PTR);
+  add(M_LEA, 8, mem(dst, 0, i, getElemSize(instr.type)), reg(addr));
+  add((instr.type == IR_FLT) ? M_MOVSS : M_MOV, getSize(instr.type), reg(r),
+      mem(addr));
+  add(M_ADD, 8, imm(1), reg(i));
+  add(M_JMP, 0, label(top));
+  add(M_LABEL, 0, label(done));
+}
+
+// The values the worker needs are stored in a context block on the stack,
+// whose address rt_parallel passes on to every chunk
+void X86Backend::selectParallelOp(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  ParallelJob job;
+  job.v = v;
+  job.sym = static_cast<uint32_t>(symbols.size());
+  symbols.push_back("par" + std::to_string(func_idx) + "_" + std::to_string(v));
+  sym_external.push_back(false);
+  job.args.push_back(func->getOperand(v, 0));
+  fusion->findArgs(v, job.args);
+
+  int64_t ctx_bytes = (8 * static_cast<int64_t>(job.args.size()) + 15) & ~15;
+  add(M_SUB, 8, imm(ctx_bytes), reg(RSP));
+  for (size_t k = 0; k < job.args.size(); k++) {
+    Reg r = getReg(job.args[k]);
+    add(isFloat(r) ? M_MOVSS : M_MOV, getSize(func->instrs[job.args[k]].type),
+        reg(r), mem(RSP, 8 * static_cast<int64_t>(k)));
+  }
+  add(M_LEA, 8, symMem(job.sym), reg(RDI));
+  add(M_MOV, 8, reg(RSP), reg(RSI));
+  add(M_MOV, 4, imm(instr.count), reg(RDX));
+  move(getReg(job.args[0]), RCX);
+  add(M_MOV, 4, imm(getElemSize(instr.type)), reg(R8));
+  call(getRuntimeSym("parallel"), {RDI, RSI, RDX, RCX, R8});
+  add(M_ADD, 8, imm(ctx_bytes), reg(RSP));
+  jobs.push_back(job);
+}
+
+// worker(ctx, begin, end): load the values from the context, then run the
+// loop over [begin, end). Labels carry on from the enclosing function's.
+void X86Backend::selectWorker(const ParallelJob& job) {
+  code.clear();
+  vreg_sizes.clear();
+  vreg_floats.clear();
+  value_regs.assign(func->instrs.size(), NO_REG);
+  stubs.clear();
+  frame_size = 0;
+
+  add(M_PUSH, 8, reg(RBP));
+  add(M_MOV, 8, reg(RSP), reg(RBP));
+  frame_instr = code.size();
+  add(M_SUB, 8, imm(0), reg(RSP));
+  Reg ctx = newVreg(IR_PTR);
+  Reg i = newVreg(IR_PTR);
+  Reg end = newVreg(IR_PTR);
+  move(RDI, ctx);
+  add(M_MOV, 4, reg(RSI), reg(RAX));  // Zero extends
+  move(RAX, i);
+  add(M_MOV, 4, reg(RDX), reg(RAX));
+  move(RAX, end);
+  for (size_t k = 0; k < job.args.size(); k++) {
+    IrType type = func->instrs[job.args[k]].type;
+    Reg r = getReg(job.args[k]);
+    add((type == IR_FLT) ? M_MOVSS : M_MOV, getSize(type),
+        mem(ctx, 8 * static_cast<int64_t>(k)), reg(r));
+  }
+  selectArrayLoop(job.v, i, end);
+  add(M_LEAVE, 0);
+  add(M_RET, 0);
+}
+
+// Element i of the result of an array operation, in a new virtual register
+Reg X86Backend::selectElemOp(const ValueId& v, const Reg& i) {
+  Instr& instr = func->instrs[v];
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  IrType dst_type = instr.type;
+  Reg a = selectElem(v, 1, i);
+  Reg b = (instr.op == IR_ABIN) ? selectElem(v, 2, i) : NO_REG;
+  Reg r = newVreg(dst_type);
+  switch (instr.op) {
+    case IR_ABIN:
+      selectScalarOp(static_cast<Opcode>(instr.imm.u), src_type, r, a, b);
+      break;
+    case IR_AUN:
+      selectScalarOp(static_cast<Opcode>(instr.imm.u), src_type, r, a);
+      break;
+    default: {
+      // Conversions go through int, as in the scalar case
+      Opcode op = IR_NOP;
+      if (src_type == IR_INT) {
+        op = (dst_type == IR_FLT) ? IR_ITOF : IR_ITOB;
+      } else if (src_type == IR_FLT) {
+        op = IR_FTOI;
+        if (dst_type == IR_BOOL) {
+          Reg t = newVreg(IR_INT);
+          selectScalarOp(IR_FTOI, IR_FLT, t, a);
+          a = t;
+          op = IR_ITOB;
+          src_type = IR_INT;
+        }
+      } else if (src_type == IR_BOOL) {
+        op = IR_BTOI;
+        if (dst_type == IR_FLT) {
+          Reg t = newVreg(IR_INT);
+          selectScalarOp(IR_BTOI, IR_BOOL, t, a);
+          a = t;
+          op = IR_ITOF;
+          src_type = IR_INT;
+        }
+      }
+      selectScalarOp(op, src_type, r, a);
+      break;
+    }
+  }
+  return r;
+}
+
+// Element i of operand n of an array operation: the scalar itself, a load,
+// or the fused operation computing it
+Reg X86Backend::selectElem(const ValueId& v, const uint32_t& n, const Reg& i) {
+  Instr& instr = func->instrs[v];
+  uint8_t scalar = (n == 1) ? IR_FLAG_LHS_SCALAR : IR_FLAG_RHS_SCALAR;
+  if ((instr.op == IR_ABIN) && (instr.flags & scalar)) {
+    return getReg(func->getOperand(v, n));
+  }
+  ValueId source = fusion->getSource(v, n);
+  if (source != NO_VALUE) return selectElemOp(source, i);
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  Reg r = newVreg(src_type);
+  add((src_type == IR_FLT) ? M_MOVSS : M_MOV, getSize(src_type),
+      mem(getReg(func->getOperand(v, n)), 0, i, getElemSize(src_type)),
+      reg(r));
+  return r;
+}
+
+// SSE2 has no integer division and strings are not four bytes wide
+bool X86Backend::canVectorize(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  if ((src_type == IR_STR) || (instr.type == IR_STR)) return false;
+  if ((instr.op == IR_ABIN) && (instr.imm.u == IR_DIV)
+      && (src_type != IR_FLT)) {
+    return false;
+  }
+  for (uint32_t n = 1; n < instr.num_ops; n++) {
+    ValueId source = fusion->getSource(v, n);
+    if ((source != NO_VALUE) && !canVectorize(source)) return false;
+  }
+  return true;
+}
+
+// Each scalar operand is copied to every lane of a register once, before the
+// loop; these take registers from the top so the loop body gets the bottom
+void X86Backend::selectBroadcasts(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  for (uint32_t n = 1; n < instr.num_ops; n++) {
+    uint8_t scalar = (n == 1) ? IR_FLAG_LHS_SCALAR : IR_FLAG_RHS_SCALAR;
+    ValueId source = fusion->getSource(v, n);
+    if (source != NO_VALUE) {
+      selectBroadcasts(source);
+      continue;
+    }
+    if ((instr.op != IR_ABIN) || !(instr.flags & scalar)) continue;
+    ValueId val = func->getOperand(v, n);
+    if (broadcasts.count(val) > 0) continue;
+    Reg r = newXmm(true);
+    Reg s = getReg(val);
+    add(isFloat(s) ? M_MOVSS : M_MOVD, 4, reg(s), reg(r));
+    add(M_PUNPCKLDQ, 16, reg(r), reg(r));
+    add(M_PUNPCKLQDQ, 16, reg(r), reg(r));
+    broadcasts[val] = r;
+  }
+}
+
+// Four elements of the result of an array operation, starting at element i,
+// in an xmm register the caller owns
+Reg X86Backend::selectVectorOp(const ValueId& v, const Reg& i) {
+  Instr& instr = func->instrs[v];
+  IrType src_type = (instr.op == IR_AUN) ? instr.type : instr.src_type;
+  Opcode op = static_cast<Opcode>(instr.imm.u);
+  Reg r = ownXmm(selectVectorElem(v, 1, i));
+
+  if (instr.op == IR_ACONV) {
+    if (src_type == IR_FLT) add(M_CVTTPS2DQ, 16, reg(r), reg(r));
+    if (instr.type == IR_FLT) {
+      add(M_CVTDQ2PS, 16, reg(r), reg(r));
+    } else if (instr.type == IR_BOOL) {
+      Reg zero = newXmm();
+      add(M_PXOR, 16, reg(zero), reg(zero));
+      return selectVectorCompare(IR_NE, IR_INT, r, zero);
+    }
+    return r;
+  }
+
+  if (instr.op == IR_AUN) {
+    Reg t = newXmm();
+    if ((op == IR_NEG) && (src_type == IR_INT)) {
+      add(M_PXOR, 16, reg(t), reg(t));
+      add(M_PSUBD, 16, reg(r), reg(t));
+      freeXmm(r);
+      return t;
+    }
+    // Flip the sign bit, the low bit of a bool, or every bit of an int
+    add(M_PCMPEQD, 16, reg(t), reg(t));
+    if (op == IR_NEG) {
+      add(M_PSLLD, 16, imm(31), reg(t));
+    } else if (src_type == IR_BOOL) {
+      add(M_PSRLD, 16, imm(31), reg(t));
+    }
+    add(M_PXOR, 16, reg(t), reg(r));
+    freeXmm(t);
+    return r;
+  }
+
+  Reg b = selectVectorElem(v, 2, i);
+  bool flt = (src_type == IR_FLT);
+  switch (op) {
+    case IR_ADD:
+      add(flt ? M_ADDPS : M_PADDD, 16, reg(b), reg(r));
+      break;
+    case IR_SUB:
+      add(flt ? M_SUBPS : M_PSUBD, 16, reg(b), reg(r));
+      break;
+    case IR_MUL:
+      if (flt) {
+        add(M_MULPS, 16, reg(b), reg(r));
+      } else {
+        // No pmulld before SSE4.1: multiply the even and odd lanes
+        // separately and interleave the low halves of the products
+        Reg odd = newXmm();
+        Reg t = newXmm();
+        add(M_MOVAPS, 16, reg(r), reg(odd));
+        add(M_PSRLQ, 16, imm(32), reg(odd));
+        add(M_MOVAPS, 16, reg(b), reg(t));
+        add(M_PSRLQ, 16, imm(32), reg(t));
+        add(M_PMULUDQ, 16, reg(t), reg(odd));
+        add(M_PSLLQ, 16, imm(32), reg(odd));
+        add(M_PMULUDQ, 16, reg(b), reg(r));
+        add(M_PSLLQ, 16, imm(32), reg(r));
+        add(M_PSRLQ, 16, imm(32), reg(r));
+        add(M_POR, 16, reg(odd), reg(r));
+        freeXmm(t);
+        freeXmm(odd);
+      }
+      break;
+    case IR_DIV:
+      add(M_DIVPS, 16, reg(b), reg(r));
+      break;
+    case IR_AND:
+      add(M_PAND, 16, reg(b), reg(r));
+      break;
+    case IR_OR:
+      add(M_POR, 16, reg(b), reg(r));
+      break;
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      return selectVectorCompare(op, src_type, r, b);
+    default:
+      LOG(ERROR) << "Cannot select " << Module::getOpName(op);
+      break;
+  }
+  freeXmm(b);
+  return r;
+}
+
+// Compares give all ones or zero in each lane; bools are 0 or 1. a is owned
+// by this and the result by the caller.
+Reg X86Backend::selectVectorCompare(const Opcode& op, const IrType& type,
+    const Reg& a, const Reg& b) {
+  Reg r = a;
+  bool negate = false;
+  if (type == IR_FLT) {
+    // Ordered compares, with the operands swapped for > and >=, are false in
+    // unordered lanes, and cmpneqps is true there, as in the scalar case
+    static const MOp cmps[] = {M_CMPLTPS, M_CMPLEPS, M_CMPLTPS, M_CMPLEPS,
+      M_CMPEQPS, M_CMPNEQPS};
+    if ((op == IR_GT) || (op == IR_GE)) {
+      r = ownXmm(b);
+      add(cmps[op - IR_LT], 16, reg(a), reg(r));
+      freeXmm(a);
+    } else {
+      add(cmps[op - IR_LT], 16, reg(b), reg(r));
+      freeXmm(b);
+    }
+  } else {
+    // Only equal and greater than; the rest swap or negate those
+    if ((op == IR_LT) || (op == IR_GE)) {
+      r = ownXmm(b);
+      add(M_PCMPGTD, 16, reg(a), reg(r));
+      freeXmm(a);
+    } else {
+      add(((op == IR_EQ) || (op == IR_NE)) ? M_PCMPEQD : M_PCMPGTD, 16,
+          reg(b), reg(r));
+      freeXmm(b);
+    }
+    negate = (op == IR_LE) || (op == IR_GE) || (op == IR_NE);
+  }
+  if (negate) {
+    // All ones is -1, so subtracting it maps a mask of -1 to 0 and 0 to 1
+    Reg t = newXmm();
+    add(M_PCMPEQD, 16, reg(t), reg(t));
+    add(M_PSUBD, 16, reg(t), reg(r));
+    freeXmm(t);
+  } else {
+    add(M_PSRLD, 16, imm(31), reg(r));
+  }
+  return r;
+}
+
+// Four elements of operand n of an array operation, starting at element i
+Reg X86Backend::selectVectorElem(const ValueId& v, const uint32_t& n,
+    const Reg& i) {
+  Instr& instr = func->instrs[v];
+  uint8_t scalar = (n == 1) ? IR_FLAG_LHS_SCALAR : IR_FLAG_RHS_SCALAR;
+  if ((instr.op == IR_ABIN) && (instr.flags & scalar)) {
+    return broadcasts[func->getOperand(v, n)];
+  }
+  ValueId source = fusion->getSource(v, n);
+  if (source != NO_VALUE) return selectVectorOp(source, i);
+  Reg r = newXmm();
+  add(M_MOVUPS, 16, mem(getReg(func->getOperand(v, n)), 0, i, 4), reg(r));
+  return r;
+}
+
+// System V calls: stack arguments are pushed right to left (keeping rsp 16
+// byte aligned), then the register arguments are loaded
+void X86Backend::selectCall(const ValueId& v) {
+  Instr& instr = func->instrs[v];
+  Function& callee = module.functions[instr.imm.u];
+  std::vector<ArgLoc> locs = getArgLocs(callee);
+  uint32_t num_stack = 0;
+  for (auto& loc : locs) {
+    if (loc.reg == NO_REG) num_stack++;
+  }
+  int64_t pop_bytes = 8 * num_stack;
+  if (num_stack % 2) {
+    add(M_SUB, 8, imm(8), reg(RSP));
+    pop_bytes += 8;
+  }
+  for (uint32_t n = instr.num_ops; n-- > 0;) {
+    if (locs[n].reg != NO_REG) continue;
+    Reg r = getReg(func->getOperand(v, n));
+    if (isFloat(r)) {
+      add(M_SUB, 8, imm(8), reg(RSP));
+      add(M_MOVSS, 4, reg(r), mem(RSP));
+    } else {
+      move(r, RAX);
+      add(M_PUSH, 8, reg(RAX));
+    }
+  }
+  std::vector<Reg> arg_regs;
+  for (uint32_t n = 0; n < instr.num_ops; n++) {
+    if (locs[n].reg == NO_REG) continue;
+    move(getReg(func->getOperand(v, n)), locs[n].reg);
+    arg_regs.push_back(locs[n].reg);
+  }
+  call(func_syms + instr.imm.u, arg_regs);
+  if (pop_bytes > 0) add(M_ADD, 8, imm(pop_bytes), reg(RSP));
+  if (instr.type != IR_VOID) {
+    Reg r = getReg(v);
+    move(isFloat(r) ? XMM0 : RAX, r);
+  }
+}
+
+// type is the operand type; the result goes to dst
+void X86Backend::selectScalarOp(const Opcode& op, const IrType& type,
+    const Reg& dst, const Reg& a, const Reg& b) {
+  bool flt = (type == IR_FLT);
+  switch (op) {
+    case IR_ADD:
+      move(a, dst);
+      add(flt ? M_ADDSS : M_ADD, 4, reg(b), reg(dst));
+      break;
+    case IR_SUB:
+      move(a, dst);
+      add(flt ? M_SUBSS : M_SUB, 4, reg(b), reg(dst));
+      break;
+    case IR_MUL:
+      move(a, dst);
+      add(flt ? M_MULSS : M_IMUL, 4, reg(b), reg(dst));
+      break;
+    case IR_AND:
+      move(a, dst);
+      add(M_AND, 4, reg(b), reg(dst));
+      break;
+    case IR_OR:
+      move(a, dst);
+      add(M_OR, 4, reg(b), reg(dst));
+      break;
+    case IR_DIV:
+      if (flt) {
+        move(a, dst);
+        add(M_DIVSS, 4, reg(b), reg(dst));
+      } else {
+        int64_t stub = newLabel();
+        add(M_CMP, 4, imm(0), reg(b));
+        add(M_JCC, 0, label(stub), MOperand(), CC_E);
+        stubs.push_back({stub, getRuntimeSym("div_error"), NO_REG, 0});
+        add(M_MOV, 4, reg(a), reg(RAX));
+
+        // INT32_MIN / -1 would trap in idiv, so -1 negates instead
+        int64_t divide = newLabel();
+        int64_t done = newLabel();
+        add(M_CMP, 4, imm(-1), reg(b));
+        add(M_JCC, 0, label(divide), MOperand(), CC_NE);
+        add(M_NEG, 4, reg(RAX));
+        add(M_JMP, 0, label(done));
+        add(M_LABEL, 0, label(divide));
+        add(M_CLTD, 0);
+        add(M_IDIV, 4, reg(b));
+        add(M_LABEL, 0, label(done));
+        add(M_MOV, 4, reg(RAX), reg(dst));
+      }
+      break;
+    case IR_LT:
+    case IR_LE:
+    case IR_GT:
+    case IR_GE:
+    case IR_EQ:
+    case IR_NE:
+      if (type == IR_STR) {
+        add(M_MOV, 8, reg(a), reg(RDI));
+        add(M_MOV, 8, reg(b), reg(RSI));
+        call(getRuntimeSym("streq"), {RDI, RSI});
+        add(M_MOV, 4, reg(RAX), reg(dst));
+        if (op == IR_NE) add(M_XOR, 4, imm(1), reg(dst));
+        break;
+      }
+      if (flt) {
+        // Unordered compares are false, except for !=
+        if ((op == IR_LT) || (op == IR_LE)) {
+          add(M_UCOMISS, 4, reg(a), reg(b));
+          add(M_SETCC, 1, reg(RAX), MOperand(), (op == IR_LT) ? CC_A : CC_AE);
+        } else if ((op == IR_GT) || (op == IR_GE)) {
+          add(M_UCOMISS, 4, reg(b), reg(a));
+          add(M_SETCC, 1, reg(RAX), MOperand(), (op == IR_GT) ? CC_A : CC_AE);
+        } else {
+          add(M_UCOMISS, 4, reg(b), reg(a));
+          bool eq = (op == IR_EQ);
+          add(M_SETCC, 1, reg(RAX), MOperand(), eq ? CC_E : CC_NE);
+          add(M_SETCC, 1, reg(RCX), MOperand(), eq ? CC_NP : CC_P);
+          add(eq ? M_AND : M_OR, 1, reg(RCX), reg(RAX));
+        }
+      } else {
+        static const Cond conds[] = {CC_L, CC_LE, CC_G, CC_GE, CC_E, CC_NE};
+        add(M_CMP, getSize(type), reg(b), reg(a));
+        add(M_SETCC, 1, reg(RAX), MOperand(), conds[op - IR_LT]);
+      }
+      add(M_MOVZB, 4, reg(RAX), reg(dst));
+      break;
+    case IR_NEG:
+      if (flt) {
+        add(M_MOVD, 4, reg(a), reg(RAX));
+        add(M_XOR, 4, imm(0x80000000), reg(RAX));
+        add(M_MOVD, 4, reg(RAX), reg(dst));
+      } else {
+        move(a, dst);
+        add(M_NEG, 4, reg(dst));
+      }
+      break;
+    case IR_NOT:
+      move(a, dst);
+      if (type == IR_BOOL) {
+        add(M_XOR, 4, imm(1), reg(dst));
+      } else {
+        add(M_NOT, 4, reg(dst));
+      }
+      break;
+    case IR_ITOF:
+      add(M_CVTSI2SS, 4, reg(a), reg(dst));
+      break;
+    case IR_FTOI:
+      add(M_CVTTSS2SI, 4, reg(a), reg(dst));
+      break;
+    case IR_ITOB:
+      add(M_CMP, 4, imm(0), reg(a));
+      add(M_SETCC, 1, reg(RAX), MOperand(), CC_NE);
+      add(M_MOVZB, 4, reg(RAX), reg(dst));
+      break;
+    case IR_BTOI:
+      move(a, dst);
+      break;
+    default:
+      LOG(ERROR) << "Cannot select " << Module::getOpName(op);
+      break;
+  }
+}
+
+// Unsigned compare, so negative indices fail too
+void X86Backend::selectBoundsCheck(const Reg& idx, const uint32_t& count) {
+  int64_t stub = newLabel();
+  add(M_CMP, 4, imm(count), reg(idx));
+  add(M_JCC, 0, label(stub), MOperand(), CC_AE);
+  stubs.push_back({stub, getRuntimeSym("bounds_error"), idx, count});
+}
+
+void X86Backend::allocateRegisters() {
+  RegisterAllocator allocator(code, vreg_sizes, vreg_floats);
+  allocator.run(frame_size, frame_instr);
+  num_values += allocator.getNumValues();
+  num_spilled += allocator.getNumSpilled();
+  num_constants += allocator.getNumConstants();
+  num_moves += allocator.getNumMoves();
+  num_saved += allocator.getNumSaved();
+}
+
+void X86Backend::runPeephole() {
+  Peephole peephole(code);
+  peephole.run();
+  for (size_t p = 0; p < Peephole::NUM_PATTERNS; p++) {
+    num_rewrites[p] += peephole.getNumRewrites(p);
+  }
+}
+
+void X86Backend::printFunction(std::ostream& os, const uint32_t& s) {
+  const std::string& name = symbols[s];
+  if (func->is_main && (s == func_syms + func_idx)) {
+    os << "\t.globl " << name << "\n";
+  }
+  os << "\t.type " << name << ", @function\n" << name << ":\n";
+  for (auto& instr : code) printInstr(os, instr);
+  os << "\t.size " << name << ", .-" << name << "\n";
+}
+
+void X86Backend::printInstr(std::ostream& os, const MInstr& instr) {
+  if (instr.op == M_LABEL) {
+    os << ".L" << func_idx << "_" << instr.ops[0].imm << ":\n";
+    return;
+  }
+  static const char suffixes[] = {' ', 'b', ' ', ' ', 'l', ' ', ' ', ' ', 'q'};
+  os << "\t" << op_names[instr.op];
+  switch (instr.op) {
+    case M_MOV:
+    case M_ADD:
+    case M_SUB:
+    case M_IMUL:
+    case M_AND:
+    case M_OR:
+    case M_XOR:
+    case M_NOT:
+    case M_NEG:
+    case M_CMP:
+    case M_TEST:
+    case M_IDIV:
+    case M_LEA:
+    case M_PUSH:
+    case M_POP:
+      os << suffixes[instr.size];
+      break;
+    case M_MOVZB:
+      os << "l";
+      break;
+    case M_CVTSI2SS:
+      os << "l";
+      break;
+    case M_SETCC:
+    case M_JCC:
+      os << cond_names[instr.cc];
+      break;
+    default:
+      break;
+  }
+  // A call's second operand only notes the argument registers
+  int num_ops = (instr.op == M_CALL) ? 1 : instr.num_ops;
+  for (int n = 0; n < num_ops; n++) {
+    os << ((n == 0) ? "\t" : ", ");
+    printOperand(os, instr, n);
+  }
+  os << "\n";
+}
+
+void X86Backend::printOperand(std::ostream& os, const MInstr& instr,
+    const int& n) {
+  const MOperand& o = instr.ops[n];
+  switch (o.kind) {
+    case MO_REG: {
+      // Width of a register operand, where it differs from the instruction's
+      uint8_t size = instr.size;
+      if ((instr.op == M_MOVZB) && (n == 0)) {
+        size = 1;
+      } else if (instr.op == M_MOVSLQ) {
+        size = (n == 0) ? 4 : 8;
+      } else if ((instr.op == M_LEA) || (instr.op == M_PUSH)
+          || (instr.op == M_POP)) {
+        size = 8;
+      }
+      os << "%" << reg_names[o.reg][(size == 1) ? 0 : (size == 4) ? 1 : 2];
+      break;
+    }
+    case MO_IMM:
+      os << "$" << o.imm;
+      break;
+    case MO_MEM:
+      if (o.sym != NO_SYM) {
+        os << symbols[o.sym] << "(%rip)";
+        break;
+      }
+      if (o.imm != 0) os << o.imm;
+      os << "(%" << reg_names[o.reg][2];
+      if (o.index != NO_REG) {
+        os << ", %" << reg_names[o.index][2] << ", "
+            << static_cast<int>(o.scale);
+      }
+      os << ")";
+      break;
+    case MO_LABEL:
+      os << ".L" << func_idx << "_" << o.imm;
+      break;
+    case MO_SYM:
+      os << symbols[o.sym];
+      if (sym_external[o.sym]) os << "@PLT";
+      break;
+    default:
+      break;
+  }
+}
+
+void X86Backend::add(const MOp& op, const uint8_t& size, const MOperand& a,
+    const MOperand& b, const Cond& cc) {
+  uint8_t num_ops = (b.kind != MO_NONE) ? 2 : (a.kind != MO_NONE) ? 1 : 0;
+  code.push_back({op, size, cc, num_ops, {a, b}});
+}
+
+// Copy between registers of the same class; integer copies use the width of
+// the virtual register involved
+// A call, with a mask of the argument registers it reads
+void X86Backend::call(const uint32_t& s, const std::vector<Reg>& args) {
+  int64_t mask = 0;
+  for (Reg r : args) mask |= int64_t(1) << r;
+  add(M_CALL, 0, sym(s), imm(mask));
+}
+
+void X86Backend::move(const Reg& src, const Reg& dst) {
+  if (src == dst) return;
+  if (isFloat(src)) {
+    add(M_MOVSS, 4, reg(src), reg(dst));
+    return;
+  }
+  uint8_t size = 8;
+  if (dst >= VREG_BASE) {
+    size = vreg_sizes[dst - VREG_BASE];
+  } else if (src >= VREG_BASE) {
+    size = vreg_sizes[src - VREG_BASE];
+  }
+  add(M_MOV, size, reg(src), reg(dst));
+}
+
+Reg X86Backend::newVreg(const IrType& type) {
+  Reg r = VREG_BASE + static_cast<Reg>(vreg_sizes.size());
+  vreg_sizes.push_back(getSize(type));
+  vreg_floats.push_back(type == IR_FLT);
+  return r;
+}
+
+Reg X86Backend::getReg(const ValueId& v) {
+  if (value_regs[v] == NO_REG) value_regs[v] = newVreg(func->instrs[v].type);
+  return value_regs[v];
+}
+
+Reg X86Backend::getPhiIn(const ValueId& v) {
+  if (phi_in_regs[v] == NO_REG) phi_in_regs[v] = newVreg(func->instrs[v].type);
+  return phi_in_regs[v];
+}
+
+// A free xmm register for a vector loop, the lowest one or, for broadcasts,
+// the highest. Running out is noted, and the loop is done in scalar code.
+Reg X86Backend::newXmm(const bool& high) {
+  if (free_xmm == 0) {
+    out_of_xmm = true;
+    return XMM0;
+  }
+  uint32_t n = high ? 31 - __builtin_clz(free_xmm) : __builtin_ctz(free_xmm);
+  free_xmm &= ~(1u << n);
+  return XMM0 + n;
+}
+
+// r, or a copy of it if it is a broadcast, which must outlive the operation
+Reg X86Backend::ownXmm(const Reg& r) {
+  for (auto& entry : broadcasts) {
+    if (entry.second != r) continue;
+    Reg copy = newXmm();
+    add(M_MOVAPS, 16, reg(r), reg(copy));
+    return copy;
+  }
+  return r;
+}
+
+void X86Backend::freeXmm(const Reg& r) {
+  for (auto& entry : broadcasts) {
+    if (entry.second == r) return;
+  }
+  free_xmm |= 1u << (r - XMM0);
+}
+
+std::vector<X86Backend::ArgLoc> X86Backend::getArgLocs(const Function& f) {
+  std::vector<ArgLoc> locs;
+  uint32_t num_int = 0;
+  uint32_t num_flt = 0;
+  uint32_t num_stack = 0;
+  for (auto& param : f.params) {
+    bool flt = (param.count == 0) && (param.type == IR_FLT);
+    if (flt && (num_flt < 8)) {
+      locs.push_back({flt_arg_regs[num_flt++], 0});
+    } else if (!flt && (num_int < 6)) {
+      locs.push_back({int_arg_regs[num_int++], 0});
+    } else {
+      locs.push_back({NO_REG, num_stack++});
+    }
+  }
+  return locs;
+}
+
+// Runtime routines and libc functions called by generated code; runtime
+// routines are given without their rt_ prefix
+uint32_t X86Backend::getRuntimeSym(const std::string& name) {
+  auto it = runtime_syms.find(name);
+  if (it != runtime_syms.end()) return it->second;
+  uint32_t s = static_cast<uint32_t>(symbols.size());
+  bool libc = (name == "memset") || (name == "memmove");
+  symbols.push_back(libc ? name : "rt_" + name);
+  sym_external.push_back(true);
+  runtime_syms[name] = s;
+  return s;
+}
+
+MOperand X86Backend::reg(const Reg& r) {
+  return {MO_REG, 1, r, NO_REG, 0, NO_SYM};
+}
+
+MOperand X86Backend::imm(const int64_t& val) {
+  return {MO_IMM, 1, NO_REG, NO_REG, val, NO_SYM};
+}
+
+MOperand X86Backend::mem(const Reg& base, const int64_t& disp,
+    const Reg& index, const uint8_t& scale) {
+  return {MO_MEM, scale, base, index, disp, NO_SYM};
+}
+
+MOperand X86Backend::symMem(const uint32_t& s) {
+  return {MO_MEM, 1, NO_REG, NO_REG, 0, s};
+}
+
+MOperand X86Backend::label(const int64_t& l) {
+  return {MO_LABEL, 1, NO_REG, NO_REG, l, NO_SYM};
+}
+
+MOperand X86Backend::sym(const uint32_t& s) {
+  return {MO_SYM, 1, NO_REG, NO_REG, 0, s};
+}
+
+// Size of a value in a register
+uint8_t X86Backend::getSize(const IrType& type) {
+  return ((type == IR_STR) || (type == IR_PTR)) ? 8 : 4;
+}
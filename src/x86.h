@@ -0,0 +1,269 @@
+#ifndef X86_H
+#define X86_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "array_fusion.h"
+#include "ir.h"
+
+// Registers: physical registers first, virtual registers from VREG_BASE up
+typedef uint32_t Reg;
+enum PhysReg : Reg {
+  RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+  XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+  XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+  NUM_PHYS_REGS,
+};
+const Reg NO_REG = 0xffffffff;
+const Reg VREG_BASE = 64;
+
+enum MOp : uint8_t {
+  M_LABEL = 0, // [label]
+  M_MOV, // [src, dst]
+  M_MOVZB, // [src8, dst32]
+  M_MOVSLQ, // [src32, dst64]
+  M_LEA, // [mem, dst64]
+  M_ADD, // [src, dst]: dst op= src
+  M_SUB,
+  M_IMUL,
+  M_AND,
+  M_OR,
+  M_XOR,
+  M_NOT, // [dst]
+  M_NEG,
+  M_CMP, // [src, dst]: flags of dst - src
+  M_TEST,
+  M_CLTD, // Sign extend eax into edx
+  M_IDIV, // [divisor]
+  M_SETCC, // [dst8]; cc
+  M_JCC, // [label]; cc
+  M_JMP, // [label]
+  M_CALL, // [sym, imm]: imm has bit r set for each argument register r
+  M_RET,
+  M_PUSH, // [src]
+  M_POP, // [dst]
+  M_LEAVE,
+  M_MOVSS, // [src, dst]
+  M_MOVD, // [src, dst]; between a 32-bit register and an xmm register
+  M_ADDSS, // [src, dst]
+  M_SUBSS,
+  M_MULSS,
+  M_DIVSS,
+  M_UCOMISS, // [src, dst]: flags of dst compared with src
+  M_CVTSI2SS, // [src32, dst]
+  M_CVTTSS2SI, // [src, dst32]
+  M_MOVUPS, // [src, dst]; four floats or ints, to or from memory
+  M_MOVAPS, // [src, dst]; between xmm registers
+  M_ADDPS, // [src, dst]: dst op= src, lane by lane
+  M_SUBPS,
+  M_MULPS,
+  M_DIVPS,
+  M_CMPLTPS, // All ones in lanes where dst < src, else zero
+  M_CMPLEPS,
+  M_CMPEQPS,
+  M_CMPNEQPS,
+  M_PADDD,
+  M_PSUBD,
+  M_PMULUDQ, // Lanes 0 and 2, to 64-bit products
+  M_PAND,
+  M_POR,
+  M_PXOR,
+  M_PCMPEQD,
+  M_PCMPGTD,
+  M_PUNPCKLDQ,
+  M_PUNPCKLQDQ,
+  M_PSLLD, // [imm, dst]
+  M_PSRLD,
+  M_PSLLQ,
+  M_PSRLQ,
+  M_CVTDQ2PS, // [src, dst]
+  M_CVTTPS2DQ,
+  NUM_MOPS,
+};
+
+enum Cond : uint8_t {
+  CC_E = 0,
+  CC_NE,
+  CC_L,
+  CC_LE,
+  CC_G,
+  CC_GE,
+  CC_B,
+  CC_BE,
+  CC_A,
+  CC_AE,
+  CC_P,
+  CC_NP,
+  NUM_CONDS,
+};
+
+enum MOperandKind : uint8_t {
+  MO_NONE = 0,
+  MO_REG,
+  MO_IMM,
+  MO_MEM, // sym(%rip) or disp(base, index, scale)
+  MO_LABEL, // Local label within the function
+  MO_SYM, // Call target
+};
+
+const uint32_t NO_SYM = 0xffffffff;
+
+struct MOperand {
+  MOperandKind kind;
+  uint8_t scale;
+  Reg reg;  // Register, or base of a memory operand
+  Reg index;
+  int64_t imm;  // Immediate, displacement, or label
+  uint32_t sym;
+};
+
+// One machine instruction, operands in AT&T order
+struct MInstr {
+  MOp op;
+  uint8_t size;  // Operand size in bytes: 1, 4, 8, or 16 for vectors
+  Cond cc;
+  uint8_t num_ops;
+  MOperand ops[2];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// x86-64 code generator
+// Instruction selection works on virtual registers, one per SSA value; a
+// linear scan register allocator then maps them to physical registers or
+// stack slots, a peephole pass tidies the result, and it is printed as GNU
+// assembler text. Calls follow the System V ABI, so compiled procedures and
+// the runtime call each other directly. Whole-array operations, with any operations fused into them, run
+// four elements at a time in SSE2 registers where the operations allow it,
+// with a scalar loop for the remaining elements; large ones that cannot fail
+// go to a worker function that rt_parallel calls on each thread's chunk.
+////////////////////////////////////////////////////////////////////////////////
+class X86Backend {
+public:
+  X86Backend(Module&, const uint32_t& = DEFAULT_PARALLEL_MIN);
+  void emit(std::ostream&);
+
+private:
+  // Where an argument is passed: a register, or a stack slot index
+  struct ArgLoc {
+    Reg reg;
+    uint32_t stack;
+  };
+
+  // A whole-array operation run by rt_parallel: the worker function and the
+  // values it is passed, in the order they are stored in its context
+  struct ParallelJob {
+    ValueId v;
+    uint32_t sym;
+    std::vector<ValueId> args;
+  };
+
+  // Out-of-line runtime error call: bounds check failures pass the index and
+  // the array length
+  struct ErrorStub {
+    int64_t label;
+    uint32_t sym;
+    Reg idx;
+    uint32_t count;
+  };
+
+  Module& module;
+  std::vector<std::string> symbols;
+  std::vector<bool> sym_external;  // Called through the PLT
+  std::unordered_map<std::string, uint32_t> runtime_syms;
+  uint32_t func_syms;
+  uint32_t string_syms;
+  uint32_t parallel_min;  // Elements; 0 never splits an operation
+
+  // Per-function state
+  Function* func;
+  uint32_t func_idx;
+  std::vector<MInstr> code;
+  std::vector<uint8_t> vreg_sizes;  // 4 or 8; floats are 4
+  std::vector<bool> vreg_floats;
+  std::vector<Reg> value_regs;  // ValueId -> vreg
+  std::vector<Reg> phi_in_regs;  // ValueId of a phi -> vreg its preds write
+  std::vector<int32_t> slot_offsets;  // Array slots, relative to rbp
+  std::vector<ErrorStub> stubs;
+  int64_t next_label;
+  uint32_t frame_size;
+  size_t frame_instr;  // Index of the instruction that reserves the frame
+  ArrayFusion* fusion;
+  std::vector<ParallelJob> jobs;
+
+  // Vector loops: scalar operand -> xmm register holding it in every lane
+  std::unordered_map<ValueId, Reg> broadcasts;
+  uint32_t free_xmm;  // Bit n set if XMM0 + n is free
+  bool out_of_xmm;
+  size_t num_vector_loops;
+
+  // Register allocation, over all functions
+  size_t num_values;
+  size_t num_spilled;
+  size_t num_constants;
+  size_t num_moves;
+  size_t num_saved;
+  std::vector<size_t> num_rewrites;  // Peephole pattern -> rewrites
+
+  void selectFunction();
+  void selectInstr(const ValueId&);
+  void selectPhiCopies(const BlockId&);
+  void selectArrayOp(const ValueId&);
+  void selectArrayLoop(const ValueId&, const Reg&, const Reg&);
+  void selectParallelOp(const ValueId&);
+  void selectWorker(const ParallelJob&);
+  Reg selectElemOp(const ValueId&, const Reg&);
+  Reg selectElem(const ValueId&, const uint32_t&, const Reg&);
+  bool canVectorize(const ValueId&);
+  void selectBroadcasts(const ValueId&);
+  Reg selectVectorOp(const ValueId&, const Reg&);
+  Reg selectVectorElem(const ValueId&, const uint32_t&, const Reg&);
+  Reg selectVectorCompare(const Opcode&, const IrType&, const Reg&,
+      const Reg&);
+  void selectCall(const ValueId&);
+  void selectScalarOp(const Opcode&, const IrType&, const Reg&, const Reg&,
+      const Reg& = NO_REG);
+  void selectBoundsCheck(const Reg&, const uint32_t&);
+  void allocateRegisters();
+  void runPeephole();
+  void printFunction(std::ostream&, const uint32_t&);
+  void printInstr(std::ostream&, const MInstr&);
+  void printOperand(std::ostream&, const MInstr&, const int&);
+
+  // Instruction helpers
+  void add(const MOp&, const uint8_t&, const MOperand& = MOperand(),
+      const MOperand& = MOperand(), const Cond& = CC_E);
+  void call(const uint32_t&, const std::vector<Reg>&);
+  void move(const Reg&, const Reg&);
+  Reg newVreg(const IrType&);
+  Reg getReg(const ValueId&);
+  Reg getPhiIn(const ValueId&);
+  Reg newXmm(const bool& = false);
+  Reg ownXmm(const Reg&);
+  void freeXmm(const Reg&);
+  int64_t newLabel() { return next_label++; }
+  std::vector<ArgLoc> getArgLocs(const Function&);
+  uint32_t getRuntimeSym(const std::string&);
+  static MOperand reg(const Reg&);
+  static MOperand imm(const int64_t&);
+  static MOperand mem(const Reg&, const int64_t& = 0, const Reg& = NO_REG,
+      const uint8_t& = 1);
+  static MOperand symMem(const uint32_t&);
+  static MOperand label(const int64_t&);
+  static MOperand sym(const uint32_t&);
+  static uint8_t getSize(const IrType&);
+  bool isFloat(const Reg& r) {
+    return (r >= VREG_BASE) ? vreg_floats[r - VREG_BASE]
+        : ((r >= XMM0) && (r <= XMM15));
+  }
+
+  static const std::string op_names[NUM_MOPS];
+  static const std::string cond_names[NUM_CONDS];
+  static const std::string reg_names[NUM_PHYS_REGS][3];
+};
+
+#endif // X86_H
@@ -0,0 +1,85 @@
+#!/usr/bin/env bash
+# File			: check.sh
+# Runs each program on every execution engine and compares the output with
+# the tree-walking interpreter's, which is the reference.
+#
+# Usage: tests/check.sh [SRC...]
+# Default is every program in tests/correct. For each NAME.src:
+#   NAME.in	- standard input, if present (otherwise none)
+#   NAME.out	- expected output, if present; the reference must match it
+#   NAME.stack	- stack limit in KB, if present: the program must run in
+#		  that much stack, so its executables are built at -O1 only
+#		  (at -O0 deep recursion needs a deep stack) and run under
+#		  ulimit -s
+# The bytecode interpreter (--run and --jit) and the executables built by
+# each backend (asm, c, llvm) are run at -O0 and -O1. The output includes
+# error messages and the exit status. An engine that differs from the
+# reference is reported as DIFF and one that fails to build as FAIL.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+COMPILER=${COMPILER:-$DIR/../bin/compiler}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+if [ $# -eq 0 ]; then
+  set -- "$DIR"/correct/*.src
+fi
+
+# run_engine ENGINE LEVEL SRC IN STACK OUT runs the program, or fails if
+# it cannot be built
+run_engine() {
+  local status
+  case $1 in
+    interpret|run|jit)
+      "$COMPILER" -w -v 3 -O "$2" -i "$3" "--$1" < "$4" > "$6" 2>&1
+      status=$?
+      ;;
+    asm|c|llvm)
+      "$COMPILER" -w -v 3 -O "$2" -i "$3" -o "$TMP/exe" --backend "$1" \
+          > /dev/null 2>&1 || return 1
+      ([ -n "$5" ] && ulimit -s "$5"; "$TMP/exe" < "$4" > "$6" 2>&1)
+      status=$?
+      ;;
+  esac
+
+  # Printing NaN's sign is up to each engine's C library
+  sed -i 's/-nan/nan/g' "$6"
+  echo "exit $status" >> "$6"
+}
+
+num_failed=0
+for src in "$@"; do
+  name=${src%.src}
+  in=/dev/null
+  [ -f "$name.in" ] && in=$name.in
+  stack=
+  levels="0 1"
+  if [ -f "$name.stack" ]; then
+    stack=$(cat "$name.stack")
+    levels=1
+  fi
+
+  failed=0
+  run_engine interpret 1 "$src" "$in" "$stack" "$TMP/expected"
+  if [ -f "$name.out" ] && ! cmp -s "$name.out" <(sed '$d' "$TMP/expected")
+  then
+    echo "DIFF $src interpret (expected $name.out)"
+    failed=1
+  fi
+  for level in 0 1; do
+    for engine in run jit asm c llvm; do
+      case $engine in
+        asm|c|llvm) [[ " $levels " == *" $level "* ]] || continue ;;
+      esac
+      if ! run_engine $engine $level "$src" "$in" "$stack" "$TMP/out"; then
+        echo "FAIL $src $engine -O $level"
+        failed=1
+      elif ! cmp -s "$TMP/expected" "$TMP/out"; then
+        echo "DIFF $src $engine -O $level"
+        failed=1
+      fi
+    done
+  done
+  num_failed=$((num_failed + failed))
+done
+echo "$(( $# - num_failed )) of $# programs match on every engine"
+[ $num_failed -eq 0 ]
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+# File			: arrays.py
+# Prints a random program of whole-array integer, float and bool expressions
+# over arrays of one random length, including division, conversions, NaN and
+# infinities, and prints every element of each result.
+#
+# Usage: tests/fuzz/arrays.py SEED
+
+import random
+import re
+import sys
+
+random.seed(int(sys.argv[1]))
+N = random.choice([1, 2, 3, 4, 5, 7, 8, 9, 12, 13, 16, 33])
+ints = ['ia', 'ib', 'ic']
+flts = ['fa', 'fb', 'fc']
+bools = ['ba', 'bb']
+
+
+def leaf(t):
+    r = random.random()
+    if t == 'i':
+        if r < 0.6: return random.choice(ints)
+        if r < 0.8: return random.choice(['si', 'sj'])
+        return str(random.randint(0, 50))
+    if t == 'f':
+        if r < 0.6: return random.choice(flts)
+        if r < 0.8: return random.choice(['sf', 'sg'])
+        return random.choice(['0.5', '2.0', '1.5', '3.25'])
+    if r < 0.7: return random.choice(bools)
+    return random.choice(['sb', 'true', 'false'])
+
+
+def expr(t, d):
+    if d <= 0 or random.random() < 0.25: return leaf(t)
+    r = random.random()
+    if t == 'i':
+        if r < 0.65:
+            op = random.choice(['+', '-', '*', '*', '&', '|'])
+            return '(%s %s %s)' % (expr('i', d - 1), op, expr('i', d - 1))
+        # nz is never 0 or -1
+        if r < 0.75: return '(%s / nz)' % expr('i', d - 1)
+        if r < 0.85: return '(not %s)' % expr('i', d - 1)
+        return '-' + random.choice(ints)
+    if t == 'f':
+        if r < 0.7:
+            op = random.choice(['+', '-', '*', '/'])
+            a = expr('f', d - 1)
+            b = expr(random.choice('fffi'), d - 1)
+            if random.random() < 0.5: a, b = b, a
+            return '(%s %s %s)' % (a, op, b)
+        return '-' + random.choice(flts)
+    if r < 0.6:
+        op = random.choice(['<', '<=', '>', '>=', '==', '!='])
+        tt = random.choice('iff')
+        lhs = expr(tt, d - 1)
+        rt = random.choice([tt, 'i']) if tt == 'f' else 'i'
+        return '(%s %s %s)' % (lhs, op, expr(rt, d - 1))
+    if r < 0.8:
+        lhs = expr('b', d - 1)
+        op = random.choice(['&', '|'])
+        return '(%s %s %s)' % (lhs, op, expr('b', d - 1))
+    if r < 0.9:
+        return '(not %s)' % expr('b', d - 1)
+    return '(%s == %s)' % (expr('b', d - 1), expr('b', d - 1))
+
+
+out = ['program fz is']
+for v in ints + ['nz', 'di']:
+    out.append('  variable %s : integer[%d];' % (v, N))
+for v in flts + ['df']:
+    out.append('  variable %s : float[%d];' % (v, N))
+for v in bools + ['db']:
+    out.append('  variable %s : bool[%d];' % (v, N))
+out += ['  variable si : integer;', '  variable sj : integer;',
+        '  variable sf : float;', '  variable sg : float;',
+        '  variable sb : bool;', '  variable k : integer;',
+        '  variable ok : bool;', 'begin']
+out.append('  si := %d; sj := %d; sf := %s; sg := %s; sb := %s;' % (
+    random.randint(-100, 100), random.randint(-2147483647, 2147483647),
+    random.choice(['0.0', '1.5', '-2.5', '100000.0']),
+    random.choice(['0.0', '0.1', '-7.0']), random.choice(['true', 'false'])))
+out.append('  for (k := 0; k < %d)' % N)
+fl = ['(k * %d.5)' % random.randint(-9, 9), '(1.0 / (k - 3))',
+      '(k * k * 1000000000.0)', '((k - 2) * 0.25)', '(0.0 / (k - 1))']
+for v in ints:
+    out.append('    %s[k] := (k * %d) - %d;' % (
+        v, random.choice([1, 7, 123457, 1000003, -65537]),
+        random.randint(0, 100)))
+out.append('    nz[k] := ((k * 3) - 11) + 0;')
+for v in flts:
+    out.append('    %s[k] := %s;' % (v, random.choice(fl)))
+out.append('    ba[k] := (k * 5) > 7;')
+out.append('    bb[k] := ((k * k) - 3) < 10;')
+out.append('    k := k + 1;')
+out.append('  end for;')
+out.append('  for (k := 0; k < %d)' % N)
+out.append('    if ((nz[k] == 0) | (nz[k] == -1)) then nz[k] := 5; end if;')
+out.append('    k := k + 1;')
+out.append('  end for;')
+for s in range(12):
+    t = random.choice('ifb')
+    kinds = [t, t, t, 'i', 'f'] if t != 'b' else ['b', 'b', 'i']
+    dst = {'i': 'di', 'f': 'df', 'b': 'db'}[random.choice(kinds)]
+    # At least one operand must be a whole array
+    while True:
+        e = expr(t, random.randint(1, 6))
+        if re.search(r'\b(ia|ib|ic|fa|fb|fc|ba|bb|nz)\b', e): break
+    out.append('  %s := %s;' % (dst, e))
+    put = {'di': 'putinteger', 'df': 'putfloat', 'db': 'putbool'}[dst]
+    out.append('  for (k := 0; k < %d)' % N)
+    out.append('    ok := %s(%s[k]);' % (put, dst))
+    out.append('    k := k + 1;')
+    out.append('  end for;')
+out.append('end program.')
+print('\n'.join(out))
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# File			: procs.py
+# Prints a random program of small procedures calling the ones before them,
+# with integer and array parameters, early returns, loops and writes to
+# globals, for the inliner, escape analysis and compile-time call
+# evaluation.
+#
+# Usage: tests/fuzz/procs.py SEED
+
+import random
+import sys
+
+R = random.Random(int(sys.argv[1]))
+out = ['program p is', '  variable g : integer;', '  variable h : integer;',
+       '  variable ga : integer[8];', '  variable i : integer;',
+       '  variable s : integer;', '  variable r : bool;', '']
+procs = []
+
+
+def expr(vars, depth=0):
+    c = R.random()
+    if depth > 2 or c < 0.3:
+        return R.choice(vars + [str(R.randint(0, 9))])
+    if c < 0.45 and procs:
+        name, kinds = R.choice(procs)
+        args = []
+        for kind in kinds:
+            args.append('ga' if kind == 'arr' else expr(vars, depth + 1))
+        return '%s(%s)' % (name, ', '.join(args))
+    if c < 0.55:
+        return 'ga[(%s) & 7]' % expr(vars, depth + 1)
+    op = R.choice(['+', '-', '*', '+', '-'])
+    return '(%s %s %s)' % (expr(vars, depth + 1), op, expr(vars, depth + 1))
+
+
+for k in range(R.randint(2, 6)):
+    name = 'f%d' % k
+    params = []
+    kinds = []
+    for j in range(R.randint(1, 3)):
+        if R.random() < 0.2 and 'arr' not in kinds:
+            kinds.append('arr')
+            params.append('variable v : integer[8]')
+        else:
+            kinds.append('int')
+            params.append('variable a%d : integer' % j)
+    vars = ['a%d' % j for j, kd in enumerate(kinds) if kd == 'int'] + ['g', 'h']
+    body = ['  procedure %s : integer(%s)' % (name, ', '.join(params)),
+            '    variable t : integer;', '  begin']
+    body.append('    t := %s;' % expr(vars))
+    if R.random() < 0.5:
+        body.append('    if (t > %d) then' % R.randint(-5, 20))
+        body.append('      return t - %s;' % expr(vars + ['t']))
+        body.append('    end if;')
+    if R.random() < 0.3:
+        body.append('    g := g + t;')
+    if 'arr' in kinds:
+        body.append('    v[t & 7] := t;')
+        body.append('    t := t + v[(t + 1) & 7];')
+    if R.random() < 0.3:
+        body.append('    for (h := 0; h < 3)')
+        body.append('      t := t + h * %s;' % expr(vars))
+        body.append('      h := h + 1;')
+        body.append('    end for;')
+    body.append('    return t + %s;' % expr(vars + ['t']))
+    body.append('  end procedure;')
+    out += body + ['']
+    procs.append((name, kinds))
+
+out.append('begin')
+out.append('  g := %d;' % R.randint(0, 5))
+out.append('  for (i := 0; i < 8)')
+out.append('    ga[i] := i * %d;' % R.randint(1, 5))
+out.append('    i := i + 1;')
+out.append('  end for;')
+out.append('  for (i := 0; i < %d)' % R.randint(3, 30))
+out.append('    s := s + %s;' % expr(['i', 's', 'g']))
+out.append('    g := g - %s;' % expr(['i', 'g']))
+out.append('    i := i + 1;')
+out.append('  end for;')
+out.append('  r := putinteger(s);')
+out.append('  r := putinteger(g);')
+out.append('  r := putinteger(ga[3]);')
+out.append('end program.')
+print('\n'.join(out))
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# File			: ranges.py
+# Prints a random program of nested counted loops, up and down, indexing one
+# array with affine and masked expressions of the loop variables. Some
+# indexes fall out of range, so the bounds checks the range analysis keeps
+# must still stop the program.
+#
+# Usage: tests/fuzz/ranges.py SEED
+
+import random
+import sys
+
+random.seed(int(sys.argv[1]))
+N = random.choice([5, 10, 16, 33])
+cmp = ['<', '<=', '>', '>=', '!=', '==']
+lines = []
+
+
+def idx(vs):
+    v = random.choice(vs)
+    k = random.randint(0, 5)
+    if k == 0: return v
+    if k == 1: return '%s + %d' % (v, random.randint(-3, 3))
+    if k == 2: return '%s - %d' % (v, random.randint(0, 3))
+    if k == 3: return '%s * %d' % (v, random.randint(0, 3))
+    if k == 4: return '(%s & %d)' % (v, random.choice([3, 7, 15]))
+    return str(random.randint(-1, N))
+
+
+def loop(var, depth, vs):
+    lo = random.randint(-2, 3)
+    hi = N + random.randint(-3, 1)
+    up = random.random() < 0.7
+    ind = '  ' * depth
+    if up:
+        lines.append(ind + 'for (%s := %d; %s %s %d)' % (
+            var, lo, var, random.choice(['<', '<=']), hi))
+    else:
+        lines.append(ind + 'for (%s := %d; %s %s %d)' % (
+            var, hi - 1, var, random.choice(['>', '>=']), lo))
+    vs = vs + [var]
+    for _ in range(random.randint(1, 3)):
+        r = random.random()
+        d = depth + 1
+        if r < 0.4:
+            lines.append('  ' * d + 'a[%s] := a[%s] + %s;' % (
+                idx(vs), idx(vs), var))
+        elif r < 0.6:
+            lines.append('  ' * d + 'if (%s %s %d) then' % (
+                random.choice(vs), random.choice(cmp), random.randint(-1, N)))
+            lines.append('  ' * (d + 1) + 's := s + a[%s];' % idx(vs))
+            lines.append('  ' * d + 'else')
+            lines.append('  ' * (d + 1) + 's := s - a[%s];' % idx(vs))
+            lines.append('  ' * d + 'end if;')
+        elif r < 0.75 and depth < 2:
+            loop('j' if var == 'i' else 'k', d, vs)
+        else:
+            lines.append('  ' * d + 's := s + a[%s];' % idx(vs))
+    step = random.choice([1, 1, 1, 2, 3])
+    lines.append(ind + '  %s := %s %s %d;' % (var, var, '+' if up else '-', step))
+    lines.append(ind + 'end for;')
+
+
+loop('i', 1, [])
+print('program p is')
+print('  variable a : integer[%d];' % N)
+print('  variable i : integer;\n  variable j : integer;\n'
+      '  variable k : integer;\n  variable s : integer;\n  variable r : bool;')
+print('begin')
+print('\n'.join(lines))
+print('  r := putinteger(s);')
+print('end program.')
@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+# File			: run.sh
+# Generates the fuzz programs from fixed seeds and checks each one on every
+# execution engine with tests/check.sh, so a failing program can always be
+# regenerated from its name.
+#
+# Usage: tests/fuzz/run.sh [GENERATOR...]
+#   arrays	- whole-array expressions, seeds 1 to 400
+#   ranges	- nested loops indexing an array, seeds 1 to 300
+#   procs	- procedures calling procedures, seeds 1 to 150
+#   tails	- self-recursive procedures, seeds 1 to 120
+# Default is all of them. Program GENERATOR-SEED.src is the output of
+# tests/fuzz/GENERATOR.py SEED.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+GENERATORS=${*:-arrays ranges procs tails}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+for gen in $GENERATORS; do
+  case $gen in
+    arrays) count=400 ;;
+    ranges) count=300 ;;
+    procs) count=150 ;;
+    tails) count=120 ;;
+    *) echo "Unknown generator $gen" >&2; exit 2 ;;
+  esac
+  for seed in $(seq 1 $count); do
+    python3 "$DIR/$gen.py" "$seed" > "$TMP/$gen-$seed.src"
+  done
+done
+"$DIR/../check.sh" "$TMP"/*.src
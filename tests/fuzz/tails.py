@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# File			: tails.py
+# Prints a random program of self-recursive procedures counting a depth
+# parameter down, with integer, float and array parameters, some of whose
+# recursive calls are tail calls and some not.
+#
+# Usage: tests/fuzz/tails.py SEED
+
+import random
+import re
+import sys
+
+R = random.Random(int(sys.argv[1]))
+out = ['program p is', '  variable g : integer;', '  variable ga : integer[8];',
+       '  variable i : integer;', '  variable s : integer;',
+       '  variable r : bool;', '']
+calls = []
+
+for k in range(R.randint(1, 4)):
+    name = 'f%d' % k
+    kinds = ['int']  # a0 is the depth
+    params = ['variable a0 : integer']
+    for j in range(1, R.randint(2, 5)):
+        c = R.random()
+        if c < 0.3:
+            kinds.append('arr')
+            params.append('variable a%d : integer[8]' % j)
+        elif c < 0.45:
+            kinds.append('flt')
+            params.append('variable a%d : float' % j)
+        else:
+            kinds.append('int')
+            params.append('variable a%d : integer' % j)
+    ints = ['a%d' % j for j, kd in enumerate(kinds) if kd == 'int'] + ['g']
+    arrs = ['a%d' % j for j, kd in enumerate(kinds) if kd == 'arr'] + ['ga']
+    flts = ['a%d' % j for j, kd in enumerate(kinds) if kd == 'flt']
+
+    def iexpr(d=0):
+        c = R.random()
+        if d > 1 or c < 0.4: return R.choice(ints + [str(R.randint(0, 9))])
+        if c < 0.55: return '%s[(%s) & 7]' % (R.choice(arrs), iexpr(d + 1))
+        return '((%s %s %s) & 1023)' % (
+            iexpr(d + 1), R.choice('+-*'), iexpr(d + 1))
+
+    def args(depth):
+        a = [depth]
+        for kd in kinds[1:]:
+            if kd == 'int': a.append(iexpr())
+            elif kd == 'arr': a.append(R.choice(arrs))
+            else: a.append(R.choice(flts + ['1.5']) + ' + 0.25')
+        return '%s(%s)' % (name, ', '.join(a))
+
+    body = ['  procedure %s : integer(%s)' % (name, ', '.join(params))]
+    if R.random() < 0.2: body.append('    variable loc : integer[4];')
+    body.append('  begin')
+    body.append('    if (a0 <= 0) then')
+    body.append('      return %s;' % iexpr())
+    body.append('    end if;')
+    for a in arrs[:-1]:
+        if R.random() < 0.5: body.append('    %s[a0 & 7] := %s;' % (a, iexpr()))
+    if R.random() < 0.3: body.append('    g := (g + %s) & 1023;' % iexpr())
+    if R.random() < 0.4:
+        body.append('    if (%s > %d) then' % (iexpr(), R.randint(0, 20)))
+        body.append('      return %s;' % args('a0 - 1'))
+        body.append('    end if;')
+    if R.random() < 0.25:
+        body.append('    return (%s + %s) & 65535;' % (args('a0 - 2'), iexpr()))
+    else:
+        body.append('    return %s;' % args('a0 - 1'))
+    body.append('  end procedure;')
+    out += body + ['']
+    m = [str(R.randint(0, 40))]
+    for kd in kinds[1:]:
+        m.append({'int': R.choice(['g', 'i', '3']), 'arr': 'ga', 'flt': '1.5'}[kd])
+    calls.append('%s(%s)' % (name, ', '.join(m)))
+
+out.append('begin')
+out.append('  for (i := 0; i < 8)')
+out.append('    ga[i] := i * %d;' % R.randint(1, 5))
+out.append('    i := i + 1;')
+out.append('  end for;')
+for c in calls:
+    out.append('  s := s + %s;' % re.sub(r'\ba\d+\b', 'i', c))
+    out.append('  r := putinteger(s);')
+out.append('  r := putinteger(g);')
+out.append('  r := putinteger(ga[3]);')
+out.append('end program.')
+print('\n'.join(out))